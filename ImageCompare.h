@@ -5,34 +5,1216 @@
 #include <iostream>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
 
 inline double clamp(double v, double lo, double hi) {
     return (v < lo) ? lo : (v > hi) ? hi : v;
 }
 
+// Units of one 8-bit step at each sample depth (full range 1.0 for float).
+// Tolerances and mean differences are given in 8-bit units at every depth
+// and scaled by this.
+template <typename T> struct CompareDepth;
+template <> struct CompareDepth<uint8_t> { static double scale() { return 1.0; } };
+template <> struct CompareDepth<uint16_t> { static double scale() { return 257.0; } };
+template <> struct CompareDepth<float> { static double scale() { return 1.0 / 255.0; } };
+
+// Number of samples in a[0..n) and b[0..n) that differ by less than tol. The
+// generic version is the reference; each depth has an SSE2 overload working
+// on full registers of its own sample width.
+template <typename T>
+inline uint64_t countSimilarRow(const T *a, const T *b, size_t n, T tol) {
+    uint64_t similar = 0;
+    for (size_t i = 0; i < n; ++i)
+        similar += (a[i] > b[i] ? a[i] - b[i] : b[i] - a[i]) < tol;
+    return similar;
+}
+
+#if defined(__SSE2__)
+// |a - b| < tol as (|a - b| saturating-minus (tol - 1)) == 0. Matches are
+// counted in per-lane accumulators (a compare result is -1 per lane) and
+// folded into the total before a lane can overflow.
+inline uint64_t countSimilarRow(const uint8_t *a, const uint8_t *b, size_t n, uint8_t tol) {
+    if (tol == 0) return 0;
+    const __m128i lim = _mm_set1_epi8(static_cast<char>(tol - 1));
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t similar = 0;
+    size_t i = 0;
+    while (i + 16 <= n) {
+        size_t end = std::min(n & ~static_cast<size_t>(15), i + 255 * 16);
+        __m128i acc = zero;
+        for (; i < end; i += 16) {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+            __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_subs_epu8(d, lim), zero));
+        }
+        __m128i sad = _mm_sad_epu8(acc, zero);
+        similar += static_cast<uint64_t>(_mm_cvtsi128_si32(sad)) + _mm_cvtsi128_si32(_mm_srli_si128(sad, 8));
+    }
+    return similar + countSimilarRow<uint8_t>(a + i, b + i, n - i, tol);
+}
+
+inline uint64_t countSimilarRow(const uint16_t *a, const uint16_t *b, size_t n, uint16_t tol) {
+    if (tol == 0) return 0;
+    const __m128i lim = _mm_set1_epi16(static_cast<short>(tol - 1));
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t similar = 0;
+    size_t i = 0;
+    while (i + 8 <= n) {
+        size_t end = std::min(n & ~static_cast<size_t>(7), i + 65535 * 8);
+        __m128i acc = zero;
+        for (; i < end; i += 8) {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+            __m128i d = _mm_or_si128(_mm_subs_epu16(va, vb), _mm_subs_epu16(vb, va));
+            acc = _mm_sub_epi16(acc, _mm_cmpeq_epi16(_mm_subs_epu16(d, lim), zero));
+        }
+        // widen the eight 16-bit counts and sum them
+        __m128i s32 = _mm_add_epi32(_mm_unpacklo_epi16(acc, zero), _mm_unpackhi_epi16(acc, zero));
+        s32 = _mm_add_epi32(s32, _mm_shuffle_epi32(s32, _MM_SHUFFLE(1, 0, 3, 2)));
+        s32 = _mm_add_epi32(s32, _mm_shuffle_epi32(s32, _MM_SHUFFLE(2, 3, 0, 1)));
+        similar += static_cast<uint32_t>(_mm_cvtsi128_si32(s32));
+    }
+    return similar + countSimilarRow<uint16_t>(a + i, b + i, n - i, tol);
+}
+
+// NaN samples never count as similar, as in the scalar version.
+inline uint64_t countSimilarRow(const float *a, const float *b, size_t n, float tol) {
+    const __m128 lim = _mm_set1_ps(tol);
+    const __m128 abs = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    uint64_t similar = 0;
+    size_t i = 0;
+    while (i + 4 <= n) {
+        size_t end = std::min(n & ~static_cast<size_t>(3), i + (static_cast<size_t>(1) << 30));
+        __m128i acc = _mm_setzero_si128();
+        for (; i < end; i += 4) {
+            __m128 d = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)), abs);
+            acc = _mm_sub_epi32(acc, _mm_castps_si128(_mm_cmplt_ps(d, lim)));
+        }
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        similar += static_cast<uint32_t>(_mm_cvtsi128_si32(acc));
+    }
+    return similar + countSimilarRow<float>(a + i, b + i, n - i, tol);
+}
+#endif
+
+// What an 8-bit comparison measures, configured per ImageComparator:
+//  - mode: PerChannel scores every channel byte on its own; PerPixelMax
+//    scores each pixel by its largest channel difference, so a pixel is
+//    similar only when all of its channels are within tolerance;
+//    PerPixelSum scores each pixel by the sum of its channel differences
+//    (tolerance then ranges up to 255 * channels);
+//  - metric: Similarity is the fraction of scores below tolerance,
+//    MeanAbsDiff and MeanSquaredError average the scores (or their squares)
+//    and ignore the tolerance.
+enum class ToleranceMode { PerChannel, PerPixelMax, PerPixelSum };
+enum class CompareMetric { Similarity, MeanAbsDiff, MeanSquaredError };
+
+struct CompareOptions {
+    int tolerance = 10;        // a difference counts as similar when below this
+    ToleranceMode mode = ToleranceMode::PerChannel;
+    CompareMetric metric = CompareMetric::Similarity;
+};
+
+// One score's contribution to the metric's sum.
+template <CompareMetric Metric> struct MetricTerm;
+template <> struct MetricTerm<CompareMetric::Similarity> {
+    static uint32_t term(int d, int tol) { return d < tol; }
+};
+template <> struct MetricTerm<CompareMetric::MeanAbsDiff> {
+    static uint32_t term(int d, int) { return d; }
+};
+template <> struct MetricTerm<CompareMetric::MeanSquaredError> {
+    static uint32_t term(int d, int) { return d * d; }
+};
+
+// Sum of the metric over one row of cols pixels with CN interleaved
+// channels. Channel count, mode and metric are all compile-time, so the inner
+// loops unroll over the channels with no per-byte branching on the options.
+template <int CN, ToleranceMode Mode, CompareMetric Metric>
+struct CompareKernel {
+    static uint64_t row(const uint8_t *a, const uint8_t *b, int cols, int tol) {
+        uint64_t sum = 0;
+        for (int x = 0; x < cols; ++x, a += CN, b += CN) {
+            if (Mode == ToleranceMode::PerChannel) {
+                for (int c = 0; c < CN; ++c)
+                    sum += MetricTerm<Metric>::term(std::abs(a[c] - b[c]), tol);
+            } else if (Mode == ToleranceMode::PerPixelMax) {
+                int d = 0;
+                for (int c = 0; c < CN; ++c)
+                    d = std::max(d, std::abs(a[c] - b[c]));
+                sum += MetricTerm<Metric>::term(d, tol);
+            } else {
+                int d = 0;
+                for (int c = 0; c < CN; ++c)
+                    d += std::abs(a[c] - b[c]);
+                sum += MetricTerm<Metric>::term(d, tol);
+            }
+        }
+        return sum;
+    }
+};
+
+// Per-channel similarity ignores pixel boundaries: count the whole row's
+// bytes with the SIMD kernel.
+template <int CN>
+struct CompareKernel<CN, ToleranceMode::PerChannel, CompareMetric::Similarity> {
+    static uint64_t row(const uint8_t *a, const uint8_t *b, int cols, int tol) {
+        size_t n = static_cast<size_t>(cols) * CN;
+        if (tol > 255) return n;
+        return tol <= 0 ? 0 : countSimilarRow(a, b, n, static_cast<uint8_t>(tol));
+    }
+};
+
+#if defined(__SSE2__)
+using cv::detail::sumLanes64;
+
+// Per-channel absolute and squared differences over the row's bytes: psadbw
+// sums |a - b| directly, pmaddwd squares and pairs the widened differences.
+template <int CN>
+struct CompareKernel<CN, ToleranceMode::PerChannel, CompareMetric::MeanAbsDiff> {
+    static uint64_t row(const uint8_t *a, const uint8_t *b, int cols, int tol) {
+        size_t n = static_cast<size_t>(cols) * CN, i = 0;
+        __m128i acc = _mm_setzero_si128();
+        for (; i + 16 <= n; i += 16) {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+        }
+        uint64_t sum = sumLanes64(acc);
+        for (; i < n; ++i) sum += std::abs(a[i] - b[i]);
+        (void)tol;
+        return sum;
+    }
+};
+
+template <int CN>
+struct CompareKernel<CN, ToleranceMode::PerChannel, CompareMetric::MeanSquaredError> {
+    static uint64_t row(const uint8_t *a, const uint8_t *b, int cols, int tol) {
+        const __m128i zero = _mm_setzero_si128();
+        size_t n = static_cast<size_t>(cols) * CN, i = 0;
+        uint64_t sum = 0;
+        while (i + 16 <= n) {
+            // 32-bit lanes take 2 * 2 * 65025 per iteration: flush well before overflow
+            size_t end = std::min(n & ~static_cast<size_t>(15), i + 4096 * 16);
+            __m128i acc = zero;
+            for (; i < end; i += 16) {
+                __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+                __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+                __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+                __m128i lo = _mm_unpacklo_epi8(d, zero), hi = _mm_unpackhi_epi8(d, zero);
+                acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+            }
+            __m128i s64 = _mm_add_epi64(_mm_unpacklo_epi32(acc, zero), _mm_unpackhi_epi32(acc, zero));
+            sum += sumLanes64(s64);
+        }
+        for (; i < n; ++i) sum += (a[i] - b[i]) * (a[i] - b[i]);
+        (void)tol;
+        return sum;
+    }
+};
+
+// Summed over a row, the per-pixel sums are just every channel difference.
+template <int CN>
+struct CompareKernel<CN, ToleranceMode::PerPixelSum, CompareMetric::MeanAbsDiff>
+    : CompareKernel<CN, ToleranceMode::PerChannel, CompareMetric::MeanAbsDiff> {};
+
+inline int popcount64(uint64_t v) {
+    v = v - ((v >> 1) & 0x5555555555555555ull);
+    v = (v & 0x3333333333333333ull) + ((v >> 2) & 0x3333333333333333ull);
+    v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return static_cast<int>((v * 0x0101010101010101ull) >> 56);
+}
+
+// The interleaved per-pixel kernels take 16 pixels (CN registers) at a time
+// and deinterleave at the bit level: a movemask over the block gives one bit
+// per channel byte, pixel p owning bits p * CN .. p * CN + CN - 1, and
+// PixelLeadBits<CN> selects the bit at the start of each pixel.
+template <int CN> struct PixelLeadBits;
+template <> struct PixelLeadBits<1> { static constexpr uint64_t value = 0xffffull; };
+template <> struct PixelLeadBits<2> { static constexpr uint64_t value = 0x55555555ull; };
+template <> struct PixelLeadBits<3> { static constexpr uint64_t value = 0x249249249249ull; };
+template <> struct PixelLeadBits<4> { static constexpr uint64_t value = 0x1111111111111111ull; };
+
+// All channels within tolerance: AND each pixel's pass bits down onto its
+// lead bit.
+template <int CN>
+struct CompareKernel<CN, ToleranceMode::PerPixelMax, CompareMetric::Similarity> {
+    static uint64_t row(const uint8_t *a, const uint8_t *b, int cols, int tol) {
+        if (tol <= 0) return 0;
+        if (tol > 255) return cols;
+        const __m128i lim = _mm_set1_epi8(static_cast<char>(tol - 1));
+        const __m128i zero = _mm_setzero_si128();
+        uint64_t similar = 0;
+        int x = 0;
+        for (; x + 16 <= cols; x += 16, a += 16 * CN, b += 16 * CN) {
+            uint64_t pass = 0;
+            for (int r = 0; r < CN; ++r) {
+                __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + 16 * r));
+                __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + 16 * r));
+                __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+                pass |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(d, lim), zero))) << (16 * r);
+            }
+            uint64_t all = pass;
+            for (int c = 1; c < CN; ++c) all &= pass >> c;
+            similar += popcount64(all & PixelLeadBits<CN>::value);
+        }
+        for (; x < cols; ++x, a += CN, b += CN) {
+            int d = 0;
+            for (int c = 0; c < CN; ++c) d = std::max(d, std::abs(a[c] - b[c]));
+            similar += d < tol;
+        }
+        return similar;
+    }
+};
+
+// Sum of channel differences below tolerance: widen the block's differences
+// to 16 bits and add each lane's next CN - 1 lanes (shifted in across register
+// boundaries), so every pixel's lead lane holds its sum, then compare and
+// select the lead bits as above.
+template <int CN>
+struct CompareKernel<CN, ToleranceMode::PerPixelSum, CompareMetric::Similarity> {
+    static uint64_t row(const uint8_t *a, const uint8_t *b, int cols, int tol) {
+        if (tol <= 0) return 0;
+        if (tol > 255 * CN) return cols;
+        const __m128i limit = _mm_set1_epi16(static_cast<short>(tol));
+        const __m128i zero = _mm_setzero_si128();
+        uint64_t similar = 0;
+        int x = 0;
+        for (; x + 16 <= cols; x += 16, a += 16 * CN, b += 16 * CN) {
+            __m128i w[2 * CN + 1];
+            for (int r = 0; r < CN; ++r) {
+                __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + 16 * r));
+                __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + 16 * r));
+                __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+                w[2 * r] = _mm_unpacklo_epi8(d, zero);
+                w[2 * r + 1] = _mm_unpackhi_epi8(d, zero);
+            }
+            w[2 * CN] = zero; // the last pixel's lanes never reach past the block
+            uint64_t pass = 0;
+            for (int r = 0; r < CN; ++r) {
+                __m128i lt[2];
+                for (int h = 0; h < 2; ++h) {
+                    const int j = 2 * r + h;
+                    __m128i sum = w[j];
+                    if (CN > 1) sum = _mm_add_epi16(sum, _mm_or_si128(_mm_srli_si128(w[j], 2), _mm_slli_si128(w[j + 1], 14)));
+                    if (CN > 2) sum = _mm_add_epi16(sum, _mm_or_si128(_mm_srli_si128(w[j], 4), _mm_slli_si128(w[j + 1], 12)));
+                    if (CN > 3) sum = _mm_add_epi16(sum, _mm_or_si128(_mm_srli_si128(w[j], 6), _mm_slli_si128(w[j + 1], 10)));
+                    lt[h] = _mm_cmplt_epi16(sum, limit);
+                }
+                pass |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_packs_epi16(lt[0], lt[1]))) << (16 * r);
+            }
+            similar += popcount64(pass & PixelLeadBits<CN>::value);
+        }
+        for (; x < cols; ++x, a += CN, b += CN) {
+            int d = 0;
+            for (int c = 0; c < CN; ++c) d += std::abs(a[c] - b[c]);
+            similar += d < tol;
+        }
+        return similar;
+    }
+};
+#endif
+
+// Sum of the metric over pixels [x, cols) of one row held as CN planes: a[c]
+// and b[c] point at channel c's row.
+template <int CN, ToleranceMode Mode, CompareMetric Metric>
+inline uint64_t planarRowScalar(const uint8_t *const *a, const uint8_t *const *b, int x, int cols, int tol) {
+    uint64_t sum = 0;
+    for (; x < cols; ++x) {
+        if (Mode == ToleranceMode::PerChannel) {
+            for (int c = 0; c < CN; ++c)
+                sum += MetricTerm<Metric>::term(std::abs(a[c][x] - b[c][x]), tol);
+            continue;
+        }
+        int d = 0;
+        for (int c = 0; c < CN; ++c) {
+            int dc = std::abs(a[c][x] - b[c][x]);
+            d = Mode == ToleranceMode::PerPixelMax ? std::max(d, dc) : d + dc;
+        }
+        sum += MetricTerm<Metric>::term(d, tol);
+    }
+    return sum;
+}
+
+// CompareKernel for planar images. Every channel is contiguous, so the
+// per-pixel modes combine whole registers across planes and never
+// deinterleave.
+template <int CN, ToleranceMode Mode, CompareMetric Metric>
+struct PlanarKernel {
+    static uint64_t row(const uint8_t *const *a, const uint8_t *const *b, int cols, int tol) {
+        return planarRowScalar<CN, Mode, Metric>(a, b, 0, cols, tol);
+    }
+};
+
+// Per channel, each plane is scored as a single-channel row.
+template <int CN, CompareMetric Metric>
+struct PlanarKernel<CN, ToleranceMode::PerChannel, Metric> {
+    static uint64_t row(const uint8_t *const *a, const uint8_t *const *b, int cols, int tol) {
+        uint64_t sum = 0;
+        for (int c = 0; c < CN; ++c)
+            sum += CompareKernel<1, ToleranceMode::PerChannel, Metric>::row(a[c], b[c], cols, tol);
+        return sum;
+    }
+};
+
+template <int CN>
+struct PlanarKernel<CN, ToleranceMode::PerPixelSum, CompareMetric::MeanAbsDiff>
+    : PlanarKernel<CN, ToleranceMode::PerChannel, CompareMetric::MeanAbsDiff> {};
+
+#if defined(__SSE2__)
+// The largest channel difference of 16 pixels is one pmaxub per plane, and
+// is then scored like a per-channel byte.
+template <int CN, CompareMetric Metric>
+struct PlanarKernel<CN, ToleranceMode::PerPixelMax, Metric> {
+    static uint64_t row(const uint8_t *const *a, const uint8_t *const *b, int cols, int tol) {
+        if (Metric == CompareMetric::Similarity) {
+            if (tol <= 0) return 0;
+            if (tol > 255) return cols;
+        }
+        const __m128i lim = _mm_set1_epi8(static_cast<char>(std::max(tol, 1) - 1));
+        const __m128i zero = _mm_setzero_si128();
+        uint64_t sum = 0;
+        int x = 0;
+        while (x + 16 <= cols) {
+            // squares reach each 32-bit lane at 2 * 2 * 65025 per block: flush well before overflow
+            int end = std::min(cols & ~15, x + 4096 * 16);
+            __m128i acc = zero;
+            for (; x < end; x += 16) {
+                __m128i d = zero;
+                for (int c = 0; c < CN; ++c) {
+                    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a[c] + x));
+                    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b[c] + x));
+                    d = _mm_max_epu8(d, _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va)));
+                }
+                if (Metric == CompareMetric::Similarity) {
+                    sum += popcount64(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(d, lim), zero))));
+                } else if (Metric == CompareMetric::MeanAbsDiff) {
+                    acc = _mm_add_epi64(acc, _mm_sad_epu8(d, zero));
+                } else {
+                    __m128i lo = _mm_unpacklo_epi8(d, zero), hi = _mm_unpackhi_epi8(d, zero);
+                    acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+                }
+            }
+            if (Metric == CompareMetric::MeanSquaredError)
+                acc = _mm_add_epi64(_mm_unpacklo_epi32(acc, zero), _mm_unpackhi_epi32(acc, zero));
+            sum += sumLanes64(acc);
+        }
+        return sum + planarRowScalar<CN, ToleranceMode::PerPixelMax, Metric>(a, b, x, cols, tol);
+    }
+};
+
+// Channel sums of 16 pixels, widened to 16 bits, are a paddw per plane.
+template <int CN, CompareMetric Metric>
+struct PlanarKernel<CN, ToleranceMode::PerPixelSum, Metric> {
+    static uint64_t row(const uint8_t *const *a, const uint8_t *const *b, int cols, int tol) {
+        if (Metric == CompareMetric::Similarity) {
+            if (tol <= 0) return 0;
+            if (tol > 255 * CN) return cols;
+        }
+        const __m128i limit = _mm_set1_epi16(static_cast<short>(std::min(tol, 255 * CN + 1)));
+        const __m128i zero = _mm_setzero_si128();
+        uint64_t sum = 0;
+        int x = 0;
+        while (x + 16 <= cols) {
+            // squared sums reach each 32-bit lane at 2 * 2 * 1020^2 per block
+            int end = std::min(cols & ~15, x + 256 * 16);
+            __m128i acc = zero;
+            for (; x < end; x += 16) {
+                __m128i lo = zero, hi = zero;
+                for (int c = 0; c < CN; ++c) {
+                    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a[c] + x));
+                    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b[c] + x));
+                    __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+                    lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(d, zero));
+                    hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(d, zero));
+                }
+                if (Metric == CompareMetric::Similarity) {
+                    __m128i lt = _mm_packs_epi16(_mm_cmplt_epi16(lo, limit), _mm_cmplt_epi16(hi, limit));
+                    sum += popcount64(static_cast<uint32_t>(_mm_movemask_epi8(lt)));
+                } else {
+                    acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+                }
+            }
+            acc = _mm_add_epi64(_mm_unpacklo_epi32(acc, zero), _mm_unpackhi_epi32(acc, zero));
+            sum += sumLanes64(acc);
+        }
+        return sum + planarRowScalar<CN, ToleranceMode::PerPixelSum, Metric>(a, b, x, cols, tol);
+    }
+};
+#endif
+
+typedef uint64_t (*CompareRowFn)(const uint8_t *a, const uint8_t *b, int cols, int tol);
+typedef uint64_t (*PlanarRowFn)(const uint8_t *const *a, const uint8_t *const *b, int cols, int tol);
+
+// The [mode][metric] table of one kernel family's row functions for CN channels.
+template <template <int, ToleranceMode, CompareMetric> class Kernel, int CN, typename Fn>
+inline Fn kernelRowFn(ToleranceMode mode, CompareMetric metric) {
+    typedef ToleranceMode TM;
+    typedef CompareMetric CM;
+    static const Fn table[3][3] = {
+        {Kernel<CN, TM::PerChannel, CM::Similarity>::row,
+         Kernel<CN, TM::PerChannel, CM::MeanAbsDiff>::row,
+         Kernel<CN, TM::PerChannel, CM::MeanSquaredError>::row},
+        {Kernel<CN, TM::PerPixelMax, CM::Similarity>::row,
+         Kernel<CN, TM::PerPixelMax, CM::MeanAbsDiff>::row,
+         Kernel<CN, TM::PerPixelMax, CM::MeanSquaredError>::row},
+        {Kernel<CN, TM::PerPixelSum, CM::Similarity>::row,
+         Kernel<CN, TM::PerPixelSum, CM::MeanAbsDiff>::row,
+         Kernel<CN, TM::PerPixelSum, CM::MeanSquaredError>::row},
+    };
+    return table[static_cast<int>(mode)][static_cast<int>(metric)];
+}
+
+template <int CN>
+inline CompareRowFn compareRowFn(ToleranceMode mode, CompareMetric metric) {
+    return kernelRowFn<CompareKernel, CN, CompareRowFn>(mode, metric);
+}
+
+// Maps options and a channel count (1-4) to its precompiled row kernel, once
+// per image rather than per pixel.
+inline CompareRowFn compareRowFn(int channels, const CompareOptions &opts) {
+    switch (channels) {
+    case 1: return compareRowFn<1>(opts.mode, opts.metric);
+    case 2: return compareRowFn<2>(opts.mode, opts.metric);
+    case 3: return compareRowFn<3>(opts.mode, opts.metric);
+    case 4: return compareRowFn<4>(opts.mode, opts.metric);
+    default: return nullptr;
+    }
+}
+
+// The planar counterpart, for 1-4 planes.
+inline PlanarRowFn planarRowFn(int planes, const CompareOptions &opts) {
+    switch (planes) {
+    case 1: return kernelRowFn<PlanarKernel, 1, PlanarRowFn>(opts.mode, opts.metric);
+    case 2: return kernelRowFn<PlanarKernel, 2, PlanarRowFn>(opts.mode, opts.metric);
+    case 3: return kernelRowFn<PlanarKernel, 3, PlanarRowFn>(opts.mode, opts.metric);
+    case 4: return kernelRowFn<PlanarKernel, 4, PlanarRowFn>(opts.mode, opts.metric);
+    default: return nullptr;
+    }
+}
+
+// CompareKernel at 16-bit and float depth: tol is in the depth's units and
+// rows sum in double, float differences not being whole. Per-channel
+// similarity counts through countSimilarRow's SIMD overloads; the other
+// combinations are scalar. A NaN sample is never similar and makes a mean NaN.
+template <typename T>
+struct DeepKernel {
+    template <int CN, ToleranceMode Mode, CompareMetric Metric>
+    struct Kernel {
+        static double term(double d, double tol) {
+            return Metric == CompareMetric::Similarity ? (d < tol) : Metric == CompareMetric::MeanAbsDiff ? d : d * d;
+        }
+
+        static double row(const T *a, const T *b, int cols, double tol) {
+            if (Mode == ToleranceMode::PerChannel && Metric == CompareMetric::Similarity) {
+                size_t n = static_cast<size_t>(cols) * CN;
+                if (tol > std::numeric_limits<T>::max()) return static_cast<double>(n);
+                return tol <= 0 ? 0.0 : static_cast<double>(countSimilarRow(a, b, n, static_cast<T>(tol)));
+            }
+            double sum = 0;
+            for (int x = 0; x < cols; ++x, a += CN, b += CN) {
+                double d = 0;
+                for (int c = 0; c < CN; ++c) {
+                    double dc = std::abs(static_cast<double>(a[c]) - static_cast<double>(b[c]));
+                    if (Mode == ToleranceMode::PerChannel)
+                        sum += term(dc, tol);
+                    else if (Mode == ToleranceMode::PerPixelSum)
+                        d += dc;
+                    else if (!(dc <= d))
+                        d = dc;
+                }
+                if (Mode != ToleranceMode::PerChannel) sum += term(d, tol);
+            }
+            return sum;
+        }
+    };
+};
+
+template <typename T>
+using DeepRowFn = double (*)(const T *a, const T *b, int cols, double tol);
+
+// compareRowFn for a 16-bit or float Mat_.
+template <typename T>
+inline DeepRowFn<T> deepRowFn(int channels, const CompareOptions &opts) {
+    switch (channels) {
+    case 1: return kernelRowFn<DeepKernel<T>::template Kernel, 1, DeepRowFn<T>>(opts.mode, opts.metric);
+    case 2: return kernelRowFn<DeepKernel<T>::template Kernel, 2, DeepRowFn<T>>(opts.mode, opts.metric);
+    case 3: return kernelRowFn<DeepKernel<T>::template Kernel, 3, DeepRowFn<T>>(opts.mode, opts.metric);
+    case 4: return kernelRowFn<DeepKernel<T>::template Kernel, 4, DeepRowFn<T>>(opts.mode, opts.metric);
+    default: return nullptr;
+    }
+}
+
+// rowSum(y) summed over rows [0, rows) by cv::parallel_for_, in bands of
+// about 64 KiB of rowBytes-long rows, in whatever type rowSum returns.
+template <typename RowSum>
+inline auto parallelRowSum(int rows, size_t rowBytes, const RowSum &rowSum) -> decltype(rowSum(0)) {
+    typedef decltype(rowSum(0)) Sum;
+    std::mutex m;
+    Sum total = 0;
+    int grain = static_cast<int>(std::max<size_t>(1, (size_t(1) << 16) / std::max<size_t>(1, rowBytes)));
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &r) {
+        Sum part = 0;
+        for (int y = r.start; y < r.end; ++y) part += rowSum(y);
+        std::lock_guard<std::mutex> lock(m);
+        total += part;
+    }, grain);
+    return total;
+}
+
+// Tuning for the coarse-to-fine comparison. Every decision taken from the
+// pyramid is made per channel of a tile:
+//  - proven same/different: the min/max envelopes of both tiles show that every
+//    byte pair is (or is not) within tolerance, so the decision is exact;
+//  - otherwise the channel means are compared: a gap <= same_margin counts the
+//    tile as similar, a gap >= diff_margin counts it as dissimilar, anything in
+//    between is ambiguous and refined one level down, ending at full resolution.
+// Mean-based decisions are the only source of error; setting same_margin < 0
+// and diff_margin > 255 makes the result identical to computeSimilarity.
+struct HierarchicalOptions {
+    int levels = 4;            // coarsest tiles are 2^levels pixels square (max 8)
+    double same_margin = 0.5;
+    double diff_margin = 48.0;
+};
+
+struct HierarchicalResult {
+    double similarity = 0.0;
+    // Fraction of full-resolution pixels that had to be compared directly.
+    double touched_fraction = 0.0;
+    // Full-resolution pixel reads per pixel of the pair, pyramid builds
+    // included: 1 + touched_fraction when the pyramids are built by the call,
+    // touched_fraction alone when they are passed in already built.
+    double read_fraction = 0.0;
+    // Guaranteed bound: |similarity - computeSimilarity()| <= error_bound. It is
+    // the fraction of bytes whose tile was accepted on mean statistics alone.
+    double error_bound = 0.0;
+};
+
+struct AlignedResult {
+    double similarity = 0.0;
+    int dx = 0, dy = 0;        // img2(x + dx, y + dy) matches img1(x, y)
+    double response = 0.0;     // phase correlation peak height, 0..1
+    double overlap = 0.0;      // fraction of img1 covered by the aligned region
+};
+
+// One level of a 2x box-downsample pyramid, keeping per-cell channel sums and
+// min/max envelopes. A cell at level k covers (1 << k) x (1 << k) pixels.
+struct StatsLevel {
+    int rows = 0, cols = 0, scale = 1;
+    std::vector<uint32_t> sum;
+    std::vector<uint8_t> lo, hi;
+};
+
+inline std::vector<StatsLevel> buildStatsPyramid(const cv::Mat &img, int levels) {
+    const int ch = img.channels;
+    std::vector<StatsLevel> pyr(levels + 1);
+    for (int k = 1; k <= levels; ++k) {
+        StatsLevel &L = pyr[k];
+        L.scale = 1 << k;
+        L.rows = (img.rows + L.scale - 1) >> k;
+        L.cols = (img.cols + L.scale - 1) >> k;
+        size_t n = static_cast<size_t>(L.rows) * L.cols * ch;
+        L.sum.assign(n, 0);
+        L.lo.assign(n, 255);
+        L.hi.assign(n, 0);
+    }
+    if (levels == 0) return pyr;
+
+    StatsLevel &L1 = pyr[1];
+    for (int y = 0; y < img.rows; ++y) {
+        const unsigned char *src = img.ptr(y);
+        size_t rowBase = static_cast<size_t>(y >> 1) * L1.cols * ch;
+        for (int x = 0; x < img.cols; ++x) {
+            size_t cell = rowBase + static_cast<size_t>(x >> 1) * ch;
+            for (int c = 0; c < ch; ++c) {
+                uint8_t v = src[x * ch + c];
+                L1.sum[cell + c] += v;
+                L1.lo[cell + c] = std::min(L1.lo[cell + c], v);
+                L1.hi[cell + c] = std::max(L1.hi[cell + c], v);
+            }
+        }
+    }
+    for (int k = 2; k <= levels; ++k) {
+        const StatsLevel &F = pyr[k - 1];
+        StatsLevel &L = pyr[k];
+        for (int y = 0; y < F.rows; ++y) {
+            for (int x = 0; x < F.cols; ++x) {
+                size_t from = (static_cast<size_t>(y) * F.cols + x) * ch;
+                size_t to = (static_cast<size_t>(y >> 1) * L.cols + (x >> 1)) * ch;
+                for (int c = 0; c < ch; ++c) {
+                    L.sum[to + c] += F.sum[from + c];
+                    L.lo[to + c] = std::min(L.lo[to + c], F.lo[from + c]);
+                    L.hi[to + c] = std::max(L.hi[to + c], F.hi[from + c]);
+                }
+            }
+        }
+    }
+    return pyr;
+}
+
+// task(i) for every i < costs.size() on the parallel_for_ pool, heaviest
+// first. Items of at least the target cost (an eighth of a thread's share of
+// the total, and no less than minCost) are tasks of their own; the lighter
+// ones are packed into runs of about the target cost. Tasks are handed out
+// from one cursor over the cost order rather than by range, because the pool
+// gives idle threads the upper half of a range first: whichever thread asks,
+// it gets the heaviest task nobody has started.
+inline void parallelLargestFirst(const std::vector<uint64_t> &costs, uint64_t minCost,
+                                 const std::function<void(size_t)> &task) {
+    std::vector<size_t> order(costs.size());
+    uint64_t total = 0;
+    for (size_t i = 0; i < costs.size(); ++i) {
+        order[i] = i;
+        total += costs[i];
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return costs[a] > costs[b]; });
+
+    const uint64_t target = std::max<uint64_t>(total / (8 * static_cast<uint64_t>(cv::getNumThreads())), minCost);
+    std::vector<size_t> taskStart;   // tasks are runs of items
+    uint64_t open = target;
+    for (size_t k = 0; k < order.size(); ++k) {
+        if (open >= target || costs[order[k]] >= target) {
+            taskStart.push_back(k);
+            open = 0;
+        }
+        open += costs[order[k]];
+    }
+    taskStart.push_back(order.size());
+
+    std::atomic<size_t> next(0);
+    cv::parallel_for_(cv::Range(0, static_cast<int>(taskStart.size()) - 1), [&](const cv::Range &r) {
+        for (int n = r.start; n < r.end; ++n) {
+            size_t t = next.fetch_add(1);
+            for (size_t k = taskStart[t]; k < taskStart[t + 1]; ++k) task(order[k]);
+        }
+    });
+}
+
+// How the viewer shows a dissimilar pair, alpha being its +/- slider:
+//  - Split: img1 up to a cut at alpha, img2 past it;
+//  - Crossfade: img1 at opacity alpha over img2;
+//  - Difference: img1 at quarter brightness with |img1 - img2| on top,
+//    amplified from 1x (alpha 0) to 16x (alpha 1).
+enum class BlendMode { Split, Crossfade, Difference };
+
 class ImageComparator {
 private:
+    CompareOptions options;
+    BlendMode blend_mode = BlendMode::Split;
     bool vertical_cut = true;
+    bool translation_tolerant = false;
+    bool normalize_size = false;
+    bool streaming = false;
     cv::Mat bigImg;
 
+    struct HierarchicalState {
+        const cv::Mat *img1, *img2;
+        const std::vector<StatsLevel> *pyr1, *pyr2;
+        HierarchicalOptions opts;
+        int tolerance;
+        uint64_t similar = 0;   // bytes counted as similar
+        uint64_t touched = 0;   // full-res pixels compared directly
+        uint64_t inexact = 0;   // bytes decided from channel means only
+    };
+
+    // Compares the pixels of one tile directly, for the channels set in mask.
+    static void compareTile(HierarchicalState &st, int y0, int x0, int size, unsigned mask) {
+        const cv::Mat &a = *st.img1;
+        const cv::Mat &b = *st.img2;
+        const int ch = a.channels;
+        int y1 = std::min(y0 + size, a.rows);
+        int x1 = std::min(x0 + size, a.cols);
+        for (int y = y0; y < y1; ++y) {
+            const unsigned char *pa = a.ptr(y) + static_cast<size_t>(x0) * ch;
+            const unsigned char *pb = b.ptr(y) + static_cast<size_t>(x0) * ch;
+            for (int i = 0; i < (x1 - x0) * ch; ++i) {
+                if ((mask >> (i % ch) & 1u) && std::abs(pa[i] - pb[i]) < st.tolerance)
+                    ++st.similar;
+            }
+        }
+        st.touched += static_cast<uint64_t>(y1 - y0) * (x1 - x0);
+    }
+
+    // Classifies channels of cell (cy, cx) at level k and descends into the
+    // four children for the channels that stay ambiguous.
+    static void refineCell(HierarchicalState &st, int k, int cy, int cx, unsigned mask) {
+        const StatsLevel &A = (*st.pyr1)[k];
+        const StatsLevel &B = (*st.pyr2)[k];
+        if (cy >= A.rows || cx >= A.cols) return;
+        const int ch = st.img1->channels;
+        size_t cell = (static_cast<size_t>(cy) * A.cols + cx) * ch;
+        uint64_t h = std::min(A.scale, st.img1->rows - cy * A.scale);
+        uint64_t w = std::min(A.scale, st.img1->cols - cx * A.scale);
+        uint64_t count = h * w;
+
+        const int tolerance = st.tolerance;
+        unsigned ambiguous = 0;
+        for (int c = 0; c < ch; ++c) {
+            if (!(mask >> c & 1u)) continue;
+            int loA = A.lo[cell + c], hiA = A.hi[cell + c];
+            int loB = B.lo[cell + c], hiB = B.hi[cell + c];
+            double gap = std::fabs(static_cast<double>(A.sum[cell + c]) - B.sum[cell + c]) / count;
+            if (hiA - loB < tolerance && hiB - loA < tolerance) {
+                st.similar += count;
+            } else if (loA - hiB >= tolerance || loB - hiA >= tolerance) {
+                // every byte pair differs by at least the tolerance
+            } else if (gap <= st.opts.same_margin) {
+                st.similar += count;
+                st.inexact += count;
+            } else if (gap >= st.opts.diff_margin) {
+                st.inexact += count;
+            } else {
+                ambiguous |= 1u << c;
+            }
+        }
+        if (!ambiguous) return;
+        if (k == 1) {
+            compareTile(st, cy * 2, cx * 2, 2, ambiguous);
+            return;
+        }
+        for (int dy = 0; dy < 2; ++dy)
+            for (int dx = 0; dx < 2; ++dx)
+                refineCell(st, k - 1, cy * 2 + dy, cx * 2 + dx, ambiguous);
+    }
+
+    // Sum of the metric over the pair through the kernel picked for opts.
+    static uint64_t metricSum(const cv::Mat &img1, const cv::Mat &img2, const CompareOptions &opts) {
+        assert(img1.rows == img2.rows);
+        assert(img1.cols == img2.cols);
+        assert(img1.channels == img2.channels);
+
+        CompareRowFn row = compareRowFn(img1.channels, opts);
+        assert(row);
+        return parallelRowSum(img1.rows, static_cast<size_t>(img1.cols) * img1.channels, [&](int y) {
+            return row(img1.ptr(y), img2.ptr(y), img1.cols, opts.tolerance);
+        });
+    }
+
+    // metricSum over images held as 1-4 planes each.
+    static uint64_t metricSum(const std::vector<cv::Mat_<uint8_t>> &planes1,
+                              const std::vector<cv::Mat_<uint8_t>> &planes2, const CompareOptions &opts) {
+        assert(planes1.size() == planes2.size());
+        int n = static_cast<int>(planes1.size());
+        PlanarRowFn row = planarRowFn(n, opts);
+        assert(row);
+        for (int c = 0; c < n; ++c) {
+            assert(planes1[c].channels == 1 && planes2[c].channels == 1);
+            assert(planes1[c].rows == planes1[0].rows && planes2[c].rows == planes1[0].rows);
+            assert(planes1[c].cols == planes1[0].cols && planes2[c].cols == planes1[0].cols);
+        }
+        return parallelRowSum(planes1[0].rows, static_cast<size_t>(planes1[0].cols) * n, [&](int y) {
+            const uint8_t *a[4], *b[4];
+            for (int c = 0; c < n; ++c) {
+                a[c] = planes1[c].ptr(y);
+                b[c] = planes2[c].ptr(y);
+            }
+            return row(a, b, planes1[0].cols, opts.tolerance);
+        });
+    }
+
+    // Number of scores metricSum averages over.
+    static uint64_t metricTerms(uint64_t pixels, int channels, const CompareOptions &opts) {
+        return opts.mode == ToleranceMode::PerChannel ? pixels * channels : pixels;
+    }
+
+    // Similarity under the comparator's tolerance and mode, whatever metric
+    // is configured: run() and its 90% threshold need a fraction.
     double computeSimilarity(const cv::Mat &img1, const cv::Mat &img2) {
+        CompareOptions opts = options;
+        opts.metric = CompareMetric::Similarity;
+        return compare(img1, img2, opts);
+    }
+
+    double computeSimilarity(const std::vector<cv::Mat_<uint8_t>> &planes1, const std::vector<cv::Mat_<uint8_t>> &planes2) {
+        CompareOptions opts = options;
+        opts.metric = CompareMetric::Similarity;
+        return compare(planes1, planes2, opts);
+    }
+
+    // metricSum over two Mat_ at a deep depth, in that depth's units.
+    template <typename T>
+    static double metricSum(const cv::Mat_<T> &img1, const cv::Mat_<T> &img2, const CompareOptions &opts) {
         assert(img1.rows == img2.rows);
         assert(img1.cols == img2.cols);
         assert(img1.channels == img2.channels);
 
-        int total_pixels = img1.rows * img1.cols * img1.channels;
-        int similar_pixels = 0;
+        DeepRowFn<T> row = deepRowFn<T>(img1.channels, opts);
+        assert(row);
+        const double tol = opts.tolerance * CompareDepth<T>::scale();
+        return parallelRowSum(img1.rows, static_cast<size_t>(img1.cols) * img1.channels * sizeof(T), [&](int y) {
+            return row(img1.ptr(y), img2.ptr(y), img1.cols, tol);
+        });
+    }
+
+    template <typename T>
+    double computeSimilarity(const cv::Mat_<T> &img1, const cv::Mat_<T> &img2) {
+        CompareOptions opts = options;
+        opts.metric = CompareMetric::Similarity;
+        return compare(img1, img2, opts);
+    }
+
+    // One input of run() and scorePair. img is the 8-bit image for the viewer
+    // and for 8-bit scoring; a pair with a 16-bit or HDR file is also scored
+    // at that depth, from deep16 or deepf. Each file is decoded once, at its
+    // own depth, and converted for the other.
+    struct PairImage {
+        cv::Mat img;
+        cv::Mat_<uint16_t> deep16;
+        cv::Mat_<float> deepf;
+    };
+
+    // Depth a pair is scored at: float if either file is HDR, else 16-bit if
+    // either is 16-bit, else 8-bit.
+    static int pairDepth(int depth1, int depth2) {
+        if (depth1 == cv::CV_32F || depth2 == cv::CV_32F) return cv::CV_32F;
+        if (depth1 == cv::CV_16U || depth2 == cv::CV_16U) return cv::CV_16U;
+        return cv::CV_8U;
+    }
+
+    // Fills out from path, a file of depth fileDepth in a pair scored at
+    // depth. false if the file can't be decoded.
+    static bool loadPairImage(const std::string &path, int fileDepth, int depth, PairImage &out) {
+        if (fileDepth == cv::CV_32F) {
+            if (!cv::imread(path, out.deepf, 3)) return false;
+            cv::convertDepth(out.deepf, out.img);
+        } else if (fileDepth == cv::CV_16U) {
+            if (!cv::imread(path, out.deep16, 3)) return false;
+            cv::convertDepth(out.deep16, out.img);
+            // next to HDR, 16-bit samples are widened from 8 bits, as
+            // stbi_loadf does
+            if (depth == cv::CV_32F) cv::convertDepth(out.img, out.deepf);
+        } else {
+            out.img = cv::imread(path);
+            if (out.img.empty()) return false;
+            if (depth == cv::CV_16U) cv::convertDepth(out.img, out.deep16);
+            if (depth == cv::CV_32F) cv::convertDepth(out.img, out.deepf);
+        }
+        return true;
+    }
+
+    // computeSimilarity of a loaded pair at depth.
+    double computeSimilarity(const PairImage &a, const PairImage &b, int depth) {
+        if (depth == cv::CV_32F) return computeSimilarity(a.deepf, b.deepf);
+        if (depth == cv::CV_16U) return computeSimilarity(a.deep16, b.deep16);
+        return computeSimilarity(a.img, b.img);
+    }
+
+    // run()'s interactive viewer over a same-sized pair.
+    void view(cv::Mat &img1, cv::Mat &img2) {
+        std::string winname = "ImageCompare";
+        cv::namedWindow(winname, cv::WINDOW_AUTOSIZE);
+        bigImg = cv::Mat(img1.rows, img1.cols, cv::CV_8UC3);
+
+        double dl = 1.0 / 100.0;
+        double alpha = 0.5;
+        while (1) {
+            showImages(img1, img2, alpha);
+            int key = cv::waitKey(0);
+            if ('d' == key) {
+                vertical_cut = !vertical_cut;
+            }
+            if ('b' == key) {
+                blend_mode = static_cast<BlendMode>((static_cast<int>(blend_mode) + 1) % 3);
+            }
+            if ('+' == key) {
+                alpha += dl;
+            }
+            if ('-' == key) {
+                alpha -= dl;
+            }
+
+            if (key == 27) {
+                break;
+            }
 
-        for (int i = 0; i < total_pixels; ++i) {
-            if (std::abs(img1.data[i] - img2.data[i]) < 10) // small difference allowed
-                ++similar_pixels;
+            alpha = clamp(alpha, 0.0, 1.0);
         }
-        return static_cast<double>(similar_pixels) / total_pixels;
+
+        cv::destroyWindow(winname);
+    }
+
+    // Longest side of the images run() shows after a streamed comparison.
+    static const int kPreviewSide = 2048;
+
+    // Decodes path through a cv::ImageReader into a copy shrunk by the
+    // smallest whole factor that brings its longer side to maxSide or less,
+    // each output pixel the mean of its factor x factor block. Streamed
+    // formats never hold more than the preview and factor source rows.
+    // Empty on failure.
+    static cv::Mat loadPreview(const std::string &path, int maxSide) {
+        cv::ImageReader reader;
+        if (!reader.open(path)) return cv::Mat();
+        const int f = std::max(1, (std::max(reader.rows, reader.cols) + maxSide - 1) / maxSide);
+        const int pcols = (reader.cols + f - 1) / f, prows = (reader.rows + f - 1) / f;
+        cv::Mat preview(prows, pcols, cv::CV_8UC3);
+        cv::Mat strip(f, reader.cols, cv::CV_8UC3);
+        std::vector<uint32_t> sum(static_cast<size_t>(pcols) * 3);
+        for (int py = 0; py < prows; ++py) {
+            int n = reader.read(strip);
+            if (n <= 0) return cv::Mat();
+            std::fill(sum.begin(), sum.end(), 0u);
+            for (int y = 0; y < n; ++y) {
+                const unsigned char *src = strip.ptr(y);
+                for (int x = 0; x < reader.cols; ++x)
+                    for (int c = 0; c < 3; ++c) sum[(x / f) * 3 + c] += src[3 * x + c];
+            }
+            unsigned char *dst = preview.ptr(py);
+            for (int px = 0; px < pcols; ++px) {
+                uint32_t count = static_cast<uint32_t>(n) * std::min(f, reader.cols - px * f);
+                for (int c = 0; c < 3; ++c) dst[3 * px + c] = static_cast<unsigned char>((sum[px * 3 + c] + count / 2) / count);
+            }
+        }
+        return preview;
+    }
+
+    // Shrinks the larger of a and b to the size of the smaller. false, leaving
+    // both alone, if their aspect ratios differ by more than the rounding of
+    // one pixel, since stretching either would distort what is compared.
+    static bool normalizePair(cv::Mat &a, cv::Mat &b) {
+        cv::Mat &big = a.total() >= b.total() ? a : b;
+        cv::Mat &small = a.total() >= b.total() ? b : a;
+        int64_t cross = static_cast<int64_t>(small.rows) * big.cols - static_cast<int64_t>(big.rows) * small.cols;
+        if (std::abs(cross) > std::max(big.cols, big.rows)) return false;
+        cv::resize(big, big, cv::Size(small.cols, small.rows), cv::INTER_AREA);
+        return true;
+    }
+
+    // run()'s score for one pair of files without the viewer, with both
+    // decodes running side by side. Pairs of different sizes are normalized
+    // as in run() and scored at 8 bits, or give -1, as do unreadable files.
+    double scorePair(const std::string &path1, const std::string &path2) {
+        const std::string *paths[2] = {&path1, &path2};
+        int depths[2] = {cv::imreadDepth(path1), cv::imreadDepth(path2)};
+        const int depth = pairDepth(depths[0], depths[1]);
+        PairImage in[2];
+        bool ok[2] = {false, false};
+        cv::parallel_for_(cv::Range(0, 2), [&](const cv::Range &r) {
+            for (int k = r.start; k < r.end; ++k) ok[k] = loadPairImage(*paths[k], depths[k], depth, in[k]);
+        });
+        if (!ok[0] || !ok[1]) return -1.0;
+        if (in[0].img.rows != in[1].img.rows || in[0].img.cols != in[1].img.cols) {
+            if (!normalize_size || !normalizePair(in[0].img, in[1].img)) return -1.0;
+            return computeSimilarity(in[0].img, in[1].img);
+        }
+        return computeSimilarity(in[0], in[1], depth);
     }
 
 public:
     ImageComparator() {}
 
+    // Tolerance, tolerance mode and metric for compare() and for scoring in
+    // run(); the defaults reproduce the original per-byte "< 10" similarity.
+    // The hierarchical comparison takes only the tolerance and always scores
+    // per channel.
+    void setCompareOptions(const CompareOptions &opts) { options = opts; }
+    const CompareOptions &compareOptions() const { return options; }
+
+    // The metric of opts over two same-sized 8-bit images with 1-4 channels:
+    // a fraction for Similarity, a mean for the others. 0 for empty images.
+    double compare(const cv::Mat &img1, const cv::Mat &img2, const CompareOptions &opts) const {
+        uint64_t terms = metricTerms(img1.total(), img1.channels, opts);
+        return terms ? static_cast<double>(metricSum(img1, img2, opts)) / terms : 0.0;
+    }
+    double compare(const cv::Mat &img1, const cv::Mat &img2) const { return compare(img1, img2, options); }
+
+    // compare() at 16-bit or float depth. opts.tolerance and the means are in
+    // 8-bit units, so a pair scores the same at any depth it is decoded at
+    // (up to the precision the depth adds).
+    template <typename T>
+    double compare(const cv::Mat_<T> &img1, const cv::Mat_<T> &img2, const CompareOptions &opts) const {
+        uint64_t terms = metricTerms(img1.total(), img1.channels, opts);
+        if (!terms) return 0.0;
+        double mean = metricSum(img1, img2, opts) / terms;
+        const double scale = CompareDepth<T>::scale();
+        if (opts.metric == CompareMetric::MeanAbsDiff) return mean / scale;
+        if (opts.metric == CompareMetric::MeanSquaredError) return mean / (scale * scale);
+        return mean;
+    }
+    template <typename T>
+    double compare(const cv::Mat_<T> &img1, const cv::Mat_<T> &img2) const { return compare(img1, img2, options); }
+
+    // compare() for images held as 1-4 same-sized planes each (see cv::split
+    // and cv::imreadPlanar), scoring the same as the interleaved pixels would.
+    double compare(const std::vector<cv::Mat_<uint8_t>> &planes1, const std::vector<cv::Mat_<uint8_t>> &planes2,
+                   const CompareOptions &opts) const {
+        if (planes1.empty()) return 0.0;
+        uint64_t terms = metricTerms(planes1[0].total(), static_cast<int>(planes1.size()), opts);
+        return terms ? static_cast<double>(metricSum(planes1, planes2, opts)) / terms : 0.0;
+    }
+    double compare(const std::vector<cv::Mat_<uint8_t>> &planes1, const std::vector<cv::Mat_<uint8_t>> &planes2) const {
+        return compare(planes1, planes2, options);
+    }
+
+    // When enabled, run() first scores the pair with computeSimilarityStreaming
+    // and only loads whole images if the viewer is needed.
+    void setStreaming(bool enable) { streaming = enable; }
+
+    // Decodes both files strip by strip and compares each strip as soon as it
+    // is available, so peak memory is O(width * strip_rows) for PNM and
+    // baseline JPEG input. Scores like computeSimilarity. Returns -1 if the
+    // images can't be compared.
+    double computeSimilarityStreaming(const std::string &path1, const std::string &path2, int strip_rows = 64) {
+        cv::ImageReader r1, r2;
+        if (!r1.open(path1) || !r2.open(path2)) {
+            std::cerr << "One or both images failed to load." << std::endl;
+            return -1.0;
+        }
+        if (r1.rows != r2.rows || r1.cols != r2.cols) {
+            std::cerr << "Images must be of the same size." << std::endl;
+            return -1.0;
+        }
+
+        cv::Mat strip1(strip_rows, r1.cols, cv::CV_8UC3);
+        cv::Mat strip2(strip_rows, r2.cols, cv::CV_8UC3);
+        CompareOptions opts = options;
+        opts.metric = CompareMetric::Similarity;
+        uint64_t similar = 0;
+        int done = 0;
+        while (done < r1.rows) {
+            int n1 = r1.read(strip1);
+            int n2 = r2.read(strip2);
+            if (n1 <= 0 || n1 != n2) {
+                std::cerr << "Failed to decode image rows." << std::endl;
+                return -1.0;
+            }
+            cv::Rect part(0, 0, r1.cols, n1);
+            similar += metricSum(strip1(part), strip2(part), opts);
+            done += n1;
+        }
+        return static_cast<double>(similar) / metricTerms(static_cast<uint64_t>(r1.rows) * r1.cols, 3, opts);
+    }
+
+    // Scores every pair as run() would, without the viewer: one similarity per
+    // pair, in order, -1 where a pair can't be compared. The cost of each
+    // pair is estimated from the image headers (pixels of both files) before
+    // anything is decoded, and the batch runs through parallelLargestFirst
+    // with tasks of no less than 256K pixels: a big pair is a task of its
+    // own, its two decodes run side by side and its comparison splits into
+    // row bands that idle threads steal; small pairs are packed together.
+    // The largest pairs start first, so the end of a batch is small work and
+    // row bands, not one thread decoding the last huge image.
+    std::vector<double> compareBatch(const std::vector<std::pair<std::string, std::string>> &pairs) {
+        std::vector<uint64_t> costs;
+        for (const std::pair<std::string, std::string> &p : pairs) {
+            uint64_t cost = 0;
+            for (const std::string *path : {&p.first, &p.second}) {
+                int w = 0, h = 0, c = 0;
+                if (stbi_info(path->c_str(), &w, &h, &c)) cost += static_cast<uint64_t>(w) * h;
+            }
+            // unreadable headers still get a slot; imread decides
+            costs.push_back(std::max<uint64_t>(cost, 1));
+        }
+        std::vector<double> scores(pairs.size(), -1.0);
+        parallelLargestFirst(costs, 1 << 18, [&](size_t i) { scores[i] = scorePair(pairs[i].first, pairs[i].second); });
+        return scores;
+    }
+
+    // When enabled, run() shrinks the larger of a mismatched pair to the size
+    // of the smaller with INTER_AREA instead of rejecting the pair, provided
+    // both have the same aspect ratio (see normalizePair).
+    void setNormalizeSize(bool enable) { normalize_size = enable; }
+
+    // When enabled, run() re-scores dissimilar pairs after aligning them with
+    // computeSimilarityAligned.
+    void setTranslationTolerant(bool enable) { translation_tolerant = enable; }
+
+    // Initial viewer mode; 'b' cycles through them in run().
+    void setBlendMode(BlendMode mode) { blend_mode = mode; }
+
+    // Estimates the offset between the images by phase correlation and compares
+    // only the region where they overlap after the shift, through views.
+    AlignedResult computeSimilarityAligned(const cv::Mat &img1, const cv::Mat &img2) {
+        assert(img1.rows == img2.rows);
+        assert(img1.cols == img2.cols);
+
+        AlignedResult res;
+        cv::Point d = cv::phaseCorrelate(img1, img2, &res.response);
+        int w = img1.cols - std::abs(d.x);
+        int h = img1.rows - std::abs(d.y);
+        if (w <= 0 || h <= 0) return res;
+
+        cv::Mat v1 = img1(cv::Rect(std::max(0, -d.x), std::max(0, -d.y), w, h));
+        cv::Mat v2 = img2(cv::Rect(std::max(0, d.x), std::max(0, d.y), w, h));
+        res.similarity = computeSimilarity(v1, v2);
+        res.dx = d.x;
+        res.dy = d.y;
+        res.overlap = static_cast<double>(w) * h / (static_cast<double>(img1.cols) * img1.rows);
+        return res;
+    }
+
+    // Coarse-to-fine variant of computeSimilarity: classifies pyramid tiles at
+    // the coarsest level and only compares full-resolution pixels for tiles
+    // that stay ambiguous all the way down. See HierarchicalOptions. Building
+    // the two pyramids reads every pixel once, so this only saves reads when
+    // pyramids are kept and reused, e.g. one reference image against many:
+    // see the overload below and read_fraction.
+    HierarchicalResult computeSimilarityHierarchical(const cv::Mat &img1, const cv::Mat &img2,
+                                                     const HierarchicalOptions &opts = HierarchicalOptions()) {
+        int levels = std::max(0, std::min(opts.levels, 8));
+        std::vector<StatsLevel> pyr1 = buildStatsPyramid(img1, levels);
+        std::vector<StatsLevel> pyr2 = buildStatsPyramid(img2, levels);
+        HierarchicalResult res = computeSimilarityHierarchical(img1, img2, pyr1, pyr2, opts);
+        if (img1.total()) res.read_fraction += 1.0;
+        return res;
+    }
+
+    // The same with pyramids from buildStatsPyramid(img, levels), which must
+    // have the same number of levels; opts.levels is ignored.
+    HierarchicalResult computeSimilarityHierarchical(const cv::Mat &img1, const cv::Mat &img2,
+                                                     const std::vector<StatsLevel> &pyr1,
+                                                     const std::vector<StatsLevel> &pyr2,
+                                                     const HierarchicalOptions &opts = HierarchicalOptions()) {
+        assert(img1.rows == img2.rows);
+        assert(img1.cols == img2.cols);
+        assert(img1.channels == img2.channels);
+        assert(img1.channels <= 8);
+        assert(!pyr1.empty() && pyr1.size() == pyr2.size());
+
+        HierarchicalResult res;
+        uint64_t pixels = static_cast<uint64_t>(img1.rows) * img1.cols;
+        uint64_t total = pixels * img1.channels;
+        if (total == 0) return res;
+
+        int levels = static_cast<int>(pyr1.size()) - 1;
+        HierarchicalState st{&img1, &img2, &pyr1, &pyr2, opts, options.tolerance};
+        unsigned all = (1u << img1.channels) - 1;
+        if (levels == 0) {
+            compareTile(st, 0, 0, std::max(img1.rows, img1.cols), all);
+        } else {
+            // rows of coarse cells in parallel, each band counting into its
+            // own state
+            const HierarchicalState empty = st;
+            std::mutex merge;
+            cv::parallel_for_(cv::Range(0, pyr1[levels].rows), [&](const cv::Range &r) {
+                HierarchicalState part = empty;
+                for (int cy = r.start; cy < r.end; ++cy)
+                    for (int cx = 0; cx < pyr1[levels].cols; ++cx)
+                        refineCell(part, levels, cy, cx, all);
+                std::lock_guard<std::mutex> lock(merge);
+                st.similar += part.similar;
+                st.touched += part.touched;
+                st.inexact += part.inexact;
+            });
+        }
+
+        res.similarity = static_cast<double>(st.similar) / total;
+        res.touched_fraction = static_cast<double>(st.touched) / pixels;
+        res.read_fraction = res.touched_fraction;
+        res.error_bound = static_cast<double>(st.inexact) / total;
+        return res;
+    }
+
     void showImages(cv::Mat &img1, cv::Mat &img2, double alpha) {
         if (img1.empty() || img2.empty()) return;
 
@@ -41,6 +1223,17 @@ public:
         assert(img1.rows == img2.rows);
         assert(img1.cols == img2.cols);
 
+        if (blend_mode == BlendMode::Crossfade) {
+            bigImg = cv::crossfade(img1, img2, alpha);
+            cv::imshow("ImageCompare", bigImg);
+            return;
+        }
+        if (blend_mode == BlendMode::Difference) {
+            bigImg = cv::amplifiedDiff(img1, img2, 1.0 + 15.0 * alpha);
+            cv::imshow("ImageCompare", bigImg);
+            return;
+        }
+
         if (alpha > 0.0 && alpha < 1.0) {
             if (vertical_cut) {
                 int colcut = img1.cols * alpha;
@@ -83,53 +1276,69 @@ public:
         std::cout << "Key + : Increase clipping value" << std::endl;
         std::cout << "Key - : Decrease clipping value" << std::endl;
         std::cout << "Key d : Change direction of clipping" << std::endl;
+        std::cout << "Key b : Cycle blend mode (split, crossfade, difference)" << std::endl;
 
-        cv::Mat img1 = cv::imread(path1);
-        cv::Mat img2 = cv::imread(path2);
+        if (streaming) {
+            double streamed = computeSimilarityStreaming(path1, path2);
+            if (streamed >= 0.0) {
+                std::cout << "Image similarity: " << streamed * 100 << "%" << std::endl;
+                if (streamed >= 0.90) {
+                    std::cout << "Images are sufficiently similar (>= 90%)." << std::endl;
+                    return;
+                }
+                // the viewer gets downscaled copies, decoded strip by strip
+                // like the score, so memory stays bounded for huge inputs
+                cv::Mat preview1 = loadPreview(path1, kPreviewSide);
+                cv::Mat preview2 = loadPreview(path2, kPreviewSide);
+                if (preview1.empty() || preview2.empty()) {
+                    std::cerr << "Failed to decode image rows." << std::endl;
+                    return;
+                }
+                view(preview1, preview2);
+                return;
+            }
+            // not comparable as streams (e.g. sizes differ): whole images
+        }
 
-        if (img1.empty() || img2.empty()) {
+        const int depth1 = cv::imreadDepth(path1), depth2 = cv::imreadDepth(path2);
+        int depth = pairDepth(depth1, depth2);
+        PairImage in1, in2;
+        if (!loadPairImage(path1, depth1, depth, in1) || !loadPairImage(path2, depth2, depth, in2)) {
             std::cerr << "One or both images failed to load." << std::endl;
             return;
         }
+        cv::Mat &img1 = in1.img;
+        cv::Mat &img2 = in2.img;
 
         if (img1.rows != img2.rows || img1.cols != img2.cols) {
-            std::cerr << "Images must be of the same size." << std::endl;
-            return;
+            if (!normalize_size) {
+                std::cerr << "Images must be of the same size." << std::endl;
+                return;
+            }
+            if (!normalizePair(img1, img2)) {
+                std::cerr << "Images have different aspect ratios; not normalizing." << std::endl;
+                return;
+            }
+            std::cout << "Normalized both images to " << img1.cols << "x" << img1.rows << std::endl;
+            depth = cv::CV_8U; // only the 8-bit images were resized
         }
 
-        double similarity = computeSimilarity(img1, img2);
+        // Exact scoring rather than computeSimilarityHierarchical: the 90%
+        // verdict shouldn't move with mean-based guesses, and one-off
+        // pyramids would read every pixel anyway.
+        double similarity = computeSimilarity(in1, in2, depth);
         std::cout << "Image similarity: " << similarity * 100 << "%" << std::endl;
+        if (translation_tolerant && similarity < 0.90) {
+            AlignedResult aligned = computeSimilarityAligned(img1, img2);
+            std::cout << "Aligned similarity: " << aligned.similarity * 100 << "% at offset ("
+                      << aligned.dx << ", " << aligned.dy << ")" << std::endl;
+            similarity = std::max(similarity, aligned.similarity);
+        }
         if (similarity >= 0.90) {
             std::cout << "Images are sufficiently similar (>= 90%)." << std::endl;
             return;
         }
 
-        std::string winname = "ImageCompare";
-        cv::namedWindow(winname, cv::WINDOW_AUTOSIZE);
-        bigImg = cv::Mat(img1.rows, img1.cols, cv::CV_8UC3);
-
-        double dl = 1.0 / 100.0;
-        double alpha = 0.5;
-        while (1) {
-            showImages(img1, img2, alpha);
-            int key = cv::waitKey(0);
-            if ('d' == key) {
-                vertical_cut = !vertical_cut;
-            }
-            if ('+' == key) {
-                alpha += dl;
-            }
-            if ('-' == key) {
-                alpha -= dl;
-            }
-
-            if (key == 27) {
-                break;
-            }
-
-            alpha = clamp(alpha, 0.0, 1.0);
-        }
-
-        cv::destroyWindow(winname);
+        view(img1, img2);
     }
 };
@@ -11,6 +11,28 @@
 #include <cstring>
 #include <algorithm>
 #include <cstdint>
+#include <cstdio>
+#include <cctype>
+#include <cmath>
+#include <complex>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -19,9 +41,13 @@
 
 namespace cv {
 
+// Up to four channel values, as doubles like OpenCV's Scalar so it can also
+// carry results such as mean().
 struct Scalar {
-    uint8_t val[3];
-    Scalar(uint8_t v0, uint8_t v1, uint8_t v2) { val[0] = v0; val[1] = v1; val[2] = v2; }
+    double val[4];
+    Scalar(double v0 = 0, double v1 = 0, double v2 = 0, double v3 = 0) {
+        val[0] = v0; val[1] = v1; val[2] = v2; val[3] = v3;
+    }
 };
 
 struct Point {
@@ -31,72 +57,1046 @@ struct Point {
 
 struct Rect {
     int x, y, width, height;
+    Rect() : x(0), y(0), width(0), height(0) {}
     Rect(int _x, int _y, int _width, int _height) : x(_x), y(_y), width(_width), height(_height) {}
+
+    int area() const { return width * height; }
+    bool empty() const { return width <= 0 || height <= 0; }
 };
 
+// Half-open interval [start, end) of indices, as taken by parallel_for_.
+struct Range {
+    int start, end;
+    Range() : start(0), end(0) {}
+    Range(int _start, int _end) : start(_start), end(_end) {}
+
+    int size() const { return end - start; }
+    bool empty() const { return start >= end; }
+};
+
+// Intersection and bounding union, as OpenCV's Rect operators; an empty
+// operand leaves the other side of a union unchanged.
+inline Rect operator&(const Rect &a, const Rect &b) {
+    int x0 = std::max(a.x, b.x), y0 = std::max(a.y, b.y);
+    int x1 = std::min(a.x + a.width, b.x + b.width), y1 = std::min(a.y + a.height, b.y + b.height);
+    if (x1 <= x0 || y1 <= y0) return Rect();
+    return Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
+inline Rect operator|(const Rect &a, const Rect &b) {
+    if (a.empty()) return b;
+    if (b.empty()) return a;
+    int x0 = std::min(a.x, b.x), y0 = std::min(a.y, b.y);
+    int x1 = std::max(a.x + a.width, b.x + b.width), y1 = std::max(a.y + a.height, b.y + b.height);
+    return Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
+template <class E> struct PixelExpr;
+
 class Mat {
 public:
     int rows = 0, cols = 0, channels = 3;
+    size_t step = 0;            // bytes between the starts of consecutive rows
     unsigned char *data = nullptr;
 
     Mat() = default;
-    Mat(int r, int c, int type) : rows(r), cols(c), channels(3) {
-        data = new unsigned char[r * c * channels]();
+    Mat(int r, int c, int type) : rows(r), cols(c), channels(3), owns(true) {
+        step = static_cast<size_t>(c) * channels;
+        data = new unsigned char[r * step]();
     }
+    // Wraps existing pixels without copying, like OpenCV's Mat(rows, cols,
+    // type, data, step). holder, if given, keeps the pixels alive for as long
+    // as this Mat (but not its ROI views); otherwise the caller does.
+    Mat(int r, int c, int /*type*/, unsigned char *d, size_t s, std::shared_ptr<void> holder = nullptr)
+        : rows(r), cols(c), channels(3), step(s), data(d), keep(std::move(holder)) {}
+    // Copies always produce a compact, owning Mat, even from a view.
     Mat(const Mat &other) {
         rows = other.rows; cols = other.cols; channels = other.channels;
-        size_t size = rows * cols * channels;
-        data = new unsigned char[size];
-        std::memcpy(data, other.data, size);
+        dirty = other.dirty;
+        step = static_cast<size_t>(cols) * channels;
+        if (other.data) {
+            owns = true;
+            data = new unsigned char[rows * step];
+            other.copyRowsTo(data, step);
+        }
     }
+    Mat(Mat &&other) noexcept { steal(other); }
+    // Evaluates a pixel expression (absdiff, threshold, addWeighted) into a
+    // new Mat in one pass.
+    template <class E> Mat(const PixelExpr<E> &expr);
     Mat &operator=(const Mat &other) {
         if (this != &other) {
-            delete[] data;
-            rows = other.rows; cols = other.cols; channels = other.channels;
-            size_t size = rows * cols * channels;
-            data = new unsigned char[size];
-            std::memcpy(data, other.data, size);
+            Mat tmp(other);
+            release();
+            steal(tmp);
+        }
+        return *this;
+    }
+    Mat &operator=(Mat &&other) noexcept {
+        if (this != &other) {
+            release();
+            steal(other);
         }
         return *this;
     }
-    ~Mat() { delete[] data; }
+    // Evaluates into the existing pixels when the size matches, so an
+    // operand may also be the destination.
+    template <class E> Mat &operator=(const PixelExpr<E> &expr);
+    ~Mat() { release(); }
 
     bool empty() const { return data == nullptr; }
+    size_t total() const { return static_cast<size_t>(rows) * cols; }
+    bool isContinuous() const { return step == static_cast<size_t>(cols) * channels; }
+    unsigned char *ptr(int y) { return data + y * step; }
+    const unsigned char *ptr(int y) const { return data + y * step; }
 
+    // Returns a view sharing this Mat's pixels, like OpenCV's ROI operator.
+    // The view does not own its data and must not outlive its parent.
     Mat operator()(const Rect &r) const {
-        Mat roi(r.height, r.width, 0);
-        for (int y = 0; y < r.height; ++y) {
-            std::memcpy(
-                roi.data + y * r.width * channels,
-                data + ((y + r.y) * cols + r.x) * channels,
-                r.width * channels
-            );
-        }
+        assert(r.x >= 0 && r.y >= 0 && r.x + r.width <= cols && r.y + r.height <= rows);
+        Mat roi;
+        roi.rows = r.height; roi.cols = r.width; roi.channels = channels;
+        roi.step = step;
+        roi.data = data + r.y * step + static_cast<size_t>(r.x) * channels;
         return roi;
     }
 
+    Mat clone() const { return Mat(*this); }
+
     void copyTo(Mat &dst) const {
         assert(dst.rows == rows && dst.cols == cols);
-        std::memcpy(dst.data, data, rows * cols * channels);
+        copyRowsTo(dst.data, dst.step);
+    }
+
+    // Bounding box of everything the drawing functions (line, rectangle,
+    // polylines, fillConvexPoly) painted since the last clearDirty(), so
+    // consumers can limit work to what changed. Empty if nothing was drawn.
+    // Copies keep it; ROI views start clean and don't report to the parent.
+    Rect dirtyRect() const { return dirty; }
+    void markDirty(const Rect &r) { dirty = dirty | (r & Rect(0, 0, cols, rows)); }
+    void clearDirty() { dirty = Rect(); }
+
+private:
+    bool owns = false;
+    std::shared_ptr<void> keep; // backing store of a wrapping Mat, e.g. a file mapping
+    Rect dirty;
+
+    void copyRowsTo(unsigned char *dst, size_t dstStep) const {
+        size_t rowBytes = static_cast<size_t>(cols) * channels;
+        if (step == rowBytes && dstStep == rowBytes) {
+            std::memcpy(dst, data, rows * rowBytes);
+            return;
+        }
+        for (int y = 0; y < rows; ++y)
+            std::memcpy(dst + y * dstStep, ptr(y), rowBytes);
+    }
+    void steal(Mat &other) {
+        rows = other.rows; cols = other.cols; channels = other.channels;
+        step = other.step; data = other.data; owns = other.owns;
+        keep = std::move(other.keep);
+        dirty = other.dirty;
+        other.data = nullptr; other.owns = false;
+        other.rows = other.cols = 0; other.step = 0;
+    }
+    void release() {
+        if (owns) delete[] data;
+        data = nullptr; owns = false;
+        keep.reset();
+    }
+};
+
+// Depths of the typed Mat_, numbered as in OpenCV.
+const int CV_8U = 0;
+const int CV_16U = 2;
+const int CV_32F = 5;
+constexpr int CV_MAKETYPE(int depth, int cn) { return depth + ((cn - 1) << 3); }
+
+template <typename T> struct DataDepth;
+template <> struct DataDepth<uint8_t> { static constexpr int value = CV_8U; };
+template <> struct DataDepth<uint16_t> { static constexpr int value = CV_16U; };
+template <> struct DataDepth<float> { static constexpr int value = CV_32F; };
+
+// Image of 1-4 interleaved channels of T (uint8_t, uint16_t or float), for
+// what doesn't fit Mat's 8-bit RGB: 16-bit PNG/PNM samples and Radiance HDR
+// floats. Same semantics as Mat: copies are deep and compact, ROI views share
+// pixels and must not outlive their parent. step is in bytes.
+template <typename T>
+class Mat_ {
+public:
+    int rows = 0, cols = 0, channels = 3;
+    size_t step = 0;
+    T *data = nullptr;
+
+    Mat_() = default;
+    Mat_(int r, int c, int cn) : rows(r), cols(c), channels(cn) {
+        step = static_cast<size_t>(c) * cn * sizeof(T);
+        data = new T[static_cast<size_t>(r) * c * cn]();
+        keep.reset(data, std::default_delete<T[]>());
+    }
+    // Wraps existing pixels without copying; holder, if given, keeps them
+    // alive for as long as this Mat_ (see Mat).
+    Mat_(int r, int c, int cn, T *d, size_t s, std::shared_ptr<void> holder = nullptr)
+        : rows(r), cols(c), channels(cn), step(s), data(d), keep(std::move(holder)) {}
+    Mat_(const Mat_ &other) : rows(other.rows), cols(other.cols), channels(other.channels) {
+        step = static_cast<size_t>(cols) * channels * sizeof(T);
+        if (other.data) {
+            data = new T[static_cast<size_t>(rows) * cols * channels];
+            keep.reset(data, std::default_delete<T[]>());
+            other.copyTo(*this);
+        }
+    }
+    Mat_(Mat_ &&other) noexcept { swap(other); }
+    Mat_ &operator=(const Mat_ &other) {
+        if (this != &other) {
+            Mat_ tmp(other);
+            swap(tmp);
+        }
+        return *this;
+    }
+    Mat_ &operator=(Mat_ &&other) noexcept {
+        if (this != &other) {
+            Mat_ tmp(std::move(other));
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    bool empty() const { return data == nullptr; }
+    size_t total() const { return static_cast<size_t>(rows) * cols; }
+    bool isContinuous() const { return step == static_cast<size_t>(cols) * channels * sizeof(T); }
+    int depth() const { return DataDepth<T>::value; }
+    int type() const { return CV_MAKETYPE(depth(), channels); }
+    T *ptr(int y) { return reinterpret_cast<T *>(reinterpret_cast<unsigned char *>(data) + y * step); }
+    const T *ptr(int y) const {
+        return reinterpret_cast<const T *>(reinterpret_cast<const unsigned char *>(data) + y * step);
+    }
+
+    Mat_ operator()(const Rect &r) const {
+        assert(r.x >= 0 && r.y >= 0 && r.x + r.width <= cols && r.y + r.height <= rows);
+        T *origin = const_cast<T *>(ptr(r.y)) + static_cast<size_t>(r.x) * channels;
+        return Mat_(r.height, r.width, channels, origin, step);
+    }
+
+    Mat_ clone() const { return Mat_(*this); }
+
+    void copyTo(Mat_ &dst) const {
+        assert(dst.rows == rows && dst.cols == cols && dst.channels == channels);
+        size_t rowBytes = static_cast<size_t>(cols) * channels * sizeof(T);
+        for (int y = 0; y < rows; ++y)
+            std::memcpy(dst.ptr(y), ptr(y), rowBytes);
+    }
+
+private:
+    std::shared_ptr<void> keep; // owned pixels, or the backing store of a wrapping Mat_
+
+    void swap(Mat_ &other) noexcept {
+        std::swap(rows, other.rows); std::swap(cols, other.cols); std::swap(channels, other.channels);
+        std::swap(step, other.step); std::swap(data, other.data);
+        keep.swap(other.keep);
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Parallel loops.
+//
+// Every parallel kernel goes through parallel_for_, which runs on one
+// process-wide pool: hardware_concurrency() - 1 workers plus whichever thread
+// called. Each participating thread owns a deque of subranges. It halves the
+// range it is given, pushing upper halves on the back of its deque and taking
+// its next piece from the back too, while idle threads steal from the front,
+// where the largest pieces sit. A thread waiting for its loop keeps running
+// tasks rather than blocking, so a parallel_for_ nested in another one just
+// splits onto the calling thread's deque for whoever is idle to take: nesting
+// never adds threads.
+
+namespace detail {
+
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(int workers) { start(workers); }
+    ~WorkStealingPool() { stop(); }
+
+    int threads() const { return workers + 1; }
+
+    // Replaces the workers; only while no loop is running.
+    void resize(int n) {
+        stop();
+        start(n);
+    }
+
+    // body over [begin, end) in pieces no shorter than grain (bar the whole
+    // range); returns once all have run, rethrowing the first exception.
+    void run(const std::function<void(const Range &)> &body, int begin, int end, int grain) {
+        Job job;
+        job.body = &body;
+        job.grain = grain;
+        job.remaining = static_cast<int64_t>(end) - begin;
+        int &self = currentSlot();
+        int claimed = -1;
+        if (self < 0) {
+            // an outside thread borrows one of the spare deques for the call
+            claimed = claimSlot();
+            if (claimed < 0) {
+                body(Range(begin, end));
+                return;
+            }
+            self = claimed;
+        }
+        execute(self, Task{&job, begin, end});
+        while (job.remaining.load(std::memory_order_acquire) > 0) {
+            Task t;
+            if (take(self, t))
+                execute(self, t);
+            else
+                std::this_thread::yield();
+        }
+        if (claimed >= 0) {
+            self = -1;
+            external[claimed - workers].store(false, std::memory_order_release);
+        }
+        if (job.error) std::rethrow_exception(job.error);
+    }
+
+private:
+    struct Job {
+        const std::function<void(const Range &)> *body;
+        int grain;
+        std::atomic<int64_t> remaining;   // iterations not run yet
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;
+    };
+    struct Task {
+        Job *job;
+        int begin, end;
+    };
+    struct Queue {
+        std::mutex m;
+        std::deque<Task> tasks;
+        std::atomic<int> size{0};
+    };
+    static const int kExternalSlots = 16;
+
+    int workers = 0;
+    std::unique_ptr<Queue[]> queues;                // workers, then external slots
+    std::unique_ptr<std::atomic<bool>[]> external;  // external slot in use
+    std::vector<std::thread> pool;
+    std::atomic<int> queued{0};     // tasks sitting in any deque
+    std::atomic<int> sleeping{0};
+    std::atomic<bool> stopping{false};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+
+    // Deque index of the calling thread, -1 outside the pool.
+    static int &currentSlot() {
+        static thread_local int slot = -1;
+        return slot;
+    }
+
+    int slots() const { return workers + kExternalSlots; }
+
+    int claimSlot() {
+        for (int k = 0; k < kExternalSlots; ++k) {
+            bool expected = false;
+            if (!external[k].load(std::memory_order_relaxed) && external[k].compare_exchange_strong(expected, true))
+                return workers + k;
+        }
+        return -1;
+    }
+
+    void start(int n) {
+        workers = std::max(0, n);
+        queues.reset(new Queue[slots()]);
+        external.reset(new std::atomic<bool>[kExternalSlots]);
+        for (int k = 0; k < kExternalSlots; ++k) external[k] = false;
+        stopping = false;
+        for (int w = 0; w < workers; ++w) pool.emplace_back([this, w] { workerLoop(w); });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &th : pool) th.join();
+        pool.clear();
+    }
+
+    void push(int self, const Task &t) {
+        Queue &q = queues[self];
+        {
+            std::lock_guard<std::mutex> lock(q.m);
+            q.tasks.push_back(t);
+            ++q.size;
+        }
+        // pairs with the sleeper's increment-then-check in workerLoop: either
+        // it sees the task or we see it asleep
+        ++queued;
+        if (sleeping.load() > 0) {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            wake.notify_one();
+        }
+    }
+
+    // Newest piece of our own deque, else the oldest of someone else's.
+    bool take(int self, Task &t) {
+        if (queued.load(std::memory_order_relaxed) == 0) return false;
+        if (popFrom(queues[self], t, true)) return true;
+        static thread_local unsigned seed = 0x9e3779b9u ^ static_cast<unsigned>(self);
+        seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+        int n = slots(), first = static_cast<int>(seed % static_cast<unsigned>(n));
+        for (int k = 0; k < n; ++k) {
+            int v = (first + k) % n;
+            if (v != self && popFrom(queues[v], t, false)) return true;
+        }
+        return false;
+    }
+
+    bool popFrom(Queue &q, Task &t, bool back) {
+        if (q.size.load(std::memory_order_relaxed) == 0) return false;
+        std::lock_guard<std::mutex> lock(q.m);
+        if (q.tasks.empty()) return false;
+        if (back) {
+            t = q.tasks.back();
+            q.tasks.pop_back();
+        } else {
+            t = q.tasks.front();
+            q.tasks.pop_front();
+        }
+        --q.size;
+        --queued;
+        return true;
+    }
+
+    // Splits t down to pieces shorter than twice the grain, offering the
+    // upper halves to thieves, and runs the lowest piece.
+    void execute(int self, Task t) {
+        Job &job = *t.job;
+        while (t.end - t.begin >= 2 * job.grain) {
+            int mid = t.begin + (t.end - t.begin) / 2;
+            push(self, Task{&job, mid, t.end});
+            t.end = mid;
+        }
+        if (!job.failed.load(std::memory_order_relaxed)) {
+            try {
+                (*job.body)(Range(t.begin, t.end));
+            } catch (...) {
+                if (!job.failed.exchange(true)) job.error = std::current_exception();
+            }
+        }
+        job.remaining.fetch_sub(t.end - t.begin, std::memory_order_acq_rel);
+    }
+
+    void workerLoop(int self) {
+        currentSlot() = self;
+        int idle = 0;
+        while (!stopping.load(std::memory_order_relaxed)) {
+            Task t;
+            if (take(self, t)) {
+                execute(self, t);
+                idle = 0;
+            } else if (++idle < 64) {
+                std::this_thread::yield();
+            } else {
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                ++sleeping;
+                wake.wait(lock, [this] { return queued.load() > 0 || stopping.load(); });
+                --sleeping;
+                idle = 0;
+            }
+        }
     }
 };
 
+inline WorkStealingPool &workPool() {
+    static WorkStealingPool pool(std::max(1, static_cast<int>(std::thread::hardware_concurrency())) - 1);
+    return pool;
+}
+
+} // namespace detail
+
+// Threads parallel_for_ spreads over, the calling thread included.
+inline int getNumThreads() { return detail::workPool().threads(); }
+
+// Resizes the pool to n threads counting the caller, or one per hardware
+// thread for n <= 0. Not while a parallel_for_ is running.
+inline void setNumThreads(int n) {
+    if (n <= 0) n = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    detail::workPool().resize(n - 1);
+}
+
+// Calls body on disjoint subranges that together cover range, spread over the
+// pool, and returns when all calls are done; an exception from body is
+// rethrown here once the others finish. Pieces are at least grain long, and
+// the grain is raised so a loop makes no more than about eight pieces per
+// thread: enough for stealing to even out uneven pieces, few enough that
+// queueing costs nothing next to the work. Ranges too short to split run
+// inline on the caller.
+inline void parallel_for_(const Range &range, const std::function<void(const Range &)> &body, int grain = 1) {
+    int n = range.size();
+    if (n <= 0) return;
+    detail::WorkStealingPool &pool = detail::workPool();
+    int threads = pool.threads();
+    grain = std::max(std::max(grain, 1), n / (8 * threads));
+    if (threads == 1 || n < 2 * grain) {
+        body(range);
+        return;
+    }
+    pool.run(body, range.start, range.end, grain);
+}
+
+namespace detail {
+
+// Whole-image decode through stb_image; empty on failure, with the reason in
+// opts.failure_reason. Settings come from opts rather than stb_image's global
+// flags, so concurrent loads don't race. stb_image caps decoded images at
+// 2^31 bytes.
+inline Mat stbiLoad(const std::string &path, stbi_load_options &opts) {
+    int w, h, c;
+    unsigned char *img = stbi_load_ex(path.c_str(), &w, &h, &c, 3, &opts);
+    if (!img) return Mat();
+    Mat mat(h, w, 0);
+    std::memcpy(mat.data, img, mat.total() * mat.channels);
+    stbi_image_free(img);
+    return mat;
+}
+
+// Whether the header of path describes an image that stb_image refuses only
+// for its size: more than 2^31 - 1 bytes at 3 channels. That is the case
+// imread can still assemble from a stream; stb_image reports corrupt files
+// with the same "too large" text, so the failure reason can't tell them apart.
+inline bool exceedsDecodeLimit(const std::string &path) {
+    int w, h, c;
+    if (!stbi_info(path.c_str(), &w, &h, &c)) return false;
+    return static_cast<uint64_t>(w) * h * 3 > (uint64_t(1) << 31) - 1;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+// A binary PPM (P6, maxval 255) already stores Mat's interleaved RGB8 rows,
+// so instead of decoding it this maps the file copy-on-write and returns a
+// Mat over the pixel payload: loading costs page faults rather than a read
+// and a copy, and writes to the Mat never reach the file. The file must not
+// be truncated while the Mat is alive. Empty for anything else; only files
+// that start with "P6" are mapped at all.
+inline Mat mapPpm(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return Mat();
+    Mat mat;
+    char magic[2];
+    struct stat st;
+    if (::read(fd, magic, 2) == 2 && magic[0] == 'P' && magic[1] == '6' && ::fstat(fd, &st) == 0 && st.st_size > 2) {
+        size_t size = static_cast<size_t>(st.st_size);
+        void *map = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            std::shared_ptr<void> holder(map, [size](void *p) { ::munmap(p, size); });
+            const unsigned char *p = static_cast<unsigned char *>(map);
+            size_t pos = 2;
+            auto headerInt = [&]() -> long {
+                while (pos < size && (p[pos] == '#' || std::isspace(p[pos]))) {
+                    if (p[pos] == '#')
+                        while (pos < size && p[pos] != '\n') ++pos;
+                    else
+                        ++pos;
+                }
+                if (pos >= size || !std::isdigit(p[pos])) return -1;
+                long v = 0;
+                while (pos < size && std::isdigit(p[pos]) && v <= (1L << 24))
+                    v = v * 10 + (p[pos++] - '0');
+                // exactly one whitespace byte ends the token
+                if (pos >= size || !std::isspace(p[pos])) return -1;
+                ++pos;
+                return v;
+            };
+            long w = headerInt(), h = headerInt(), maxval = headerInt();
+            if (w > 0 && h > 0 && w <= (1L << 24) && h <= (1L << 24) && maxval == 255 &&
+                static_cast<size_t>(w) * 3 * static_cast<size_t>(h) <= size - pos)
+                mat = Mat(static_cast<int>(h), static_cast<int>(w), 0, static_cast<unsigned char *>(map) + pos,
+                          static_cast<size_t>(w) * 3, holder);
+        }
+    }
+    ::close(fd);
+    return mat;
+}
+#endif
+
+// stb_image's loader for each Mat_ depth, picked by the pointer type; like
+// stbiLoad, settings come from opts rather than the global flags.
+inline void *stbiLoadDepth(const char *path, int *w, int *h, int *c, int cn, stbi_load_options &opts, uint8_t *) {
+    return stbi_load_ex(path, w, h, c, cn, &opts);
+}
+inline void *stbiLoadDepth(const char *path, int *w, int *h, int *c, int cn, stbi_load_options &opts, uint16_t *) {
+    return stbi_load_16_ex(path, w, h, c, cn, &opts);
+}
+inline void *stbiLoadDepth(const char *path, int *w, int *h, int *c, int cn, stbi_load_options &opts, float *) {
+    return stbi_loadf_ex(path, w, h, c, cn, &opts);
+}
+
+// body(begin, end) over bands of [0, n) through parallel_for_, each band at
+// least minRows long.
+inline void parallelRows(int n, int minRows, const std::function<void(int, int)> &body) {
+    parallel_for_(Range(0, n), [&](const Range &r) { body(r.start, r.end); }, minRows);
+}
+
+// stbi_write_parallel_func on top of parallelRows: the writer's tasks (PNG
+// filter bands and deflate chunks, JPEG restart bands) are shared out in
+// contiguous runs.
+inline void stbiwParallelFor(void *, int count, void (*task)(void *, int), void *data) {
+    parallelRows(count, 1, [&](int i0, int i1) {
+        for (int i = i0; i < i1; ++i) task(data, i);
+    });
+}
+
+inline void stbiwFileWrite(void *context, void *data, int size) {
+    std::fwrite(data, 1, size, static_cast<FILE *>(context));
+}
+
+// Baseline JPEG through the banded stb_image_write encoder; img must be
+// continuous.
+inline bool writeJpeg(const std::string &path, const Mat &img, int quality) {
+    FILE *f = std::fopen(path.c_str(), "wb");
+    if (!f) return false;
+    bool ok = stbi_write_jpg_to_func_parallel(stbiwFileWrite, f, img.cols, img.rows, img.channels, img.data,
+                                              quality, stbiwParallelFor, nullptr) != 0;
+    return std::fclose(f) == 0 && ok;
+}
+
+#if defined(__SSE2__)
+// Four packed RGB pixels (the low 12 bytes of v) to one pixel per 32-bit lane,
+// top byte zero: bytes 6-11 move up to the high qword, then each qword's
+// second pixel moves up one byte.
+inline __m128i widenRgb4(__m128i v) {
+    const __m128i lo6 = _mm_set_epi32(0, 0, 0x0000ffff, -1);
+    const __m128i p0 = _mm_set_epi32(0, 0x00ffffff, 0, 0x00ffffff);
+    __m128i u = _mm_or_si128(_mm_and_si128(v, lo6), _mm_and_si128(_mm_slli_si128(v, 2), _mm_slli_si128(lo6, 8)));
+    return _mm_or_si128(_mm_and_si128(u, p0), _mm_and_si128(_mm_slli_epi64(u, 8), _mm_slli_epi64(p0, 32)));
+}
+
+// The inverse: four 32-bit pixel lanes to 12 packed bytes, the top 4 zero.
+inline __m128i narrowRgb4(__m128i v) {
+    const __m128i lo6 = _mm_set_epi32(0, 0, 0x0000ffff, -1);
+    const __m128i p0 = _mm_set_epi32(0, 0x00ffffff, 0, 0x00ffffff);
+    __m128i u = _mm_or_si128(_mm_and_si128(v, p0), _mm_and_si128(_mm_srli_epi64(v, 8), _mm_slli_epi64(p0, 24)));
+    return _mm_or_si128(_mm_and_si128(u, lo6), _mm_and_si128(_mm_srli_si128(u, 2), _mm_slli_si128(lo6, 6)));
+}
+#endif
+
+// Deinterleaves n RGB pixels into three planes, 16 pixels (three loads) at a
+// time.
+inline void splitRow3(const unsigned char *src, uint8_t *r, uint8_t *g, uint8_t *b, int n) {
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i low = _mm_set1_epi32(0xff);
+    for (; x + 16 <= n; x += 16, src += 48) {
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+        __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32));
+        __m128i px[4] = {
+            widenRgb4(v0),
+            widenRgb4(_mm_or_si128(_mm_srli_si128(v0, 12), _mm_slli_si128(v1, 4))),
+            widenRgb4(_mm_or_si128(_mm_srli_si128(v1, 8), _mm_slli_si128(v2, 8))),
+            widenRgb4(_mm_srli_si128(v2, 4)),
+        };
+        uint8_t *dst[3] = {r + x, g + x, b + x};
+        for (int c = 0; c < 3; ++c) {
+            __m128i ch[4];
+            for (int k = 0; k < 4; ++k) ch[k] = _mm_and_si128(_mm_srli_epi32(px[k], 8 * c), low);
+            __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(ch[0], ch[1]), _mm_packs_epi32(ch[2], ch[3]));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst[c]), bytes);
+        }
+    }
+#endif
+    for (; x < n; ++x, src += 3) {
+        r[x] = src[0];
+        g[x] = src[1];
+        b[x] = src[2];
+    }
+}
+
+// Interleaves three planes into n RGB pixels, 16 pixels (three stores) at a
+// time.
+inline void mergeRow3(const uint8_t *r, const uint8_t *g, const uint8_t *b, unsigned char *dst, int n) {
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= n; x += 16, dst += 48) {
+        __m128i vr = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r + x));
+        __m128i vg = _mm_loadu_si128(reinterpret_cast<const __m128i *>(g + x));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + x));
+        __m128i rg0 = _mm_unpacklo_epi8(vr, vg), rg1 = _mm_unpackhi_epi8(vr, vg);
+        __m128i b0 = _mm_unpacklo_epi8(vb, zero), b1 = _mm_unpackhi_epi8(vb, zero);
+        __m128i q0 = narrowRgb4(_mm_unpacklo_epi16(rg0, b0));
+        __m128i q1 = narrowRgb4(_mm_unpackhi_epi16(rg0, b0));
+        __m128i q2 = narrowRgb4(_mm_unpacklo_epi16(rg1, b1));
+        __m128i q3 = narrowRgb4(_mm_unpackhi_epi16(rg1, b1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_or_si128(q0, _mm_slli_si128(q1, 12)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_or_si128(_mm_srli_si128(q1, 4), _mm_slli_si128(q2, 8)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 32), _mm_or_si128(_mm_srli_si128(q2, 8), _mm_slli_si128(q3, 4)));
+    }
+#endif
+    for (; x < n; ++x, dst += 3) {
+        dst[0] = r[x];
+        dst[1] = g[x];
+        dst[2] = b[x];
+    }
+}
+
+} // namespace detail
+
+// Pulls decoded RGB rows from an image file a strip at a time, so peak memory
+// stays proportional to the strip instead of the image. Binary PNM (P5/P6,
+// maxval 255) is read straight from the file and baseline JPEG is decoded one
+// MCU row at a time. Other formats are decoded whole on open and served from
+// memory; streaming() tells the two apart. That includes PNG: stb_image
+// inflates a PNG's whole zlib stream into one buffer before unfiltering any
+// row, so streaming it would take an incremental inflater that stb doesn't
+// have.
+class ImageReader {
+public:
+    int rows = 0, cols = 0;
+
+    ImageReader() = default;
+    ImageReader(const ImageReader &) = delete;
+    ImageReader &operator=(const ImageReader &) = delete;
+    ~ImageReader() { close(); }
+
+    bool open(const std::string &path) {
+        close();
+        file = std::fopen(path.c_str(), "rb");
+        if (!file) {
+            std::cerr << "Failed to open image: " << path << std::endl;
+            return false;
+        }
+        if (openPnm()) return true;
+        std::fseek(file, 0, SEEK_SET);
+        int c;
+        jpeg = stbi_jpeg_stream_open(file, &cols, &rows, &c, 3);
+        if (jpeg) {
+            kind = JPEG;
+            return true;
+        }
+        std::fclose(file);
+        file = nullptr;
+        stbi_load_options opts = {};
+        whole = detail::stbiLoad(path, opts);
+        if (whole.empty()) {
+            std::cerr << "Failed to load image: " << path << std::endl;
+            return false;
+        }
+        kind = WHOLE;
+        rows = whole.rows;
+        cols = whole.cols;
+        return true;
+    }
+
+    bool streaming() const { return kind == PNM || kind == JPEG; }
+
+    // Decodes up to dst.rows rows into dst, which must be cols wide. Returns
+    // the number of rows written, 0 at the end of the image or on error.
+    int read(Mat &dst) {
+        assert(dst.cols == cols && dst.channels == 3);
+        int n = std::min(dst.rows, rows - next);
+        if (n <= 0) return 0;
+        switch (kind) {
+        case PNM:
+            for (int y = 0; y < n; ++y) {
+                unsigned char *row = dst.ptr(y);
+                if (!gray) {
+                    if (std::fread(row, 1, static_cast<size_t>(cols) * 3, file) != static_cast<size_t>(cols) * 3) return y;
+                    continue;
+                }
+                if (std::fread(line.data(), 1, cols, file) != static_cast<size_t>(cols)) return y;
+                for (int x = 0; x < cols; ++x)
+                    row[3 * x] = row[3 * x + 1] = row[3 * x + 2] = line[x];
+            }
+            break;
+        case JPEG:
+            n = stbi_jpeg_stream_read(jpeg, dst.data, static_cast<int>(dst.step), n);
+            break;
+        case WHOLE:
+        {
+            Mat part = dst(Rect(0, 0, cols, n));
+            whole(Rect(0, next, cols, n)).copyTo(part);
+            break;
+        }
+        default:
+            return 0;
+        }
+        next += n;
+        return n;
+    }
+
+    void close() {
+        if (jpeg) stbi_jpeg_stream_close(jpeg);
+        if (file) std::fclose(file);
+        jpeg = nullptr;
+        file = nullptr;
+        whole = Mat();
+        kind = NONE;
+        rows = cols = next = 0;
+    }
+
+private:
+    enum Kind { NONE, PNM, JPEG, WHOLE } kind = NONE;
+    FILE *file = nullptr;
+    stbi_jpeg_stream *jpeg = nullptr;
+    bool gray = false;
+    int next = 0;
+    Mat whole;
+    std::vector<unsigned char> line;
+
+    int pnmInt() {
+        int c = std::fgetc(file);
+        while (c == '#' || std::isspace(c)) {
+            if (c == '#')
+                while (c != '\n' && c != EOF) c = std::fgetc(file);
+            c = std::fgetc(file);
+        }
+        int v = 0;
+        if (!std::isdigit(c)) return -1;
+        while (std::isdigit(c)) {
+            // stop accumulating past stb_image's dimension limit, so a crafted
+            // header can't overflow
+            if (v <= (1 << 24)) v = v * 10 + (c - '0');
+            c = std::fgetc(file);
+        }
+        return v > (1 << 24) ? -1 : v; // the whitespace after the token is consumed
+    }
+
+    bool openPnm() {
+        if (std::fgetc(file) != 'P') return false;
+        int type = std::fgetc(file);
+        if (type != '5' && type != '6') return false;
+        int w = pnmInt(), h = pnmInt(), maxval = pnmInt();
+        if (w <= 0 || h <= 0 || maxval != 255) return false;
+        kind = PNM;
+        gray = type == '5';
+        cols = w;
+        rows = h;
+        if (gray) line.resize(w);
+        return true;
+    }
+};
+
+// Binary PPMs come back as a view over a mapping of the file (see mapPpm).
+// Images beyond stb_image's 2^31-byte cap are assembled from an ImageReader
+// stream when the format allows it (binary PNM, baseline JPEG).
 inline Mat imread(const std::string &path) {
+#if defined(__unix__) || defined(__APPLE__)
+    Mat mapped = detail::mapPpm(path);
+    if (!mapped.empty()) return mapped;
+#endif
+    stbi_load_options opts = {};
+    Mat mat = detail::stbiLoad(path, opts);
+    if (!mat.empty()) return mat;
+
+    ImageReader reader;
+    if (detail::exceedsDecodeLimit(path) && reader.open(path) && reader.streaming()) {
+        mat = Mat(reader.rows, reader.cols, 0);
+        int done = 0;
+        while (done < mat.rows) {
+            Mat rest = mat(Rect(0, done, mat.cols, mat.rows - done));
+            int n = reader.read(rest);
+            if (n <= 0) break;
+            done += n;
+        }
+        if (done == mat.rows) return mat;
+    }
+    std::cerr << "Failed to load image: " << path << std::endl;
+    return Mat();
+}
+
+// imread at the depth of dst, so 16-bit samples and HDR floats survive the
+// load. Shallower files are widened by stb_image: 8-bit samples to 16 bits
+// by *257, LDR to linear float through stbi_ldr_to_hdr_gamma. channels = 0
+// keeps the file's channel count. dst adopts the decoded buffer, no copy.
+template <typename T>
+inline bool imread(const std::string &path, Mat_<T> &dst, int channels = 0) {
+    stbi_load_options opts = {};
     int w, h, c;
-    unsigned char *img = stbi_load(path.c_str(), &w, &h, &c, 3);
+    T *img = static_cast<T *>(detail::stbiLoadDepth(path.c_str(), &w, &h, &c, channels, opts, static_cast<T *>(nullptr)));
     if (!img) {
         std::cerr << "Failed to load image: " << path << std::endl;
-        return Mat();
+        return false;
     }
-    Mat mat(h, w, 0);
-    std::memcpy(mat.data, img, h * w * 3);
-    stbi_image_free(img);
-    return mat;
+    int cn = channels ? channels : c;
+    dst = Mat_<T>(h, w, cn, img, static_cast<size_t>(w) * cn * sizeof(T), std::shared_ptr<void>(img, stbi_image_free));
+    return true;
 }
 
+// Sample depth of the file at path, read from its header through a single
+// open: CV_32F for Radiance HDR, CV_16U for 16-bit PNG and PNM, CV_8U for
+// anything else, unreadable files included.
+inline int imreadDepth(const std::string &path) {
+    FILE *f = std::fopen(path.c_str(), "rb");
+    if (!f) return CV_8U;
+    int depth = stbi_is_hdr_from_file(f) ? CV_32F : stbi_is_16_bit_from_file(f) ? CV_16U : CV_8U;
+    std::fclose(f);
+    return depth;
+}
+
+// Conversions between Mat and a 3-channel Mat_ that produce what stb_image
+// decodes from the same file at the other depth (with its default gamma of
+// 2.2 between LDR and HDR), so an image loaded once can be used at both.
+inline void convertDepth(const Mat &src, Mat_<uint16_t> &dst) {
+    dst = Mat_<uint16_t>(src.rows, src.cols, 3);
+    detail::parallelRows(src.rows, 64, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const unsigned char *s = src.ptr(y);
+            uint16_t *d = dst.ptr(y);
+            for (int x = 0; x < src.cols * 3; ++x) d[x] = static_cast<uint16_t>(s[x] * 257);
+        }
+    });
+}
+
+inline void convertDepth(const Mat &src, Mat_<float> &dst) {
+    float lut[256];
+    for (int v = 0; v < 256; ++v) lut[v] = static_cast<float>(std::pow(static_cast<double>(v / 255.0f), static_cast<double>(2.2f)));
+    dst = Mat_<float>(src.rows, src.cols, 3);
+    detail::parallelRows(src.rows, 64, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const unsigned char *s = src.ptr(y);
+            float *d = dst.ptr(y);
+            for (int x = 0; x < src.cols * 3; ++x) d[x] = lut[s[x]];
+        }
+    });
+}
+
+inline void convertDepth(const Mat_<uint16_t> &src, Mat &dst) {
+    assert(src.channels == 3);
+    dst = Mat(src.rows, src.cols, 0);
+    detail::parallelRows(src.rows, 64, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const uint16_t *s = src.ptr(y);
+            unsigned char *d = dst.ptr(y);
+            for (int x = 0; x < src.cols * 3; ++x) d[x] = static_cast<unsigned char>(s[x] >> 8);
+        }
+    });
+}
+
+inline void convertDepth(const Mat_<float> &src, Mat &dst) {
+    assert(src.channels == 3);
+    dst = Mat(src.rows, src.cols, 0);
+    detail::parallelRows(src.rows, 16, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const float *s = src.ptr(y);
+            unsigned char *d = dst.ptr(y);
+            for (int x = 0; x < src.cols * 3; ++x) {
+                // stb's arithmetic to the letter: pow in double, the rest in float
+                float z = static_cast<float>(std::pow(static_cast<double>(s[x]), static_cast<double>(1.0f / 2.2f))) * 255 + 0.5f;
+                d[x] = static_cast<unsigned char>(z < 0 ? 0 : z > 255 ? 255 : static_cast<int>(z));
+            }
+        }
+    });
+}
+
+// Splits an interleaved Mat into one single-channel plane per channel, as
+// OpenCV's split does. Planes already of the right size are written in place.
+inline void split(const Mat &src, std::vector<Mat_<uint8_t>> &planes) {
+    planes.resize(src.channels);
+    for (Mat_<uint8_t> &p : planes)
+        if (p.rows != src.rows || p.cols != src.cols || p.channels != 1) p = Mat_<uint8_t>(src.rows, src.cols, 1);
+    detail::parallelRows(src.rows, 64, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const unsigned char *s = src.ptr(y);
+            if (src.channels == 3) {
+                detail::splitRow3(s, planes[0].ptr(y), planes[1].ptr(y), planes[2].ptr(y), src.cols);
+                continue;
+            }
+            for (int c = 0; c < src.channels; ++c) {
+                uint8_t *d = planes[c].ptr(y);
+                for (int x = 0; x < src.cols; ++x) d[x] = s[x * src.channels + c];
+            }
+        }
+    });
+}
+
+// The inverse of split for Mat's three channels; dst is reallocated unless it
+// already has the planes' size.
+inline void merge(const std::vector<Mat_<uint8_t>> &planes, Mat &dst) {
+    assert(planes.size() == 3);
+    const Mat_<uint8_t> &p0 = planes[0];
+    for (const Mat_<uint8_t> &p : planes) {
+        assert(p.rows == p0.rows && p.cols == p0.cols && p.channels == 1);
+        (void)p;
+    }
+    if (dst.empty() || dst.rows != p0.rows || dst.cols != p0.cols) dst = Mat(p0.rows, p0.cols, 0);
+    detail::parallelRows(dst.rows, 64, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y)
+            detail::mergeRow3(planes[0].ptr(y), planes[1].ptr(y), planes[2].ptr(y), dst.ptr(y), dst.cols);
+    });
+}
+
+// imread straight to R, G and B planes sharing one buffer, for per-channel
+// work at full vector width. JPEGs are color-converted from YCbCr directly
+// into the planes; other formats are split by stb_image after decoding.
+inline bool imreadPlanar(const std::string &path, std::vector<Mat_<uint8_t>> &planes) {
+    stbi_load_options opts = {};
+    opts.planar = 1;
+    int w, h, c;
+    unsigned char *img = stbi_load_ex(path.c_str(), &w, &h, &c, 3, &opts);
+    if (!img) {
+        std::cerr << "Failed to load image: " << path << std::endl;
+        return false;
+    }
+    std::shared_ptr<void> holder(img, stbi_image_free);
+    size_t plane = static_cast<size_t>(w) * h;
+    planes.clear();
+    for (int k = 0; k < 3; ++k)
+        planes.push_back(Mat_<uint8_t>(h, w, 1, img + k * plane, static_cast<size_t>(w), holder));
+    return true;
+}
+
+// imread for batch workers: owns an stb_image decoder context whose working
+// buffers are recycled from one image to the next, and decodes into dst's
+// existing pixels when the size already matches, so a worker reading a run
+// of same-sized images allocates nothing after the first. One per thread.
+class ImageDecoder {
+public:
+    stbi_load_options options = {}; // flip/unpremultiply settings for every read (not planar)
+
+    ImageDecoder() : dec(stbi_decoder_create()) {}
+    ImageDecoder(const ImageDecoder &) = delete;
+    ImageDecoder &operator=(const ImageDecoder &) = delete;
+    ~ImageDecoder() { stbi_decoder_free(dec); }
+
+    bool read(const std::string &path, Mat &dst) {
+        int w, h, c;
+        options.planar = 0;
+        unsigned char *img = dec ? stbi_decoder_load(dec, path.c_str(), &w, &h, &c, 3, &options) : nullptr;
+        if (!img) {
+            if (detail::exceedsDecodeLimit(path)) {
+                dst = imread(path);
+                return !dst.empty();
+            }
+            std::cerr << "Failed to load image: " << path << std::endl;
+            return false;
+        }
+        if (dst.empty() || dst.rows != h || dst.cols != w) dst = Mat(h, w, 0);
+        Mat src;
+        src.rows = h; src.cols = w;
+        src.step = static_cast<size_t>(w) * 3;
+        src.data = img;
+        src.copyTo(dst);
+        return true;
+    }
+
+    Mat read(const std::string &path) {
+        Mat dst;
+        read(path, dst);
+        return dst;
+    }
+
+private:
+    stbi_decoder *dec;
+};
+
 inline void imshow(const std::string &winname, const Mat &img) {
     std::string filename = winname + ".out.jpg";
-    stbi_write_jpg(filename.c_str(), img.cols, img.rows, 3, img.data, 90);
+    if (!img.isContinuous()) {
+        imshow(winname, img.clone());
+        return;
+    }
+    detail::writeJpeg(filename, img, 90);
     std::cout << "Saved display image to: " << filename << std::endl;
 }
 
@@ -105,7 +1105,7 @@ inline void namedWindow(const std::string &winname, int flags) {
 }
 
 inline int waitKey(int delay) {
-    std::cout << "Press key (+/-/d/ESC): ";
+    std::cout << "Press key (+/-/d/b/ESC): ";
     char c;
     std::cin >> c;
     return static_cast<int>(c);
@@ -115,25 +1115,1207 @@ inline void destroyWindow(const std::string &winname) {
     std::cout << "Destroying window: " << winname << std::endl;
 }
 
-inline void line(Mat &img, const Point &p1, const Point &p2, const Scalar &color, int thickness, int lineType) {
-    int midx = (p1.x + p2.x) / 2;
-    int midy = (p1.y + p2.y) / 2;
-    for (int dy = -thickness/2; dy <= thickness/2; ++dy) {
-        for (int dx = -thickness/2; dx <= thickness/2; ++dx) {
-            int x = midx + dx;
-            int y = midy + dy;
-            if (x >= 0 && x < img.cols && y >= 0 && y < img.rows) {
-                unsigned char *pixel = img.data + (y * img.cols + x) * 3;
-                pixel[0] = color.val[0];
-                pixel[1] = color.val[1];
-                pixel[2] = color.val[2];
+// ---------------------------------------------------------------------------
+// Resampling.
+
+namespace detail {
+
+// Fixed-point separable filter taps for one axis: output i reads source
+// indices idx[i * taps + k] with weights wt[i * taps + k], which sum to
+// 1 << resizeCoefBits.
+const int resizeCoefBits = 11;
+
+struct ResizeAxis {
+    int taps = 0;
+    std::vector<int> idx;
+    std::vector<int16_t> wt;
+};
+
+inline ResizeAxis resizeTable(int src, int dst, bool area) {
+    ResizeAxis ax;
+    const double scale = static_cast<double>(src) / dst;
+    const int one = 1 << resizeCoefBits;
+    std::vector<double> w;
+    if (area && scale > 1.0) {
+        ax.taps = static_cast<int>(std::ceil(scale)) + 1;
+        ax.idx.resize(static_cast<size_t>(dst) * ax.taps);
+        ax.wt.resize(static_cast<size_t>(dst) * ax.taps);
+        for (int i = 0; i < dst; ++i) {
+            double f0 = i * scale, f1 = (i + 1) * scale;
+            int s0 = static_cast<int>(std::floor(f0));
+            w.assign(ax.taps, 0.0);
+            for (int k = 0; k < ax.taps; ++k) {
+                int sx = s0 + k;
+                double overlap = std::min(f1, sx + 1.0) - std::max(f0, static_cast<double>(sx));
+                if (sx < src && overlap > 0) w[k] = overlap / scale;
+                ax.idx[i * ax.taps + k] = std::min(sx, src - 1);
+            }
+            int sum = 0, big = 0;
+            for (int k = 0; k < ax.taps; ++k) {
+                ax.wt[i * ax.taps + k] = static_cast<int16_t>(std::lround(w[k] * one));
+                sum += ax.wt[i * ax.taps + k];
+                if (w[k] > w[big]) big = k;
             }
+            ax.wt[i * ax.taps + big] += static_cast<int16_t>(one - sum);
+        }
+    } else {
+        ax.taps = 2;
+        ax.idx.resize(static_cast<size_t>(dst) * 2);
+        ax.wt.resize(static_cast<size_t>(dst) * 2);
+        for (int i = 0; i < dst; ++i) {
+            double f = (i + 0.5) * scale - 0.5;
+            int s = static_cast<int>(std::floor(f));
+            double frac = f - s;
+            if (s < 0) { s = 0; frac = 0.0; }
+            if (s >= src - 1) { s = src - 1; frac = 0.0; }
+            int16_t w1 = static_cast<int16_t>(std::lround(frac * one));
+            ax.idx[2 * i] = s;
+            ax.idx[2 * i + 1] = std::min(s + 1, src - 1);
+            ax.wt[2 * i] = static_cast<int16_t>(one - w1);
+            ax.wt[2 * i + 1] = w1;
         }
     }
+    return ax;
 }
 
-const int WINDOW_AUTOSIZE = 1;
+// Horizontal pass: one source row of scols pixels to 16-bit intermediates
+// with 7 fractional bits (255 << 7 still fits an int16). For 2-4 channels the
+// SSE2 path does one output pixel per step, its channels in four 32-bit lanes:
+// each pair of taps is two 4-byte pixel loads interleaved and weighted with
+// one pmaddwd, as in the vertical pass. It stops where a 4-byte load or store
+// would leave the row; the scalar loop finishes (and does 1-channel rows).
+inline void resizeRowH(const unsigned char *src, int scols, int16_t *dst, const ResizeAxis &ax, int dcols, int cn) {
+    const int shift = resizeCoefBits - 7;
+    const int taps = ax.taps;
+    const int round = 1 << (shift - 1);
+    int x = 0;
+#if defined(__SSE2__)
+    if (cn >= 2) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i vround = _mm_set1_epi32(round);
+        auto load = [&](int sx) {
+            int32_t v;
+            std::memcpy(&v, src + static_cast<size_t>(sx) * cn, 4);
+            return _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero);
+        };
+        for (; x * cn + 4 <= dcols * cn; ++x) {
+            const int *idx = &ax.idx[static_cast<size_t>(x) * taps];
+            const int16_t *wt = &ax.wt[static_cast<size_t>(x) * taps];
+            // source indices only grow with x and with k
+            if (idx[taps - 1] * cn + 4 > scols * cn) break;
+            __m128i acc = vround;
+            for (int k = 0; k < taps; k += 2) {
+                __m128i p0 = load(idx[k]);
+                __m128i p1 = k + 1 < taps ? load(idx[k + 1]) : zero;
+                int w1 = k + 1 < taps ? wt[k + 1] : 0;
+                __m128i w = _mm_set1_epi32((w1 << 16) | static_cast<uint16_t>(wt[k]));
+                acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi16(p0, p1), w));
+            }
+            acc = _mm_srai_epi32(acc, shift);
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + static_cast<size_t>(x) * cn), _mm_packs_epi32(acc, acc));
+        }
+    }
+#endif
+    if (taps == 2) {
+        for (; x < dcols; ++x) {
+            const unsigned char *s0 = src + ax.idx[2 * x] * cn;
+            const unsigned char *s1 = src + ax.idx[2 * x + 1] * cn;
+            const int w0 = ax.wt[2 * x], w1 = ax.wt[2 * x + 1];
+            for (int c = 0; c < cn; ++c)
+                dst[x * cn + c] = static_cast<int16_t>((s0[c] * w0 + s1[c] * w1 + round) >> shift);
+        }
+        return;
+    }
+    for (; x < dcols; ++x) {
+        const int *idx = &ax.idx[static_cast<size_t>(x) * taps];
+        const int16_t *wt = &ax.wt[static_cast<size_t>(x) * taps];
+        for (int c = 0; c < cn; ++c) {
+            int acc = 0;
+            for (int k = 0; k < taps; ++k)
+                acc += src[idx[k] * cn + c] * wt[k];
+            dst[x * cn + c] = static_cast<int16_t>((acc + round) >> shift);
+        }
+    }
+}
+
+// Vertical pass: weighted sum of `taps` intermediate rows, rounded back to 8
+// bits. The SSE2 path interleaves row pairs and uses pmaddwd, eight values at
+// a time.
+inline void resizeRowV(const int16_t *const *rows, const int16_t *wt, int taps, unsigned char *dst, int n) {
+    const int shift = resizeCoefBits + 7;
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+    for (; i + 8 <= n; i += 8) {
+        __m128i lo = round, hi = round;
+        for (int k = 0; k < taps; k += 2) {
+            __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows[k] + i));
+            __m128i r1 = k + 1 < taps ? _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows[k + 1] + i)) : zero;
+            int w1 = k + 1 < taps ? wt[k + 1] : 0;
+            __m128i w = _mm_set1_epi32((w1 << 16) | static_cast<uint16_t>(wt[k]));
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(r0, r1), w));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(r0, r1), w));
+        }
+        __m128i packed = _mm_packs_epi32(_mm_srai_epi32(lo, shift), _mm_srai_epi32(hi, shift));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(packed, zero));
+    }
+#endif
+    for (; i < n; ++i) {
+        int acc = 1 << (shift - 1);
+        for (int k = 0; k < taps; ++k) acc += rows[k][i] * wt[k];
+        acc >>= shift;
+        dst[i] = static_cast<unsigned char>(acc < 0 ? 0 : acc > 255 ? 255 : acc);
+    }
+}
+
+} // namespace detail
+
+const int INTER_LINEAR = 1;
+const int INTER_AREA = 3;
+
+struct Size {
+    int width, height;
+    Size(int _width, int _height) : width(_width), height(_height) {}
+};
+
+// Resizes src to dsize with INTER_LINEAR or INTER_AREA. INTER_AREA averages
+// the covered source pixels when shrinking and behaves like INTER_LINEAR when
+// enlarging. Both axes use precomputed fixed-point taps; output rows are
+// produced in parallel bands, each keeping a ring of horizontally filtered
+// source rows.
+inline void resize(const Mat &src, Mat &dst, Size dsize, int interpolation = INTER_LINEAR) {
+    assert(!src.empty() && dsize.width > 0 && dsize.height > 0);
+    if (dsize.width == src.cols && dsize.height == src.rows) {
+        dst = src.clone();
+        return;
+    }
+    const bool area = interpolation == INTER_AREA;
+    const int cn = src.channels;
+    const detail::ResizeAxis ax = detail::resizeTable(src.cols, dsize.width, area);
+    const detail::ResizeAxis ay = detail::resizeTable(src.rows, dsize.height, area);
+    Mat out(dsize.height, dsize.width, 0);
+    const int rowLen = dsize.width * cn;
+
+    detail::parallelRows(dsize.height, 16, [&](int y0, int y1) {
+        const int taps = ay.taps;
+        std::vector<int16_t> ring(static_cast<size_t>(taps) * rowLen);
+        std::vector<int> ringTag(taps, -1);
+        std::vector<const int16_t *> rows(taps);
+        for (int y = y0; y < y1; ++y) {
+            for (int k = 0; k < taps; ++k) {
+                int sy = ay.idx[static_cast<size_t>(y) * taps + k];
+                int slot = sy % taps;
+                int16_t *buf = &ring[static_cast<size_t>(slot) * rowLen];
+                if (ringTag[slot] != sy) {
+                    detail::resizeRowH(src.ptr(sy), src.cols, buf, ax, dsize.width, cn);
+                    ringTag[slot] = sy;
+                }
+                rows[k] = buf;
+            }
+            detail::resizeRowV(rows.data(), &ay.wt[static_cast<size_t>(y) * taps], taps, out.ptr(y), rowLen);
+        }
+    });
+    dst = std::move(out);
+}
+
+// ---------------------------------------------------------------------------
+// Drawing.
+//
+// Everything is rasterized as horizontal spans wherever possible, and spans
+// are filled with 16-byte stores of a repeating color pattern: axis-aligned
+// lines and rectangles are rectangles of spans, thick lines are convex quads
+// scanned into spans. Only thin diagonal lines go pixel by pixel (Bresenham,
+// or Wu for LINE_AA). Each call records what it touched with Mat::markDirty.
+
+const int FILLED = -1;
 const int LINE_4 = 4;
-const int CV_8UC3 = 16;
+const int LINE_8 = 8;
+const int LINE_AA = 16;
+
+namespace detail {
+
+// A color as the bytes of one pixel of img.
+struct PixelColor {
+    unsigned char b[4];
+    int cn;
+
+    PixelColor(const Mat &img, const Scalar &color) : cn(img.channels) {
+        assert(cn >= 1 && cn <= 4);
+        for (int c = 0; c < 4; ++c)
+            b[c] = static_cast<unsigned char>(std::min(std::max(std::lround(color.val[c]), 0L), 255L));
+    }
+};
+
+// Paints n pixels from p. 48 bytes hold a whole number of pixels for every
+// channel count from 1 to 4, so the pattern is three registers.
+inline void fillSpan(unsigned char *p, int n, const PixelColor &col) {
+    size_t bytes = static_cast<size_t>(n) * col.cn, i = 0;
+#if defined(__SSE2__)
+    if (bytes >= 48) {
+        alignas(16) unsigned char pat[48];
+        for (int k = 0; k < 48; ++k) pat[k] = col.b[k % col.cn];
+        __m128i v0 = _mm_load_si128(reinterpret_cast<const __m128i *>(pat));
+        __m128i v1 = _mm_load_si128(reinterpret_cast<const __m128i *>(pat + 16));
+        __m128i v2 = _mm_load_si128(reinterpret_cast<const __m128i *>(pat + 32));
+        for (; i + 48 <= bytes; i += 48) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(p + i), v0);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(p + i + 16), v1);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(p + i + 32), v2);
+        }
+    }
+#endif
+    for (; i < bytes; ++i) p[i] = col.b[i % col.cn];
+}
+
+// Fills r clipped to img; returns the clipped rectangle.
+inline Rect fillRect(Mat &img, const Rect &r, const PixelColor &col) {
+    Rect c = r & Rect(0, 0, img.cols, img.rows);
+    for (int y = c.y; y < c.y + c.height; ++y)
+        fillSpan(img.ptr(y) + static_cast<size_t>(c.x) * col.cn, c.width, col);
+    return c;
+}
+
+// Fills a convex polygon and returns the bounding box of what was painted.
+// Pixel (x, y) is taken when its center lies inside: on the closed polygon
+// when inclusive (integer outlines, as OpenCV fills them), else half-open,
+// ceil(left) <= x < ceil(right) and likewise for rows, so that sub-pixel
+// shapes sharing an edge never paint it twice or leave a gap.
+inline Rect fillConvex(Mat &img, const double (*pts)[2], int n, const PixelColor &col, bool inclusive) {
+    double ymin = pts[0][1], ymax = pts[0][1];
+    for (int k = 1; k < n; ++k) {
+        ymin = std::min(ymin, pts[k][1]);
+        ymax = std::max(ymax, pts[k][1]);
+    }
+    int y0 = std::max(0, static_cast<int>(std::ceil(ymin)));
+    int y1 = std::min(img.rows, static_cast<int>(inclusive ? std::floor(ymax) + 1 : std::ceil(ymax)));
+    Rect box;
+    for (int y = y0; y < y1; ++y) {
+        double left = 1e300, right = -1e300;
+        for (int k = 0; k < n; ++k) {
+            const double *a = pts[k], *b = pts[(k + 1) % n];
+            if (a[1] == b[1]) {
+                if (inclusive && a[1] == y) {
+                    left = std::min(left, std::min(a[0], b[0]));
+                    right = std::max(right, std::max(a[0], b[0]));
+                }
+                continue;
+            }
+            bool crosses = inclusive ? std::min(a[1], b[1]) <= y && y <= std::max(a[1], b[1]) : (y < a[1]) != (y < b[1]);
+            if (!crosses) continue;
+            double x = a[0] + (y - a[1]) * (b[0] - a[0]) / (b[1] - a[1]);
+            left = std::min(left, x);
+            right = std::max(right, x);
+        }
+        if (left > right) continue;
+        int x0 = static_cast<int>(std::max(0.0, std::ceil(left)));
+        double end = inclusive ? std::floor(right) + 1 : std::ceil(right);
+        int x1 = static_cast<int>(std::min(static_cast<double>(img.cols), end));
+        if (x1 <= x0) continue;
+        fillSpan(img.ptr(y) + static_cast<size_t>(x0) * col.cn, x1 - x0, col);
+        box = box | Rect(x0, y, x1 - x0, 1);
+    }
+    return box;
+}
+
+inline void putPixel(Mat &img, int x, int y, const PixelColor &col) {
+    unsigned char *p = img.ptr(y) + static_cast<size_t>(x) * col.cn;
+    for (int c = 0; c < col.cn; ++c) p[c] = col.b[c];
+}
+
+// Blends col over pixel (x, y) with coverage w out of 256.
+inline void blendPixel(Mat &img, int x, int y, const PixelColor &col, int w) {
+    if (x < 0 || y < 0 || x >= img.cols || y >= img.rows) return;
+    unsigned char *p = img.ptr(y) + static_cast<size_t>(x) * col.cn;
+    for (int c = 0; c < col.cn; ++c) p[c] = static_cast<unsigned char>((p[c] * (256 - w) + col.b[c] * w + 128) >> 8);
+}
+
+// One-pixel line through the pixel centers; 4-connected steps never move
+// diagonally, taking whichever axis the exact line crosses first.
+inline void bresenham(Mat &img, Point p0, Point p1, const PixelColor &col, bool connect4) {
+    int dx = std::abs(p1.x - p0.x), sx = p0.x < p1.x ? 1 : -1;
+    int dy = std::abs(p1.y - p0.y), sy = p0.y < p1.y ? 1 : -1;
+    auto plot = [&](int x, int y) {
+        if (x >= 0 && y >= 0 && x < img.cols && y < img.rows) putPixel(img, x, y, col);
+    };
+    if (connect4) {
+        plot(p0.x, p0.y);
+        for (int64_t ix = 0, iy = 0; ix < dx || iy < dy;) {
+            if ((1 + 2 * ix) * dy < (1 + 2 * iy) * dx) { ++ix; p0.x += sx; }
+            else { ++iy; p0.y += sy; }
+            plot(p0.x, p0.y);
+        }
+        return;
+    }
+    int err = dx - dy;
+    for (;;) {
+        plot(p0.x, p0.y);
+        if (p0.x == p1.x && p0.y == p1.y) break;
+        int e2 = 2 * err;
+        if (e2 >= -dy) { err -= dy; p0.x += sx; }
+        if (e2 <= dx) { err += dx; p0.y += sy; }
+    }
+}
+
+// Xiaolin Wu's antialiased line: along the major axis, split each step's
+// coverage between the two pixels straddling the exact position (16.16
+// fixed point).
+inline void wuLine(Mat &img, Point p0, Point p1, const PixelColor &col) {
+    bool steep = std::abs(p1.y - p0.y) > std::abs(p1.x - p0.x);
+    if (steep) { std::swap(p0.x, p0.y); std::swap(p1.x, p1.y); }
+    if (p0.x > p1.x) std::swap(p0, p1);
+    int dx = p1.x - p0.x;
+    int64_t grad = dx ? (static_cast<int64_t>(p1.y - p0.y) << 16) / dx : 0;
+    int64_t pos = static_cast<int64_t>(p0.y) << 16;
+    for (int x = p0.x; x <= p1.x; ++x, pos += grad) {
+        int y = static_cast<int>(pos >> 16), f = static_cast<int>((pos >> 8) & 0xff);
+        if (steep) {
+            blendPixel(img, y, x, col, 256 - f);
+            blendPixel(img, y + 1, x, col, f);
+        } else {
+            blendPixel(img, x, y, col, 256 - f);
+            blendPixel(img, x, y + 1, col, f);
+        }
+    }
+}
+
+} // namespace detail
+
+// Clips the segment to [0, size.width) x [0, size.height) (Cohen-Sutherland).
+// false if it lies entirely outside.
+inline bool clipLine(Size size, Point &pt1, Point &pt2) {
+    const int64_t right = size.width - 1, bottom = size.height - 1;
+    if (right < 0 || bottom < 0) return false;
+    int64_t x1 = pt1.x, y1 = pt1.y, x2 = pt2.x, y2 = pt2.y;
+    auto code = [&](int64_t x, int64_t y) {
+        return (x < 0) | ((x > right) << 1) | ((y < 0) << 2) | ((y > bottom) << 3);
+    };
+    int c1 = code(x1, y1), c2 = code(x2, y2);
+    while (c1 | c2) {
+        if (c1 & c2) return false;
+        int c = c1 ? c1 : c2;
+        int64_t x, y;
+        if (c & 1)      { x = 0;      y = y1 + (y2 - y1) * (0 - x1) / (x2 - x1); }
+        else if (c & 2) { x = right;  y = y1 + (y2 - y1) * (right - x1) / (x2 - x1); }
+        else if (c & 4) { y = 0;      x = x1 + (x2 - x1) * (0 - y1) / (y2 - y1); }
+        else            { y = bottom; x = x1 + (x2 - x1) * (bottom - y1) / (y2 - y1); }
+        if (c == c1) { x1 = x; y1 = y; c1 = code(x1, y1); }
+        else         { x2 = x; y2 = y; c2 = code(x2, y2); }
+    }
+    pt1 = Point(static_cast<int>(x1), static_cast<int>(y1));
+    pt2 = Point(static_cast<int>(x2), static_cast<int>(y2));
+    return true;
+}
+
+// Draws a segment thickness pixels wide with square caps reaching
+// thickness / 2 past each end. LINE_8 and LINE_4 pick the connectivity of
+// one-pixel lines, LINE_AA antialiases them; thicker lines are filled spans
+// either way.
+inline void line(Mat &img, Point pt1, Point pt2, const Scalar &color, int thickness = 1, int lineType = LINE_8) {
+    if (img.empty() || thickness <= 0) return;
+    detail::PixelColor col(img, color);
+    const int lo = thickness / 2, hi = thickness - thickness / 2;
+    if (pt1.x == pt2.x || pt1.y == pt2.y) {
+        int x0 = std::min(pt1.x, pt2.x), x1 = std::max(pt1.x, pt2.x);
+        int y0 = std::min(pt1.y, pt2.y), y1 = std::max(pt1.y, pt2.y);
+        Rect r = thickness == 1 ? Rect(x0, y0, x1 - x0 + 1, y1 - y0 + 1)
+                                : Rect(x0 - lo, y0 - lo, x1 - x0 + lo + hi, y1 - y0 + lo + hi);
+        img.markDirty(detail::fillRect(img, r, col));
+        return;
+    }
+    if (thickness == 1) {
+        if (!clipLine(Size(img.cols, img.rows), pt1, pt2)) return;
+        if (lineType == LINE_AA)
+            detail::wuLine(img, pt1, pt2, col);
+        else
+            detail::bresenham(img, pt1, pt2, col, lineType == LINE_4);
+        // Wu's second pixel may reach one row or column past the end points
+        int pad = lineType == LINE_AA;
+        img.markDirty(Rect(std::min(pt1.x, pt2.x) - pad, std::min(pt1.y, pt2.y) - pad,
+                           std::abs(pt2.x - pt1.x) + 1 + 2 * pad, std::abs(pt2.y - pt1.y) + 1 + 2 * pad));
+        return;
+    }
+    double dx = pt2.x - pt1.x, dy = pt2.y - pt1.y, len = std::sqrt(dx * dx + dy * dy);
+    double h = thickness / 2.0, ux = dx / len * h, uy = dy / len * h;
+    const double quad[4][2] = {
+        {pt1.x - ux - uy, pt1.y - uy + ux},
+        {pt2.x + ux - uy, pt2.y + uy + ux},
+        {pt2.x + ux + uy, pt2.y + uy - ux},
+        {pt1.x - ux + uy, pt1.y - uy - ux},
+    };
+    img.markDirty(detail::fillConvex(img, quad, 4, col, false));
+}
+
+// Outline of the rectangle with corners pt1 and pt2 (inclusive), lines
+// centered on its border; thickness FILLED (< 0) fills it instead.
+inline void rectangle(Mat &img, Point pt1, Point pt2, const Scalar &color, int thickness = 1, int lineType = LINE_8) {
+    if (img.empty() || thickness == 0) return;
+    detail::PixelColor col(img, color);
+    int x0 = std::min(pt1.x, pt2.x), x1 = std::max(pt1.x, pt2.x);
+    int y0 = std::min(pt1.y, pt2.y), y1 = std::max(pt1.y, pt2.y);
+    if (thickness < 0) {
+        img.markDirty(detail::fillRect(img, Rect(x0, y0, x1 - x0 + 1, y1 - y0 + 1), col));
+        return;
+    }
+    (void)lineType; // axis-aligned edges look the same for every line type
+    const int lo = thickness / 2, t = thickness;
+    const Rect edges[4] = {
+        Rect(x0 - lo, y0 - lo, x1 - x0 + t, t),              // top
+        Rect(x0 - lo, y1 - lo, x1 - x0 + t, t),              // bottom
+        Rect(x0 - lo, y0 - lo + t, t, y1 - y0 - t),          // left, between the two
+        Rect(x1 - lo, y0 - lo + t, t, y1 - y0 - t),          // right
+    };
+    for (const Rect &e : edges)
+        if (!e.empty()) img.markDirty(detail::fillRect(img, e, col));
+}
+
+inline void rectangle(Mat &img, const Rect &rec, const Scalar &color, int thickness = 1, int lineType = LINE_8) {
+    if (rec.empty()) return;
+    rectangle(img, Point(rec.x, rec.y), Point(rec.x + rec.width - 1, rec.y + rec.height - 1), color, thickness, lineType);
+}
+
+// Connected segments through pts, closing back to the first when isClosed.
+inline void polylines(Mat &img, const std::vector<Point> &pts, bool isClosed, const Scalar &color,
+                      int thickness = 1, int lineType = LINE_8) {
+    size_t n = pts.size();
+    if (n == 1) line(img, pts[0], pts[0], color, thickness, lineType);
+    for (size_t k = 0; k + 1 < n; ++k) line(img, pts[k], pts[k + 1], color, thickness, lineType);
+    if (isClosed && n > 2) line(img, pts[n - 1], pts[0], color, thickness, lineType);
+}
+
+// Fills a convex polygon given by its vertices in order.
+inline void fillConvexPoly(Mat &img, const std::vector<Point> &pts, const Scalar &color, int lineType = LINE_8) {
+    (void)lineType;
+    if (img.empty() || pts.empty()) return;
+    std::unique_ptr<double[][2]> xy(new double[pts.size()][2]);
+    for (size_t k = 0; k < pts.size(); ++k) {
+        xy[k][0] = pts[k].x;
+        xy[k][1] = pts[k].y;
+    }
+    img.markDirty(detail::fillConvex(img, xy.get(), static_cast<int>(pts.size()), detail::PixelColor(img, color), true));
+}
+
+// ---------------------------------------------------------------------------
+// Pixel arithmetic.
+//
+// absdiff, threshold, addWeighted and the viewer blends (crossfade,
+// amplifiedDiff) return lazy expressions rather than images. Each node
+// computes element i (one channel byte) of row y on demand, 16 at a time
+// under SSE2, and nothing runs until a consumer -- countNonZero, mean, or
+// assignment to a Mat -- walks the rows. A chain such as
+// countNonZero(threshold(absdiff(a, b), 10)) is then one loop that reads each
+// source byte once and allocates nothing. Operands are same-sized Mats or
+// other expressions. Expressions refer to their Mats: consume them within the
+// statement that builds them.
+
+const int THRESH_BINARY = 0;
+const int THRESH_BINARY_INV = 1;
+const int THRESH_TRUNC = 2;
+const int THRESH_TOZERO = 3;
+const int THRESH_TOZERO_INV = 4;
+
+// Base of every expression node, E being the node itself.
+template <class E>
+struct PixelExpr {
+    int rows = 0, cols = 0, channels = 0;
+
+    const E &self() const { return static_cast<const E &>(*this); }
+};
+
+namespace detail {
+
+#if defined(__SSE2__)
+inline uint64_t sumLanes64(__m128i v) {
+    uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), v);
+    return lanes[0] + lanes[1];
+}
+#endif
+
+struct MatTerm : PixelExpr<MatTerm> {
+    const Mat &m;
+
+    explicit MatTerm(const Mat &mat) : m(mat) { rows = mat.rows; cols = mat.cols; channels = mat.channels; }
+    int at(int y, int i) const { return m.ptr(y)[i]; }
+#if defined(__SSE2__)
+    __m128i load(int y, int i) const { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(m.ptr(y) + i)); }
+#endif
+};
+
+// Operand adapter: Mats become MatTerm leaves, expressions pass through.
+template <class T> struct ExprTerm {
+    typedef T type;
+    static const T &get(const PixelExpr<T> &e) { return e.self(); }
+};
+template <> struct ExprTerm<Mat> {
+    typedef MatTerm type;
+    static MatTerm get(const Mat &m) { return MatTerm(m); }
+};
+
+template <class A, class B>
+struct AbsDiffExpr : PixelExpr<AbsDiffExpr<A, B>> {
+    A a;
+    B b;
+
+    AbsDiffExpr(const A &a_, const B &b_) : a(a_), b(b_) {
+        assert(a.rows == b.rows && a.cols == b.cols && a.channels == b.channels);
+        this->rows = a.rows; this->cols = a.cols; this->channels = a.channels;
+    }
+    int at(int y, int i) const { return std::abs(a.at(y, i) - b.at(y, i)); }
+#if defined(__SSE2__)
+    __m128i load(int y, int i) const {
+        __m128i va = a.load(y, i), vb = b.load(y, i);
+        return _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+    }
+#endif
+};
+
+// Every threshold type is a select between two (x & mask) | constant forms,
+// so one branch-free kernel covers them all: x > thresh picks hi, else lo.
+template <class A>
+struct ThresholdExpr : PixelExpr<ThresholdExpr<A>> {
+    A a;
+    int thresh;
+    uint8_t hiMask = 0, hiConst = 0, loMask = 0, loConst = 0;
+
+    ThresholdExpr(const A &a_, double t, double maxval, int type) : a(a_) {
+        this->rows = a.rows; this->cols = a.cols; this->channels = a.channels;
+        int it = static_cast<int>(std::floor(t));
+        uint8_t mv = static_cast<uint8_t>(std::min(std::max(std::lround(maxval), 0L), 255L));
+        switch (type) {
+        case THRESH_BINARY: hiConst = mv; break;
+        case THRESH_BINARY_INV: loConst = mv; break;
+        case THRESH_TRUNC: hiConst = static_cast<uint8_t>(std::min(std::max(it, 0), 255)); loMask = 0xff; break;
+        case THRESH_TOZERO: hiMask = 0xff; break;
+        case THRESH_TOZERO_INV: loMask = 0xff; break;
+        default: assert(!"unknown threshold type");
+        }
+        // outside 0..254 every byte falls on one side
+        if (it < 0) { loMask = hiMask; loConst = hiConst; }
+        if (it >= 255) { hiMask = loMask; hiConst = loConst; }
+        thresh = std::min(std::max(it, 0), 254);
+    }
+    int at(int y, int i) const {
+        int x = a.at(y, i);
+        return x > thresh ? (x & hiMask) | hiConst : (x & loMask) | loConst;
+    }
+#if defined(__SSE2__)
+    __m128i load(int y, int i) const {
+        __m128i x = a.load(y, i);
+        __m128i le = _mm_cmpeq_epi8(_mm_subs_epu8(x, _mm_set1_epi8(static_cast<char>(thresh))), _mm_setzero_si128());
+        __m128i hi = _mm_or_si128(_mm_and_si128(x, _mm_set1_epi8(static_cast<char>(hiMask))), _mm_set1_epi8(static_cast<char>(hiConst)));
+        __m128i lo = _mm_or_si128(_mm_and_si128(x, _mm_set1_epi8(static_cast<char>(loMask))), _mm_set1_epi8(static_cast<char>(loConst)));
+        return _mm_or_si128(_mm_and_si128(le, lo), _mm_andnot_si128(le, hi));
+    }
+#endif
+};
+
+// a * alpha + b * beta + gamma in float, saturated and rounded to nearest
+// even; the scalar and SSE2 paths agree bit for bit.
+template <class A, class B>
+struct AddWeightedExpr : PixelExpr<AddWeightedExpr<A, B>> {
+    A a;
+    B b;
+    float alpha, beta, gamma;
+
+    AddWeightedExpr(const A &a_, double al, const B &b_, double be, double ga)
+        : a(a_), b(b_), alpha(static_cast<float>(al)), beta(static_cast<float>(be)), gamma(static_cast<float>(ga)) {
+        assert(a.rows == b.rows && a.cols == b.cols && a.channels == b.channels);
+        this->rows = a.rows; this->cols = a.cols; this->channels = a.channels;
+    }
+    int at(int y, int i) const {
+        float v = static_cast<float>(a.at(y, i)) * alpha + static_cast<float>(b.at(y, i)) * beta + gamma;
+        return static_cast<int>(std::nearbyint(std::min(std::max(v, 0.0f), 255.0f)));
+    }
+#if defined(__SSE2__)
+    __m128i load(int y, int i) const {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 al = _mm_set1_ps(alpha), be = _mm_set1_ps(beta), ga = _mm_set1_ps(gamma);
+        const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(255.0f);
+        __m128i va = a.load(y, i), vb = b.load(y, i);
+        __m128i words[2];
+        for (int h = 0; h < 2; ++h) {
+            __m128i wa = h ? _mm_unpackhi_epi8(va, zero) : _mm_unpacklo_epi8(va, zero);
+            __m128i wb = h ? _mm_unpackhi_epi8(vb, zero) : _mm_unpacklo_epi8(vb, zero);
+            __m128i dw[2];
+            for (int q = 0; q < 2; ++q) {
+                __m128 fa = _mm_cvtepi32_ps(q ? _mm_unpackhi_epi16(wa, zero) : _mm_unpacklo_epi16(wa, zero));
+                __m128 fb = _mm_cvtepi32_ps(q ? _mm_unpackhi_epi16(wb, zero) : _mm_unpacklo_epi16(wb, zero));
+                __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(fa, al), _mm_mul_ps(fb, be)), ga);
+                dw[q] = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v, lo), hi));
+            }
+            words[h] = _mm_packs_epi32(dw[0], dw[1]);
+        }
+        return _mm_packus_epi16(words[0], words[1]);
+    }
+#endif
+};
+
+// Weights in 8.8 fixed point (256 = 1.0), rounded and clamped to lo..hi.
+inline int fixed88(double w, int lo, int hi) {
+    return static_cast<int>(std::min(std::max(std::lround(w * 256.0), static_cast<long>(lo)), static_cast<long>(hi)));
+}
+
+// (a * w + b * (256 - w) + 128) >> 8: an addWeighted restricted to a convex
+// pair of 8.8 weights, so every product and the sum fit 16-bit lanes and
+// nothing goes through float.
+template <class A, class B>
+struct CrossfadeExpr : PixelExpr<CrossfadeExpr<A, B>> {
+    A a;
+    B b;
+    int w;
+
+    CrossfadeExpr(const A &a_, const B &b_, double alpha) : a(a_), b(b_), w(fixed88(alpha, 0, 256)) {
+        assert(a.rows == b.rows && a.cols == b.cols && a.channels == b.channels);
+        this->rows = a.rows; this->cols = a.cols; this->channels = a.channels;
+    }
+    int at(int y, int i) const { return (a.at(y, i) * w + b.at(y, i) * (256 - w) + 128) >> 8; }
+#if defined(__SSE2__)
+    __m128i load(int y, int i) const {
+        const __m128i zero = _mm_setzero_si128(), half = _mm_set1_epi16(128);
+        const __m128i wa = _mm_set1_epi16(static_cast<short>(w)), wb = _mm_set1_epi16(static_cast<short>(256 - w));
+        __m128i va = a.load(y, i), vb = b.load(y, i);
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa), _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa), _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, half), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, half), 8);
+        return _mm_packus_epi16(lo, hi);
+    }
+#endif
+};
+
+// min(255, ((a * base + 128) >> 8) + ((|a - b| * gain) >> 8)) with 8.8
+// weights: a dimmed a with the differences scaled up on top. The gain
+// product is taken as the high half of (|a - b| << 8) * gain, so gains up to
+// 255.99 stay in 16-bit lanes.
+template <class A, class B>
+struct AmplifiedDiffExpr : PixelExpr<AmplifiedDiffExpr<A, B>> {
+    A a;
+    B b;
+    int gain, base;
+
+    AmplifiedDiffExpr(const A &a_, const B &b_, double g, double baseWeight)
+        : a(a_), b(b_), gain(fixed88(g, 0, 65535)), base(fixed88(baseWeight, 0, 256)) {
+        assert(a.rows == b.rows && a.cols == b.cols && a.channels == b.channels);
+        this->rows = a.rows; this->cols = a.cols; this->channels = a.channels;
+    }
+    int at(int y, int i) const {
+        int va = a.at(y, i), d = std::abs(va - b.at(y, i));
+        return std::min(255, ((va * base + 128) >> 8) + ((d * gain) >> 8));
+    }
+#if defined(__SSE2__)
+    __m128i load(int y, int i) const {
+        const __m128i zero = _mm_setzero_si128(), half = _mm_set1_epi16(128), top = _mm_set1_epi16(255);
+        const __m128i g = _mm_set1_epi16(static_cast<short>(gain)), wb = _mm_set1_epi16(static_cast<short>(base));
+        __m128i va = a.load(y, i), vb = b.load(y, i);
+        __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+        __m128i out[2];
+        for (int h = 0; h < 2; ++h) {
+            __m128i wa = h ? _mm_unpackhi_epi8(va, zero) : _mm_unpacklo_epi8(va, zero);
+            __m128i dw = h ? _mm_unpackhi_epi8(zero, d) : _mm_unpacklo_epi8(zero, d); // d << 8
+            __m128i v = _mm_adds_epu16(_mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(wa, wb), half), 8), _mm_mulhi_epu16(dw, g));
+            out[h] = _mm_sub_epi16(v, _mm_subs_epu16(v, top));
+        }
+        return _mm_packus_epi16(out[0], out[1]);
+    }
+#endif
+};
+
+// Writes every element of e into dst, which has e's shape.
+template <class E>
+inline void evalExpr(const E &e, Mat &dst) {
+    const int n = e.cols * e.channels;
+    parallelRows(e.rows, 64, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            unsigned char *d = dst.ptr(y);
+            int i = 0;
+#if defined(__SSE2__)
+            for (; i + 16 <= n; i += 16) _mm_storeu_si128(reinterpret_cast<__m128i *>(d + i), e.load(y, i));
+#endif
+            for (; i < n; ++i) d[i] = static_cast<unsigned char>(e.at(y, i));
+        }
+    });
+}
+
+} // namespace detail
+
+template <class E>
+Mat::Mat(const PixelExpr<E> &expr) : Mat(expr.rows, expr.cols, 0) {
+    assert(expr.channels == channels);
+    detail::evalExpr(expr.self(), *this);
+}
+
+template <class E>
+Mat &Mat::operator=(const PixelExpr<E> &expr) {
+    if (empty() || rows != expr.rows || cols != expr.cols) {
+        Mat tmp(expr);
+        release();
+        steal(tmp);
+    } else {
+        assert(expr.channels == channels);
+        detail::evalExpr(expr.self(), *this);
+    }
+    return *this;
+}
+
+// |a - b| per element.
+template <class A, class B>
+inline detail::AbsDiffExpr<typename detail::ExprTerm<A>::type, typename detail::ExprTerm<B>::type>
+absdiff(const A &a, const B &b) {
+    return {detail::ExprTerm<A>::get(a), detail::ExprTerm<B>::get(b)};
+}
+
+// OpenCV's fixed-threshold types for 8-bit data: thresh is floored, maxval
+// rounded and saturated.
+template <class A>
+inline detail::ThresholdExpr<typename detail::ExprTerm<A>::type>
+threshold(const A &src, double thresh, double maxval = 255, int type = THRESH_BINARY) {
+    return {detail::ExprTerm<A>::get(src), thresh, maxval, type};
+}
+
+// saturate(src1 * alpha + src2 * beta + gamma) per element.
+template <class A, class B>
+inline detail::AddWeightedExpr<typename detail::ExprTerm<A>::type, typename detail::ExprTerm<B>::type>
+addWeighted(const A &src1, double alpha, const B &src2, double beta, double gamma) {
+    return {detail::ExprTerm<A>::get(src1), alpha, detail::ExprTerm<B>::get(src2), beta, gamma};
+}
+
+// Opacity crossfade src1 * alpha + src2 * (1 - alpha), in 8.8 fixed point.
+template <class A, class B>
+inline detail::CrossfadeExpr<typename detail::ExprTerm<A>::type, typename detail::ExprTerm<B>::type>
+crossfade(const A &src1, const B &src2, double alpha) {
+    return {detail::ExprTerm<A>::get(src1), detail::ExprTerm<B>::get(src2), alpha};
+}
+
+// Difference overlay: src1 dimmed to base plus |src1 - src2| * gain,
+// saturated; weights in 8.8 fixed point (gain up to 255).
+template <class A, class B>
+inline detail::AmplifiedDiffExpr<typename detail::ExprTerm<A>::type, typename detail::ExprTerm<B>::type>
+amplifiedDiff(const A &src1, const B &src2, double gain, double base = 0.25) {
+    return {detail::ExprTerm<A>::get(src1), detail::ExprTerm<B>::get(src2), gain, base};
+}
+
+// The OpenCV signatures, evaluating into dst.
+template <class A, class B>
+inline void absdiff(const A &a, const B &b, Mat &dst) { dst = absdiff(a, b); }
+
+template <class A>
+inline double threshold(const A &src, Mat &dst, double thresh, double maxval, int type) {
+    dst = threshold(src, thresh, maxval, type);
+    return thresh;
+}
+
+template <class A, class B>
+inline void addWeighted(const A &src1, double alpha, const B &src2, double beta, double gamma, Mat &dst) {
+    dst = addWeighted(src1, alpha, src2, beta, gamma);
+}
+
+// Number of nonzero elements. Unlike OpenCV this accepts any channel count
+// and counts channel bytes, not pixels.
+template <class A>
+inline int countNonZero(const A &src) {
+    const typename detail::ExprTerm<A>::type &e = detail::ExprTerm<A>::get(src);
+    const int n = e.cols * e.channels;
+    std::mutex lock;
+    uint64_t count = 0;
+    detail::parallelRows(e.rows, 64, [&](int y0, int y1) {
+        uint64_t nonzero = 0;
+        for (int y = y0; y < y1; ++y) {
+            int i = 0;
+#if defined(__SSE2__)
+            const __m128i zero = _mm_setzero_si128();
+            while (i + 16 <= n) {
+                // per-byte zero counters hold 255 blocks
+                int end = std::min(n & ~15, i + 255 * 16), start = i;
+                __m128i zeros = zero;
+                for (; i < end; i += 16) zeros = _mm_sub_epi8(zeros, _mm_cmpeq_epi8(e.load(y, i), zero));
+                nonzero += static_cast<uint64_t>(end - start) - detail::sumLanes64(_mm_sad_epu8(zeros, zero));
+            }
+#endif
+            for (; i < n; ++i) nonzero += e.at(y, i) != 0;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        count += nonzero;
+    });
+    return static_cast<int>(count);
+}
+
+// Per-channel mean over all pixels (up to four channels).
+template <class A>
+inline Scalar mean(const A &src) {
+    const typename detail::ExprTerm<A>::type &e = detail::ExprTerm<A>::get(src);
+    const int cn = e.channels;
+    assert(cn >= 1 && cn <= 4);
+    std::mutex lock;
+    uint64_t sums[4] = {0, 0, 0, 0};
+    detail::parallelRows(e.rows, 64, [&](int y0, int y1) {
+        uint64_t part[4] = {0, 0, 0, 0};
+        for (int y = y0; y < y1; ++y) {
+            int x = 0;
+#if defined(__SSE2__)
+            // 16 pixels are cn registers; byte k of the block belongs to
+            // channel k % cn. 16-bit lane sums hold 256 blocks.
+            const __m128i zero = _mm_setzero_si128();
+            while (x + 16 <= e.cols) {
+                int end = std::min(e.cols & ~15, x + 256 * 16);
+                __m128i acc[8];
+                for (int r = 0; r < 2 * cn; ++r) acc[r] = zero;
+                for (; x < end; x += 16) {
+                    for (int r = 0; r < cn; ++r) {
+                        __m128i v = e.load(y, x * cn + 16 * r);
+                        acc[2 * r] = _mm_add_epi16(acc[2 * r], _mm_unpacklo_epi8(v, zero));
+                        acc[2 * r + 1] = _mm_add_epi16(acc[2 * r + 1], _mm_unpackhi_epi8(v, zero));
+                    }
+                }
+                uint16_t lanes[8];
+                for (int r = 0; r < 2 * cn; ++r) {
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), acc[r]);
+                    for (int k = 0; k < 8; ++k) part[(8 * r + k) % cn] += lanes[k];
+                }
+            }
+#endif
+            for (; x < e.cols; ++x)
+                for (int c = 0; c < cn; ++c) part[c] += e.at(y, x * cn + c);
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        for (int c = 0; c < cn; ++c) sums[c] += part[c];
+    });
+    Scalar m;
+    double pixels = static_cast<double>(e.rows) * e.cols;
+    for (int c = 0; c < cn; ++c) m.val[c] = pixels > 0 ? sums[c] / pixels : 0.0;
+    return m;
+}
+
+// ---------------------------------------------------------------------------
+// Discrete Fourier transform and phase correlation.
+
+namespace detail {
+
+typedef std::complex<double> cplx;
+
+const double kPi = 3.14159265358979323846;
+
+#if defined(__SSE2__)
+typedef __m128d cvec;
+inline cvec cload(const cplx *p) { return _mm_loadu_pd(reinterpret_cast<const double *>(p)); }
+inline void cstore(cplx *p, cvec v) { _mm_storeu_pd(reinterpret_cast<double *>(p), v); }
+inline cvec cadd(cvec a, cvec b) { return _mm_add_pd(a, b); }
+inline cvec csub(cvec a, cvec b) { return _mm_sub_pd(a, b); }
+inline cvec cscale(cvec a, double s) { return _mm_mul_pd(a, _mm_set1_pd(s)); }
+inline cvec cmul(cvec a, cplx w) {
+    __m128d swapped = _mm_shuffle_pd(a, a, 1);
+    return _mm_add_pd(_mm_mul_pd(a, _mm_set1_pd(w.real())),
+                      _mm_mul_pd(swapped, _mm_set_pd(w.imag(), -w.imag())));
+}
+// Multiplies by -i: (re, im) -> (im, -re).
+inline cvec cmulNegI(cvec a) {
+    return _mm_xor_pd(_mm_shuffle_pd(a, a, 1), _mm_set_pd(-0.0, 0.0));
+}
+#else
+typedef cplx cvec;
+inline cvec cload(const cplx *p) { return *p; }
+inline void cstore(cplx *p, cvec v) { *p = v; }
+inline cvec cadd(cvec a, cvec b) { return a + b; }
+inline cvec csub(cvec a, cvec b) { return a - b; }
+inline cvec cscale(cvec a, double s) { return a * s; }
+inline cvec cmul(cvec a, cplx w) { return a * w; }
+inline cvec cmulNegI(cvec a) { return cvec(a.imag(), -a.real()); }
+#endif
+
+// Batched mixed-radix Stockham FFT of length n. The data of `batch` signals is
+// laid out as [n][batch], so each butterfly sweeps contiguous runs of complex
+// values sharing one twiddle and vectorizes without gathers. Radix 4, 2, 3 and
+// 5 are used first; any remaining prime factor goes through a generic O(p^2)
+// butterfly, so callers should pad to getOptimalDFTSize() where they can.
+class FFTPlan {
+public:
+    explicit FFTPlan(int n) : n_(n) {
+        int rest = n, s = 1;
+        while (rest > 1) {
+            int p = 0;
+            for (int f : {4, 2, 3, 5})
+                if (rest % f == 0) { p = f; break; }
+            if (!p) {
+                p = 7;
+                while (rest % p) p += 2;
+            }
+            Stage st;
+            st.p = p; st.m = rest / p; st.s = s;
+            st.tw.resize(static_cast<size_t>(st.m) * p);
+            for (int i = 0; i < st.m; ++i)
+                for (int k = 0; k < p; ++k)
+                    st.tw[i * p + k] = std::polar(1.0, -2.0 * kPi * i * k / rest);
+            st.rot.resize(p);
+            for (int k = 0; k < p; ++k)
+                st.rot[k] = std::polar(1.0, -2.0 * kPi * k / p);
+            stages_.push_back(std::move(st));
+            rest /= p;
+            s *= p;
+        }
+    }
+
+    int size() const { return n_; }
+
+    // In-place unscaled transform; work must hold size() * batch values.
+    void forward(cplx *data, cplx *work, size_t batch) const { run(data, work, batch); }
+
+    void inverse(cplx *data, cplx *work, size_t batch) const {
+        size_t count = static_cast<size_t>(n_) * batch;
+        for (size_t i = 0; i < count; ++i) data[i] = std::conj(data[i]);
+        run(data, work, batch);
+        for (size_t i = 0; i < count; ++i) data[i] = std::conj(data[i]);
+    }
+
+private:
+    struct Stage {
+        int p, m, s;
+        std::vector<cplx> tw;   // tw[i * p + k] = W_(p*m)^(i*k)
+        std::vector<cplx> rot;  // rot[k] = W_p^k
+    };
+    int n_;
+    std::vector<Stage> stages_;
+
+    void run(cplx *data, cplx *work, size_t batch) const {
+        cplx *x = data, *y = work;
+        for (const Stage &st : stages_) {
+            runStage(st, x, y, batch);
+            std::swap(x, y);
+        }
+        if (x != data)
+            std::memcpy(data, x, static_cast<size_t>(n_) * batch * sizeof(cplx));
+    }
+
+    static void runStage(const Stage &st, const cplx *x, cplx *y, size_t batch) {
+        const int p = st.p, m = st.m;
+        const size_t len = static_cast<size_t>(st.s) * batch;
+        std::vector<cplx> a(p);
+        for (int i = 0; i < m; ++i) {
+            const cplx *w = &st.tw[static_cast<size_t>(i) * p];
+            const cplx *in = x + i * len;
+            cplx *out = y + static_cast<size_t>(i) * p * len;
+            const size_t inStride = static_cast<size_t>(m) * len;
+            switch (p) {
+            case 2:
+                for (size_t t = 0; t < len; ++t) {
+                    cvec a0 = cload(in + t), a1 = cload(in + inStride + t);
+                    cstore(out + t, cadd(a0, a1));
+                    cstore(out + len + t, cmul(csub(a0, a1), w[1]));
+                }
+                break;
+            case 4:
+                for (size_t t = 0; t < len; ++t) {
+                    cvec a0 = cload(in + t), a1 = cload(in + inStride + t);
+                    cvec a2 = cload(in + 2 * inStride + t), a3 = cload(in + 3 * inStride + t);
+                    cvec b0 = cadd(a0, a2), b1 = csub(a0, a2);
+                    cvec b2 = cadd(a1, a3), b3 = cmulNegI(csub(a1, a3));
+                    cstore(out + t, cadd(b0, b2));
+                    cstore(out + len + t, cmul(cadd(b1, b3), w[1]));
+                    cstore(out + 2 * len + t, cmul(csub(b0, b2), w[2]));
+                    cstore(out + 3 * len + t, cmul(csub(b1, b3), w[3]));
+                }
+                break;
+            case 3: {
+                const double s3 = std::sqrt(3.0) / 2.0;
+                for (size_t t = 0; t < len; ++t) {
+                    cvec a0 = cload(in + t), a1 = cload(in + inStride + t);
+                    cvec a2 = cload(in + 2 * inStride + t);
+                    cvec sum = cadd(a1, a2);
+                    cvec mid = csub(a0, cscale(sum, 0.5));
+                    cvec rot = cscale(cmulNegI(csub(a1, a2)), s3);
+                    cstore(out + t, cadd(a0, sum));
+                    cstore(out + len + t, cmul(cadd(mid, rot), w[1]));
+                    cstore(out + 2 * len + t, cmul(csub(mid, rot), w[2]));
+                }
+                break;
+            }
+            default:
+                for (size_t t = 0; t < len; ++t) {
+                    for (int r = 0; r < p; ++r) a[r] = in[r * inStride + t];
+                    for (int k = 0; k < p; ++k) {
+                        cvec acc = cload(&a[0]);
+                        for (int r = 1; r < p; ++r)
+                            acc = cadd(acc, cmul(cload(&a[r]), st.rot[(r * k) % p]));
+                        cstore(out + k * len + t, k ? cmul(acc, w[k]) : acc);
+                    }
+                }
+                break;
+            }
+        }
+    }
+};
+
+inline void transpose(const cplx *src, cplx *dst, int rows, int cols) {
+    const int B = 32;
+    for (int y0 = 0; y0 < rows; y0 += B)
+        for (int x0 = 0; x0 < cols; x0 += B)
+            for (int y = y0; y < std::min(y0 + B, rows); ++y)
+                for (int x = x0; x < std::min(x0 + B, cols); ++x)
+                    dst[static_cast<size_t>(x) * rows + y] = src[static_cast<size_t>(y) * cols + x];
+}
+
+// Everything phaseCorrelate needs for one input size: the padded transform
+// size, both 1-D plans and the separable Hann window.
+struct PhaseCorrPlan {
+    int rows, cols, prows, pcols;
+    FFTPlan planY, planX;   // lengths prows and pcols
+    std::vector<double> winY, winX;
+
+    PhaseCorrPlan(int r, int c, int pr, int pc)
+        : rows(r), cols(c), prows(pr), pcols(pc), planY(pr), planX(pc), winY(r), winX(c) {
+        for (int y = 0; y < r; ++y) winY[y] = r > 1 ? 0.5 - 0.5 * std::cos(2.0 * kPi * y / (r - 1)) : 1.0;
+        for (int x = 0; x < c; ++x) winX[x] = c > 1 ? 0.5 - 0.5 * std::cos(2.0 * kPi * x / (c - 1)) : 1.0;
+    }
+};
+
+// Plans are cached per input size, so repeated pairs only pay for transforms.
+// The cache keeps the kPlanCacheSize most recently used sizes, so a batch of
+// mixed sizes doesn't grow it without limit; callers hold their plan by
+// shared_ptr, so evicting one in use is safe.
+const size_t kPlanCacheSize = 8;
+
+inline std::shared_ptr<const PhaseCorrPlan> getPhaseCorrPlan(int rows, int cols, int prows, int pcols) {
+    static std::mutex mutex;
+    static std::list<std::shared_ptr<const PhaseCorrPlan>> cache;  // most recent first
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+        if ((*it)->rows == rows && (*it)->cols == cols) {
+            cache.splice(cache.begin(), cache, it);
+            return cache.front();
+        }
+    }
+    cache.push_front(std::make_shared<PhaseCorrPlan>(rows, cols, prows, pcols));
+    if (cache.size() > kPlanCacheSize) cache.pop_back();
+    return cache.front();
+}
+
+} // namespace detail
+
+// Smallest size >= n whose only prime factors are 2, 3 and 5.
+inline int getOptimalDFTSize(int n) {
+    for (int m = std::max(n, 1);; ++m) {
+        int r = m;
+        for (int f : {2, 3, 5})
+            while (r % f == 0) r /= f;
+        if (r == 1) return m;
+    }
+}
+
+// Estimates the integer translation (dx, dy) such that img2(x + dx, y + dy)
+// matches img1(x, y), using phase correlation of the windowed luma planes.
+// Both images are packed into one complex transform (img1 real, img2
+// imaginary) and their spectra separated through Hermitian symmetry, which is
+// the real-to-complex saving. `response` receives the normalized peak height.
+inline Point phaseCorrelate(const Mat &img1, const Mat &img2, double *response = nullptr) {
+    assert(img1.rows == img2.rows && img1.cols == img2.cols);
+    assert(img1.channels == 3 && img2.channels == 3);
+    typedef detail::cplx cplx;
+    const int R = img1.rows, C = img1.cols;
+    std::shared_ptr<const detail::PhaseCorrPlan> plan =
+        detail::getPhaseCorrPlan(R, C, getOptimalDFTSize(R), getOptimalDFTSize(C));
+    const int PR = plan->prows, PC = plan->pcols;
+    const size_t N = static_cast<size_t>(PR) * PC;
+
+    double mean1 = 0.0, mean2 = 0.0;
+    for (int y = 0; y < R; ++y) {
+        const unsigned char *p1 = img1.ptr(y), *p2 = img2.ptr(y);
+        for (int x = 0; x < C * 3; x += 3) {
+            mean1 += 0.299 * p1[x] + 0.587 * p1[x + 1] + 0.114 * p1[x + 2];
+            mean2 += 0.299 * p2[x] + 0.587 * p2[x + 1] + 0.114 * p2[x + 2];
+        }
+    }
+    mean1 /= static_cast<double>(R) * C;
+    mean2 /= static_cast<double>(R) * C;
+
+    std::vector<cplx> buf(N), work(N);
+    for (int y = 0; y < R; ++y) {
+        const unsigned char *p1 = img1.ptr(y), *p2 = img2.ptr(y);
+        cplx *row = &buf[static_cast<size_t>(y) * PC];
+        for (int x = 0; x < C; ++x) {
+            double w = plan->winY[y] * plan->winX[x];
+            double l1 = 0.299 * p1[3 * x] + 0.587 * p1[3 * x + 1] + 0.114 * p1[3 * x + 2];
+            double l2 = 0.299 * p2[3 * x] + 0.587 * p2[3 * x + 1] + 0.114 * p2[3 * x + 2];
+            row[x] = cplx((l1 - mean1) * w, (l2 - mean2) * w);
+        }
+    }
+
+    // Forward: columns as a batch over [PR][PC], then rows as a batch after a
+    // transpose. The spectrum stays transposed, as [PC][PR].
+    plan->planY.forward(buf.data(), work.data(), PC);
+    detail::transpose(buf.data(), work.data(), PR, PC);
+    buf.swap(work);
+    plan->planX.forward(buf.data(), work.data(), PR);
+
+    // Split the packed spectra and form the normalized cross-power spectrum
+    // F2 * conj(F1) / |F2 * conj(F1)|.
+    for (int kx = 0; kx < PC; ++kx) {
+        const cplx *z = &buf[static_cast<size_t>(kx) * PR];
+        const cplx *zm = &buf[static_cast<size_t>((PC - kx) % PC) * PR];
+        cplx *out = &work[static_cast<size_t>(kx) * PR];
+        for (int ky = 0; ky < PR; ++ky) {
+            cplx a = z[ky], b = std::conj(zm[(PR - ky) % PR]);
+            cplx f1 = 0.5 * (a + b);
+            cplx f2 = cplx(0.0, -0.5) * (a - b);
+            cplx cross = f2 * std::conj(f1);
+            double mag = std::abs(cross);
+            out[ky] = mag > 1e-12 ? cross / mag : cplx(0.0, 0.0);
+        }
+    }
+
+    buf.swap(work);
+    plan->planX.inverse(buf.data(), work.data(), PR);
+    detail::transpose(buf.data(), work.data(), PC, PR);
+    buf.swap(work);
+    plan->planY.inverse(buf.data(), work.data(), PC);
+
+    size_t best = 0;
+    for (size_t i = 1; i < N; ++i)
+        if (buf[i].real() > buf[best].real()) best = i;
+    if (response) *response = buf[best].real() / static_cast<double>(N);
+
+    int dy = static_cast<int>(best / PC), dx = static_cast<int>(best % PC);
+    if (dy > PR / 2) dy -= PR;
+    if (dx > PC / 2) dx -= PC;
+    return Point(dx, dy);
+}
+
+// ---------------------------------------------------------------------------
+// Encoding.
+
+// Writes img as PNG, JPEG or BMP, chosen by the file extension. PNG output is
+// filtered and deflated in parallel chunks.
+inline bool imwrite(const std::string &path, const Mat &img) {
+    if (img.empty()) return false;
+    std::string ext = path.substr(path.find_last_of('.') + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if (ext == "png") {
+        int len = 0;
+        unsigned char *png = stbi_write_png_to_mem_parallel(img.data, static_cast<int>(img.step), img.cols, img.rows,
+                                                            img.channels, &len, detail::stbiwParallelFor, nullptr);
+        if (!png) return false;
+        FILE *f = std::fopen(path.c_str(), "wb");
+        bool ok = f && std::fwrite(png, 1, len, f) == static_cast<size_t>(len);
+        if (f) ok = std::fclose(f) == 0 && ok;
+        STBIW_FREE(png);
+        return ok;
+    }
+    if (!img.isContinuous()) return imwrite(path, img.clone());
+    if (ext == "jpg" || ext == "jpeg")
+        return detail::writeJpeg(path, img, 90);
+    if (ext == "bmp")
+        return stbi_write_bmp(path.c_str(), img.cols, img.rows, img.channels, img.data) != 0;
+    std::cerr << "Unsupported image format: " << path << std::endl;
+    return false;
+}
+
+const int WINDOW_AUTOSIZE = 1;
+const int CV_8UC1 = CV_MAKETYPE(CV_8U, 1);
+const int CV_8UC3 = CV_MAKETYPE(CV_8U, 3);
+const int CV_8UC4 = CV_MAKETYPE(CV_8U, 4);
+const int CV_16UC1 = CV_MAKETYPE(CV_16U, 1);
+const int CV_16UC3 = CV_MAKETYPE(CV_16U, 3);
+const int CV_16UC4 = CV_MAKETYPE(CV_16U, 4);
+const int CV_32FC1 = CV_MAKETYPE(CV_32F, 1);
+const int CV_32FC3 = CV_MAKETYPE(CV_32F, 3);
+const int CV_32FC4 = CV_MAKETYPE(CV_32F, 4);
 
 } // namespace cv
@@ -433,6 +433,46 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
 #endif
 
+// per-call settings, so loads on different threads can use different
+// settings without the process-wide stbi_set_*_on_load flags. zero-init for
+// stb_image's defaults. the load writes failure_reason: NULL on success, else
+// what stbi_failure_reason() reports for this call (exact even under
+// concurrency, as long as STBI_THREAD_LOCAL is available)
+typedef struct
+{
+   int flip_vertically;           // as stbi_set_flip_vertically_on_load
+   int unpremultiply;             // as stbi_set_unpremultiply_on_load
+   int convert_iphone_png_to_rgb; // as stbi_convert_iphone_png_to_rgb
+   int planar;                    // 8-bit loads: one w*h plane per channel, in
+                                  // channel order, instead of interleaved pixels
+   const char *failure_reason;
+} stbi_load_options;
+
+STBIDEF stbi_uc *stbi_load_from_memory_ex   (stbi_uc           const *buffer, int len   , int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options *opts);
+STBIDEF stbi_uc *stbi_load_from_callbacks_ex(stbi_io_callbacks const *clbk  , void *user, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options *opts);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_ex            (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options *opts);
+STBIDEF stbi_uc *stbi_load_from_file_ex  (FILE *f, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options *opts);
+#endif
+
+// reusable decoder context: loads through a decoder recycle the previous
+// load's working buffers (JPEG state and component planes, zlib output, PNG
+// rows, the result itself), so decoding a batch of similar images on one
+// thread does no allocation once the pool has warmed up. the returned pixels
+// belong to the decoder and stay valid until its next load or until
+// stbi_decoder_free -- don't stbi_image_free them. a decoder must only be
+// used by one thread at a time. without thread-local storage (see
+// STBI_THREAD_LOCAL) these are plain loads that free the previous result.
+// opts may be NULL to use the stbi_set_*_on_load flags.
+typedef struct stbi__decoder stbi_decoder;
+STBIDEF stbi_decoder *stbi_decoder_create(void);
+STBIDEF void          stbi_decoder_free  (stbi_decoder *dec);
+STBIDEF stbi_uc      *stbi_decoder_load_from_memory(stbi_decoder *dec, stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options *opts);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc      *stbi_decoder_load          (stbi_decoder *dec, char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options *opts);
+STBIDEF stbi_uc      *stbi_decoder_load_from_file(stbi_decoder *dec, FILE *f, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options *opts);
+#endif
+
 #ifdef STBI_WINDOWS_UTF8
 STBIDEF int stbi_convert_wchar_to_utf8(char *buffer, size_t bufferlen, const wchar_t* input);
 #endif
@@ -450,6 +490,12 @@ STBIDEF stbi_us *stbi_load_16          (char const *filename, int *x, int *y, in
 STBIDEF stbi_us *stbi_load_from_file_16(FILE *f, int *x, int *y, int *channels_in_file, int desired_channels);
 #endif
 
+// as the 8-bit _ex loads; opts->planar is ignored, results are interleaved
+STBIDEF stbi_us *stbi_load_16_from_memory_ex(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options *opts);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_us *stbi_load_16_ex            (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options *opts);
+#endif
+
 ////////////////////////////////////
 //
 // float-per-channel interface
@@ -462,6 +508,12 @@ STBIDEF stbi_us *stbi_load_from_file_16(FILE *f, int *x, int *y, int *channels_i
    STBIDEF float *stbi_loadf            (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
    STBIDEF float *stbi_loadf_from_file  (FILE *f, int *x, int *y, int *channels_in_file, int desired_channels);
    #endif
+
+   // as the 8-bit _ex loads; opts->planar is ignored, results are interleaved
+   STBIDEF float *stbi_loadf_from_memory_ex(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options *opts);
+   #ifndef STBI_NO_STDIO
+   STBIDEF float *stbi_loadf_ex            (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, stbi_load_options *opts);
+   #endif
 #endif
 
 #ifndef STBI_NO_HDR
@@ -501,6 +553,17 @@ STBIDEF int      stbi_info               (char const *filename,     int *x, int
 STBIDEF int      stbi_info_from_file     (FILE *f,                  int *x, int *y, int *comp);
 STBIDEF int      stbi_is_16_bit          (char const *filename);
 STBIDEF int      stbi_is_16_bit_from_file(FILE *f);
+
+// streaming JPEG decode: baseline JPEGs whose components share a single
+// interleaved scan are decoded one MCU row at a time, so memory stays
+// proportional to width * MCU height instead of the whole image. open fails
+// (see stbi_failure_reason) for progressive or multi-scan files. read writes
+// up to max_rows rows of req_comp-channel pixels, out_stride bytes apart, and
+// returns the number of rows written (0 once the image is exhausted).
+typedef struct stbi__jpeg_stream stbi_jpeg_stream;
+STBIDEF stbi_jpeg_stream *stbi_jpeg_stream_open (FILE *f, int *x, int *y, int *comp, int req_comp);
+STBIDEF int               stbi_jpeg_stream_read (stbi_jpeg_stream *js, stbi_uc *out, int out_stride, int max_rows);
+STBIDEF void              stbi_jpeg_stream_close(stbi_jpeg_stream *js);
 #endif
 
 
@@ -643,12 +706,14 @@ typedef unsigned short stbi__uint16;
 typedef   signed short stbi__int16;
 typedef unsigned int   stbi__uint32;
 typedef   signed int   stbi__int32;
+typedef unsigned __int64 stbi__uint64;
 #else
 #include <stdint.h>
 typedef uint16_t stbi__uint16;
 typedef int16_t  stbi__int16;
 typedef uint32_t stbi__uint32;
 typedef int32_t  stbi__int32;
+typedef uint64_t stbi__uint64;
 #endif
 
 // should produce compiler error if size is wrong
@@ -750,7 +815,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    int info3 = stbi__cpuid3();
@@ -761,7 +826,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    // If we're even attempting to compile this on GCC/Clang, that means
@@ -774,6 +839,35 @@ static int stbi__sse2_available(void)
 #endif
 #endif
 
+// AVX2 JPEG kernels. These get compiled with a target attribute and are only
+// picked at run time, so nothing else is built for AVX2. #define STBI_NO_AVX2
+// to leave them out.
+#if defined(STBI_SSE2) && !defined(STBI_NO_AVX2) && !defined(STBI_NO_JPEG)
+#if defined(_MSC_VER) && _MSC_VER >= 1800 && !defined(__clang__)
+#define STBI_AVX2
+#define STBI_AVX2_TARGET
+#include <immintrin.h>
+static int stbi__avx2_available(void)
+{
+   int info[4];
+   __cpuid(info, 1);
+   // AVX + OSXSAVE, and the OS saves the ymm state
+   if ((info[2] & 0x18000000) != 0x18000000 || (_xgetbv(0) & 6) != 6)
+      return 0;
+   __cpuidex(info, 7, 0);
+   return (info[1] >> 5) & 1;
+}
+#elif defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+#define STBI_AVX2
+#define STBI_AVX2_TARGET __attribute__((target("avx2")))
+#include <immintrin.h>
+static int stbi__avx2_available(void)
+{
+   return __builtin_cpu_supports("avx2");
+}
+#endif
+#endif
+
 // ARM NEON
 #if defined(STBI_NO_SIMD) && defined(STBI_NEON)
 #undef STBI_NEON
@@ -817,6 +911,8 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   stbi_load_options const *opts; // per-call settings, or NULL for the set_*_on_load flags
 } stbi__context;
 
 
@@ -826,6 +922,7 @@ static void stbi__refill_buffer(stbi__context *s);
 static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
 {
    s->io.read = NULL;
+   s->opts = NULL;
    s->read_from_callbacks = 0;
    s->callback_already_read = 0;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
@@ -837,6 +934,7 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
 {
    s->io = *c;
    s->io_user_data = user;
+   s->opts = NULL;
    s->buflen = sizeof(s->buffer_start);
    s->read_from_callbacks = 1;
    s->callback_already_read = 0;
@@ -903,6 +1001,7 @@ typedef struct
    int bits_per_channel;
    int num_channels;
    int channel_order;
+   int planar;       // loader already wrote one plane per channel
 } stbi__result_info;
 
 #ifndef STBI_NO_JPEG
@@ -982,9 +1081,105 @@ static int stbi__err(const char *str)
 }
 #endif
 
+// stbi_decoder: a fixed set of recycled blocks. while a decoder load runs,
+// stbi__malloc hands out the best-fitting idle block (or grows one) and
+// stbi__free just marks it idle again; every block is idle again at the
+// start of the next load. outside a decoder load these are plain
+// STBI_MALLOC/STBI_FREE, and pointers that aren't in the pool always go
+// straight to STBI_FREE.
+#define STBI__DECODER_BLOCKS  24
+
+struct stbi__decoder
+{
+   struct {
+      void *p;
+      size_t cap;
+      int used;
+   } block[STBI__DECODER_BLOCKS];
+   void *loose; // a result that didn't come from the pool
+};
+
+#ifdef STBI_THREAD_LOCAL
+static STBI_THREAD_LOCAL stbi_decoder *stbi__active_decoder;
+#endif
+
 static void *stbi__malloc(size_t size)
 {
-    return STBI_MALLOC(size);
+#ifdef STBI_THREAD_LOCAL
+   stbi_decoder *d = stbi__active_decoder;
+   if (d) {
+      int i, best = -1, grow = -1;
+      for (i=0; i < STBI__DECODER_BLOCKS; ++i) {
+         if (d->block[i].used) continue;
+         if (d->block[i].p == NULL) {
+            if (grow < 0 || d->block[grow].p) grow = i;
+         } else if (d->block[i].cap >= size) {
+            if (best < 0 || d->block[i].cap < d->block[best].cap) best = i;
+         } else if (grow < 0 || (d->block[grow].p && d->block[i].cap < d->block[grow].cap)) {
+            grow = i; // prefer an empty slot, else sacrifice the smallest idle block
+         }
+      }
+      if (best < 0 && grow >= 0) {
+         // some headroom so a batch of slightly different sizes settles quickly
+         size_t cap = size + (size >> 3) + 64;
+         void *p = STBI_MALLOC(cap);
+         if (p == NULL) return NULL;
+         if (d->block[grow].p) STBI_FREE(d->block[grow].p);
+         d->block[grow].p = p;
+         d->block[grow].cap = cap;
+         best = grow;
+      }
+      if (best >= 0) {
+         d->block[best].used = 1;
+         return d->block[best].p;
+      }
+   }
+#endif
+   return STBI_MALLOC(size);
+}
+
+#ifdef STBI_THREAD_LOCAL
+static int stbi__decoder_block(stbi_decoder *d, void *p)
+{
+   int i;
+   if (d && p)
+      for (i=0; i < STBI__DECODER_BLOCKS; ++i)
+         if (d->block[i].p == p)
+            return i;
+   return -1;
+}
+#endif
+
+static void stbi__free(void *p)
+{
+#ifdef STBI_THREAD_LOCAL
+   int i = stbi__decoder_block(stbi__active_decoder, p);
+   if (i >= 0) {
+      stbi__active_decoder->block[i].used = 0;
+      return;
+   }
+#endif
+   STBI_FREE(p);
+}
+
+static void *stbi__realloc_sized(void *p, size_t oldsz, size_t newsz)
+{
+#ifdef STBI_THREAD_LOCAL
+   stbi_decoder *d = stbi__active_decoder;
+   int i = stbi__decoder_block(d, p);
+   if (i >= 0) {
+      void *q;
+      if (d->block[i].cap >= newsz) return p;
+      q = stbi__malloc(newsz);
+      if (q == NULL) return NULL;
+      memcpy(q, p, oldsz < newsz ? oldsz : newsz);
+      stbi__free(p);
+      return q;
+   }
+   if (d && p == NULL) return stbi__malloc(newsz);
+#endif
+   STBI_NOTUSED(oldsz);
+   return STBI_REALLOC_SIZED(p,oldsz,newsz);
 }
 
 // stb_image uses ints pervasively, including for offset calculations.
@@ -1119,7 +1314,7 @@ STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
 }
 
 #ifndef STBI_THREAD_LOCAL
-#define stbi__vertically_flip_on_load  stbi__vertically_flip_on_load_global
+#define stbi__vertically_flip_on_load_default  stbi__vertically_flip_on_load_global
 #else
 static STBI_THREAD_LOCAL int stbi__vertically_flip_on_load_local, stbi__vertically_flip_on_load_set;
 
@@ -1129,11 +1324,14 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
    stbi__vertically_flip_on_load_set = 1;
 }
 
-#define stbi__vertically_flip_on_load  (stbi__vertically_flip_on_load_set       \
-                                         ? stbi__vertically_flip_on_load_local  \
-                                         : stbi__vertically_flip_on_load_global)
+#define stbi__vertically_flip_on_load_default  (stbi__vertically_flip_on_load_set       \
+                                                 ? stbi__vertically_flip_on_load_local  \
+                                                 : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+#define stbi__vertically_flip_on_load(s)  ((s)->opts ? (s)->opts->flip_vertically : stbi__vertically_flip_on_load_default)
+#define stbi__planar_on_load(s)           ((s)->opts && (s)->opts->planar)
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1199,7 +1397,7 @@ static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int chan
    for (i = 0; i < img_len; ++i)
       reduced[i] = (stbi_uc)((orig[i] >> 8) & 0xFF); // top half of each byte is sufficient approx of 16->8 bit scaling
 
-   STBI_FREE(orig);
+   stbi__free(orig);
    return reduced;
 }
 
@@ -1215,7 +1413,7 @@ static stbi__uint16 *stbi__convert_8_to_16(stbi_uc *orig, int w, int h, int chan
    for (i = 0; i < img_len; ++i)
       enlarged[i] = (stbi__uint16)((orig[i] << 8) + orig[i]); // replicate to high and low byte, maps 0->0, 255->0xffff
 
-   STBI_FREE(orig);
+   stbi__free(orig);
    return enlarged;
 }
 
@@ -1243,7 +1441,6 @@ static void stbi__vertical_flip(void *image, int w, int h, int bytes_per_pixel)
    }
 }
 
-#ifndef STBI_NO_GIF
 static void stbi__vertical_flip_slices(void *image, int w, int h, int z, int bytes_per_pixel)
 {
    int slice;
@@ -1255,7 +1452,27 @@ static void stbi__vertical_flip_slices(void *image, int w, int h, int z, int byt
       bytes += slice_size;
    }
 }
-#endif
+
+// interleaved 8-bit pixels to one plane per channel, for loaders that can't
+// write planes themselves
+static stbi_uc *stbi__planarize(stbi_uc *data, int w, int h, int n)
+{
+   size_t i, plane = (size_t) w * h;
+   int c;
+   stbi_uc *out = (stbi_uc *) stbi__malloc_mad3(n, w, h, 0);
+   if (out == NULL) {
+      stbi__free(data);
+      return stbi__errpuc("outofmem", "Out of memory");
+   }
+   for (c = 0; c < n; ++c) {
+      stbi_uc *dst = out + c * plane;
+      const stbi_uc *src = data + c;
+      for (i = 0; i < plane; ++i, src += n)
+         dst[i] = *src;
+   }
+   stbi__free(data);
+   return out;
+}
 
 static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
 {
@@ -1275,7 +1492,15 @@ static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x,
 
    // @TODO: move stbi__convert_format to here
 
-   if (stbi__vertically_flip_on_load) {
+   if (stbi__planar_on_load(s)) {
+      int channels = req_comp ? req_comp : *comp;
+      if (!ri.planar && channels > 1) {
+         result = stbi__planarize((stbi_uc *) result, *x, *y, channels);
+         if (result == NULL) return NULL;
+      }
+      if (stbi__vertically_flip_on_load(s))
+         stbi__vertical_flip_slices(result, *x, *y, channels, sizeof(stbi_uc));
+   } else if (stbi__vertically_flip_on_load(s)) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
    }
@@ -1302,7 +1527,7 @@ static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x,
    // @TODO: move stbi__convert_format16 to here
    // @TODO: special case RGB-to-Y (and RGBA-to-YA) for 8-bit-to-16-bit case to keep more precision
 
-   if (stbi__vertically_flip_on_load) {
+   if (stbi__vertically_flip_on_load(s)) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi__uint16));
    }
@@ -1311,9 +1536,9 @@ static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x,
 }
 
 #if !defined(STBI_NO_HDR) && !defined(STBI_NO_LINEAR)
-static void stbi__float_postprocess(float *result, int *x, int *y, int *comp, int req_comp)
+static void stbi__float_postprocess(stbi__context *s, float *result, int *x, int *y, int *comp, int req_comp)
 {
-   if (stbi__vertically_flip_on_load && result != NULL) {
+   if (stbi__vertically_flip_on_load(s) && result != NULL) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(float));
    }
@@ -1440,6 +1665,187 @@ STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *u
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+// the 8-bit load with s->opts set; the failure reason is cleared first so
+// opts->failure_reason can't report an earlier call's error
+static stbi_uc *stbi__load_with_options(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi_load_options *opts)
+{
+   stbi_uc *result;
+   if (opts) {
+      s->opts = opts;
+      stbi__g_failure_reason = NULL;
+   }
+   result = stbi__load_and_postprocess_8bit(s,x,y,comp,req_comp);
+   if (opts) opts->failure_reason = result ? NULL : stbi__g_failure_reason;
+   return result;
+}
+
+// the same for the 16-bit and float loads, through a copy of opts with
+// planar cleared since those results are always interleaved
+static void stbi__start_options(stbi__context *s, stbi_load_options *opts, stbi_load_options *interleaved)
+{
+   if (opts) {
+      *interleaved = *opts;
+      interleaved->planar = 0;
+      s->opts = interleaved;
+      stbi__g_failure_reason = NULL;
+   }
+}
+
+static void stbi__finish_options(stbi_load_options *opts, void *result)
+{
+   if (opts) opts->failure_reason = result ? NULL : stbi__g_failure_reason;
+}
+
+static stbi__uint16 *stbi__load_16_with_options(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi_load_options *opts)
+{
+   stbi_load_options interleaved;
+   stbi__uint16 *result;
+   stbi__start_options(s, opts, &interleaved);
+   result = stbi__load_and_postprocess_16bit(s,x,y,comp,req_comp);
+   stbi__finish_options(opts, result);
+   return result;
+}
+
+STBIDEF stbi_us *stbi_load_16_from_memory_ex(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_load_options *opts)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_16_with_options(&s,x,y,comp,req_comp,opts);
+}
+
+STBIDEF stbi_uc *stbi_load_from_memory_ex(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_load_options *opts)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_with_options(&s,x,y,comp,req_comp,opts);
+}
+
+STBIDEF stbi_uc *stbi_load_from_callbacks_ex(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp, stbi_load_options *opts)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi__load_with_options(&s,x,y,comp,req_comp,opts);
+}
+
+#ifndef STBI_NO_STDIO
+static stbi_uc *stbi__fopen_failed(stbi_load_options *opts)
+{
+   stbi_uc *result = stbi__errpuc("can't fopen", "Unable to open file");
+   if (opts) opts->failure_reason = stbi__g_failure_reason;
+   return result;
+}
+
+STBIDEF stbi_uc *stbi_load_ex(char const *filename, int *x, int *y, int *comp, int req_comp, stbi_load_options *opts)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   unsigned char *result;
+   if (!f) return stbi__fopen_failed(opts);
+   result = stbi_load_from_file_ex(f,x,y,comp,req_comp,opts);
+   fclose(f);
+   return result;
+}
+
+STBIDEF stbi_uc *stbi_load_from_file_ex(FILE *f, int *x, int *y, int *comp, int req_comp, stbi_load_options *opts)
+{
+   unsigned char *result;
+   stbi__context s;
+   stbi__start_file(&s,f);
+   result = stbi__load_with_options(&s,x,y,comp,req_comp,opts);
+   if (result) {
+      // need to 'unget' all the characters in the IO buffer
+      fseek(f, - (int) (s.img_buffer_end - s.img_buffer), SEEK_CUR);
+   }
+   return result;
+}
+
+STBIDEF stbi_us *stbi_load_16_ex(char const *filename, int *x, int *y, int *comp, int req_comp, stbi_load_options *opts)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   stbi__uint16 *result;
+   stbi__context s;
+   if (!f) return (stbi_us *) stbi__fopen_failed(opts);
+   stbi__start_file(&s,f);
+   result = stbi__load_16_with_options(&s,x,y,comp,req_comp,opts);
+   fclose(f);
+   return result;
+}
+#endif
+
+STBIDEF stbi_decoder *stbi_decoder_create(void)
+{
+   stbi_decoder *d = (stbi_decoder *) STBI_MALLOC(sizeof(*d));
+   if (d) memset(d, 0, sizeof(*d));
+   return d;
+}
+
+STBIDEF void stbi_decoder_free(stbi_decoder *d)
+{
+   int i;
+   if (!d) return;
+   for (i=0; i < STBI__DECODER_BLOCKS; ++i)
+      if (d->block[i].p) STBI_FREE(d->block[i].p);
+   if (d->loose) STBI_FREE(d->loose);
+   STBI_FREE(d);
+}
+
+static void stbi__decoder_begin(stbi_decoder *d)
+{
+   int i;
+   for (i=0; i < STBI__DECODER_BLOCKS; ++i)
+      d->block[i].used = 0;
+   if (d->loose) STBI_FREE(d->loose);
+   d->loose = NULL;
+#ifdef STBI_THREAD_LOCAL
+   stbi__active_decoder = d;
+#endif
+}
+
+// the result stays marked used until the next begin; anything else a failed
+// load left behind is reclaimed then too
+static stbi_uc *stbi__decoder_end(stbi_decoder *d, stbi_uc *result)
+{
+#ifdef STBI_THREAD_LOCAL
+   stbi__active_decoder = NULL;
+   if (stbi__decoder_block(d, result) >= 0) return result;
+#endif
+   d->loose = result;
+   return result;
+}
+
+STBIDEF stbi_uc *stbi_decoder_load_from_memory(stbi_decoder *dec, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_load_options *opts)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   stbi__decoder_begin(dec);
+   return stbi__decoder_end(dec, stbi__load_with_options(&s,x,y,comp,req_comp,opts));
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_decoder_load(stbi_decoder *dec, char const *filename, int *x, int *y, int *comp, int req_comp, stbi_load_options *opts)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   unsigned char *result;
+   if (!f) return stbi__fopen_failed(opts);
+   result = stbi_decoder_load_from_file(dec,f,x,y,comp,req_comp,opts);
+   fclose(f);
+   return result;
+}
+
+STBIDEF stbi_uc *stbi_decoder_load_from_file(stbi_decoder *dec, FILE *f, int *x, int *y, int *comp, int req_comp, stbi_load_options *opts)
+{
+   unsigned char *result;
+   stbi__context s;
+   stbi__start_file(&s,f);
+   stbi__decoder_begin(dec);
+   result = stbi__decoder_end(dec, stbi__load_with_options(&s,x,y,comp,req_comp,opts));
+   if (result) {
+      // need to 'unget' all the characters in the IO buffer
+      fseek(f, - (int) (s.img_buffer_end - s.img_buffer), SEEK_CUR);
+   }
+   return result;
+}
+#endif
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp)
 {
@@ -1448,7 +1854,7 @@ STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int *
    stbi__start_mem(&s,buffer,len);
 
    result = (unsigned char*) stbi__load_gif_main(&s, delays, x, y, z, comp, req_comp);
-   if (stbi__vertically_flip_on_load) {
+   if (stbi__vertically_flip_on_load(&s)) {
       stbi__vertical_flip_slices( result, *x, *y, *z, *comp );
    }
 
@@ -1465,7 +1871,7 @@ static float *stbi__loadf_main(stbi__context *s, int *x, int *y, int *comp, int
       stbi__result_info ri;
       float *hdr_data = stbi__hdr_load(s,x,y,comp,req_comp, &ri);
       if (hdr_data)
-         stbi__float_postprocess(hdr_data,x,y,comp,req_comp);
+         stbi__float_postprocess(s,hdr_data,x,y,comp,req_comp);
       return hdr_data;
    }
    #endif
@@ -1489,7 +1895,36 @@ STBIDEF float *stbi_loadf_from_callbacks(stbi_io_callbacks const *clbk, void *us
    return stbi__loadf_main(&s,x,y,comp,req_comp);
 }
 
+static float *stbi__loadf_with_options(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi_load_options *opts)
+{
+   stbi_load_options interleaved;
+   float *result;
+   stbi__start_options(s, opts, &interleaved);
+   result = stbi__loadf_main(s,x,y,comp,req_comp);
+   stbi__finish_options(opts, result);
+   return result;
+}
+
+STBIDEF float *stbi_loadf_from_memory_ex(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_load_options *opts)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__loadf_with_options(&s,x,y,comp,req_comp,opts);
+}
+
 #ifndef STBI_NO_STDIO
+STBIDEF float *stbi_loadf_ex(char const *filename, int *x, int *y, int *comp, int req_comp, stbi_load_options *opts)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   float *result;
+   stbi__context s;
+   if (!f) return (float *) stbi__fopen_failed(opts);
+   stbi__start_file(&s,f);
+   result = stbi__loadf_with_options(&s,x,y,comp,req_comp,opts);
+   fclose(f);
+   return result;
+}
+
 STBIDEF float *stbi_loadf(char const *filename, int *x, int *y, int *comp, int req_comp)
 {
    float *result;
@@ -1591,7 +2026,8 @@ enum
 {
    STBI__SCAN_load=0,
    STBI__SCAN_type,
-   STBI__SCAN_header
+   STBI__SCAN_header,
+   STBI__SCAN_stream
 };
 
 static void stbi__refill_buffer(stbi__context *s)
@@ -1762,7 +2198,7 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
 
    good = (unsigned char *) stbi__malloc_mad3(req_comp, x, y, 0);
    if (good == NULL) {
-      STBI_FREE(data);
+      stbi__free(data);
       return stbi__errpuc("outofmem", "Out of memory");
    }
 
@@ -1787,12 +2223,12 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
          STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
          STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
          STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
+         default: STBI_ASSERT(0); stbi__free(data); stbi__free(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
       }
       #undef STBI__CASE
    }
 
-   STBI_FREE(data);
+   stbi__free(data);
    return good;
 }
 #endif
@@ -1819,7 +2255,7 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
 
    good = (stbi__uint16 *) stbi__malloc(req_comp * x * y * 2);
    if (good == NULL) {
-      STBI_FREE(data);
+      stbi__free(data);
       return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
    }
 
@@ -1844,12 +2280,12 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
          STBI__CASE(4,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
          STBI__CASE(4,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = src[3]; } break;
          STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                       } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return (stbi__uint16*) stbi__errpuc("unsupported", "Unsupported format conversion");
+         default: STBI_ASSERT(0); stbi__free(data); stbi__free(good); return (stbi__uint16*) stbi__errpuc("unsupported", "Unsupported format conversion");
       }
       #undef STBI__CASE
    }
 
-   STBI_FREE(data);
+   stbi__free(data);
    return good;
 }
 #endif
@@ -1861,7 +2297,7 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
    float *output;
    if (!data) return NULL;
    output = (float *) stbi__malloc_mad4(x, y, comp, sizeof(float), 0);
-   if (output == NULL) { STBI_FREE(data); return stbi__errpf("outofmem", "Out of memory"); }
+   if (output == NULL) { stbi__free(data); return stbi__errpf("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -1874,7 +2310,7 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
          output[i*comp + n] = data[i*comp + n]/255.0f;
       }
    }
-   STBI_FREE(data);
+   stbi__free(data);
    return output;
 }
 #endif
@@ -1887,7 +2323,7 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
    stbi_uc *output;
    if (!data) return NULL;
    output = (stbi_uc *) stbi__malloc_mad3(x, y, comp, 0);
-   if (output == NULL) { STBI_FREE(data); return stbi__errpuc("outofmem", "Out of memory"); }
+   if (output == NULL) { stbi__free(data); return stbi__errpuc("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -1904,7 +2340,7 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
          output[i*comp + k] = (stbi_uc) stbi__float2int(z);
       }
    }
-   STBI_FREE(data);
+   stbi__free(data);
    return output;
 }
 #endif
@@ -1933,7 +2369,7 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
 #ifndef STBI_NO_JPEG
 
 // huffman decoding acceleration
-#define FAST_BITS   9  // larger handles more cases; smaller stomps less cache
+#define FAST_BITS   12 // larger handles more cases; smaller stomps less cache
 
 typedef struct
 {
@@ -1976,7 +2412,7 @@ typedef struct
       int      coeff_w, coeff_h; // number of 8x8 coefficient blocks
    } img_comp[4];
 
-   stbi__uint32   code_buffer; // jpeg entropy-coded buffer
+   stbi__uint64   code_buffer; // jpeg entropy-coded buffer, MSB-aligned
    int            code_bits;   // number of valid bits
    unsigned char  marker;      // marker seen while filling entropy buffer
    int            nomore;      // flag if we saw a marker so must stop
@@ -1996,7 +2432,9 @@ typedef struct
 
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
+   void (*idct_2blocks_kernel)(stbi_uc *out0, stbi_uc *out1, int out_stride, short *data0, short *data1); // NULL if none
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
+   void (*YCbCr_to_planar_kernel)(stbi_uc *r, stbi_uc *g, stbi_uc *b, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count);
    stbi_uc *(*resample_row_hv_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
 } stbi__jpeg;
 
@@ -2074,6 +2512,24 @@ static void stbi__build_fast_ac(stbi__int16 *fast_ac, stbi__huffman *h)
 
 static void stbi__grow_buffer_unsafe(stbi__jpeg *j)
 {
+   stbi__context *s = j->s;
+   if (!j->nomore && s->img_buffer_end - s->img_buffer >= 8) {
+      // common case: none of the next 8 bytes is 0xff, so there's no byte
+      // stuffing or marker to look out for and as many as fit go in at once
+      const stbi__uint64 ones = ((stbi__uint64) 0x01010101 << 32) | 0x01010101;
+      stbi_uc *p = s->img_buffer;
+      stbi__uint64 v = ((stbi__uint64) (((stbi__uint32) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]) << 32)
+                     | (((stbi__uint32) p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7]);
+      stbi__uint64 x = ~v; // a zero byte here is an 0xff byte in the stream
+      if (((x - ones) & ~x & (ones << 7)) == 0) {
+         int n = (63 - j->code_bits) >> 3;
+         int bits = j->code_bits + n*8;
+         j->code_buffer |= (v >> j->code_bits) & ~(~(stbi__uint64) 0 >> bits);
+         j->code_bits = bits;
+         s->img_buffer += n;
+         return;
+      }
+   }
    do {
       unsigned int b = j->nomore ? 0 : stbi__get8(j->s);
       if (b == 0xff) {
@@ -2085,14 +2541,11 @@ static void stbi__grow_buffer_unsafe(stbi__jpeg *j)
             return;
          }
       }
-      j->code_buffer |= b << (24 - j->code_bits);
+      j->code_buffer |= (stbi__uint64) b << (56 - j->code_bits);
       j->code_bits += 8;
-   } while (j->code_bits <= 24);
+   } while (j->code_bits <= 56);
 }
 
-// (1 << n) - 1
-static const stbi__uint32 stbi__bmask[17]={0,1,3,7,15,31,63,127,255,511,1023,2047,4095,8191,16383,32767,65535};
-
 // decode a jpeg huffman value from the bitstream
 stbi_inline static int stbi__jpeg_huff_decode(stbi__jpeg *j, stbi__huffman *h)
 {
@@ -2103,7 +2556,7 @@ stbi_inline static int stbi__jpeg_huff_decode(stbi__jpeg *j, stbi__huffman *h)
 
    // look at the top FAST_BITS and determine what symbol ID it is,
    // if the code is <= FAST_BITS
-   c = (j->code_buffer >> (32 - FAST_BITS)) & ((1 << FAST_BITS)-1);
+   c = (int) (j->code_buffer >> (64 - FAST_BITS));
    k = h->fast[c];
    if (k < 255) {
       int s = h->size[k];
@@ -2120,7 +2573,7 @@ stbi_inline static int stbi__jpeg_huff_decode(stbi__jpeg *j, stbi__huffman *h)
    // end; in other words, regardless of the number of bits, it
    // wants to be compared against something shifted to have 16;
    // that way we don't need to shift inside the loop.
-   temp = j->code_buffer >> 16;
+   temp = (unsigned int) (j->code_buffer >> 48);
    for (k=FAST_BITS+1 ; ; ++k)
       if (temp < h->maxcode[k])
          break;
@@ -2134,10 +2587,10 @@ stbi_inline static int stbi__jpeg_huff_decode(stbi__jpeg *j, stbi__huffman *h)
       return -1;
 
    // convert the huffman code to the symbol id
-   c = ((j->code_buffer >> (32 - k)) & stbi__bmask[k]) + h->delta[k];
+   c = (int) (j->code_buffer >> (64 - k)) + h->delta[k];
    if(c < 0 || c >= 256) // symbol id out of bounds!
        return -1;
-   STBI_ASSERT((((j->code_buffer) >> (32 - h->size[c])) & stbi__bmask[h->size[c]]) == h->code[c]);
+   STBI_ASSERT((j->code_buffer >> (64 - h->size[c])) == h->code[c]);
 
    // convert the id to a symbol
    j->code_bits -= k;
@@ -2157,10 +2610,9 @@ stbi_inline static int stbi__extend_receive(stbi__jpeg *j, int n)
    if (j->code_bits < n) stbi__grow_buffer_unsafe(j);
    if (j->code_bits < n) return 0; // ran out of bits from stream, return 0s intead of continuing
 
-   sgn = j->code_buffer >> 31; // sign bit always in MSB; 0 if MSB clear (positive), 1 if MSB set (negative)
-   k = stbi_lrot(j->code_buffer, n);
-   j->code_buffer = k & ~stbi__bmask[n];
-   k &= stbi__bmask[n];
+   sgn = (int) (j->code_buffer >> 63); // sign bit always in MSB; 0 if MSB clear (positive), 1 if MSB set (negative)
+   k = (unsigned int) (j->code_buffer >> (64 - n));
+   j->code_buffer <<= n;
    j->code_bits -= n;
    return k + (stbi__jbias[n] & (sgn - 1));
 }
@@ -2171,22 +2623,21 @@ stbi_inline static int stbi__jpeg_get_bits(stbi__jpeg *j, int n)
    unsigned int k;
    if (j->code_bits < n) stbi__grow_buffer_unsafe(j);
    if (j->code_bits < n) return 0; // ran out of bits from stream, return 0s intead of continuing
-   k = stbi_lrot(j->code_buffer, n);
-   j->code_buffer = k & ~stbi__bmask[n];
-   k &= stbi__bmask[n];
+   k = (unsigned int) (j->code_buffer >> (64 - n));
+   j->code_buffer <<= n;
    j->code_bits -= n;
    return k;
 }
 
 stbi_inline static int stbi__jpeg_get_bit(stbi__jpeg *j)
 {
-   unsigned int k;
+   int k;
    if (j->code_bits < 1) stbi__grow_buffer_unsafe(j);
    if (j->code_bits < 1) return 0; // ran out of bits from stream, return 0s intead of continuing
-   k = j->code_buffer;
+   k = (int) (j->code_buffer >> 63);
    j->code_buffer <<= 1;
    --j->code_bits;
-   return k & 0x80000000;
+   return k;
 }
 
 // given a value that's at position X in the zigzag stream,
@@ -2232,7 +2683,7 @@ static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman
       unsigned int zig;
       int c,r,s;
       if (j->code_bits < 16) stbi__grow_buffer_unsafe(j);
-      c = (j->code_buffer >> (32 - FAST_BITS)) & ((1 << FAST_BITS)-1);
+      c = (int) (j->code_buffer >> (64 - FAST_BITS));
       r = fac[c];
       if (r) { // fast-AC path
          k += (r >> 4) & 15; // run
@@ -2310,7 +2761,7 @@ static int stbi__jpeg_decode_block_prog_ac(stbi__jpeg *j, short data[64], stbi__
          unsigned int zig;
          int c,r,s;
          if (j->code_bits < 16) stbi__grow_buffer_unsafe(j);
-         c = (j->code_buffer >> (32 - FAST_BITS)) & ((1 << FAST_BITS)-1);
+         c = (int) (j->code_buffer >> (64 - FAST_BITS));
          r = fac[c];
          if (r) { // fast-AC path
             k += (r >> 4) & 15; // run
@@ -2639,19 +3090,204 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
    dct_pass(bias_0, 10);
 
    {
-      // 16bit 8x8 transpose pass 1
+      // 16bit 8x8 transpose pass 1
+      dct_interleave16(row0, row4);
+      dct_interleave16(row1, row5);
+      dct_interleave16(row2, row6);
+      dct_interleave16(row3, row7);
+
+      // transpose pass 2
+      dct_interleave16(row0, row2);
+      dct_interleave16(row1, row3);
+      dct_interleave16(row4, row6);
+      dct_interleave16(row5, row7);
+
+      // transpose pass 3
+      dct_interleave16(row0, row1);
+      dct_interleave16(row2, row3);
+      dct_interleave16(row4, row5);
+      dct_interleave16(row6, row7);
+   }
+
+   // row pass
+   dct_pass(bias_1, 17);
+
+   {
+      // pack
+      __m128i p0 = _mm_packus_epi16(row0, row1); // a0a1a2a3...a7b0b1b2b3...b7
+      __m128i p1 = _mm_packus_epi16(row2, row3);
+      __m128i p2 = _mm_packus_epi16(row4, row5);
+      __m128i p3 = _mm_packus_epi16(row6, row7);
+
+      // 8bit 8x8 transpose pass 1
+      dct_interleave8(p0, p2); // a0e0a1e1...
+      dct_interleave8(p1, p3); // c0g0c1g1...
+
+      // transpose pass 2
+      dct_interleave8(p0, p1); // a0c0e0g0...
+      dct_interleave8(p2, p3); // b0d0f0h0...
+
+      // transpose pass 3
+      dct_interleave8(p0, p2); // a0b0c0d0...
+      dct_interleave8(p1, p3); // a4b4c4d4...
+
+      // store
+      _mm_storel_epi64((__m128i *) out, p0); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p0, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p2); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p2, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p1); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p1, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p3); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p3, 0x4e));
+   }
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_wadd
+#undef dct_wsub
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+}
+
+#endif // STBI_SSE2
+
+#ifdef STBI_AVX2
+// the sse2 IDCT above at twice the width, doing two blocks at once. every
+// step of it stays inside a 128-bit lane, so lane 0 carries data0 and
+// lane 1 data1, and the results are the same bit-identical ones.
+STBI_AVX2_TARGET
+static void stbi__idct_2blocks_avx2(stbi_uc *out0, stbi_uc *out1, int out_stride, short *data0, short *data1)
+{
+   __m256i row0, row1, row2, row3, row4, row5, row6, row7;
+   __m256i tmp;
+
+   #define dct_const(x,y)  _mm256_set1_epi32((int) (((unsigned int) (y) << 16) | ((x) & 0xffff)))
+
+   #define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##lo = _mm256_unpacklo_epi16((x),(y)); \
+      __m256i c0##hi = _mm256_unpackhi_epi16((x),(y)); \
+      __m256i out0##_l = _mm256_madd_epi16(c0##lo, c0); \
+      __m256i out0##_h = _mm256_madd_epi16(c0##hi, c0); \
+      __m256i out1##_l = _mm256_madd_epi16(c0##lo, c1); \
+      __m256i out1##_h = _mm256_madd_epi16(c0##hi, c1)
+
+   #define dct_widen(out, in) \
+      __m256i out##_l = _mm256_srai_epi32(_mm256_unpacklo_epi16(_mm256_setzero_si256(), (in)), 4); \
+      __m256i out##_h = _mm256_srai_epi32(_mm256_unpackhi_epi16(_mm256_setzero_si256(), (in)), 4)
+
+   #define dct_wadd(out, a, b) \
+      __m256i out##_l = _mm256_add_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_add_epi32(a##_h, b##_h)
+
+   #define dct_wsub(out, a, b) \
+      __m256i out##_l = _mm256_sub_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_sub_epi32(a##_h, b##_h)
+
+   #define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased_l = _mm256_add_epi32(a##_l, bias); \
+         __m256i abiased_h = _mm256_add_epi32(a##_h, bias); \
+         dct_wadd(sum, abiased, b); \
+         dct_wsub(dif, abiased, b); \
+         out0 = _mm256_packs_epi32(_mm256_srai_epi32(sum_l, s), _mm256_srai_epi32(sum_h, s)); \
+         out1 = _mm256_packs_epi32(_mm256_srai_epi32(dif_l, s), _mm256_srai_epi32(dif_h, s)); \
+      }
+
+   #define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi8(a, b); \
+      b = _mm256_unpackhi_epi8(tmp, b)
+
+   #define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi16(a, b); \
+      b = _mm256_unpackhi_epi16(tmp, b)
+
+   #define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m256i sum04 = _mm256_add_epi16(row0, row4); \
+         __m256i dif04 = _mm256_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         dct_wadd(x0, t0e, t3e); \
+         dct_wsub(x3, t0e, t3e); \
+         dct_wadd(x1, t1e, t2e); \
+         dct_wsub(x2, t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m256i sum17 = _mm256_add_epi16(row1, row7); \
+         __m256i sum35 = _mm256_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         dct_wadd(x4, y0o, y4o); \
+         dct_wadd(x5, y1o, y5o); \
+         dct_wadd(x6, y2o, y5o); \
+         dct_wadd(x7, y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+   // block 0 in the low lane, block 1 in the high lane
+   #define dct_load(r) \
+      _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) (data0 + (r)*8))), \
+                              _mm_loadu_si128((const __m128i *) (data1 + (r)*8)), 1)
+
+   // same store sequence as the sse2 version, one block's lane at a time
+   #define dct_store(out, p0,p1,p2,p3) \
+      _mm_storel_epi64((__m128i *) out, p0); out += out_stride; \
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p0, 0x4e)); out += out_stride; \
+      _mm_storel_epi64((__m128i *) out, p2); out += out_stride; \
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p2, 0x4e)); out += out_stride; \
+      _mm_storel_epi64((__m128i *) out, p1); out += out_stride; \
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p1, 0x4e)); out += out_stride; \
+      _mm_storel_epi64((__m128i *) out, p3); out += out_stride; \
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p3, 0x4e))
+
+   __m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+   __m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f( 0.765366865f), stbi__f2f(0.5411961f));
+   __m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+   __m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+   __m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f( 0.298631336f), stbi__f2f(-1.961570560f));
+   __m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f( 3.072711026f));
+   __m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f( 2.053119869f), stbi__f2f(-0.390180644f));
+   __m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f( 1.501321110f));
+
+   // rounding biases in column/row passes, see stbi__idct_block for explanation.
+   __m256i bias_0 = _mm256_set1_epi32(512);
+   __m256i bias_1 = _mm256_set1_epi32(65536 + (128<<17));
+
+   row0 = dct_load(0);
+   row1 = dct_load(1);
+   row2 = dct_load(2);
+   row3 = dct_load(3);
+   row4 = dct_load(4);
+   row5 = dct_load(5);
+   row6 = dct_load(6);
+   row7 = dct_load(7);
+
+   // column pass
+   dct_pass(bias_0, 10);
+
+   {
+      // 16bit 8x8 transpose
       dct_interleave16(row0, row4);
       dct_interleave16(row1, row5);
       dct_interleave16(row2, row6);
       dct_interleave16(row3, row7);
 
-      // transpose pass 2
       dct_interleave16(row0, row2);
       dct_interleave16(row1, row3);
       dct_interleave16(row4, row6);
       dct_interleave16(row5, row7);
 
-      // transpose pass 3
       dct_interleave16(row0, row1);
       dct_interleave16(row2, row3);
       dct_interleave16(row4, row5);
@@ -2663,32 +3299,26 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 
    {
       // pack
-      __m128i p0 = _mm_packus_epi16(row0, row1); // a0a1a2a3...a7b0b1b2b3...b7
-      __m128i p1 = _mm_packus_epi16(row2, row3);
-      __m128i p2 = _mm_packus_epi16(row4, row5);
-      __m128i p3 = _mm_packus_epi16(row6, row7);
+      __m256i p0 = _mm256_packus_epi16(row0, row1);
+      __m256i p1 = _mm256_packus_epi16(row2, row3);
+      __m256i p2 = _mm256_packus_epi16(row4, row5);
+      __m256i p3 = _mm256_packus_epi16(row6, row7);
 
-      // 8bit 8x8 transpose pass 1
-      dct_interleave8(p0, p2); // a0e0a1e1...
-      dct_interleave8(p1, p3); // c0g0c1g1...
+      // 8bit 8x8 transpose
+      dct_interleave8(p0, p2);
+      dct_interleave8(p1, p3);
 
-      // transpose pass 2
-      dct_interleave8(p0, p1); // a0c0e0g0...
-      dct_interleave8(p2, p3); // b0d0f0h0...
+      dct_interleave8(p0, p1);
+      dct_interleave8(p2, p3);
 
-      // transpose pass 3
-      dct_interleave8(p0, p2); // a0b0c0d0...
-      dct_interleave8(p1, p3); // a4b4c4d4...
+      dct_interleave8(p0, p2);
+      dct_interleave8(p1, p3);
 
       // store
-      _mm_storel_epi64((__m128i *) out, p0); out += out_stride;
-      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p0, 0x4e)); out += out_stride;
-      _mm_storel_epi64((__m128i *) out, p2); out += out_stride;
-      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p2, 0x4e)); out += out_stride;
-      _mm_storel_epi64((__m128i *) out, p1); out += out_stride;
-      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p1, 0x4e)); out += out_stride;
-      _mm_storel_epi64((__m128i *) out, p3); out += out_stride;
-      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p3, 0x4e));
+      dct_store(out0, _mm256_castsi256_si128(p0), _mm256_castsi256_si128(p1),
+                      _mm256_castsi256_si128(p2), _mm256_castsi256_si128(p3));
+      dct_store(out1, _mm256_extracti128_si256(p0, 1), _mm256_extracti128_si256(p1, 1),
+                      _mm256_extracti128_si256(p2, 1), _mm256_extracti128_si256(p3, 1));
    }
 
 #undef dct_const
@@ -2700,9 +3330,10 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 #undef dct_interleave8
 #undef dct_interleave16
 #undef dct_pass
+#undef dct_load
+#undef dct_store
 }
-
-#endif // STBI_SSE2
+#endif // STBI_AVX2
 
 #ifdef STBI_NEON
 
@@ -2952,7 +3583,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
    if (!z->progressive) {
       if (z->scan_n == 1) {
          int i,j;
-         STBI_SIMD_ALIGN(short, data[64]);
+         STBI_SIMD_ALIGN(short, data[128]);
          int n = z->order[0];
          // non-interleaved data, we just need to process one block at a time,
          // in trivial scanline order
@@ -2963,8 +3594,17 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
          for (j=0; j < h; ++j) {
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
+               stbi_uc *out = z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               if (z->idct_2blocks_kernel && i+1 < w && z->todo > 1) {
+                  // pair up with the next block when no restart falls between them
+                  if (!stbi__jpeg_decode_block(z, data+64, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                  z->idct_2blocks_kernel(out, out+8, z->img_comp[n].w2, data, data+64);
+                  --z->todo;
+                  ++i;
+               } else {
+                  z->idct_block_kernel(out, z->img_comp[n].w2, data);
+               }
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2978,7 +3618,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
          return 1;
       } else { // interleaved
          int i,j,k,x,y;
-         STBI_SIMD_ALIGN(short, data[64]);
+         STBI_SIMD_ALIGN(short, data[128]);
          for (j=0; j < z->img_mcu_y; ++j) {
             for (i=0; i < z->img_mcu_x; ++i) {
                // scan an interleaved mcu... process scan_n components in order
@@ -2991,8 +3631,15 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                         int x2 = (i*z->img_comp[n].h + x)*8;
                         int y2 = (j*z->img_comp[n].v + y)*8;
                         int ha = z->img_comp[n].ha;
+                        stbi_uc *out = z->img_comp[n].data+z->img_comp[n].w2*y2+x2;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        if (z->idct_2blocks_kernel && x+1 < z->img_comp[n].h) {
+                           if (!stbi__jpeg_decode_block(z, data+64, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                           z->idct_2blocks_kernel(out, out+8, z->img_comp[n].w2, data, data+64);
+                           ++x;
+                        } else {
+                           z->idct_block_kernel(out, z->img_comp[n].w2, data);
+                        }
                      }
                   }
                }
@@ -3088,8 +3735,15 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
          for (j=0; j < h; ++j) {
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+               stbi_uc *out = z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8;
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               if (z->idct_2blocks_kernel && i+1 < w) {
+                  stbi__jpeg_dequantize(data+64, z->dequant[z->img_comp[n].tq]);
+                  z->idct_2blocks_kernel(out, out+8, z->img_comp[n].w2, data, data+64);
+                  ++i;
+               } else {
+                  z->idct_block_kernel(out, z->img_comp[n].w2, data);
+               }
             }
          }
       }
@@ -3244,17 +3898,17 @@ static int stbi__free_jpeg_components(stbi__jpeg *z, int ncomp, int why)
    int i;
    for (i=0; i < ncomp; ++i) {
       if (z->img_comp[i].raw_data) {
-         STBI_FREE(z->img_comp[i].raw_data);
+         stbi__free(z->img_comp[i].raw_data);
          z->img_comp[i].raw_data = NULL;
          z->img_comp[i].data = NULL;
       }
       if (z->img_comp[i].raw_coeff) {
-         STBI_FREE(z->img_comp[i].raw_coeff);
+         stbi__free(z->img_comp[i].raw_coeff);
          z->img_comp[i].raw_coeff = 0;
          z->img_comp[i].coeff = 0;
       }
       if (z->img_comp[i].linebuf) {
-         STBI_FREE(z->img_comp[i].linebuf);
+         stbi__free(z->img_comp[i].linebuf);
          z->img_comp[i].linebuf = NULL;
       }
    }
@@ -3293,9 +3947,12 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       z->img_comp[i].tq = stbi__get8(s);  if (z->img_comp[i].tq > 3) return stbi__err("bad TQ","Corrupt JPEG");
    }
 
-   if (scan != STBI__SCAN_load) return 1;
+   if (scan != STBI__SCAN_load && scan != STBI__SCAN_stream) return 1;
 
-   if (!stbi__mad3sizes_valid(s->img_x, s->img_y, s->img_n, 0)) return stbi__err("too large", "Image too large to decode");
+   // a stream only ever holds two MCU rows, so only whole-image loads need the size check
+   if (scan == STBI__SCAN_stream) {
+      if (z->progressive) return stbi__err("progressive jpeg","JPEG format not supported for streaming: progressive");
+   } else if (!stbi__mad3sizes_valid(s->img_x, s->img_y, s->img_n, 0)) return stbi__err("too large", "Image too large to decode");
 
    for (i=0; i < s->img_n; ++i) {
       if (z->img_comp[i].h > h_max) h_max = z->img_comp[i].h;
@@ -3334,9 +3991,12 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
-      z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
+      z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, scan == STBI__SCAN_stream ? z->img_comp[i].v * 16 : z->img_comp[i].h2, 15);
       if (z->img_comp[i].raw_data == NULL)
          return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
+      // blocks a truncated scan never reaches decode as zero rather than
+      // as whatever a recycled stbi_decoder block held
+      memset(z->img_comp[i].raw_data, 0, (size_t) z->img_comp[i].w2 * (scan == STBI__SCAN_stream ? z->img_comp[i].v * 16 : z->img_comp[i].h2) + 15);
       // align blocks for idct using mmx/sse
       z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       if (z->progressive) {
@@ -3346,6 +4006,7 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
          z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
+         memset(z->img_comp[i].raw_coeff, 0, (size_t) z->img_comp[i].w2 * z->img_comp[i].h2 * sizeof(short) + 15);
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
       }
    }
@@ -3643,6 +4304,70 @@ static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stb
 }
 #endif
 
+#ifdef STBI_AVX2
+// the sse2 loop above on 16 pixels at a time
+STBI_AVX2_TARGET
+static stbi_uc *stbi__resample_row_hv_2_avx2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+   int i=0,t0,t1;
+
+   if (w == 1) {
+      out[0] = out[1] = stbi__div4(3*in_near[0] + in_far[0] + 2);
+      return out;
+   }
+
+   t1 = 3*in_near[0] + in_far[0];
+   for (; i < ((w-1) & ~15); i += 16) {
+      // vertical pass, 3*x + y = 4*x + (y - x)
+      __m256i farw  = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_far + i)));
+      __m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_near + i)));
+      __m256i diff  = _mm256_sub_epi16(farw, nearw);
+      __m256i nears = _mm256_slli_epi16(nearw, 2);
+      __m256i curr  = _mm256_add_epi16(nears, diff);
+
+      // prev/next are curr shifted by one pixel; the shift crosses the two
+      // 128-bit lanes, hence the permute feeding each alignr
+      __m256i prv0 = _mm256_alignr_epi8(curr, _mm256_permute2x128_si256(curr, curr, 0x08), 14);
+      __m256i nxt0 = _mm256_alignr_epi8(_mm256_permute2x128_si256(curr, curr, 0x81), curr, 2);
+      __m256i prev = _mm256_insert_epi16(prv0, t1, 0);
+      __m256i next = _mm256_insert_epi16(nxt0, 3*in_near[i+16] + in_far[i+16], 15);
+
+      // horizontal pass, polyphase as in the sse2 version
+      __m256i bias = _mm256_set1_epi16(8);
+      __m256i curs = _mm256_slli_epi16(curr, 2);
+      __m256i prvd = _mm256_sub_epi16(prev, curr);
+      __m256i nxtd = _mm256_sub_epi16(next, curr);
+      __m256i curb = _mm256_add_epi16(curs, bias);
+      __m256i even = _mm256_add_epi16(prvd, curb);
+      __m256i odd  = _mm256_add_epi16(nxtd, curb);
+
+      // interleave and undo scaling; per-lane unpack/pack leaves the
+      // 32 output bytes in order
+      __m256i de0  = _mm256_srli_epi16(_mm256_unpacklo_epi16(even, odd), 4);
+      __m256i de1  = _mm256_srli_epi16(_mm256_unpackhi_epi16(even, odd), 4);
+      _mm256_storeu_si256((__m256i *) (out + i*2), _mm256_packus_epi16(de0, de1));
+
+      t1 = 3*in_near[i+15] + in_far[i+15];
+   }
+
+   t0 = t1;
+   t1 = 3*in_near[i] + in_far[i];
+   out[i*2] = stbi__div16(3*t1 + t0 + 8);
+
+   for (++i; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = stbi__div16(3*t0 + t1 + 8);
+      out[i*2  ] = stbi__div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = stbi__div4(t1+2);
+
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+#endif
+
 static stbi_uc *stbi__resample_row_generic(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
 {
    // resample with nearest-neighbor
@@ -3657,7 +4382,10 @@ static stbi_uc *stbi__resample_row_generic(stbi_uc *out, stbi_uc *in_near, stbi_
 // this is a reduced-precision calculation of YCbCr-to-RGB introduced
 // to make sure the code produces the same results in both SIMD and scalar
 #define stbi__float2fixed(x)  (((int) ((x) * 4096.0f + 0.5f)) << 8)
-static void stbi__YCbCr_to_RGB_row(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step)
+// the one scalar conversion, writing channel c of pixel i to its pointer at
+// [i*step]; the interleaved and planar kernels and the simd row ends all go
+// through it, so every path rounds the same way
+static void stbi__YCbCr_to_RGB_strided(stbi_uc *pr, stbi_uc *pg, stbi_uc *pb, int step, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count)
 {
    int i;
    for (i=0; i < count; ++i) {
@@ -3674,15 +4402,111 @@ static void stbi__YCbCr_to_RGB_row(stbi_uc *out, const stbi_uc *y, const stbi_uc
       if ((unsigned) r > 255) { if (r < 0) r = 0; else r = 255; }
       if ((unsigned) g > 255) { if (g < 0) g = 0; else g = 255; }
       if ((unsigned) b > 255) { if (b < 0) b = 0; else b = 255; }
-      out[0] = (stbi_uc)r;
-      out[1] = (stbi_uc)g;
-      out[2] = (stbi_uc)b;
-      out[3] = 255;
-      out += step;
+      pr[i*step] = (stbi_uc)r;
+      pg[i*step] = (stbi_uc)g;
+      pb[i*step] = (stbi_uc)b;
    }
 }
 
+static void stbi__YCbCr_to_RGB_row(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step)
+{
+   int i;
+   stbi__YCbCr_to_RGB_strided(out, out+1, out+2, step, y, pcb, pcr, count);
+   if (step == 4)
+      for (i=0; i < count; ++i)
+         out[i*4+3] = 255;
+}
+
+// same conversion, writing each channel to its own plane
+static void stbi__YCbCr_to_planar_row(stbi_uc *r, stbi_uc *g, stbi_uc *b, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count)
+{
+   stbi__YCbCr_to_RGB_strided(r, g, b, 1, y, pcb, pcr, count);
+}
+
 #if defined(STBI_SSE2) || defined(STBI_NEON)
+// planar output needs no interleave, so every lane of the transform is a
+// pixel and each plane takes one full-width store. the 4096-scale constants
+// are stbi__float2fixed's, and every lane equals the scalar row's result
+static void stbi__YCbCr_to_planar_simd(stbi_uc *r, stbi_uc *g, stbi_uc *b, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count)
+{
+   int i = 0;
+
+#ifdef STBI_SSE2
+   __m128i signflip  = _mm_set1_epi8(-0x80);
+   __m128i cr_const0 = _mm_set1_epi16(   (short) ( 1.40200f*4096.0f+0.5f));
+   __m128i cr_const1 = _mm_set1_epi16( - (short) ( 0.71414f*4096.0f+0.5f));
+   __m128i cb_const0 = _mm_set1_epi16( - (short) ( 0.34414f*4096.0f+0.5f));
+   __m128i cb_const1 = _mm_set1_epi16(   (short) ( 1.77200f*4096.0f+0.5f));
+   __m128i y_bias = _mm_set1_epi8((char) (unsigned char) 128);
+
+   for (; i+15 < count; i += 16) {
+      __m128i y_bytes = _mm_loadu_si128((__m128i *) (y+i));
+      __m128i cr_biased = _mm_xor_si128(_mm_loadu_si128((__m128i *) (pcr+i)), signflip); // -128
+      __m128i cb_biased = _mm_xor_si128(_mm_loadu_si128((__m128i *) (pcb+i)), signflip); // -128
+      __m128i rw[2], gw[2], bw[2];
+      int h;
+
+      for (h=0; h < 2; ++h) {
+         // unpack to short (and left-shift cr, cb by 8)
+         __m128i yw  = h ? _mm_unpackhi_epi8(y_bias, y_bytes) : _mm_unpacklo_epi8(y_bias, y_bytes);
+         __m128i crw = h ? _mm_unpackhi_epi8(_mm_setzero_si128(), cr_biased) : _mm_unpacklo_epi8(_mm_setzero_si128(), cr_biased);
+         __m128i cbw = h ? _mm_unpackhi_epi8(_mm_setzero_si128(), cb_biased) : _mm_unpacklo_epi8(_mm_setzero_si128(), cb_biased);
+
+         // color transform
+         __m128i yws = _mm_srli_epi16(yw, 4);
+         __m128i cr0 = _mm_mulhi_epi16(cr_const0, crw);
+         __m128i cb0 = _mm_mulhi_epi16(cb_const0, cbw);
+         __m128i cb1 = _mm_mulhi_epi16(cbw, cb_const1);
+         __m128i cr1 = _mm_mulhi_epi16(crw, cr_const1);
+         __m128i rws = _mm_add_epi16(cr0, yws);
+         __m128i gwt = _mm_add_epi16(cb0, yws);
+         __m128i bws = _mm_add_epi16(yws, cb1);
+         __m128i gws = _mm_add_epi16(gwt, cr1);
+
+         // descale
+         rw[h] = _mm_srai_epi16(rws, 4);
+         gw[h] = _mm_srai_epi16(gws, 4);
+         bw[h] = _mm_srai_epi16(bws, 4);
+      }
+
+      _mm_storeu_si128((__m128i *) (r+i), _mm_packus_epi16(rw[0], rw[1]));
+      _mm_storeu_si128((__m128i *) (g+i), _mm_packus_epi16(gw[0], gw[1]));
+      _mm_storeu_si128((__m128i *) (b+i), _mm_packus_epi16(bw[0], bw[1]));
+   }
+#endif
+
+#ifdef STBI_NEON
+   uint8x8_t signflip = vdup_n_u8(0x80);
+   int16x8_t cr_const0 = vdupq_n_s16(   (short) ( 1.40200f*4096.0f+0.5f));
+   int16x8_t cr_const1 = vdupq_n_s16( - (short) ( 0.71414f*4096.0f+0.5f));
+   int16x8_t cb_const0 = vdupq_n_s16( - (short) ( 0.34414f*4096.0f+0.5f));
+   int16x8_t cb_const1 = vdupq_n_s16(   (short) ( 1.77200f*4096.0f+0.5f));
+
+   for (; i+7 < count; i += 8) {
+      uint8x8_t y_bytes  = vld1_u8(y + i);
+      uint8x8_t cr_bytes = vld1_u8(pcr + i);
+      uint8x8_t cb_bytes = vld1_u8(pcb + i);
+      int8x8_t cr_biased = vreinterpret_s8_u8(vsub_u8(cr_bytes, signflip));
+      int8x8_t cb_biased = vreinterpret_s8_u8(vsub_u8(cb_bytes, signflip));
+
+      int16x8_t yws = vreinterpretq_s16_u16(vshll_n_u8(y_bytes, 4));
+      int16x8_t crw = vshll_n_s8(cr_biased, 7);
+      int16x8_t cbw = vshll_n_s8(cb_biased, 7);
+
+      int16x8_t cr0 = vqdmulhq_s16(crw, cr_const0);
+      int16x8_t cb0 = vqdmulhq_s16(cbw, cb_const0);
+      int16x8_t cr1 = vqdmulhq_s16(crw, cr_const1);
+      int16x8_t cb1 = vqdmulhq_s16(cbw, cb_const1);
+
+      vst1_u8(r + i, vqrshrun_n_s16(vaddq_s16(yws, cr0), 4));
+      vst1_u8(g + i, vqrshrun_n_s16(vaddq_s16(vaddq_s16(yws, cb0), cr1), 4));
+      vst1_u8(b + i, vqrshrun_n_s16(vaddq_s16(yws, cb1), 4));
+   }
+#endif
+
+   stbi__YCbCr_to_planar_row(r+i, g+i, b+i, y+i, pcb+i, pcr+i, count-i);
+}
+
 static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
 {
    int i = 0;
@@ -3794,26 +4618,91 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
    }
 #endif
 
-   for (; i < count; ++i) {
-      int y_fixed = (y[i] << 20) + (1<<19); // rounding
-      int r,g,b;
-      int cr = pcr[i] - 128;
-      int cb = pcb[i] - 128;
-      r = y_fixed + cr* stbi__float2fixed(1.40200f);
-      g = y_fixed + cr*-stbi__float2fixed(0.71414f) + ((cb*-stbi__float2fixed(0.34414f)) & 0xffff0000);
-      b = y_fixed                                   +   cb* stbi__float2fixed(1.77200f);
-      r >>= 20;
-      g >>= 20;
-      b >>= 20;
-      if ((unsigned) r > 255) { if (r < 0) r = 0; else r = 255; }
-      if ((unsigned) g > 255) { if (g < 0) g = 0; else g = 255; }
-      if ((unsigned) b > 255) { if (b < 0) b = 0; else b = 255; }
-      out[0] = (stbi_uc)r;
-      out[1] = (stbi_uc)g;
-      out[2] = (stbi_uc)b;
-      out[3] = 255;
-      out += step;
+   stbi__YCbCr_to_RGB_row(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+#endif
+
+#ifdef STBI_AVX2
+// 16 pixels per step of the sse2 step == 4 loop, and of step == 3 too, since
+// that's what an RGB decode asks for; the rest goes to the sse2 kernel
+STBI_AVX2_TARGET
+static void stbi__YCbCr_to_RGB_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+{
+   int i = 0;
+   if (step == 3 || step == 4) {
+      // drops the x byte of each rgbx pixel, per 128-bit lane
+      __m256i rgb_only = _mm256_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1,
+                                          0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+      __m128i signflip  = _mm_set1_epi8(-0x80);
+      __m256i cr_const0 = _mm256_set1_epi16(   (short) ( 1.40200f*4096.0f+0.5f));
+      __m256i cr_const1 = _mm256_set1_epi16( - (short) ( 0.71414f*4096.0f+0.5f));
+      __m256i cb_const0 = _mm256_set1_epi16( - (short) ( 0.34414f*4096.0f+0.5f));
+      __m256i cb_const1 = _mm256_set1_epi16(   (short) ( 1.77200f*4096.0f+0.5f));
+      __m256i y_bias = _mm256_set1_epi16(128);
+      __m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+      for (; i+15 < count; i += 16) {
+         // load
+         __m128i y_bytes = _mm_loadu_si128((__m128i *) (y+i));
+         __m128i cr_biased = _mm_xor_si128(_mm_loadu_si128((__m128i *) (pcr+i)), signflip); // -128
+         __m128i cb_biased = _mm_xor_si128(_mm_loadu_si128((__m128i *) (pcb+i)), signflip); // -128
+
+         // widen to short: y<<8 | 128, and cr, cb left-shifted by 8
+         __m256i yw  = _mm256_or_si256(_mm256_slli_epi16(_mm256_cvtepu8_epi16(y_bytes), 8), y_bias);
+         __m256i crw = _mm256_slli_epi16(_mm256_cvtepu8_epi16(cr_biased), 8);
+         __m256i cbw = _mm256_slli_epi16(_mm256_cvtepu8_epi16(cb_biased), 8);
+
+         // color transform
+         __m256i yws = _mm256_srli_epi16(yw, 4);
+         __m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+         __m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+         __m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+         __m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+         __m256i rws = _mm256_add_epi16(cr0, yws);
+         __m256i gwt = _mm256_add_epi16(cb0, yws);
+         __m256i bws = _mm256_add_epi16(yws, cb1);
+         __m256i gws = _mm256_add_epi16(gwt, cr1);
+
+         // descale
+         __m256i rw = _mm256_srai_epi16(rws, 4);
+         __m256i bw = _mm256_srai_epi16(bws, 4);
+         __m256i gw = _mm256_srai_epi16(gws, 4);
+
+         // back to byte and interleave; each lane ends up holding pixels
+         // 0-3/8-11 (o0) and 4-7/12-15 (o1), so swap lane halves to store
+         __m256i brb = _mm256_packus_epi16(rw, bw);
+         __m256i gxb = _mm256_packus_epi16(gw, xw);
+         __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+         __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+         __m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+         __m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+         __m256i p0 = _mm256_permute2x128_si256(o0, o1, 0x20); // pixels 0-7
+         __m256i p1 = _mm256_permute2x128_si256(o0, o1, 0x31); // pixels 8-15
+
+         // store
+         if (step == 4) {
+            _mm256_storeu_si256((__m256i *) (out + 0), p0);
+            _mm256_storeu_si256((__m256i *) (out + 32), p1);
+            out += 64;
+         } else {
+            // four 12-byte groups; each 16-byte store's last 4 bytes are
+            // overwritten by the next, and the last group is stored as 8+4
+            __m128i g3;
+            int tail;
+            p0 = _mm256_shuffle_epi8(p0, rgb_only);
+            p1 = _mm256_shuffle_epi8(p1, rgb_only);
+            g3 = _mm256_extracti128_si256(p1, 1);
+            _mm_storeu_si128((__m128i *) (out + 0), _mm256_castsi256_si128(p0));
+            _mm_storeu_si128((__m128i *) (out + 12), _mm256_extracti128_si256(p0, 1));
+            _mm_storeu_si128((__m128i *) (out + 24), _mm256_castsi256_si128(p1));
+            _mm_storel_epi64((__m128i *) (out + 36), g3);
+            tail = _mm_cvtsi128_si32(_mm_srli_si128(g3, 8));
+            memcpy(out + 44, &tail, 4);
+            out += 48;
+         }
+      }
    }
+   stbi__YCbCr_to_RGB_simd(out, y+i, pcb+i, pcr+i, count-i, step);
 }
 #endif
 
@@ -3821,20 +4710,32 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
    j->idct_block_kernel = stbi__idct_block;
+   j->idct_2blocks_kernel = NULL;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
+   j->YCbCr_to_planar_kernel = stbi__YCbCr_to_planar_row;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
 
 #ifdef STBI_SSE2
    if (stbi__sse2_available()) {
       j->idct_block_kernel = stbi__idct_simd;
       j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
+      j->YCbCr_to_planar_kernel = stbi__YCbCr_to_planar_simd;
       j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
    }
 #endif
 
+#ifdef STBI_AVX2
+   if (stbi__avx2_available()) {
+      j->idct_2blocks_kernel = stbi__idct_2blocks_avx2;
+      j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+      j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+   }
+#endif
+
 #ifdef STBI_NEON
    j->idct_block_kernel = stbi__idct_simd;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
+   j->YCbCr_to_planar_kernel = stbi__YCbCr_to_planar_simd;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
 #endif
 }
@@ -3862,9 +4763,95 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+// color-convert one row of resampled component lines into n-channel output
+static void stbi__jpeg_convert_row(stbi__jpeg *z, stbi_uc *out, stbi_uc **coutput, int n, int is_rgb)
+{
+   unsigned int i;
+   if (n >= 3) {
+      stbi_uc *y = coutput[0];
+      if (z->s->img_n == 3) {
+         if (is_rgb) {
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = y[i];
+               out[1] = coutput[1][i];
+               out[2] = coutput[2][i];
+               out[3] = 255;
+               out += n;
+            }
+         } else {
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+         }
+      } else if (z->s->img_n == 4) {
+         if (z->app14_color_transform == 0) { // CMYK
+            for (i=0; i < z->s->img_x; ++i) {
+               stbi_uc m = coutput[3][i];
+               out[0] = stbi__blinn_8x8(coutput[0][i], m);
+               out[1] = stbi__blinn_8x8(coutput[1][i], m);
+               out[2] = stbi__blinn_8x8(coutput[2][i], m);
+               out[3] = 255;
+               out += n;
+            }
+         } else if (z->app14_color_transform == 2) { // YCCK
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            for (i=0; i < z->s->img_x; ++i) {
+               stbi_uc m = coutput[3][i];
+               out[0] = stbi__blinn_8x8(255 - out[0], m);
+               out[1] = stbi__blinn_8x8(255 - out[1], m);
+               out[2] = stbi__blinn_8x8(255 - out[2], m);
+               out += n;
+            }
+         } else { // YCbCr + alpha?  Ignore the fourth channel for now
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+         }
+      } else
+         for (i=0; i < z->s->img_x; ++i) {
+            out[0] = out[1] = out[2] = y[i];
+            out[3] = 255; // not used if n==3
+            out += n;
+         }
+   } else {
+      if (is_rgb) {
+         if (n == 1)
+            for (i=0; i < z->s->img_x; ++i)
+               *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+         else {
+            for (i=0; i < z->s->img_x; ++i, out += 2) {
+               out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+               out[1] = 255;
+            }
+         }
+      } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+         for (i=0; i < z->s->img_x; ++i) {
+            stbi_uc m = coutput[3][i];
+            stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+            stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+            stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+            out[0] = stbi__compute_y(r, g, b);
+            out[1] = 255;
+            out += n;
+         }
+      } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+         for (i=0; i < z->s->img_x; ++i) {
+            out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+            out[1] = 255;
+            out += n;
+         }
+      } else {
+         stbi_uc *y = coutput[0];
+         if (n == 1)
+            for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+         else
+            for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+      }
+   }
+}
+
+// planar: write one plane per output channel; YCbCr images go through
+// YCbCr_to_planar_kernel, anything else is converted a row at a time and
+// scattered
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp, int planar)
 {
-   int n, decode_n, is_rgb;
+   int n, decode_n, is_rgb, direct;
    z->s->img_n = 0; // make stbi__cleanup_jpeg safe
 
    // validate req_comp
@@ -3890,9 +4877,10 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    // resample and color-convert
    {
       int k;
-      unsigned int i,j;
-      stbi_uc *output;
+      unsigned int i, j;
+      stbi_uc *output, *rowbuf = NULL;
       stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+      size_t plane = (size_t) z->s->img_x * z->s->img_y;
 
       stbi__resample res_comp[4];
 
@@ -3918,13 +4906,20 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
          else                               r->resample = stbi__resample_row_generic;
       }
 
+      direct = planar && n >= 3 && z->s->img_n == 3 && !is_rgb;
+      if (planar && n > 1 && !direct) {
+         rowbuf = (stbi_uc *) stbi__malloc_mad2(n, z->s->img_x, 0);
+         if (!rowbuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+      }
+
       // can't error after this so, this is safe
       output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-      if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+      if (!output) { stbi__free(rowbuf); stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
       // now go ahead and resample
       for (j=0; j < z->s->img_y; ++j) {
          stbi_uc *out = output + n * z->s->img_x * j;
+         size_t row = (size_t) z->s->img_x * j;
          for (k=0; k < decode_n; ++k) {
             stbi__resample *r = &res_comp[k];
             int y_bot = r->ystep >= (r->vs >> 1);
@@ -3939,84 +4934,23 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
                   r->line1 += z->img_comp[k].w2;
             }
          }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
-                  out += n;
-               }
-         } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+         if (direct) {
+            z->YCbCr_to_planar_kernel(output + row, output + plane + row, output + 2*plane + row,
+                                      coutput[0], coutput[1], coutput[2], z->s->img_x);
+         } else if (rowbuf) {
+            int c;
+            stbi__jpeg_convert_row(z, rowbuf, coutput, n, is_rgb);
+            for (c=0; c < n; ++c) {
+               stbi_uc *dst = output + c*plane + row;
+               for (i=0; i < z->s->img_x; ++i)
+                  dst[i] = rowbuf[i*n + c];
             }
-         }
+         } else
+            stbi__jpeg_convert_row(z, out, coutput, n, is_rgb);
       }
+      if (direct && n == 4)
+         memset(output + 3*plane, 255, plane);
+      stbi__free(rowbuf);
       stbi__cleanup_jpeg(z);
       *out_x = z->s->img_x;
       *out_y = z->s->img_y;
@@ -4031,11 +4965,11 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
    if (!j) return stbi__errpuc("outofmem", "Out of memory");
    memset(j, 0, sizeof(stbi__jpeg));
-   STBI_NOTUSED(ri);
    j->s = s;
    stbi__setup_jpeg(j);
-   result = load_jpeg_image(j, x,y,comp,req_comp);
-   STBI_FREE(j);
+   ri->planar = stbi__planar_on_load(s);
+   result = load_jpeg_image(j, x,y,comp,req_comp,ri->planar);
+   stbi__free(j);
    return result;
 }
 
@@ -4049,7 +4983,7 @@ static int stbi__jpeg_test(stbi__context *s)
    stbi__setup_jpeg(j);
    r = stbi__decode_jpeg_header(j, STBI__SCAN_type);
    stbi__rewind(s);
-   STBI_FREE(j);
+   stbi__free(j);
    return r;
 }
 
@@ -4073,9 +5007,188 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
    memset(j, 0, sizeof(stbi__jpeg));
    j->s = s;
    result = stbi__jpeg_info_raw(j, x, y, comp);
-   STBI_FREE(j);
+   stbi__free(j);
    return result;
 }
+
+#ifndef STBI_NO_STDIO
+struct stbi__jpeg_stream
+{
+   stbi__context s;
+   stbi__jpeg j;
+   stbi__resample res_comp[4];
+   int line0[4], line1[4];  // component rows feeding the resampler
+   int n, decode_n, is_rgb;
+   int mcu_rows_done, out_row;
+   stbi_uc *rowbuf;  // one output row plus the byte the converters may write past it
+};
+
+// decode MCU row j of a baseline scan into the component rings, which hold
+// two MCU rows (v*16 lines) each
+static int stbi__jpeg_decode_mcu_row(stbi__jpeg *z, int j)
+{
+   int i,k,x,y,r;
+   STBI_SIMD_ALIGN(short, data[128]);
+   int blocks_x = z->scan_n == 1 ? (z->img_comp[z->order[0]].x+7) >> 3 : z->img_mcu_x;
+   int block_rows = 1, row = j;
+   if (z->scan_n == 1) {
+      // a lone component's blocks are each an MCU, but the MCU rows counted
+      // by the caller still span v of its block rows
+      int n = z->order[0];
+      int h = (z->img_comp[n].y+7) >> 3;
+      row = j * z->img_comp[n].v;
+      block_rows = h - row < z->img_comp[n].v ? h - row : z->img_comp[n].v;
+   }
+   for (r=0; r < block_rows; ++r, ++row)
+   for (i=0; i < blocks_x; ++i) {
+      for (k=0; k < z->scan_n; ++k) {
+         int n = z->order[k];
+         int hn = z->scan_n == 1 ? 1 : z->img_comp[n].h;
+         int vn = z->scan_n == 1 ? 1 : z->img_comp[n].v;
+         for (y=0; y < vn; ++y) {
+            for (x=0; x < hn; ++x) {
+               int x2 = (i*hn + x)*8;
+               int y2 = ((row*vn + y)*8) % (z->img_comp[n].v*16);
+               int ha = z->img_comp[n].ha;
+               stbi_uc *out = z->img_comp[n].data+z->img_comp[n].w2*y2+x2;
+               if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+               if (z->idct_2blocks_kernel && x+1 < hn) {
+                  if (!stbi__jpeg_decode_block(z, data+64, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                  z->idct_2blocks_kernel(out, out+8, z->img_comp[n].w2, data, data+64);
+                  ++x;
+               } else {
+                  z->idct_block_kernel(out, z->img_comp[n].w2, data);
+               }
+            }
+         }
+      }
+      if (--z->todo <= 0) {
+         if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+         // as in stbi__parse_entropy_coded_data, a missing restart yields corrupt data, not an error
+         if (STBI__RESTART(z->marker)) stbi__jpeg_reset(z);
+      }
+   }
+   return 1;
+}
+
+static stbi_uc *stbi__jpeg_stream_line(stbi__jpeg *z, int k, int row)
+{
+   return z->img_comp[k].data + z->img_comp[k].w2 * (row % (z->img_comp[k].v*16));
+}
+
+STBIDEF stbi_jpeg_stream *stbi_jpeg_stream_open(FILE *f, int *x, int *y, int *comp, int req_comp)
+{
+   int m,k;
+   stbi__jpeg *z;
+   stbi_jpeg_stream *js;
+   if (req_comp < 0 || req_comp > 4) return (stbi_jpeg_stream *) (size_t) stbi__err("bad req_comp", "Internal error");
+   js = (stbi_jpeg_stream *) stbi__malloc(sizeof(stbi_jpeg_stream));
+   if (!js) return (stbi_jpeg_stream *) (size_t) stbi__err("outofmem", "Out of memory");
+   memset(js, 0, sizeof(*js));
+   stbi__start_file(&js->s, f);
+   z = &js->j;
+   z->s = &js->s;
+   stbi__setup_jpeg(z);
+
+   if (!stbi__decode_jpeg_header(z, STBI__SCAN_stream)) goto fail;
+   m = stbi__get_marker(z);
+   while (!stbi__SOS(m)) {
+      if (stbi__EOI(m) || m == STBI__MARKER_none) { stbi__err("no SOS", "Corrupt JPEG"); goto fail; }
+      if (!stbi__process_marker(z, m)) goto fail;
+      m = stbi__get_marker(z);
+   }
+   if (!stbi__process_scan_header(z)) goto fail;
+   if (z->scan_n != z->s->img_n) { stbi__err("multi-scan jpeg", "JPEG format not supported for streaming: components in separate scans"); goto fail; }
+   stbi__jpeg_reset(z);
+
+   js->n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
+   js->is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+   js->decode_n = (z->s->img_n == 3 && js->n < 3 && !js->is_rgb) ? 1 : z->s->img_n;
+   js->rowbuf = (stbi_uc *) stbi__malloc_mad2(z->s->img_x, js->n, 1);
+   if (!js->rowbuf) { stbi__err("outofmem", "Out of memory"); goto fail; }
+   for (k=0; k < js->decode_n; ++k) {
+      stbi__resample *r = &js->res_comp[k];
+      z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
+      if (!z->img_comp[k].linebuf) { stbi__err("outofmem", "Out of memory"); goto fail; }
+      r->hs      = z->img_h_max / z->img_comp[k].h;
+      r->vs      = z->img_v_max / z->img_comp[k].v;
+      r->ystep   = r->vs >> 1;
+      r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
+      r->ypos    = 0;
+      js->line0[k] = js->line1[k] = 0;
+      if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+      else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+      else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+      else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+      else                               r->resample = stbi__resample_row_generic;
+   }
+
+   if (x) *x = z->s->img_x;
+   if (y) *y = z->s->img_y;
+   if (comp) *comp = z->s->img_n >= 3 ? 3 : 1;
+   return js;
+
+fail:
+   stbi__free_jpeg_components(z, z->s->img_n, 0);
+   stbi__free(js->rowbuf);
+   stbi__free(js);
+   return NULL;
+}
+
+STBIDEF int stbi_jpeg_stream_read(stbi_jpeg_stream *js, stbi_uc *out, int out_stride, int max_rows)
+{
+   stbi__jpeg *z = &js->j;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+   int rows = 0, k;
+   while (rows < max_rows && js->out_row < (int) z->s->img_y) {
+      // make sure every component line the resampler reads has been decoded
+      for (k=0; k < js->decode_n; ++k) {
+         while (js->line1[k] >= js->mcu_rows_done * z->img_comp[k].v * 8 && js->mcu_rows_done < z->img_mcu_y) {
+            if (!stbi__jpeg_decode_mcu_row(z, js->mcu_rows_done)) return rows;
+            ++js->mcu_rows_done;
+         }
+      }
+      for (k=0; k < js->decode_n; ++k) {
+         stbi__resample *r = &js->res_comp[k];
+         int y_bot = r->ystep >= (r->vs >> 1);
+         stbi_uc *l0 = stbi__jpeg_stream_line(z, k, js->line0[k]);
+         stbi_uc *l1 = stbi__jpeg_stream_line(z, k, js->line1[k]);
+         coutput[k] = r->resample(z->img_comp[k].linebuf, y_bot ? l1 : l0, y_bot ? l0 : l1, r->w_lores, r->hs);
+         if (++r->ystep >= r->vs) {
+            r->ystep = 0;
+            js->line0[k] = js->line1[k];
+            if (++r->ypos < z->img_comp[k].y)
+               ++js->line1[k];
+         }
+      }
+      stbi__jpeg_convert_row(z, js->rowbuf, coutput, js->n, js->is_rgb);
+      memcpy(out + (size_t) rows * out_stride, js->rowbuf, z->s->img_x * js->n);
+      ++js->out_row;
+      ++rows;
+   }
+   return rows;
+}
+
+STBIDEF void stbi_jpeg_stream_close(stbi_jpeg_stream *js)
+{
+   if (!js) return;
+   stbi__free_jpeg_components(&js->j, js->j.s->img_n, 0);
+   stbi__free(js->rowbuf);
+   stbi__free(js);
+}
+#endif // !STBI_NO_STDIO
+#elif !defined(STBI_NO_STDIO)
+STBIDEF stbi_jpeg_stream *stbi_jpeg_stream_open(FILE *f, int *x, int *y, int *comp, int req_comp)
+{
+   STBI_NOTUSED(f); STBI_NOTUSED(x); STBI_NOTUSED(y); STBI_NOTUSED(comp); STBI_NOTUSED(req_comp);
+   return (stbi_jpeg_stream *) (size_t) stbi__err("no jpeg", "JPEG support disabled");
+}
+STBIDEF int stbi_jpeg_stream_read(stbi_jpeg_stream *js, stbi_uc *out, int out_stride, int max_rows)
+{
+   STBI_NOTUSED(js); STBI_NOTUSED(out); STBI_NOTUSED(out_stride); STBI_NOTUSED(max_rows);
+   return 0;
+}
+STBIDEF void stbi_jpeg_stream_close(stbi_jpeg_stream *js) { STBI_NOTUSED(js); }
 #endif
 
 // public domain zlib decode    v0.2  Sean Barrett 2006-11-18
@@ -4088,7 +5201,7 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 #ifndef STBI_NO_ZLIB
 
 // fast-way is faster to check than jpeg huffman, but slow way is slower
-#define STBI__ZFAST_BITS  9 // accelerate all cases in default tables
+#define STBI__ZFAST_BITS  11 // accelerate all cases in default tables, and most dynamic ones
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
 #define STBI__ZNSYMS 288 // number of symbols in literal/length alphabet
 
@@ -4179,7 +5292,7 @@ typedef struct
    stbi_uc *zbuffer, *zbuffer_end;
    int num_bits;
    int hit_zeof_once;
-   stbi__uint32 code_buffer;
+   stbi__uint64 code_buffer;
 
    char *zout;
    char *zout_start;
@@ -4199,23 +5312,39 @@ stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
    return stbi__zeof(z) ? 0 : *z->zbuffer++;
 }
 
+stbi_inline static stbi__uint64 stbi__zload64(const stbi_uc *p)
+{
+   // little-endian regardless of host; compilers fold this into one load
+   return (stbi__uint64) (p[0] | (p[1] << 8) | (p[2] << 16) | ((stbi__uint32) p[3] << 24))
+        | ((stbi__uint64) (p[4] | (p[5] << 8) | (p[6] << 16) | ((stbi__uint32) p[7] << 24)) << 32);
+}
+
 static void stbi__fill_bits(stbi__zbuf *z)
 {
+   if ((z->code_buffer >> z->num_bits) != 0) {
+      z->zbuffer = z->zbuffer_end;  /* treat this as EOF so we fail. */
+      return;
+   }
+   if (z->zbuffer_end - z->zbuffer >= 8) {
+      // top up to 56+ bits with one 8-byte read, so a whole length/distance
+      // pair usually decodes without refilling
+      int n = (63 - z->num_bits) >> 3;
+      z->code_buffer |= (stbi__zload64(z->zbuffer) & ((((stbi__uint64) 1) << (n*8)) - 1)) << z->num_bits;
+      z->zbuffer += n;
+      z->num_bits += n*8;
+      return;
+   }
    do {
-      if (z->code_buffer >= (1U << z->num_bits)) {
-        z->zbuffer = z->zbuffer_end;  /* treat this as EOF so we fail. */
-        return;
-      }
-      z->code_buffer |= (unsigned int) stbi__zget8(z) << z->num_bits;
+      z->code_buffer |= (stbi__uint64) stbi__zget8(z) << z->num_bits;
       z->num_bits += 8;
-   } while (z->num_bits <= 24);
+   } while (z->num_bits <= 56);
 }
 
 stbi_inline static unsigned int stbi__zreceive(stbi__zbuf *z, int n)
 {
    unsigned int k;
    if (z->num_bits < n) stbi__fill_bits(z);
-   k = z->code_buffer & ((1 << n) - 1);
+   k = (unsigned int) (z->code_buffer & ((1 << n) - 1));
    z->code_buffer >>= n;
    z->num_bits -= n;
    return k;
@@ -4226,7 +5355,7 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
    int b,s,k;
    // not resolved by fast table, so compute it the slow way
    // use jpeg approach, which requires MSbits at top
-   k = stbi__bit_reverse(a->code_buffer, 16);
+   k = stbi__bit_reverse((int) (a->code_buffer & 0xffff), 16);
    for (s=STBI__ZFAST_BITS+1; ; ++s)
       if (k < z->maxcode[s])
          break;
@@ -4283,7 +5412,7 @@ static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room
       if(limit > UINT_MAX / 2) return stbi__err("outofmem", "Out of memory");
       limit *= 2;
    }
-   q = (char *) STBI_REALLOC_SIZED(z->zout_start, old_limit, limit);
+   q = (char *) stbi__realloc_sized(z->zout_start, old_limit, limit);
    STBI_NOTUSED(old_limit);
    if (q == NULL) return stbi__err("outofmem", "Out of memory");
    z->zout_start = q;
@@ -4347,8 +5476,18 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
          }
          p = (stbi_uc *) (zout - dist);
          if (dist == 1) { // run of one byte; common in images.
-            stbi_uc v = *p;
-            if (len) { do *zout++ = v; while (--len); }
+            memset(zout, *p, len);
+            zout += len;
+         } else if (dist >= 8 && a->zout_end - zout >= len + 7) {
+            // 8 bytes at a time; each step's source lies wholly behind its
+            // destination, and the overshoot lands in unused buffer space
+            char *end = zout + len;
+            do {
+               memcpy(zout, p, 8);
+               zout += 8;
+               p += 8;
+            } while (zout < end);
+            zout = end;
          } else {
             if (len) { do *zout++ = *p++; while (--len); }
          }
@@ -4414,12 +5553,19 @@ static int stbi__parse_uncompressed_block(stbi__zbuf *a)
       stbi__zreceive(a, a->num_bits & 7); // discard
    // drain the bit-packed data into header
    k = 0;
-   while (a->num_bits > 0) {
+   while (a->num_bits > 0 && k < 4) {
       header[k++] = (stbi_uc) (a->code_buffer & 255); // suppress MSVC run-time check
       a->code_buffer >>= 8;
       a->num_bits -= 8;
    }
    if (a->num_bits < 0) return stbi__err("zlib corrupt","Corrupt PNG");
+   if (a->num_bits > 0) {
+      // the bit buffer read ahead past the header; hand those bytes back
+      if (a->hit_zeof_once) return stbi__err("zlib corrupt","Corrupt PNG");
+      a->zbuffer -= a->num_bits >> 3;
+      a->code_buffer = 0;
+      a->num_bits = 0;
+   }
    // now fill header the normal way
    while (k < 4)
       header[k++] = stbi__zget8(a);
@@ -4528,7 +5674,7 @@ STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -4549,7 +5695,7 @@ STBIDEF char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, i
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -4576,7 +5722,7 @@ STBIDEF char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -4667,6 +5813,84 @@ static int stbi__paeth(int a, int b, int c)
    return t1;
 }
 
+#ifdef STBI_SSE2
+// Sub/Avg/Paeth chain each pixel to the one before it, so these run one
+// 3- or 4-byte pixel per step with all its channels in one register.
+// prior == NULL means the row above is all zero (first row).
+static __m128i stbi__png_load_px(const stbi_uc *p, int bpp)
+{
+   stbi__uint32 v = p[0] | (p[1] << 8) | (p[2] << 16);
+   if (bpp == 4) v |= (stbi__uint32) p[3] << 24;
+   return _mm_cvtsi32_si128((int) v);
+}
+
+static void stbi__png_store_px(stbi_uc *p, __m128i x, int bpp)
+{
+   stbi__uint32 v = (stbi__uint32) _mm_cvtsi128_si32(x);
+   p[0] = (stbi_uc) v;
+   p[1] = (stbi_uc) (v >> 8);
+   p[2] = (stbi_uc) (v >> 16);
+   if (bpp == 4) p[3] = (stbi_uc) (v >> 24);
+}
+
+static void stbi__png_unfilter_sse2(stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int nk, int bpp, int filter)
+{
+   const __m128i zero = _mm_setzero_si128();
+   __m128i a = zero, b = zero, c = zero, d;
+   int k;
+   switch (filter) {
+   case STBI__F_sub:
+      for (k = 0; k < nk; k += bpp) {
+         a = _mm_add_epi8(a, stbi__png_load_px(raw+k, bpp));
+         stbi__png_store_px(cur+k, a, bpp);
+      }
+      break;
+   case STBI__F_avg:
+   case STBI__F_avg_first:
+      for (k = 0; k < nk; k += bpp) {
+         // pavgb rounds up; take the carry back off for floor((a+b)/2)
+         __m128i avg;
+         if (prior) b = stbi__png_load_px(prior+k, bpp);
+         avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+         a = _mm_add_epi8(stbi__png_load_px(raw+k, bpp), avg);
+         stbi__png_store_px(cur+k, a, bpp);
+      }
+      break;
+   case STBI__F_paeth:
+      // 16-bit lanes; picks a, b, c in the spec's tie order
+      for (k = 0; k < nk; k += bpp) {
+         __m128i pa, pb, pc, smallest, nearest;
+         b = _mm_unpacklo_epi8(stbi__png_load_px(prior+k, bpp), zero);
+         d = _mm_unpacklo_epi8(stbi__png_load_px(raw+k, bpp), zero);
+         pa = _mm_sub_epi16(b, c);
+         pb = _mm_sub_epi16(a, c);
+         pc = _mm_add_epi16(pa, pb);
+         pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+         pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+         pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+         smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+         nearest = _mm_cmpeq_epi16(pb, smallest);
+         nearest = _mm_or_si128(_mm_and_si128(nearest, b), _mm_andnot_si128(nearest, c));
+         pa = _mm_cmpeq_epi16(pa, smallest);
+         nearest = _mm_or_si128(_mm_and_si128(pa, a), _mm_andnot_si128(pa, nearest));
+         a = _mm_add_epi8(d, nearest); // high bytes stay zero
+         stbi__png_store_px(cur+k, _mm_packus_epi16(a, a), bpp);
+         c = b;
+      }
+      break;
+   }
+}
+
+static void stbi__png_unfilter_up_sse2(stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int nk)
+{
+   int k = 0;
+   for (; k + 16 <= nk; k += 16)
+      _mm_storeu_si128((__m128i *) (cur+k), _mm_add_epi8(_mm_loadu_si128((const __m128i *) (raw+k)), _mm_loadu_si128((const __m128i *) (prior+k))));
+   for (; k < nk; ++k)
+      cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+}
+#endif
+
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
 // adds an extra all-255 alpha channel
@@ -4707,6 +5931,9 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    int output_bytes = out_n*bytes;
    int filter_bytes = img_n*bytes;
    int width = x;
+#ifdef STBI_SSE2
+   int simd = stbi__sse2_available();
+#endif
 
    STBI_ASSERT(out_n == s->img_n || out_n == s->img_n+1);
    a->out = (stbi_uc *) stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
@@ -4752,6 +5979,15 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       if (j == 0) filter = first_row_filter[filter];
 
       // perform actual filtering
+#ifdef STBI_SSE2
+      if (simd && filter == STBI__F_up) {
+         stbi__png_unfilter_up_sse2(cur, raw, prior, nk);
+         filter = -1;
+      } else if (simd && filter != STBI__F_none && (filter_bytes == 3 || filter_bytes == 4)) {
+         stbi__png_unfilter_sse2(cur, raw, j ? prior : NULL, nk, filter_bytes, filter);
+         filter = -1;
+      }
+#endif
       switch (filter) {
       case STBI__F_none:
          memcpy(cur, raw, nk);
@@ -4852,7 +6088,7 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       }
    }
 
-   STBI_FREE(filter_buf);
+   stbi__free(filter_buf);
    if (!all_ok) return 0;
 
    return 1;
@@ -4882,7 +6118,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
       if (x && y) {
          stbi__uint32 img_len = ((((a->s->img_n * x * depth) + 7) >> 3) + 1) * y;
          if (!stbi__create_png_image_raw(a, image_data, image_data_len, out_n, x, y, depth, color)) {
-            STBI_FREE(final);
+            stbi__free(final);
             return 0;
          }
          for (j=0; j < y; ++j) {
@@ -4893,7 +6129,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
                       a->out + (j*x+i)*out_bytes, out_bytes);
             }
          }
-         STBI_FREE(a->out);
+         stbi__free(a->out);
          image_data += img_len;
          image_data_len -= img_len;
       }
@@ -4982,7 +6218,7 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
          p += 4;
       }
    }
-   STBI_FREE(a->out);
+   stbi__free(a->out);
    a->out = temp_out;
 
    STBI_NOTUSED(len);
@@ -5004,8 +6240,8 @@ STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert)
 }
 
 #ifndef STBI_THREAD_LOCAL
-#define stbi__unpremultiply_on_load  stbi__unpremultiply_on_load_global
-#define stbi__de_iphone_flag  stbi__de_iphone_flag_global
+#define stbi__unpremultiply_on_load_default  stbi__unpremultiply_on_load_global
+#define stbi__de_iphone_flag_default  stbi__de_iphone_flag_global
 #else
 static STBI_THREAD_LOCAL int stbi__unpremultiply_on_load_local, stbi__unpremultiply_on_load_set;
 static STBI_THREAD_LOCAL int stbi__de_iphone_flag_local, stbi__de_iphone_flag_set;
@@ -5022,14 +6258,17 @@ STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_conve
    stbi__de_iphone_flag_set = 1;
 }
 
-#define stbi__unpremultiply_on_load  (stbi__unpremultiply_on_load_set           \
-                                       ? stbi__unpremultiply_on_load_local      \
-                                       : stbi__unpremultiply_on_load_global)
-#define stbi__de_iphone_flag  (stbi__de_iphone_flag_set                         \
-                                ? stbi__de_iphone_flag_local                    \
-                                : stbi__de_iphone_flag_global)
+#define stbi__unpremultiply_on_load_default  (stbi__unpremultiply_on_load_set           \
+                                               ? stbi__unpremultiply_on_load_local      \
+                                               : stbi__unpremultiply_on_load_global)
+#define stbi__de_iphone_flag_default  (stbi__de_iphone_flag_set                         \
+                                        ? stbi__de_iphone_flag_local                    \
+                                        : stbi__de_iphone_flag_global)
 #endif // STBI_THREAD_LOCAL
 
+#define stbi__unpremultiply_on_load(s)  ((s)->opts ? (s)->opts->unpremultiply : stbi__unpremultiply_on_load_default)
+#define stbi__de_iphone_flag(s)  ((s)->opts ? (s)->opts->convert_iphone_png_to_rgb : stbi__de_iphone_flag_default)
+
 static void stbi__de_iphone(stbi__png *z)
 {
    stbi__context *s = z->s;
@@ -5045,7 +6284,7 @@ static void stbi__de_iphone(stbi__png *z)
       }
    } else {
       STBI_ASSERT(s->img_out_n == 4);
-      if (stbi__unpremultiply_on_load) {
+      if (stbi__unpremultiply_on_load(s)) {
          // convert bgr to rgb and unpremultiply
          for (i=0; i < pixel_count; ++i) {
             stbi_uc a = p[3];
@@ -5188,7 +6427,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                while (ioff + c.length > idata_limit)
                   idata_limit *= 2;
                STBI_NOTUSED(idata_limit_old);
-               p = (stbi_uc *) STBI_REALLOC_SIZED(z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
+               p = (stbi_uc *) stbi__realloc_sized(z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
                z->idata = p;
             }
             if (!stbi__getn(s, z->idata+ioff,c.length)) return stbi__err("outofdata","Corrupt PNG");
@@ -5206,7 +6445,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
             z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
             if (z->expanded == NULL) return 0; // zlib should set error
-            STBI_FREE(z->idata); z->idata = NULL;
+            stbi__free(z->idata); z->idata = NULL;
             if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
                s->img_out_n = s->img_n+1;
             else
@@ -5219,7 +6458,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                   if (!stbi__compute_transparency(z, tc, s->img_out_n)) return 0;
                }
             }
-            if (is_iphone && stbi__de_iphone_flag && s->img_out_n > 2)
+            if (is_iphone && stbi__de_iphone_flag(s) && s->img_out_n > 2)
                stbi__de_iphone(z);
             if (pal_img_n) {
                // pal_img_n == 3 or 4
@@ -5232,7 +6471,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                // non-paletted image with tRNS -> source image has (constant) alpha
                ++s->img_n;
             }
-            STBI_FREE(z->expanded); z->expanded = NULL;
+            stbi__free(z->expanded); z->expanded = NULL;
             // end of PNG chunk, read and skip CRC
             stbi__get32be(s);
             return 1;
@@ -5285,9 +6524,9 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
       *y = p->s->img_y;
       if (n) *n = p->s->img_n;
    }
-   STBI_FREE(p->out);      p->out      = NULL;
-   STBI_FREE(p->expanded); p->expanded = NULL;
-   STBI_FREE(p->idata);    p->idata    = NULL;
+   stbi__free(p->out);      p->out      = NULL;
+   stbi__free(p->expanded); p->expanded = NULL;
+   stbi__free(p->idata);    p->idata    = NULL;
 
    return result;
 }
@@ -5598,7 +6837,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
    if (!out) return stbi__errpuc("outofmem", "Out of memory");
    if (info.bpp < 16) {
       int z=0;
-      if (psize == 0 || psize > 256) { STBI_FREE(out); return stbi__errpuc("invalid", "Corrupt BMP"); }
+      if (psize == 0 || psize > 256) { stbi__free(out); return stbi__errpuc("invalid", "Corrupt BMP"); }
       for (i=0; i < psize; ++i) {
          pal[i][2] = stbi__get8(s);
          pal[i][1] = stbi__get8(s);
@@ -5610,7 +6849,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
       if (info.bpp == 1) width = (s->img_x + 7) >> 3;
       else if (info.bpp == 4) width = (s->img_x + 1) >> 1;
       else if (info.bpp == 8) width = s->img_x;
-      else { STBI_FREE(out); return stbi__errpuc("bad bpp", "Corrupt BMP"); }
+      else { stbi__free(out); return stbi__errpuc("bad bpp", "Corrupt BMP"); }
       pad = (-width)&3;
       if (info.bpp == 1) {
          for (j=0; j < (int) s->img_y; ++j) {
@@ -5667,13 +6906,13 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
             easy = 2;
       }
       if (!easy) {
-         if (!mr || !mg || !mb) { STBI_FREE(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
+         if (!mr || !mg || !mb) { stbi__free(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
          // right shift amt to put high bit in position #7
          rshift = stbi__high_bit(mr)-7; rcount = stbi__bitcount(mr);
          gshift = stbi__high_bit(mg)-7; gcount = stbi__bitcount(mg);
          bshift = stbi__high_bit(mb)-7; bcount = stbi__bitcount(mb);
          ashift = stbi__high_bit(ma)-7; acount = stbi__bitcount(ma);
-         if (rcount > 8 || gcount > 8 || bcount > 8 || acount > 8) { STBI_FREE(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
+         if (rcount > 8 || gcount > 8 || bcount > 8 || acount > 8) { stbi__free(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
       }
       for (j=0; j < (int) s->img_y; ++j) {
          if (easy) {
@@ -5941,7 +7180,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
       if ( tga_indexed)
       {
          if (tga_palette_len == 0) {  /* you have to have at least one entry! */
-            STBI_FREE(tga_data);
+            stbi__free(tga_data);
             return stbi__errpuc("bad palette", "Corrupt TGA");
          }
 
@@ -5950,7 +7189,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
          //   load the palette
          tga_palette = (unsigned char*)stbi__malloc_mad2(tga_palette_len, tga_comp, 0);
          if (!tga_palette) {
-            STBI_FREE(tga_data);
+            stbi__free(tga_data);
             return stbi__errpuc("outofmem", "Out of memory");
          }
          if (tga_rgb16) {
@@ -5961,8 +7200,8 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
                pal_entry += tga_comp;
             }
          } else if (!stbi__getn(s, tga_palette, tga_palette_len * tga_comp)) {
-               STBI_FREE(tga_data);
-               STBI_FREE(tga_palette);
+               stbi__free(tga_data);
+               stbi__free(tga_palette);
                return stbi__errpuc("bad palette", "Corrupt TGA");
          }
       }
@@ -6043,7 +7282,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
       //   clear my palette, if I had one
       if ( tga_palette != NULL )
       {
-         STBI_FREE( tga_palette );
+         stbi__free( tga_palette );
       }
    }
 
@@ -6235,7 +7474,7 @@ static void *stbi__psd_load(stbi__context *s, int *x, int *y, int *comp, int req
          } else {
             // Read the RLE data.
             if (!stbi__psd_decode_rle(s, p, pixelCount)) {
-               STBI_FREE(out);
+               stbi__free(out);
                return stbi__errpuc("corrupt", "bad RLE data");
             }
          }
@@ -6527,7 +7766,7 @@ static void *stbi__pic_load(stbi__context *s,int *px,int *py,int *comp,int req_c
    memset(result, 0xff, x*y*4);
 
    if (!stbi__pic_load_core(s,x,y,comp, result)) {
-      STBI_FREE(result);
+      stbi__free(result);
       result=0;
    }
    *px = x;
@@ -6641,13 +7880,13 @@ static int stbi__gif_info_raw(stbi__context *s, int *x, int *y, int *comp)
    stbi__gif* g = (stbi__gif*) stbi__malloc(sizeof(stbi__gif));
    if (!g) return stbi__err("outofmem", "Out of memory");
    if (!stbi__gif_header(s, g, comp, 1)) {
-      STBI_FREE(g);
+      stbi__free(g);
       stbi__rewind( s );
       return 0;
    }
    if (x) *x = g->w;
    if (y) *y = g->h;
-   STBI_FREE(g);
+   stbi__free(g);
    return 1;
 }
 
@@ -6951,12 +8190,12 @@ static stbi_uc *stbi__gif_load_next(stbi__context *s, stbi__gif *g, int *comp, i
 
 static void *stbi__load_gif_main_outofmem(stbi__gif *g, stbi_uc *out, int **delays)
 {
-   STBI_FREE(g->out);
-   STBI_FREE(g->history);
-   STBI_FREE(g->background);
+   stbi__free(g->out);
+   stbi__free(g->history);
+   stbi__free(g->background);
 
-   if (out) STBI_FREE(out);
-   if (delays && *delays) STBI_FREE(*delays);
+   if (out) stbi__free(out);
+   if (delays && *delays) stbi__free(*delays);
    return stbi__errpuc("outofmem", "Out of memory");
 }
 
@@ -6991,7 +8230,7 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
             stride = g.w * g.h * 4;
 
             if (out) {
-               void *tmp = (stbi_uc*) STBI_REALLOC_SIZED( out, out_size, layers * stride );
+               void *tmp = (stbi_uc*) stbi__realloc_sized( out, out_size, layers * stride );
                if (!tmp)
                   return stbi__load_gif_main_outofmem(&g, out, delays);
                else {
@@ -7000,7 +8239,7 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
                }
 
                if (delays) {
-                  int *new_delays = (int*) STBI_REALLOC_SIZED( *delays, delays_size, sizeof(int) * layers );
+                  int *new_delays = (int*) stbi__realloc_sized( *delays, delays_size, sizeof(int) * layers );
                   if (!new_delays)
                      return stbi__load_gif_main_outofmem(&g, out, delays);
                   *delays = new_delays;
@@ -7030,9 +8269,9 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
       } while (u != 0);
 
       // free temp buffer;
-      STBI_FREE(g.out);
-      STBI_FREE(g.history);
-      STBI_FREE(g.background);
+      stbi__free(g.out);
+      stbi__free(g.history);
+      stbi__free(g.background);
 
       // do the final conversion after loading everything;
       if (req_comp && req_comp != 4)
@@ -7064,12 +8303,12 @@ static void *stbi__gif_load(stbi__context *s, int *x, int *y, int *comp, int req
          u = stbi__convert_format(u, 4, req_comp, g.w, g.h);
    } else if (g.out) {
       // if there was an error and we allocated an image buffer, free it!
-      STBI_FREE(g.out);
+      stbi__free(g.out);
    }
 
    // free buffers needed for multiple frame loading;
-   STBI_FREE(g.history);
-   STBI_FREE(g.background);
+   stbi__free(g.history);
+   stbi__free(g.background);
 
    return u;
 }
@@ -7242,16 +8481,16 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
             stbi__hdr_convert(hdr_data, rgbe, req_comp);
             i = 1;
             j = 0;
-            STBI_FREE(scanline);
+            stbi__free(scanline);
             goto main_decode_loop; // yes, this makes no sense
          }
          len <<= 8;
          len |= stbi__get8(s);
-         if (len != width) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
+         if (len != width) { stbi__free(hdr_data); stbi__free(scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
          if (scanline == NULL) {
             scanline = (stbi_uc *) stbi__malloc_mad2(width, 4, 0);
             if (!scanline) {
-               STBI_FREE(hdr_data);
+               stbi__free(hdr_data);
                return stbi__errpf("outofmem", "Out of memory");
             }
          }
@@ -7265,12 +8504,12 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
                   // Run
                   value = stbi__get8(s);
                   count -= 128;
-                  if ((count == 0) || (count > nleft)) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
+                  if ((count == 0) || (count > nleft)) { stbi__free(hdr_data); stbi__free(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
                   for (z = 0; z < count; ++z)
                      scanline[i++ * 4 + k] = value;
                } else {
                   // Dump
-                  if ((count == 0) || (count > nleft)) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
+                  if ((count == 0) || (count > nleft)) { stbi__free(hdr_data); stbi__free(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
                   for (z = 0; z < count; ++z)
                      scanline[i++ * 4 + k] = stbi__get8(s);
                }
@@ -7280,7 +8519,7 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
             stbi__hdr_convert(hdr_data+(j*width + i)*req_comp, scanline + i*4, req_comp);
       }
       if (scanline)
-         STBI_FREE(scanline);
+         stbi__free(scanline);
    }
 
    return hdr_data;
@@ -7525,10 +8764,18 @@ static void *stbi__pnm_load(stbi__context *s, int *x, int *y, int *comp, int req
    out = (stbi_uc *) stbi__malloc_mad4(s->img_n, s->img_x, s->img_y, ri->bits_per_channel / 8, 0);
    if (!out) return stbi__errpuc("outofmem", "Out of memory");
    if (!stbi__getn(s, out, s->img_n * s->img_x * s->img_y * (ri->bits_per_channel / 8))) {
-      STBI_FREE(out);
+      stbi__free(out);
       return stbi__errpuc("bad PNM", "PNM file truncated");
    }
 
+   if (ri->bits_per_channel == 16) {
+      // 16-bit samples are stored most significant byte first
+      stbi__uint32 i, n = s->img_n * s->img_x * s->img_y;
+      stbi__uint16 *q = (stbi__uint16 *) out;
+      for (i=0; i < n; ++i)
+         q[i] = (stbi__uint16) ((out[2*i] << 8) | out[2*i+1]);
+   }
+
    if (req_comp && req_comp != s->img_n) {
       if (ri->bits_per_channel == 16) {
          out = (stbi_uc *) stbi__convert_format16((stbi__uint16 *) out, s->img_n, req_comp, s->img_x, s->img_y);
@@ -31,6 +31,10 @@ BUILDING:
    unsigned char * my_compress(unsigned char *data, int data_len, int *out_len, int quality);
    The returned data will be freed with STBIW_FREE() (free() by default),
    so it must be heap allocated with STBIW_MALLOC() (malloc() by default),
+   You can #define STBIW_NO_SIMD to turn off the SSE2 JPEG DCT/quantizer and
+   Adler-32 and the PCLMULQDQ CRC32, which are otherwise used whenever the
+   compiler targets SSE2 (PCLMULQDQ also needs the CPU to have it).
+   #define STBIW_SELFTEST to get stbi_write_checksum_selftest().
 
 UNICODE:
 
@@ -66,8 +70,9 @@ USAGE:
 
    You can configure it with these global variables:
       int stbi_write_tga_with_rle;             // defaults to true; set to 0 to disable RLE
-      int stbi_write_png_compression_level;    // defaults to 8; set to higher for more compression
+      int stbi_write_png_compression_level;    // 0..9, defaults to 8; set to higher for more compression
       int stbi_write_force_png_filter;         // defaults to -1; set to 0..5 to force a filter mode
+      int stbi_write_jpg_optimize_huffman;     // defaults to 0; set to 1 for two-pass optimal JPEG Huffman tables
 
 
    You can define STBI_WRITE_NO_STDIO to disable the file variant of these
@@ -97,7 +102,10 @@ USAGE:
    at the end of the line.)
 
    PNG allows you to set the deflate compression level by setting the global
-   variable 'stbi_write_png_compression_level' (it defaults to 8).
+   variable 'stbi_write_png_compression_level' (it defaults to 8). As in zlib,
+   0 stores, 1..3 use a fast greedy matcher (1 is a single hash probe, good
+   for mostly-flat images like diffs), and 4..9 use lazy matching with
+   progressively longer hash chains.
 
    HDR expects linear float data. Since the format is always 32-bit rgb(e)
    data, alpha (if provided) is discarded, and for monochrome data it is
@@ -107,7 +115,11 @@ USAGE:
    data, set the global variable 'stbi_write_tga_with_rle' to 0.
 
    JPEG does ignore alpha channels in input data; quality is between 1 and 100.
-   Higher quality looks better but results in a bigger image.
+   Higher quality looks better but results in a bigger image. Setting the
+   global variable 'stbi_write_jpg_optimize_huffman' to 1 makes the encoder
+   run twice: once to count symbols, once to emit them with Huffman tables
+   built for this image instead of the standard ones, typically 5-10% smaller
+   at roughly twice the encode time.
    JPEG baseline (no JPEG progressive).
 
 CREDITS:
@@ -170,6 +182,7 @@ LICENSE
 STBIWDEF int stbi_write_tga_with_rle;
 STBIWDEF int stbi_write_png_compression_level;
 STBIWDEF int stbi_write_force_png_filter;
+STBIWDEF int stbi_write_jpg_optimize_huffman;
 #endif
 
 #ifndef STBI_WRITE_NO_STDIO
@@ -194,6 +207,28 @@ STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x,
 
 STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 
+#ifdef STBIW_SELFTEST
+// checks the SIMD/sliced CRC32 and Adler-32 against the plain byte loops,
+// and the combine functions the parallel PNG writer uses against checksums
+// of the joined data, over assorted lengths, alignments and split points.
+// Like the writers it returns non-0 if everything agrees, 0 on a mismatch.
+STBIWDEF int stbi_write_checksum_selftest(void);
+#endif
+
+// parallel PNG writer: rows are filtered in bands and the deflate stream is
+// cut into independent chunks (pigz-style: each chunk sees the previous 32K
+// as dictionary and ends in a sync flush), then joined into one IDAT with
+// combined adler32/crc32. stb_image_write has no threads of its own; the
+// caller passes a parallel-for that runs task(task_data, i) for i in [0,count).
+// A NULL parallel_for runs the tasks in order on the calling thread.
+typedef void stbi_write_parallel_func(void *context, int count, void (*task)(void *task_data, int index), void *task_data);
+STBIWDEF unsigned char *stbi_write_png_to_mem_parallel(const unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len, stbi_write_parallel_func *parallel_for, void *parallel_context);
+
+// parallel JPEG writer: the image is cut into bands of MCU rows that are
+// encoded independently and joined with restart markers (DRI/RSTn), so the
+// output is a standard baseline JPEG a few bytes larger than the serial one.
+STBIWDEF int stbi_write_jpg_to_func_parallel(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int quality, stbi_write_parallel_func *parallel_for, void *parallel_context);
+
 #endif//INCLUDE_STB_IMAGE_WRITE_H
 
 #ifdef STB_IMAGE_WRITE_IMPLEMENTATION
@@ -245,16 +280,55 @@ STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 #define STBIW_ASSERT(x) assert(x)
 #endif
 
+#if !defined(STBIW_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define STBIW_SSE2
+#include <emmintrin.h>
+
+// carry-less multiply CRC32, picked at run time: MSVC asks cpuid, GCC/Clang
+// compile the kernel for pclmul via a target attribute and ask the
+// compiler's cpu model (or skip the check when built with -mpclmul)
+#if defined(_MSC_VER) && _MSC_VER >= 1600
+#define STBIW_PCLMUL
+#define STBIW_PCLMUL_TARGET
+#include <intrin.h>
+#include <wmmintrin.h>
+static int stbiw__pclmul_available(void)
+{
+   static int avail = -1; // idempotent, so racing first calls are harmless
+   if (avail < 0) {
+      int info[4];
+      __cpuid(info, 1);
+      avail = (info[2] >> 1) & 1;
+   }
+   return avail;
+}
+#elif defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define STBIW_PCLMUL
+#define STBIW_PCLMUL_TARGET __attribute__((target("pclmul")))
+#include <wmmintrin.h>
+static int stbiw__pclmul_available(void)
+{
+#ifdef __PCLMUL__
+   return 1;
+#else
+   return __builtin_cpu_supports("pclmul");
+#endif
+}
+#endif
+#endif
+
 #define STBIW_UCHAR(x) (unsigned char) ((x) & 0xff)
 
 #ifdef STB_IMAGE_WRITE_STATIC
 static int stbi_write_png_compression_level = 8;
 static int stbi_write_tga_with_rle = 1;
 static int stbi_write_force_png_filter = -1;
+static int stbi_write_jpg_optimize_huffman = 0;
 #else
 int stbi_write_png_compression_level = 8;
 int stbi_write_tga_with_rle = 1;
 int stbi_write_force_png_filter = -1;
+int stbi_write_jpg_optimize_huffman = 0;
 #endif
 
 static int stbi__flip_vertically_on_write = 0;
@@ -856,24 +930,49 @@ static int stbiw__zlib_bitrev(int code, int codebits)
    return res;
 }
 
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define stbiw__zlib_firstdiff(x)  (__builtin_ctzll(x) >> 3)
+#endif
+
+// compares 8 bytes per word, two words per step; the first differing byte of
+// a mismatched word comes from its low set bit where that's cheap to find
 static unsigned int stbiw__zlib_countm(unsigned char *a, unsigned char *b, int limit)
 {
-   int i;
-   for (i=0; i < limit && i < 258; ++i)
+   int i=0;
+   if (limit > 258) limit = 258;
+   for (; i+16 <= limit; i += 16) {
+      unsigned long long a0,a1,b0,b1;
+      memcpy(&a0, a+i, 8); memcpy(&a1, a+i+8, 8);
+      memcpy(&b0, b+i, 8); memcpy(&b1, b+i+8, 8);
+      if (a0 != b0) {
+#ifdef stbiw__zlib_firstdiff
+         return i + stbiw__zlib_firstdiff(a0 ^ b0);
+#else
+         break;
+#endif
+      }
+      if (a1 != b1) {
+#ifdef stbiw__zlib_firstdiff
+         return i + 8 + stbiw__zlib_firstdiff(a1 ^ b1);
+#else
+         i += 8;
+         break;
+#endif
+      }
+   }
+   for (; i < limit; ++i)
       if (a[i] != b[i]) break;
    return i;
 }
 
+#define stbiw__ZHASH_BITS  15
+#define stbiw__ZHASH       (1 << stbiw__ZHASH_BITS)
+#define stbiw__ZWINDOW     32768
+
 static unsigned int stbiw__zhash(unsigned char *data)
 {
    stbiw_uint32 hash = data[0] + (data[1] << 8) + (data[2] << 16);
-   hash ^= hash << 3;
-   hash += hash >> 5;
-   hash ^= hash << 4;
-   hash += hash >> 17;
-   hash ^= hash << 25;
-   hash += hash >> 6;
-   return hash;
+   return (hash * 2654435761u) >> (32 - stbiw__ZHASH_BITS);
 }
 
 #define stbiw__zlib_flush() (out = stbiw__zlib_flushf(out, &bitbuf, &bitcount))
@@ -888,132 +987,307 @@ static unsigned int stbiw__zhash(unsigned char *data)
 #define stbiw__zlib_huff(n)  ((n) <= 143 ? stbiw__zlib_huff1(n) : (n) <= 255 ? stbiw__zlib_huff2(n) : (n) <= 279 ? stbiw__zlib_huff3(n) : stbiw__zlib_huff4(n))
 #define stbiw__zlib_huffb(n) ((n) <= 143 ? stbiw__zlib_huff1(n) : stbiw__zlib_huff2(n))
 
-#define stbiw__ZHASH   16384
-
 #endif // STBIW_ZLIB_COMPRESS
 
-STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality)
+#ifndef STBIW_ZLIB_COMPRESS
+static unsigned short stbiw__zlib_lengthc[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258, 259 };
+static unsigned char  stbiw__zlib_lengtheb[]= { 0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0 };
+static unsigned short stbiw__zlib_distc[]   = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577, 32768 };
+static unsigned char  stbiw__zlib_disteb[]  = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+
+#define stbiw__zlib_match(len,dist) do { \
+      int k_, l_ = (len), d_ = (dist); \
+      STBIW_ASSERT(d_ <= 32767 && l_ <= 258); \
+      for (k_=0; l_ > stbiw__zlib_lengthc[k_+1]-1; ++k_); \
+      stbiw__zlib_huff(k_+257); \
+      if (stbiw__zlib_lengtheb[k_]) stbiw__zlib_add(l_ - stbiw__zlib_lengthc[k_], stbiw__zlib_lengtheb[k_]); \
+      for (k_=0; d_ > stbiw__zlib_distc[k_+1]-1; ++k_); \
+      stbiw__zlib_add(stbiw__zlib_bitrev(k_,5),5); \
+      if (stbiw__zlib_disteb[k_]) stbiw__zlib_add(d_ - stbiw__zlib_distc[k_], stbiw__zlib_disteb[k_]); \
+   } while (0)
+
+// per-level matcher settings, after zlib's: the chain search is cut to a
+// quarter once the match in hand is good_length long and stops at nice_length.
+// Lazy levels only look for a better match at the next byte while the current
+// one is shorter than max_lazy; greedy levels reuse max_lazy as the longest
+// match whose interior positions still get hashed.
+typedef struct
+{
+   unsigned short good_length, max_lazy, nice_length, max_chain;
+} stbiw__zlib_config;
+
+static stbiw__zlib_config stbiw__zlib_levels[10] =
+{
+   {  0,   0,   0,    0 },  // 0: stored
+   {  4,   4,   8,    1 },  // 1: greedy, single probe
+   {  4,   5,  16,    2 },
+   {  4,   6,  32,    4 },
+   {  4,   4,  16,    4 },  // 4: lazy from here on
+   {  8,  16,  32,    6 },
+   {  8,  16,  64,    8 },
+   {  8,  32, 128,   12 },
+   { 16,  64, 258,   16 },  // 8: default, about the old matcher's cost
+   { 32, 258, 258, 1024 },
+};
+#define stbiw__ZLIB_LAZY_LEVEL  4
+
+// longest match for data[i..] among the chain starting at cur that beats
+// best; *bestpos is left alone unless something longer was found
+static int stbiw__zlib_longest(unsigned char *data, int i, int end, int cur, int *prev, int chain, int nice, int best, int *bestpos)
+{
+   int limit = i - (stbiw__ZWINDOW-1), maxlen = end - i;
+   if (limit < 0) limit = 0;
+   if (maxlen > 258) maxlen = 258;
+   if (nice > maxlen) nice = maxlen;
+   if (best >= nice) return best;
+   while (cur >= limit && chain-- > 0) {
+      unsigned char *m = data + cur;
+      // a candidate can only win if it also matches the byte that would extend best
+      if (m[best] == data[i+best] && m[0] == data[i] && m[1] == data[i+1]) {
+         int len = stbiw__zlib_countm(m, data+i, maxlen);
+         if (len > best) {
+            best = len;
+            *bestpos = cur;
+            if (len >= nice) break;
+         }
+      }
+      cur = prev[cur & (stbiw__ZWINDOW-1)];
+   }
+   return best;
+}
+
+#define stbiw__zlib_insert(p) \
+      (h = stbiw__zhash(data+(p)), cur = head[h], prev[(p) & (stbiw__ZWINDOW-1)] = cur, head[h] = (p))
+
+// deflate data[start..end) as fixed-huffman code, with up to 32K of data
+// before start primed into the hash chains as dictionary. The output is
+// byte-aligned: a final range pads its last block, a non-final range ends in
+// a sync flush (empty stored block), so ranges compressed independently can
+// be concatenated into one deflate stream. quality is the level 0..9.
+static unsigned char *stbiw__zlib_deflate_range(unsigned char *out, unsigned char *data, int start, int end, int final, int quality)
 {
-#ifdef STBIW_ZLIB_COMPRESS
-   // user provided a zlib compress implementation, use that
-   return STBIW_ZLIB_COMPRESS(data, data_len, out_len, quality);
-#else // use builtin
-   static unsigned short lengthc[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258, 259 };
-   static unsigned char  lengtheb[]= { 0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0 };
-   static unsigned short distc[]   = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577, 32768 };
-   static unsigned char  disteb[]  = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
    unsigned int bitbuf=0;
-   int i,j, bitcount=0;
-   unsigned char *out = NULL;
-   unsigned char ***hash_table = (unsigned char***) STBIW_MALLOC(stbiw__ZHASH * sizeof(unsigned char**));
-   if (hash_table == NULL)
+   int i,j, h, cur, bitcount=0, out_start;
+   int *head, *prev;
+   stbiw__zlib_config cfg;
+
+   if (quality < 0) quality = 0;
+   if (quality > 9) quality = 9;
+   cfg = stbiw__zlib_levels[quality];
+
+   (void) stbiw__sbmaybegrow(out, 1);
+   out_start = stbiw__sbn(out);
+   if (quality == 0)
+      goto stored;
+
+   head = (int *) STBIW_MALLOC((stbiw__ZHASH + stbiw__ZWINDOW) * sizeof(int));
+   if (head == NULL) {
+      (void) stbiw__sbfree(out);
       return NULL;
-   if (quality < 5) quality = 5;
+   }
+   prev = head + stbiw__ZHASH;
+   memset(head, 0xff, stbiw__ZHASH * sizeof(int)); // -1: empty chain
 
-   stbiw__sbpush(out, 0x78);   // DEFLATE 32K window
-   stbiw__sbpush(out, 0x5e);   // FLEVEL = 1
-   stbiw__zlib_add(1,1);  // BFINAL = 1
+   for (i = start > stbiw__ZWINDOW-1 ? start-(stbiw__ZWINDOW-1) : 0; i < start && i+3 <= end; ++i)
+      stbiw__zlib_insert(i);
+
+   stbiw__zlib_add(final ? 1 : 0,1);  // BFINAL
    stbiw__zlib_add(1,2);  // BTYPE = 1 -- fixed huffman
 
-   for (i=0; i < stbiw__ZHASH; ++i)
-      hash_table[i] = NULL;
-
-   i=0;
-   while (i < data_len-3) {
-      // hash next 3 bytes of data to be compressed
-      int h = stbiw__zhash(data+i)&(stbiw__ZHASH-1), best=3;
-      unsigned char *bestloc = 0;
-      unsigned char **hlist = hash_table[h];
-      int n = stbiw__sbcount(hlist);
-      for (j=0; j < n; ++j) {
-         if (hlist[j]-data > i-32768) { // if entry lies within window
-            int d = stbiw__zlib_countm(hlist[j], data+i, data_len-i);
-            if (d >= best) { best=d; bestloc=hlist[j]; }
+   i=start;
+   if (quality < stbiw__ZLIB_LAZY_LEVEL) {
+      // greedy: take the first acceptable match, and don't bother hashing
+      // the inside of long ones
+      while (i+3 <= end) {
+         int pos = -1, best;
+         stbiw__zlib_insert(i);
+         best = stbiw__zlib_longest(data, i, end, cur, prev, cfg.max_chain, cfg.nice_length, 2, &pos);
+         if (pos >= 0) {
+            stbiw__zlib_match(best, i - pos);
+            if (best <= cfg.max_lazy)
+               for (j=1; j < best && i+j+3 <= end; ++j)
+                  stbiw__zlib_insert(i+j);
+            i += best;
+         } else {
+            stbiw__zlib_huffb(data[i]);
+            ++i;
          }
       }
-      // when hash table entry is too long, delete half the entries
-      if (hash_table[h] && stbiw__sbn(hash_table[h]) == 2*quality) {
-         STBIW_MEMMOVE(hash_table[h], hash_table[h]+quality, sizeof(hash_table[h][0])*quality);
-         stbiw__sbn(hash_table[h]) = quality;
-      }
-      stbiw__sbpush(hash_table[h],data+i);
-
-      if (bestloc) {
-         // "lazy matching" - check match at *next* byte, and if it's better, do cur byte as literal
-         h = stbiw__zhash(data+i+1)&(stbiw__ZHASH-1);
-         hlist = hash_table[h];
-         n = stbiw__sbcount(hlist);
-         for (j=0; j < n; ++j) {
-            if (hlist[j]-data > i-32767) {
-               int e = stbiw__zlib_countm(hlist[j], data+i+1, data_len-i-1);
-               if (e > best) { // if next match is better, bail on current match
-                  bestloc = NULL;
-                  break;
-               }
-            }
+   } else {
+      // lazy: a match found at i-1 is only emitted if the one at i isn't
+      // longer, and the decision carries forward byte by byte
+      int prev_len = 2, prev_pos = -1, pending = 0;
+      while (i < end) {
+         int pos = -1, best = 2;
+         if (i+3 <= end) {
+            stbiw__zlib_insert(i);
+            if (prev_len < cfg.max_lazy)
+               best = stbiw__zlib_longest(data, i, end, cur, prev, prev_len >= cfg.good_length ? cfg.max_chain >> 2 : cfg.max_chain,
+                                          cfg.nice_length, prev_len, &pos);
+            if (pos < 0) best = 2;
          }
-      }
-
-      if (bestloc) {
-         int d = (int) (data+i - bestloc); // distance back
-         STBIW_ASSERT(d <= 32767 && best <= 258);
-         for (j=0; best > lengthc[j+1]-1; ++j);
-         stbiw__zlib_huff(j+257);
-         if (lengtheb[j]) stbiw__zlib_add(best - lengthc[j], lengtheb[j]);
-         for (j=0; d > distc[j+1]-1; ++j);
-         stbiw__zlib_add(stbiw__zlib_bitrev(j,5),5);
-         if (disteb[j]) stbiw__zlib_add(d - distc[j], disteb[j]);
-         i += best;
-      } else {
-         stbiw__zlib_huffb(data[i]);
+         if (prev_len >= 3 && best <= prev_len) {
+            int stop = i-1 + prev_len;
+            stbiw__zlib_match(prev_len, i-1 - prev_pos);
+            for (++i; i < stop; ++i)
+               if (i+3 <= end)
+                  stbiw__zlib_insert(i);
+            pending = 0;
+            prev_len = 2;
+            continue;
+         }
+         if (pending)
+            stbiw__zlib_huffb(data[i-1]);
+         pending = 1;
+         prev_len = best;
+         prev_pos = pos;
          ++i;
       }
+      if (pending)
+         stbiw__zlib_huffb(data[i-1]);
    }
    // write out final bytes
-   for (;i < data_len; ++i)
+   for (;i < end; ++i)
       stbiw__zlib_huffb(data[i]);
    stbiw__zlib_huff(256); // end of block
+   if (!final) {
+      stbiw__zlib_add(0,1);  // BFINAL = 0
+      stbiw__zlib_add(0,2);  // BTYPE = 0 -- empty stored block
+   }
    // pad with 0 bits to byte boundary
    while (bitcount)
       stbiw__zlib_add(0,1);
+   if (!final) {
+      stbiw__sbpush(out, 0x00);
+      stbiw__sbpush(out, 0x00);
+      stbiw__sbpush(out, 0xff);
+      stbiw__sbpush(out, 0xff);
+   }
 
-   for (i=0; i < stbiw__ZHASH; ++i)
-      (void) stbiw__sbfree(hash_table[i]);
-   STBIW_FREE(hash_table);
+   STBIW_FREE(head);
 
    // store uncompressed instead if compression was worse
-   if (stbiw__sbn(out) > data_len + 2 + ((data_len+32766)/32767)*5) {
-      stbiw__sbn(out) = 2;  // truncate to DEFLATE 32K window and FLEVEL = 1
-      for (j = 0; j < data_len;) {
-         int blocklen = data_len - j;
+   if (stbiw__sbn(out) - out_start > (end-start) + ((end-start+32766)/32767)*5) {
+stored:
+      stbiw__sbn(out) = out_start;
+      j = start;
+      do { // at least one block, so an empty range is still a valid stream
+         int blocklen = end - j;
          if (blocklen > 32767) blocklen = 32767;
-         stbiw__sbpush(out, data_len - j == blocklen); // BFINAL = ?, BTYPE = 0 -- no compression
+         stbiw__sbpush(out, final && end - j == blocklen); // BFINAL = ?, BTYPE = 0 -- no compression
          stbiw__sbpush(out, STBIW_UCHAR(blocklen)); // LEN
          stbiw__sbpush(out, STBIW_UCHAR(blocklen >> 8));
          stbiw__sbpush(out, STBIW_UCHAR(~blocklen)); // NLEN
          stbiw__sbpush(out, STBIW_UCHAR(~blocklen >> 8));
+         (void) stbiw__sbmaybegrow(out, blocklen);
          memcpy(out+stbiw__sbn(out), data+j, blocklen);
          stbiw__sbn(out) += blocklen;
          j += blocklen;
-      }
+      } while (j < end);
    }
+   return out;
+}
+#endif // STBIW_ZLIB_COMPRESS
 
-   {
-      // compute adler32 on input
-      unsigned int s1=1, s2=0;
-      int blocklen = (int) (data_len % 5552);
-      j=0;
-      while (j < data_len) {
-         for (i=0; i < blocklen; ++i) { s1 += data[j+i]; s2 += s1; }
-         s1 %= 65521; s2 %= 65521;
-         j += blocklen;
-         blocklen = 5552;
+static unsigned int stbiw__adler32_bytes(unsigned int adler, unsigned char *data, int data_len)
+{
+   unsigned int s1 = adler & 0xffff, s2 = adler >> 16;
+   int i, j=0;
+   int blocklen = (int) (data_len % 5552);
+   while (j < data_len) {
+      for (i=0; i < blocklen; ++i) { s1 += data[j+i]; s2 += s1; }
+      s1 %= 65521; s2 %= 65521;
+      j += blocklen;
+      blocklen = 5552;
+   }
+   return (s2 << 16) | s1;
+}
+
+#ifdef STBIW_SSE2
+static unsigned int stbiw__hsum_epi32(__m128i v)
+{
+   v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1,0,3,2)));
+   v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2,3,0,1)));
+   return (unsigned int) _mm_cvtsi128_si32(v);
+}
+
+// 32 bytes per step: s1 from psadbw, s2 from the bytes weighted 32..1 with
+// pmaddwd plus 32 times the s1 carried into each step. Runs stay under 5552
+// bytes so no 32-bit sum can wrap before the modulo.
+static unsigned int stbiw__adler32_sse2(unsigned int adler, unsigned char *data, int data_len)
+{
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i w0 = _mm_setr_epi16(32,31,30,29,28,27,26,25), w1 = _mm_setr_epi16(24,23,22,21,20,19,18,17);
+   const __m128i w2 = _mm_setr_epi16(16,15,14,13,12,11,10, 9), w3 = _mm_setr_epi16( 8, 7, 6, 5, 4, 3, 2, 1);
+   unsigned int s1 = adler & 0xffff, s2 = adler >> 16;
+   while (data_len >= 32) {
+      int blocks = (data_len < 5536 ? data_len : 5536) / 32;
+      __m128i vs1 = zero, vs2 = zero, vps = zero;
+      s2 += s1 * 32 * blocks;
+      data_len -= blocks * 32;
+      while (blocks--) {
+         __m128i a = _mm_loadu_si128((const __m128i *) data);
+         __m128i b = _mm_loadu_si128((const __m128i *) (data + 16));
+         vps = _mm_add_epi32(vps, vs1);
+         vs1 = _mm_add_epi32(vs1, _mm_add_epi32(_mm_sad_epu8(a, zero), _mm_sad_epu8(b, zero)));
+         vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpacklo_epi8(a, zero), w0));
+         vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpackhi_epi8(a, zero), w1));
+         vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpacklo_epi8(b, zero), w2));
+         vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpackhi_epi8(b, zero), w3));
+         data += 32;
       }
-      stbiw__sbpush(out, STBIW_UCHAR(s2 >> 8));
-      stbiw__sbpush(out, STBIW_UCHAR(s2));
-      stbiw__sbpush(out, STBIW_UCHAR(s1 >> 8));
-      stbiw__sbpush(out, STBIW_UCHAR(s1));
+      s2 += (stbiw__hsum_epi32(vps) << 5) + stbiw__hsum_epi32(vs2);
+      s1 += stbiw__hsum_epi32(vs1);
+      s1 %= 65521; s2 %= 65521;
    }
+   return stbiw__adler32_bytes((s2 << 16) | s1, data, data_len);
+}
+#endif
+
+static unsigned int stbiw__adler32(unsigned int adler, unsigned char *data, int data_len)
+{
+#ifdef STBIW_SSE2
+   return stbiw__adler32_sse2(adler, data, data_len);
+#else
+   return stbiw__adler32_bytes(adler, data, data_len);
+#endif
+}
+
+// adler32 of A followed by B, from adler32(A), adler32(B) and len(B)
+static unsigned int stbiw__adler32_combine(unsigned int adler1, unsigned int adler2, int len2)
+{
+   unsigned int base = 65521;
+   unsigned int rem = (unsigned int) (len2 % 65521);
+   unsigned int sum1 = adler1 & 0xffff;
+   unsigned int sum2 = (rem * sum1) % base;
+   sum1 += (adler2 & 0xffff) + base - 1;
+   sum2 += (adler1 >> 16) + (adler2 >> 16) + base - rem;
+   if (sum1 >= base) sum1 -= base;
+   if (sum1 >= base) sum1 -= base;
+   if (sum2 >= (base << 1)) sum2 -= (base << 1);
+   if (sum2 >= base) sum2 -= base;
+   return sum1 | (sum2 << 16);
+}
+
+STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality)
+{
+#ifdef STBIW_ZLIB_COMPRESS
+   // user provided a zlib compress implementation, use that
+   return STBIW_ZLIB_COMPRESS(data, data_len, out_len, quality);
+#else // use builtin
+   unsigned int adler;
+   unsigned char *out = NULL;
+
+   stbiw__sbpush(out, 0x78);   // DEFLATE 32K window
+   stbiw__sbpush(out, 0x5e);   // FLEVEL = 1
+   out = stbiw__zlib_deflate_range(out, data, 0, data_len, 1, quality);
+   if (out == NULL) return NULL;
+
+   adler = stbiw__adler32(1, data, data_len);
+   stbiw__sbpush(out, STBIW_UCHAR(adler >> 24));
+   stbiw__sbpush(out, STBIW_UCHAR(adler >> 16));
+   stbiw__sbpush(out, STBIW_UCHAR(adler >> 8));
+   stbiw__sbpush(out, STBIW_UCHAR(adler));
    *out_len = stbiw__sbn(out);
    // make returned pointer freeable
    STBIW_MEMMOVE(stbiw__sbraw(out), out, *out_len);
@@ -1021,55 +1295,482 @@ STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, i
 #endif // STBIW_ZLIB_COMPRESS
 }
 
+#ifndef STBIW_CRC32
+static unsigned int stbiw__crc_table[256] =
+{
+   0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3,
+   0x0eDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988, 0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
+   0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+   0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5,
+   0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172, 0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B,
+   0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+   0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423, 0xCFBA9599, 0xB8BDA50F,
+   0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924, 0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D,
+   0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+   0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01,
+   0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E, 0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457,
+   0x65B0D9C6, 0x12B7E950, 0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+   0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB,
+   0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0, 0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9,
+   0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+   0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81, 0xB7BD5C3B, 0xC0BA6CAD,
+   0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A, 0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683,
+   0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+   0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7,
+   0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC, 0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5,
+   0xD6D6A3E8, 0xA1D1937E, 0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+   0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79,
+   0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236, 0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F,
+   0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+   0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F, 0x72076785, 0x05005713,
+   0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38, 0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21,
+   0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+   0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45,
+   0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2, 0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB,
+   0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+   0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
+   0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+};
+
+// the checksums below work on the inverted register, crc = ~crc32
+static unsigned int stbiw__crc32_bytes(unsigned int crc, unsigned char *buffer, int len)
+{
+   int i;
+   for (i=0; i < len; ++i)
+      crc = (crc >> 8) ^ stbiw__crc_table[buffer[i] ^ (crc & 0xff)];
+   return crc;
+}
+
+// slicing-by-8: stbiw__crc_slice_table[k-1][b] is the crc of byte b followed
+// by k zero bytes (k = 1..7, with stbiw__crc_table as k = 0), so eight table
+// lookups retire eight bytes.
+static const unsigned int stbiw__crc_slice_table[7][256] =
+{
+   {
+      0x00000000, 0x191B3141, 0x32366282, 0x2B2D53C3, 0x646CC504, 0x7D77F445, 0x565AA786, 0x4F4196C7,
+      0xC8D98A08, 0xD1C2BB49, 0xFAEFE88A, 0xE3F4D9CB, 0xACB54F0C, 0xB5AE7E4D, 0x9E832D8E, 0x87981CCF,
+      0x4AC21251, 0x53D92310, 0x78F470D3, 0x61EF4192, 0x2EAED755, 0x37B5E614, 0x1C98B5D7, 0x05838496,
+      0x821B9859, 0x9B00A918, 0xB02DFADB, 0xA936CB9A, 0xE6775D5D, 0xFF6C6C1C, 0xD4413FDF, 0xCD5A0E9E,
+      0x958424A2, 0x8C9F15E3, 0xA7B24620, 0xBEA97761, 0xF1E8E1A6, 0xE8F3D0E7, 0xC3DE8324, 0xDAC5B265,
+      0x5D5DAEAA, 0x44469FEB, 0x6F6BCC28, 0x7670FD69, 0x39316BAE, 0x202A5AEF, 0x0B07092C, 0x121C386D,
+      0xDF4636F3, 0xC65D07B2, 0xED705471, 0xF46B6530, 0xBB2AF3F7, 0xA231C2B6, 0x891C9175, 0x9007A034,
+      0x179FBCFB, 0x0E848DBA, 0x25A9DE79, 0x3CB2EF38, 0x73F379FF, 0x6AE848BE, 0x41C51B7D, 0x58DE2A3C,
+      0xF0794F05, 0xE9627E44, 0xC24F2D87, 0xDB541CC6, 0x94158A01, 0x8D0EBB40, 0xA623E883, 0xBF38D9C2,
+      0x38A0C50D, 0x21BBF44C, 0x0A96A78F, 0x138D96CE, 0x5CCC0009, 0x45D73148, 0x6EFA628B, 0x77E153CA,
+      0xBABB5D54, 0xA3A06C15, 0x888D3FD6, 0x91960E97, 0xDED79850, 0xC7CCA911, 0xECE1FAD2, 0xF5FACB93,
+      0x7262D75C, 0x6B79E61D, 0x4054B5DE, 0x594F849F, 0x160E1258, 0x0F152319, 0x243870DA, 0x3D23419B,
+      0x65FD6BA7, 0x7CE65AE6, 0x57CB0925, 0x4ED03864, 0x0191AEA3, 0x188A9FE2, 0x33A7CC21, 0x2ABCFD60,
+      0xAD24E1AF, 0xB43FD0EE, 0x9F12832D, 0x8609B26C, 0xC94824AB, 0xD05315EA, 0xFB7E4629, 0xE2657768,
+      0x2F3F79F6, 0x362448B7, 0x1D091B74, 0x04122A35, 0x4B53BCF2, 0x52488DB3, 0x7965DE70, 0x607EEF31,
+      0xE7E6F3FE, 0xFEFDC2BF, 0xD5D0917C, 0xCCCBA03D, 0x838A36FA, 0x9A9107BB, 0xB1BC5478, 0xA8A76539,
+      0x3B83984B, 0x2298A90A, 0x09B5FAC9, 0x10AECB88, 0x5FEF5D4F, 0x46F46C0E, 0x6DD93FCD, 0x74C20E8C,
+      0xF35A1243, 0xEA412302, 0xC16C70C1, 0xD8774180, 0x9736D747, 0x8E2DE606, 0xA500B5C5, 0xBC1B8484,
+      0x71418A1A, 0x685ABB5B, 0x4377E898, 0x5A6CD9D9, 0x152D4F1E, 0x0C367E5F, 0x271B2D9C, 0x3E001CDD,
+      0xB9980012, 0xA0833153, 0x8BAE6290, 0x92B553D1, 0xDDF4C516, 0xC4EFF457, 0xEFC2A794, 0xF6D996D5,
+      0xAE07BCE9, 0xB71C8DA8, 0x9C31DE6B, 0x852AEF2A, 0xCA6B79ED, 0xD37048AC, 0xF85D1B6F, 0xE1462A2E,
+      0x66DE36E1, 0x7FC507A0, 0x54E85463, 0x4DF36522, 0x02B2F3E5, 0x1BA9C2A4, 0x30849167, 0x299FA026,
+      0xE4C5AEB8, 0xFDDE9FF9, 0xD6F3CC3A, 0xCFE8FD7B, 0x80A96BBC, 0x99B25AFD, 0xB29F093E, 0xAB84387F,
+      0x2C1C24B0, 0x350715F1, 0x1E2A4632, 0x07317773, 0x4870E1B4, 0x516BD0F5, 0x7A468336, 0x635DB277,
+      0xCBFAD74E, 0xD2E1E60F, 0xF9CCB5CC, 0xE0D7848D, 0xAF96124A, 0xB68D230B, 0x9DA070C8, 0x84BB4189,
+      0x03235D46, 0x1A386C07, 0x31153FC4, 0x280E0E85, 0x674F9842, 0x7E54A903, 0x5579FAC0, 0x4C62CB81,
+      0x8138C51F, 0x9823F45E, 0xB30EA79D, 0xAA1596DC, 0xE554001B, 0xFC4F315A, 0xD7626299, 0xCE7953D8,
+      0x49E14F17, 0x50FA7E56, 0x7BD72D95, 0x62CC1CD4, 0x2D8D8A13, 0x3496BB52, 0x1FBBE891, 0x06A0D9D0,
+      0x5E7EF3EC, 0x4765C2AD, 0x6C48916E, 0x7553A02F, 0x3A1236E8, 0x230907A9, 0x0824546A, 0x113F652B,
+      0x96A779E4, 0x8FBC48A5, 0xA4911B66, 0xBD8A2A27, 0xF2CBBCE0, 0xEBD08DA1, 0xC0FDDE62, 0xD9E6EF23,
+      0x14BCE1BD, 0x0DA7D0FC, 0x268A833F, 0x3F91B27E, 0x70D024B9, 0x69CB15F8, 0x42E6463B, 0x5BFD777A,
+      0xDC656BB5, 0xC57E5AF4, 0xEE530937, 0xF7483876, 0xB809AEB1, 0xA1129FF0, 0x8A3FCC33, 0x9324FD72
+   },
+   {
+      0x00000000, 0x01C26A37, 0x0384D46E, 0x0246BE59, 0x0709A8DC, 0x06CBC2EB, 0x048D7CB2, 0x054F1685,
+      0x0E1351B8, 0x0FD13B8F, 0x0D9785D6, 0x0C55EFE1, 0x091AF964, 0x08D89353, 0x0A9E2D0A, 0x0B5C473D,
+      0x1C26A370, 0x1DE4C947, 0x1FA2771E, 0x1E601D29, 0x1B2F0BAC, 0x1AED619B, 0x18ABDFC2, 0x1969B5F5,
+      0x1235F2C8, 0x13F798FF, 0x11B126A6, 0x10734C91, 0x153C5A14, 0x14FE3023, 0x16B88E7A, 0x177AE44D,
+      0x384D46E0, 0x398F2CD7, 0x3BC9928E, 0x3A0BF8B9, 0x3F44EE3C, 0x3E86840B, 0x3CC03A52, 0x3D025065,
+      0x365E1758, 0x379C7D6F, 0x35DAC336, 0x3418A901, 0x3157BF84, 0x3095D5B3, 0x32D36BEA, 0x331101DD,
+      0x246BE590, 0x25A98FA7, 0x27EF31FE, 0x262D5BC9, 0x23624D4C, 0x22A0277B, 0x20E69922, 0x2124F315,
+      0x2A78B428, 0x2BBADE1F, 0x29FC6046, 0x283E0A71, 0x2D711CF4, 0x2CB376C3, 0x2EF5C89A, 0x2F37A2AD,
+      0x709A8DC0, 0x7158E7F7, 0x731E59AE, 0x72DC3399, 0x7793251C, 0x76514F2B, 0x7417F172, 0x75D59B45,
+      0x7E89DC78, 0x7F4BB64F, 0x7D0D0816, 0x7CCF6221, 0x798074A4, 0x78421E93, 0x7A04A0CA, 0x7BC6CAFD,
+      0x6CBC2EB0, 0x6D7E4487, 0x6F38FADE, 0x6EFA90E9, 0x6BB5866C, 0x6A77EC5B, 0x68315202, 0x69F33835,
+      0x62AF7F08, 0x636D153F, 0x612BAB66, 0x60E9C151, 0x65A6D7D4, 0x6464BDE3, 0x662203BA, 0x67E0698D,
+      0x48D7CB20, 0x4915A117, 0x4B531F4E, 0x4A917579, 0x4FDE63FC, 0x4E1C09CB, 0x4C5AB792, 0x4D98DDA5,
+      0x46C49A98, 0x4706F0AF, 0x45404EF6, 0x448224C1, 0x41CD3244, 0x400F5873, 0x4249E62A, 0x438B8C1D,
+      0x54F16850, 0x55330267, 0x5775BC3E, 0x56B7D609, 0x53F8C08C, 0x523AAABB, 0x507C14E2, 0x51BE7ED5,
+      0x5AE239E8, 0x5B2053DF, 0x5966ED86, 0x58A487B1, 0x5DEB9134, 0x5C29FB03, 0x5E6F455A, 0x5FAD2F6D,
+      0xE1351B80, 0xE0F771B7, 0xE2B1CFEE, 0xE373A5D9, 0xE63CB35C, 0xE7FED96B, 0xE5B86732, 0xE47A0D05,
+      0xEF264A38, 0xEEE4200F, 0xECA29E56, 0xED60F461, 0xE82FE2E4, 0xE9ED88D3, 0xEBAB368A, 0xEA695CBD,
+      0xFD13B8F0, 0xFCD1D2C7, 0xFE976C9E, 0xFF5506A9, 0xFA1A102C, 0xFBD87A1B, 0xF99EC442, 0xF85CAE75,
+      0xF300E948, 0xF2C2837F, 0xF0843D26, 0xF1465711, 0xF4094194, 0xF5CB2BA3, 0xF78D95FA, 0xF64FFFCD,
+      0xD9785D60, 0xD8BA3757, 0xDAFC890E, 0xDB3EE339, 0xDE71F5BC, 0xDFB39F8B, 0xDDF521D2, 0xDC374BE5,
+      0xD76B0CD8, 0xD6A966EF, 0xD4EFD8B6, 0xD52DB281, 0xD062A404, 0xD1A0CE33, 0xD3E6706A, 0xD2241A5D,
+      0xC55EFE10, 0xC49C9427, 0xC6DA2A7E, 0xC7184049, 0xC25756CC, 0xC3953CFB, 0xC1D382A2, 0xC011E895,
+      0xCB4DAFA8, 0xCA8FC59F, 0xC8C97BC6, 0xC90B11F1, 0xCC440774, 0xCD866D43, 0xCFC0D31A, 0xCE02B92D,
+      0x91AF9640, 0x906DFC77, 0x922B422E, 0x93E92819, 0x96A63E9C, 0x976454AB, 0x9522EAF2, 0x94E080C5,
+      0x9FBCC7F8, 0x9E7EADCF, 0x9C381396, 0x9DFA79A1, 0x98B56F24, 0x99770513, 0x9B31BB4A, 0x9AF3D17D,
+      0x8D893530, 0x8C4B5F07, 0x8E0DE15E, 0x8FCF8B69, 0x8A809DEC, 0x8B42F7DB, 0x89044982, 0x88C623B5,
+      0x839A6488, 0x82580EBF, 0x801EB0E6, 0x81DCDAD1, 0x8493CC54, 0x8551A663, 0x8717183A, 0x86D5720D,
+      0xA9E2D0A0, 0xA820BA97, 0xAA6604CE, 0xABA46EF9, 0xAEEB787C, 0xAF29124B, 0xAD6FAC12, 0xACADC625,
+      0xA7F18118, 0xA633EB2F, 0xA4755576, 0xA5B73F41, 0xA0F829C4, 0xA13A43F3, 0xA37CFDAA, 0xA2BE979D,
+      0xB5C473D0, 0xB40619E7, 0xB640A7BE, 0xB782CD89, 0xB2CDDB0C, 0xB30FB13B, 0xB1490F62, 0xB08B6555,
+      0xBBD72268, 0xBA15485F, 0xB853F606, 0xB9919C31, 0xBCDE8AB4, 0xBD1CE083, 0xBF5A5EDA, 0xBE9834ED
+   },
+   {
+      0x00000000, 0xB8BC6765, 0xAA09C88B, 0x12B5AFEE, 0x8F629757, 0x37DEF032, 0x256B5FDC, 0x9DD738B9,
+      0xC5B428EF, 0x7D084F8A, 0x6FBDE064, 0xD7018701, 0x4AD6BFB8, 0xF26AD8DD, 0xE0DF7733, 0x58631056,
+      0x5019579F, 0xE8A530FA, 0xFA109F14, 0x42ACF871, 0xDF7BC0C8, 0x67C7A7AD, 0x75720843, 0xCDCE6F26,
+      0x95AD7F70, 0x2D111815, 0x3FA4B7FB, 0x8718D09E, 0x1ACFE827, 0xA2738F42, 0xB0C620AC, 0x087A47C9,
+      0xA032AF3E, 0x188EC85B, 0x0A3B67B5, 0xB28700D0, 0x2F503869, 0x97EC5F0C, 0x8559F0E2, 0x3DE59787,
+      0x658687D1, 0xDD3AE0B4, 0xCF8F4F5A, 0x7733283F, 0xEAE41086, 0x525877E3, 0x40EDD80D, 0xF851BF68,
+      0xF02BF8A1, 0x48979FC4, 0x5A22302A, 0xE29E574F, 0x7F496FF6, 0xC7F50893, 0xD540A77D, 0x6DFCC018,
+      0x359FD04E, 0x8D23B72B, 0x9F9618C5, 0x272A7FA0, 0xBAFD4719, 0x0241207C, 0x10F48F92, 0xA848E8F7,
+      0x9B14583D, 0x23A83F58, 0x311D90B6, 0x89A1F7D3, 0x1476CF6A, 0xACCAA80F, 0xBE7F07E1, 0x06C36084,
+      0x5EA070D2, 0xE61C17B7, 0xF4A9B859, 0x4C15DF3C, 0xD1C2E785, 0x697E80E0, 0x7BCB2F0E, 0xC377486B,
+      0xCB0D0FA2, 0x73B168C7, 0x6104C729, 0xD9B8A04C, 0x446F98F5, 0xFCD3FF90, 0xEE66507E, 0x56DA371B,
+      0x0EB9274D, 0xB6054028, 0xA4B0EFC6, 0x1C0C88A3, 0x81DBB01A, 0x3967D77F, 0x2BD27891, 0x936E1FF4,
+      0x3B26F703, 0x839A9066, 0x912F3F88, 0x299358ED, 0xB4446054, 0x0CF80731, 0x1E4DA8DF, 0xA6F1CFBA,
+      0xFE92DFEC, 0x462EB889, 0x549B1767, 0xEC277002, 0x71F048BB, 0xC94C2FDE, 0xDBF98030, 0x6345E755,
+      0x6B3FA09C, 0xD383C7F9, 0xC1366817, 0x798A0F72, 0xE45D37CB, 0x5CE150AE, 0x4E54FF40, 0xF6E89825,
+      0xAE8B8873, 0x1637EF16, 0x048240F8, 0xBC3E279D, 0x21E91F24, 0x99557841, 0x8BE0D7AF, 0x335CB0CA,
+      0xED59B63B, 0x55E5D15E, 0x47507EB0, 0xFFEC19D5, 0x623B216C, 0xDA874609, 0xC832E9E7, 0x708E8E82,
+      0x28ED9ED4, 0x9051F9B1, 0x82E4565F, 0x3A58313A, 0xA78F0983, 0x1F336EE6, 0x0D86C108, 0xB53AA66D,
+      0xBD40E1A4, 0x05FC86C1, 0x1749292F, 0xAFF54E4A, 0x322276F3, 0x8A9E1196, 0x982BBE78, 0x2097D91D,
+      0x78F4C94B, 0xC048AE2E, 0xD2FD01C0, 0x6A4166A5, 0xF7965E1C, 0x4F2A3979, 0x5D9F9697, 0xE523F1F2,
+      0x4D6B1905, 0xF5D77E60, 0xE762D18E, 0x5FDEB6EB, 0xC2098E52, 0x7AB5E937, 0x680046D9, 0xD0BC21BC,
+      0x88DF31EA, 0x3063568F, 0x22D6F961, 0x9A6A9E04, 0x07BDA6BD, 0xBF01C1D8, 0xADB46E36, 0x15080953,
+      0x1D724E9A, 0xA5CE29FF, 0xB77B8611, 0x0FC7E174, 0x9210D9CD, 0x2AACBEA8, 0x38191146, 0x80A57623,
+      0xD8C66675, 0x607A0110, 0x72CFAEFE, 0xCA73C99B, 0x57A4F122, 0xEF189647, 0xFDAD39A9, 0x45115ECC,
+      0x764DEE06, 0xCEF18963, 0xDC44268D, 0x64F841E8, 0xF92F7951, 0x41931E34, 0x5326B1DA, 0xEB9AD6BF,
+      0xB3F9C6E9, 0x0B45A18C, 0x19F00E62, 0xA14C6907, 0x3C9B51BE, 0x842736DB, 0x96929935, 0x2E2EFE50,
+      0x2654B999, 0x9EE8DEFC, 0x8C5D7112, 0x34E11677, 0xA9362ECE, 0x118A49AB, 0x033FE645, 0xBB838120,
+      0xE3E09176, 0x5B5CF613, 0x49E959FD, 0xF1553E98, 0x6C820621, 0xD43E6144, 0xC68BCEAA, 0x7E37A9CF,
+      0xD67F4138, 0x6EC3265D, 0x7C7689B3, 0xC4CAEED6, 0x591DD66F, 0xE1A1B10A, 0xF3141EE4, 0x4BA87981,
+      0x13CB69D7, 0xAB770EB2, 0xB9C2A15C, 0x017EC639, 0x9CA9FE80, 0x241599E5, 0x36A0360B, 0x8E1C516E,
+      0x866616A7, 0x3EDA71C2, 0x2C6FDE2C, 0x94D3B949, 0x090481F0, 0xB1B8E695, 0xA30D497B, 0x1BB12E1E,
+      0x43D23E48, 0xFB6E592D, 0xE9DBF6C3, 0x516791A6, 0xCCB0A91F, 0x740CCE7A, 0x66B96194, 0xDE0506F1
+   },
+   {
+      0x00000000, 0x3D6029B0, 0x7AC05360, 0x47A07AD0, 0xF580A6C0, 0xC8E08F70, 0x8F40F5A0, 0xB220DC10,
+      0x30704BC1, 0x0D106271, 0x4AB018A1, 0x77D03111, 0xC5F0ED01, 0xF890C4B1, 0xBF30BE61, 0x825097D1,
+      0x60E09782, 0x5D80BE32, 0x1A20C4E2, 0x2740ED52, 0x95603142, 0xA80018F2, 0xEFA06222, 0xD2C04B92,
+      0x5090DC43, 0x6DF0F5F3, 0x2A508F23, 0x1730A693, 0xA5107A83, 0x98705333, 0xDFD029E3, 0xE2B00053,
+      0xC1C12F04, 0xFCA106B4, 0xBB017C64, 0x866155D4, 0x344189C4, 0x0921A074, 0x4E81DAA4, 0x73E1F314,
+      0xF1B164C5, 0xCCD14D75, 0x8B7137A5, 0xB6111E15, 0x0431C205, 0x3951EBB5, 0x7EF19165, 0x4391B8D5,
+      0xA121B886, 0x9C419136, 0xDBE1EBE6, 0xE681C256, 0x54A11E46, 0x69C137F6, 0x2E614D26, 0x13016496,
+      0x9151F347, 0xAC31DAF7, 0xEB91A027, 0xD6F18997, 0x64D15587, 0x59B17C37, 0x1E1106E7, 0x23712F57,
+      0x58F35849, 0x659371F9, 0x22330B29, 0x1F532299, 0xAD73FE89, 0x9013D739, 0xD7B3ADE9, 0xEAD38459,
+      0x68831388, 0x55E33A38, 0x124340E8, 0x2F236958, 0x9D03B548, 0xA0639CF8, 0xE7C3E628, 0xDAA3CF98,
+      0x3813CFCB, 0x0573E67B, 0x42D39CAB, 0x7FB3B51B, 0xCD93690B, 0xF0F340BB, 0xB7533A6B, 0x8A3313DB,
+      0x0863840A, 0x3503ADBA, 0x72A3D76A, 0x4FC3FEDA, 0xFDE322CA, 0xC0830B7A, 0x872371AA, 0xBA43581A,
+      0x9932774D, 0xA4525EFD, 0xE3F2242D, 0xDE920D9D, 0x6CB2D18D, 0x51D2F83D, 0x167282ED, 0x2B12AB5D,
+      0xA9423C8C, 0x9422153C, 0xD3826FEC, 0xEEE2465C, 0x5CC29A4C, 0x61A2B3FC, 0x2602C92C, 0x1B62E09C,
+      0xF9D2E0CF, 0xC4B2C97F, 0x8312B3AF, 0xBE729A1F, 0x0C52460F, 0x31326FBF, 0x7692156F, 0x4BF23CDF,
+      0xC9A2AB0E, 0xF4C282BE, 0xB362F86E, 0x8E02D1DE, 0x3C220DCE, 0x0142247E, 0x46E25EAE, 0x7B82771E,
+      0xB1E6B092, 0x8C869922, 0xCB26E3F2, 0xF646CA42, 0x44661652, 0x79063FE2, 0x3EA64532, 0x03C66C82,
+      0x8196FB53, 0xBCF6D2E3, 0xFB56A833, 0xC6368183, 0x74165D93, 0x49767423, 0x0ED60EF3, 0x33B62743,
+      0xD1062710, 0xEC660EA0, 0xABC67470, 0x96A65DC0, 0x248681D0, 0x19E6A860, 0x5E46D2B0, 0x6326FB00,
+      0xE1766CD1, 0xDC164561, 0x9BB63FB1, 0xA6D61601, 0x14F6CA11, 0x2996E3A1, 0x6E369971, 0x5356B0C1,
+      0x70279F96, 0x4D47B626, 0x0AE7CCF6, 0x3787E546, 0x85A73956, 0xB8C710E6, 0xFF676A36, 0xC2074386,
+      0x4057D457, 0x7D37FDE7, 0x3A978737, 0x07F7AE87, 0xB5D77297, 0x88B75B27, 0xCF1721F7, 0xF2770847,
+      0x10C70814, 0x2DA721A4, 0x6A075B74, 0x576772C4, 0xE547AED4, 0xD8278764, 0x9F87FDB4, 0xA2E7D404,
+      0x20B743D5, 0x1DD76A65, 0x5A7710B5, 0x67173905, 0xD537E515, 0xE857CCA5, 0xAFF7B675, 0x92979FC5,
+      0xE915E8DB, 0xD475C16B, 0x93D5BBBB, 0xAEB5920B, 0x1C954E1B, 0x21F567AB, 0x66551D7B, 0x5B3534CB,
+      0xD965A31A, 0xE4058AAA, 0xA3A5F07A, 0x9EC5D9CA, 0x2CE505DA, 0x11852C6A, 0x562556BA, 0x6B457F0A,
+      0x89F57F59, 0xB49556E9, 0xF3352C39, 0xCE550589, 0x7C75D999, 0x4115F029, 0x06B58AF9, 0x3BD5A349,
+      0xB9853498, 0x84E51D28, 0xC34567F8, 0xFE254E48, 0x4C059258, 0x7165BBE8, 0x36C5C138, 0x0BA5E888,
+      0x28D4C7DF, 0x15B4EE6F, 0x521494BF, 0x6F74BD0F, 0xDD54611F, 0xE03448AF, 0xA794327F, 0x9AF41BCF,
+      0x18A48C1E, 0x25C4A5AE, 0x6264DF7E, 0x5F04F6CE, 0xED242ADE, 0xD044036E, 0x97E479BE, 0xAA84500E,
+      0x4834505D, 0x755479ED, 0x32F4033D, 0x0F942A8D, 0xBDB4F69D, 0x80D4DF2D, 0xC774A5FD, 0xFA148C4D,
+      0x78441B9C, 0x4524322C, 0x028448FC, 0x3FE4614C, 0x8DC4BD5C, 0xB0A494EC, 0xF704EE3C, 0xCA64C78C
+   },
+   {
+      0x00000000, 0xCB5CD3A5, 0x4DC8A10B, 0x869472AE, 0x9B914216, 0x50CD91B3, 0xD659E31D, 0x1D0530B8,
+      0xEC53826D, 0x270F51C8, 0xA19B2366, 0x6AC7F0C3, 0x77C2C07B, 0xBC9E13DE, 0x3A0A6170, 0xF156B2D5,
+      0x03D6029B, 0xC88AD13E, 0x4E1EA390, 0x85427035, 0x9847408D, 0x531B9328, 0xD58FE186, 0x1ED33223,
+      0xEF8580F6, 0x24D95353, 0xA24D21FD, 0x6911F258, 0x7414C2E0, 0xBF481145, 0x39DC63EB, 0xF280B04E,
+      0x07AC0536, 0xCCF0D693, 0x4A64A43D, 0x81387798, 0x9C3D4720, 0x57619485, 0xD1F5E62B, 0x1AA9358E,
+      0xEBFF875B, 0x20A354FE, 0xA6372650, 0x6D6BF5F5, 0x706EC54D, 0xBB3216E8, 0x3DA66446, 0xF6FAB7E3,
+      0x047A07AD, 0xCF26D408, 0x49B2A6A6, 0x82EE7503, 0x9FEB45BB, 0x54B7961E, 0xD223E4B0, 0x197F3715,
+      0xE82985C0, 0x23755665, 0xA5E124CB, 0x6EBDF76E, 0x73B8C7D6, 0xB8E41473, 0x3E7066DD, 0xF52CB578,
+      0x0F580A6C, 0xC404D9C9, 0x4290AB67, 0x89CC78C2, 0x94C9487A, 0x5F959BDF, 0xD901E971, 0x125D3AD4,
+      0xE30B8801, 0x28575BA4, 0xAEC3290A, 0x659FFAAF, 0x789ACA17, 0xB3C619B2, 0x35526B1C, 0xFE0EB8B9,
+      0x0C8E08F7, 0xC7D2DB52, 0x4146A9FC, 0x8A1A7A59, 0x971F4AE1, 0x5C439944, 0xDAD7EBEA, 0x118B384F,
+      0xE0DD8A9A, 0x2B81593F, 0xAD152B91, 0x6649F834, 0x7B4CC88C, 0xB0101B29, 0x36846987, 0xFDD8BA22,
+      0x08F40F5A, 0xC3A8DCFF, 0x453CAE51, 0x8E607DF4, 0x93654D4C, 0x58399EE9, 0xDEADEC47, 0x15F13FE2,
+      0xE4A78D37, 0x2FFB5E92, 0xA96F2C3C, 0x6233FF99, 0x7F36CF21, 0xB46A1C84, 0x32FE6E2A, 0xF9A2BD8F,
+      0x0B220DC1, 0xC07EDE64, 0x46EAACCA, 0x8DB67F6F, 0x90B34FD7, 0x5BEF9C72, 0xDD7BEEDC, 0x16273D79,
+      0xE7718FAC, 0x2C2D5C09, 0xAAB92EA7, 0x61E5FD02, 0x7CE0CDBA, 0xB7BC1E1F, 0x31286CB1, 0xFA74BF14,
+      0x1EB014D8, 0xD5ECC77D, 0x5378B5D3, 0x98246676, 0x852156CE, 0x4E7D856B, 0xC8E9F7C5, 0x03B52460,
+      0xF2E396B5, 0x39BF4510, 0xBF2B37BE, 0x7477E41B, 0x6972D4A3, 0xA22E0706, 0x24BA75A8, 0xEFE6A60D,
+      0x1D661643, 0xD63AC5E6, 0x50AEB748, 0x9BF264ED, 0x86F75455, 0x4DAB87F0, 0xCB3FF55E, 0x006326FB,
+      0xF135942E, 0x3A69478B, 0xBCFD3525, 0x77A1E680, 0x6AA4D638, 0xA1F8059D, 0x276C7733, 0xEC30A496,
+      0x191C11EE, 0xD240C24B, 0x54D4B0E5, 0x9F886340, 0x828D53F8, 0x49D1805D, 0xCF45F2F3, 0x04192156,
+      0xF54F9383, 0x3E134026, 0xB8873288, 0x73DBE12D, 0x6EDED195, 0xA5820230, 0x2316709E, 0xE84AA33B,
+      0x1ACA1375, 0xD196C0D0, 0x5702B27E, 0x9C5E61DB, 0x815B5163, 0x4A0782C6, 0xCC93F068, 0x07CF23CD,
+      0xF6999118, 0x3DC542BD, 0xBB513013, 0x700DE3B6, 0x6D08D30E, 0xA65400AB, 0x20C07205, 0xEB9CA1A0,
+      0x11E81EB4, 0xDAB4CD11, 0x5C20BFBF, 0x977C6C1A, 0x8A795CA2, 0x41258F07, 0xC7B1FDA9, 0x0CED2E0C,
+      0xFDBB9CD9, 0x36E74F7C, 0xB0733DD2, 0x7B2FEE77, 0x662ADECF, 0xAD760D6A, 0x2BE27FC4, 0xE0BEAC61,
+      0x123E1C2F, 0xD962CF8A, 0x5FF6BD24, 0x94AA6E81, 0x89AF5E39, 0x42F38D9C, 0xC467FF32, 0x0F3B2C97,
+      0xFE6D9E42, 0x35314DE7, 0xB3A53F49, 0x78F9ECEC, 0x65FCDC54, 0xAEA00FF1, 0x28347D5F, 0xE368AEFA,
+      0x16441B82, 0xDD18C827, 0x5B8CBA89, 0x90D0692C, 0x8DD55994, 0x46898A31, 0xC01DF89F, 0x0B412B3A,
+      0xFA1799EF, 0x314B4A4A, 0xB7DF38E4, 0x7C83EB41, 0x6186DBF9, 0xAADA085C, 0x2C4E7AF2, 0xE712A957,
+      0x15921919, 0xDECECABC, 0x585AB812, 0x93066BB7, 0x8E035B0F, 0x455F88AA, 0xC3CBFA04, 0x089729A1,
+      0xF9C19B74, 0x329D48D1, 0xB4093A7F, 0x7F55E9DA, 0x6250D962, 0xA90C0AC7, 0x2F987869, 0xE4C4ABCC
+   },
+   {
+      0x00000000, 0xA6770BB4, 0x979F1129, 0x31E81A9D, 0xF44F2413, 0x52382FA7, 0x63D0353A, 0xC5A73E8E,
+      0x33EF4E67, 0x959845D3, 0xA4705F4E, 0x020754FA, 0xC7A06A74, 0x61D761C0, 0x503F7B5D, 0xF64870E9,
+      0x67DE9CCE, 0xC1A9977A, 0xF0418DE7, 0x56368653, 0x9391B8DD, 0x35E6B369, 0x040EA9F4, 0xA279A240,
+      0x5431D2A9, 0xF246D91D, 0xC3AEC380, 0x65D9C834, 0xA07EF6BA, 0x0609FD0E, 0x37E1E793, 0x9196EC27,
+      0xCFBD399C, 0x69CA3228, 0x582228B5, 0xFE552301, 0x3BF21D8F, 0x9D85163B, 0xAC6D0CA6, 0x0A1A0712,
+      0xFC5277FB, 0x5A257C4F, 0x6BCD66D2, 0xCDBA6D66, 0x081D53E8, 0xAE6A585C, 0x9F8242C1, 0x39F54975,
+      0xA863A552, 0x0E14AEE6, 0x3FFCB47B, 0x998BBFCF, 0x5C2C8141, 0xFA5B8AF5, 0xCBB39068, 0x6DC49BDC,
+      0x9B8CEB35, 0x3DFBE081, 0x0C13FA1C, 0xAA64F1A8, 0x6FC3CF26, 0xC9B4C492, 0xF85CDE0F, 0x5E2BD5BB,
+      0x440B7579, 0xE27C7ECD, 0xD3946450, 0x75E36FE4, 0xB044516A, 0x16335ADE, 0x27DB4043, 0x81AC4BF7,
+      0x77E43B1E, 0xD19330AA, 0xE07B2A37, 0x460C2183, 0x83AB1F0D, 0x25DC14B9, 0x14340E24, 0xB2430590,
+      0x23D5E9B7, 0x85A2E203, 0xB44AF89E, 0x123DF32A, 0xD79ACDA4, 0x71EDC610, 0x4005DC8D, 0xE672D739,
+      0x103AA7D0, 0xB64DAC64, 0x87A5B6F9, 0x21D2BD4D, 0xE47583C3, 0x42028877, 0x73EA92EA, 0xD59D995E,
+      0x8BB64CE5, 0x2DC14751, 0x1C295DCC, 0xBA5E5678, 0x7FF968F6, 0xD98E6342, 0xE86679DF, 0x4E11726B,
+      0xB8590282, 0x1E2E0936, 0x2FC613AB, 0x89B1181F, 0x4C162691, 0xEA612D25, 0xDB8937B8, 0x7DFE3C0C,
+      0xEC68D02B, 0x4A1FDB9F, 0x7BF7C102, 0xDD80CAB6, 0x1827F438, 0xBE50FF8C, 0x8FB8E511, 0x29CFEEA5,
+      0xDF879E4C, 0x79F095F8, 0x48188F65, 0xEE6F84D1, 0x2BC8BA5F, 0x8DBFB1EB, 0xBC57AB76, 0x1A20A0C2,
+      0x8816EAF2, 0x2E61E146, 0x1F89FBDB, 0xB9FEF06F, 0x7C59CEE1, 0xDA2EC555, 0xEBC6DFC8, 0x4DB1D47C,
+      0xBBF9A495, 0x1D8EAF21, 0x2C66B5BC, 0x8A11BE08, 0x4FB68086, 0xE9C18B32, 0xD82991AF, 0x7E5E9A1B,
+      0xEFC8763C, 0x49BF7D88, 0x78576715, 0xDE206CA1, 0x1B87522F, 0xBDF0599B, 0x8C184306, 0x2A6F48B2,
+      0xDC27385B, 0x7A5033EF, 0x4BB82972, 0xEDCF22C6, 0x28681C48, 0x8E1F17FC, 0xBFF70D61, 0x198006D5,
+      0x47ABD36E, 0xE1DCD8DA, 0xD034C247, 0x7643C9F3, 0xB3E4F77D, 0x1593FCC9, 0x247BE654, 0x820CEDE0,
+      0x74449D09, 0xD23396BD, 0xE3DB8C20, 0x45AC8794, 0x800BB91A, 0x267CB2AE, 0x1794A833, 0xB1E3A387,
+      0x20754FA0, 0x86024414, 0xB7EA5E89, 0x119D553D, 0xD43A6BB3, 0x724D6007, 0x43A57A9A, 0xE5D2712E,
+      0x139A01C7, 0xB5ED0A73, 0x840510EE, 0x22721B5A, 0xE7D525D4, 0x41A22E60, 0x704A34FD, 0xD63D3F49,
+      0xCC1D9F8B, 0x6A6A943F, 0x5B828EA2, 0xFDF58516, 0x3852BB98, 0x9E25B02C, 0xAFCDAAB1, 0x09BAA105,
+      0xFFF2D1EC, 0x5985DA58, 0x686DC0C5, 0xCE1ACB71, 0x0BBDF5FF, 0xADCAFE4B, 0x9C22E4D6, 0x3A55EF62,
+      0xABC30345, 0x0DB408F1, 0x3C5C126C, 0x9A2B19D8, 0x5F8C2756, 0xF9FB2CE2, 0xC813367F, 0x6E643DCB,
+      0x982C4D22, 0x3E5B4696, 0x0FB35C0B, 0xA9C457BF, 0x6C636931, 0xCA146285, 0xFBFC7818, 0x5D8B73AC,
+      0x03A0A617, 0xA5D7ADA3, 0x943FB73E, 0x3248BC8A, 0xF7EF8204, 0x519889B0, 0x6070932D, 0xC6079899,
+      0x304FE870, 0x9638E3C4, 0xA7D0F959, 0x01A7F2ED, 0xC400CC63, 0x6277C7D7, 0x539FDD4A, 0xF5E8D6FE,
+      0x647E3AD9, 0xC209316D, 0xF3E12BF0, 0x55962044, 0x90311ECA, 0x3646157E, 0x07AE0FE3, 0xA1D90457,
+      0x579174BE, 0xF1E67F0A, 0xC00E6597, 0x66796E23, 0xA3DE50AD, 0x05A95B19, 0x34414184, 0x92364A30
+   },
+   {
+      0x00000000, 0xCCAA009E, 0x4225077D, 0x8E8F07E3, 0x844A0EFA, 0x48E00E64, 0xC66F0987, 0x0AC50919,
+      0xD3E51BB5, 0x1F4F1B2B, 0x91C01CC8, 0x5D6A1C56, 0x57AF154F, 0x9B0515D1, 0x158A1232, 0xD92012AC,
+      0x7CBB312B, 0xB01131B5, 0x3E9E3656, 0xF23436C8, 0xF8F13FD1, 0x345B3F4F, 0xBAD438AC, 0x767E3832,
+      0xAF5E2A9E, 0x63F42A00, 0xED7B2DE3, 0x21D12D7D, 0x2B142464, 0xE7BE24FA, 0x69312319, 0xA59B2387,
+      0xF9766256, 0x35DC62C8, 0xBB53652B, 0x77F965B5, 0x7D3C6CAC, 0xB1966C32, 0x3F196BD1, 0xF3B36B4F,
+      0x2A9379E3, 0xE639797D, 0x68B67E9E, 0xA41C7E00, 0xAED97719, 0x62737787, 0xECFC7064, 0x205670FA,
+      0x85CD537D, 0x496753E3, 0xC7E85400, 0x0B42549E, 0x01875D87, 0xCD2D5D19, 0x43A25AFA, 0x8F085A64,
+      0x562848C8, 0x9A824856, 0x140D4FB5, 0xD8A74F2B, 0xD2624632, 0x1EC846AC, 0x9047414F, 0x5CED41D1,
+      0x299DC2ED, 0xE537C273, 0x6BB8C590, 0xA712C50E, 0xADD7CC17, 0x617DCC89, 0xEFF2CB6A, 0x2358CBF4,
+      0xFA78D958, 0x36D2D9C6, 0xB85DDE25, 0x74F7DEBB, 0x7E32D7A2, 0xB298D73C, 0x3C17D0DF, 0xF0BDD041,
+      0x5526F3C6, 0x998CF358, 0x1703F4BB, 0xDBA9F425, 0xD16CFD3C, 0x1DC6FDA2, 0x9349FA41, 0x5FE3FADF,
+      0x86C3E873, 0x4A69E8ED, 0xC4E6EF0E, 0x084CEF90, 0x0289E689, 0xCE23E617, 0x40ACE1F4, 0x8C06E16A,
+      0xD0EBA0BB, 0x1C41A025, 0x92CEA7C6, 0x5E64A758, 0x54A1AE41, 0x980BAEDF, 0x1684A93C, 0xDA2EA9A2,
+      0x030EBB0E, 0xCFA4BB90, 0x412BBC73, 0x8D81BCED, 0x8744B5F4, 0x4BEEB56A, 0xC561B289, 0x09CBB217,
+      0xAC509190, 0x60FA910E, 0xEE7596ED, 0x22DF9673, 0x281A9F6A, 0xE4B09FF4, 0x6A3F9817, 0xA6959889,
+      0x7FB58A25, 0xB31F8ABB, 0x3D908D58, 0xF13A8DC6, 0xFBFF84DF, 0x37558441, 0xB9DA83A2, 0x7570833C,
+      0x533B85DA, 0x9F918544, 0x111E82A7, 0xDDB48239, 0xD7718B20, 0x1BDB8BBE, 0x95548C5D, 0x59FE8CC3,
+      0x80DE9E6F, 0x4C749EF1, 0xC2FB9912, 0x0E51998C, 0x04949095, 0xC83E900B, 0x46B197E8, 0x8A1B9776,
+      0x2F80B4F1, 0xE32AB46F, 0x6DA5B38C, 0xA10FB312, 0xABCABA0B, 0x6760BA95, 0xE9EFBD76, 0x2545BDE8,
+      0xFC65AF44, 0x30CFAFDA, 0xBE40A839, 0x72EAA8A7, 0x782FA1BE, 0xB485A120, 0x3A0AA6C3, 0xF6A0A65D,
+      0xAA4DE78C, 0x66E7E712, 0xE868E0F1, 0x24C2E06F, 0x2E07E976, 0xE2ADE9E8, 0x6C22EE0B, 0xA088EE95,
+      0x79A8FC39, 0xB502FCA7, 0x3B8DFB44, 0xF727FBDA, 0xFDE2F2C3, 0x3148F25D, 0xBFC7F5BE, 0x736DF520,
+      0xD6F6D6A7, 0x1A5CD639, 0x94D3D1DA, 0x5879D144, 0x52BCD85D, 0x9E16D8C3, 0x1099DF20, 0xDC33DFBE,
+      0x0513CD12, 0xC9B9CD8C, 0x4736CA6F, 0x8B9CCAF1, 0x8159C3E8, 0x4DF3C376, 0xC37CC495, 0x0FD6C40B,
+      0x7AA64737, 0xB60C47A9, 0x3883404A, 0xF42940D4, 0xFEEC49CD, 0x32464953, 0xBCC94EB0, 0x70634E2E,
+      0xA9435C82, 0x65E95C1C, 0xEB665BFF, 0x27CC5B61, 0x2D095278, 0xE1A352E6, 0x6F2C5505, 0xA386559B,
+      0x061D761C, 0xCAB77682, 0x44387161, 0x889271FF, 0x825778E6, 0x4EFD7878, 0xC0727F9B, 0x0CD87F05,
+      0xD5F86DA9, 0x19526D37, 0x97DD6AD4, 0x5B776A4A, 0x51B26353, 0x9D1863CD, 0x1397642E, 0xDF3D64B0,
+      0x83D02561, 0x4F7A25FF, 0xC1F5221C, 0x0D5F2282, 0x079A2B9B, 0xCB302B05, 0x45BF2CE6, 0x89152C78,
+      0x50353ED4, 0x9C9F3E4A, 0x121039A9, 0xDEBA3937, 0xD47F302E, 0x18D530B0, 0x965A3753, 0x5AF037CD,
+      0xFF6B144A, 0x33C114D4, 0xBD4E1337, 0x71E413A9, 0x7B211AB0, 0xB78B1A2E, 0x39041DCD, 0xF5AE1D53,
+      0x2C8E0FFF, 0xE0240F61, 0x6EAB0882, 0xA201081C, 0xA8C40105, 0x646E019B, 0xEAE10678, 0x264B06E6
+   }
+};
+
+// shorter inputs (PNG chunk headers, small IDATs) stay on the byte loop
+#define STBIW_CRC_SLICE_MIN  32
+
+static unsigned int stbiw__crc32_slice8(unsigned int crc, unsigned char *p, int len)
+{
+   const unsigned int (*t)[256] = stbiw__crc_slice_table;
+   for (; len >= 8; len -= 8, p += 8) {
+      unsigned int lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24));
+      unsigned int hi = p[4] | (p[5] << 8) | (p[6] << 16) | ((unsigned int) p[7] << 24);
+      crc = t[6][lo & 0xff] ^ t[5][(lo >> 8) & 0xff] ^ t[4][(lo >> 16) & 0xff] ^ t[3][lo >> 24]
+          ^ t[2][hi & 0xff] ^ t[1][(hi >> 8) & 0xff] ^ t[0][(hi >> 16) & 0xff] ^ stbiw__crc_table[hi >> 24];
+   }
+   return stbiw__crc32_bytes(crc, p, len);
+}
+
+#ifdef STBIW_PCLMUL
+// folds four 16-byte lanes at a time with carry-less multiplies, then
+// Barrett-reduces to 32 bits, after Intel's "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ". len must be a multiple of 16 and >= 64.
+STBIW_PCLMUL_TARGET
+static unsigned int stbiw__crc32_pclmul(unsigned int crc, unsigned char *buf, int len)
+{
+   const __m128i k1k2 = _mm_set_epi32(0x00000001, 0xc6e41596, 0x00000001, 0x54442bd4);
+   const __m128i k3k4 = _mm_set_epi32(0x00000000, 0xccaa009e, 0x00000001, 0x751997d0);
+   const __m128i k5k0 = _mm_set_epi32(0x00000000, 0x00000000, 0x00000001, 0x63cd6124);
+   const __m128i poly = _mm_set_epi32(0x00000001, 0xf7011641, 0x00000001, 0xdb710641);
+   const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+   __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+   x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (buf + 0x00)), _mm_cvtsi32_si128((int) crc));
+   x2 = _mm_loadu_si128((const __m128i *) (buf + 0x10));
+   x3 = _mm_loadu_si128((const __m128i *) (buf + 0x20));
+   x4 = _mm_loadu_si128((const __m128i *) (buf + 0x30));
+   buf += 64;
+   len -= 64;
+
+   x0 = k1k2;
+   for (; len >= 64; buf += 64, len -= 64) {
+      x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+      x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+      x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+      x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+      x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+      x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+      x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+      x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+      x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *) (buf + 0x00)));
+      x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *) (buf + 0x10)));
+      x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *) (buf + 0x20)));
+      x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *) (buf + 0x30)));
+   }
+
+   // fold the four lanes into one, then any remaining 16-byte blocks
+   x0 = k3k4;
+   x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+   x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x2), x5);
+   x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+   x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x3), x5);
+   x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+   x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x4), x5);
+   for (; len >= 16; buf += 16, len -= 16) {
+      x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+      x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), _mm_loadu_si128((const __m128i *) buf)), x5);
+   }
+
+   // 128 -> 64 bits
+   x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+   x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+   x2 = _mm_srli_si128(x1, 4);
+   x1 = _mm_and_si128(x1, mask32);
+   x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5k0, 0x00), x2);
+
+   // Barrett reduction to 32 bits
+   x2 = _mm_and_si128(x1, mask32);
+   x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+   x2 = _mm_and_si128(x2, mask32);
+   x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+   x1 = _mm_xor_si128(x1, x2);
+   return (unsigned int) _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif
+#endif // STBIW_CRC32
+
 static unsigned int stbiw__crc32(unsigned char *buffer, int len)
 {
 #ifdef STBIW_CRC32
     return STBIW_CRC32(buffer, len);
 #else
-   static unsigned int crc_table[256] =
-   {
-      0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3,
-      0x0eDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988, 0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
-      0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
-      0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5,
-      0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172, 0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B,
-      0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
-      0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423, 0xCFBA9599, 0xB8BDA50F,
-      0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924, 0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D,
-      0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
-      0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01,
-      0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E, 0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457,
-      0x65B0D9C6, 0x12B7E950, 0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
-      0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB,
-      0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0, 0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9,
-      0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
-      0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81, 0xB7BD5C3B, 0xC0BA6CAD,
-      0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A, 0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683,
-      0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
-      0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7,
-      0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC, 0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5,
-      0xD6D6A3E8, 0xA1D1937E, 0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
-      0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79,
-      0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236, 0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F,
-      0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
-      0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F, 0x72076785, 0x05005713,
-      0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38, 0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21,
-      0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
-      0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45,
-      0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2, 0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB,
-      0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
-      0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
-      0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
-   };
-
    unsigned int crc = ~0u;
-   int i;
-   for (i=0; i < len; ++i)
-      crc = (crc >> 8) ^ crc_table[buffer[i] ^ (crc & 0xff)];
-   return ~crc;
+#ifdef STBIW_PCLMUL
+   if (len >= 64 && stbiw__pclmul_available()) {
+      int n = len & ~15;
+      crc = stbiw__crc32_pclmul(crc, buffer, n);
+      buffer += n;
+      len -= n;
+   }
+#endif
+   if (len >= STBIW_CRC_SLICE_MIN)
+      return ~stbiw__crc32_slice8(crc, buffer, len);
+   return ~stbiw__crc32_bytes(crc, buffer, len);
 #endif
 }
 
+static unsigned int stbiw__gf2_matrix_times(const unsigned int *mat, unsigned int vec)
+{
+   unsigned int sum = 0;
+   while (vec) {
+      if (vec & 1) sum ^= *mat;
+      vec >>= 1;
+      mat++;
+   }
+   return sum;
+}
+
+static void stbiw__gf2_matrix_square(unsigned int *square, const unsigned int *mat)
+{
+   int n;
+   for (n = 0; n < 32; n++)
+      square[n] = stbiw__gf2_matrix_times(mat, mat[n]);
+}
+
+// crc32 of A followed by B, from crc32(A), crc32(B) and len(B), by applying
+// len2 zero bytes to crc1 with repeated squaring of the shift operator
+static unsigned int stbiw__crc32_combine(unsigned int crc1, unsigned int crc2, int len2)
+{
+   unsigned int even[32], odd[32], row = 1;
+   int n;
+   if (len2 <= 0) return crc1;
+
+   odd[0] = 0xedb88320u;  // operator for one zero bit
+   for (n = 1; n < 32; n++) {
+      odd[n] = row;
+      row <<= 1;
+   }
+   stbiw__gf2_matrix_square(even, odd);  // two zero bits
+   stbiw__gf2_matrix_square(odd, even);  // four zero bits
+
+   do {
+      stbiw__gf2_matrix_square(even, odd);
+      if (len2 & 1) crc1 = stbiw__gf2_matrix_times(even, crc1);
+      len2 >>= 1;
+      if (len2 == 0) break;
+      stbiw__gf2_matrix_square(odd, even);
+      if (len2 & 1) crc1 = stbiw__gf2_matrix_times(odd, crc1);
+      len2 >>= 1;
+   } while (len2 != 0);
+   return crc1 ^ crc2;
+}
+
+#ifdef STBIW_SELFTEST
+STBIWDEF int stbi_write_checksum_selftest(void)
+{
+   static const int lens[] = { 0, 1, 7, 15, 16, 17, 63, 64, 65, 100, 255, 5551, 5552, 5553, 4095, 4096, 4097, 65536+13, 300000 };
+   unsigned char *buf = (unsigned char *) STBIW_MALLOC(300000 + 16);
+   unsigned int seed = 1;
+   int i, j, k, ok = 1;
+   if (!buf) return 0;
+   for (k=0; k < 3; ++k) {
+      // random bytes, all 0xff (worst case for the Adler-32 sums), all zero
+      for (i=0; i < 300000 + 16; ++i) {
+         seed = seed * 1103515245 + 12345;
+         buf[i] = k == 0 ? (unsigned char) (seed >> 24) : k == 1 ? 0xff : 0;
+      }
+      for (i=0; i < (int) (sizeof(lens)/sizeof(lens[0])); ++i) {
+         for (j=0; j < 16; j += 5) { // misaligned starts
+            unsigned char *p = buf + j;
+            unsigned int adler0 = k == 1 ? 0xfff0fff0u : 1;
+            int split = lens[i] / 3;
+            if (stbiw__adler32(adler0, p, lens[i]) != stbiw__adler32_bytes(adler0, p, lens[i])) ok = 0;
+#ifndef STBIW_CRC32
+            if (stbiw__crc32(p, lens[i]) != ~stbiw__crc32_bytes(~0u, p, lens[i])) ok = 0;
+            if (stbiw__crc32_slice8(0x12345678u, p, lens[i]) != stbiw__crc32_bytes(0x12345678u, p, lens[i])) ok = 0;
+#endif
+            if (stbiw__adler32_combine(stbiw__adler32(1, p, split), stbiw__adler32(1, p + split, lens[i] - split), lens[i] - split)
+                != stbiw__adler32(1, p, lens[i])) ok = 0;
+            if (stbiw__crc32_combine(stbiw__crc32(p, split), stbiw__crc32(p + split, lens[i] - split), lens[i] - split)
+                != stbiw__crc32(p, lens[i])) ok = 0;
+         }
+      }
+   }
+   STBIW_FREE(buf);
+   return ok;
+}
+#endif
+
 #define stbiw__wpng4(o,a,b,c,d) ((o)[0]=STBIW_UCHAR(a),(o)[1]=STBIW_UCHAR(b),(o)[2]=STBIW_UCHAR(c),(o)[3]=STBIW_UCHAR(d),(o)+=4)
 #define stbiw__wp32(data,v) stbiw__wpng4(data, (v)>>24,(v)>>16,(v)>>8,(v));
 #define stbiw__wptag(data,s) stbiw__wpng4(data, s[0],s[1],s[2],s[3])
@@ -1125,11 +1826,62 @@ static void stbiw__encode_png_line(unsigned char *pixels, int stride_bytes, int
    }
 }
 
+// pick the filter for row j (or use force_filter) and write the filter byte
+// plus filtered row into filt
+static void stbiw__png_filter_row(const unsigned char *pixels, int stride_bytes, int x, int y, int j, int n, int force_filter, signed char *line_buffer, unsigned char *filt)
+{
+   int filter_type;
+   if (force_filter > -1) {
+      filter_type = force_filter;
+      stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, force_filter, line_buffer);
+   } else { // Estimate the best filter by running through all of them:
+      int best_filter = 0, best_filter_val = 0x7fffffff, est, i;
+      for (filter_type = 0; filter_type < 5; filter_type++) {
+         stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, filter_type, line_buffer);
+
+         // Estimate the entropy of the line using this filter; the less, the better.
+         est = 0;
+         for (i = 0; i < x*n; ++i) {
+            est += abs((signed char) line_buffer[i]);
+         }
+         if (est < best_filter_val) {
+            best_filter_val = est;
+            best_filter = filter_type;
+         }
+      }
+      if (filter_type != best_filter) {  // If the last iteration already got us the best filter, don't redo it
+         stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, best_filter, line_buffer);
+         filter_type = best_filter;
+      }
+   }
+   // when we get here, filter_type contains the filter type, and line_buffer contains the data
+   filt[j*(x*n+1)] = (unsigned char) filter_type;
+   STBIW_MEMMOVE(filt+j*(x*n+1)+1, line_buffer, x*n);
+}
+
+// PNG signature plus the IHDR chunk, 8 + 12+13 bytes
+static void stbiw__wpng_header(unsigned char **data, int x, int y, int n)
+{
+   static int ctype[5] = { -1, 0, 4, 2, 6 };
+   static unsigned char sig[8] = { 137,80,78,71,13,10,26,10 };
+   unsigned char *o = *data;
+   STBIW_MEMMOVE(o,sig,8); o+= 8;
+   stbiw__wp32(o, 13); // header length
+   stbiw__wptag(o, "IHDR");
+   stbiw__wp32(o, x);
+   stbiw__wp32(o, y);
+   *o++ = 8;
+   *o++ = STBIW_UCHAR(ctype[n]);
+   *o++ = 0;
+   *o++ = 0;
+   *o++ = 0;
+   stbiw__wpcrc(&o,13);
+   *data = o;
+}
+
 STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len)
 {
    int force_filter = stbi_write_force_png_filter;
-   int ctype[5] = { -1, 0, 4, 2, 6 };
-   unsigned char sig[8] = { 137,80,78,71,13,10,26,10 };
    unsigned char *out,*o, *filt, *zlib;
    signed char *line_buffer;
    int j,zlen;
@@ -1143,35 +1895,8 @@ STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int s
 
    filt = (unsigned char *) STBIW_MALLOC((x*n+1) * y); if (!filt) return 0;
    line_buffer = (signed char *) STBIW_MALLOC(x * n); if (!line_buffer) { STBIW_FREE(filt); return 0; }
-   for (j=0; j < y; ++j) {
-      int filter_type;
-      if (force_filter > -1) {
-         filter_type = force_filter;
-         stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, force_filter, line_buffer);
-      } else { // Estimate the best filter by running through all of them:
-         int best_filter = 0, best_filter_val = 0x7fffffff, est, i;
-         for (filter_type = 0; filter_type < 5; filter_type++) {
-            stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, filter_type, line_buffer);
-
-            // Estimate the entropy of the line using this filter; the less, the better.
-            est = 0;
-            for (i = 0; i < x*n; ++i) {
-               est += abs((signed char) line_buffer[i]);
-            }
-            if (est < best_filter_val) {
-               best_filter_val = est;
-               best_filter = filter_type;
-            }
-         }
-         if (filter_type != best_filter) {  // If the last iteration already got us the best filter, don't redo it
-            stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, best_filter, line_buffer);
-            filter_type = best_filter;
-         }
-      }
-      // when we get here, filter_type contains the filter type, and line_buffer contains the data
-      filt[j*(x*n+1)] = (unsigned char) filter_type;
-      STBIW_MEMMOVE(filt+j*(x*n+1)+1, line_buffer, x*n);
-   }
+   for (j=0; j < y; ++j)
+      stbiw__png_filter_row(pixels, stride_bytes, x, y, j, n, force_filter, line_buffer, filt);
    STBIW_FREE(line_buffer);
    zlib = stbi_zlib_compress(filt, y*( x*n+1), &zlen, stbi_write_png_compression_level);
    STBIW_FREE(filt);
@@ -1183,17 +1908,7 @@ STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int s
    *out_len = 8 + 12+13 + 12+zlen + 12;
 
    o=out;
-   STBIW_MEMMOVE(o,sig,8); o+= 8;
-   stbiw__wp32(o, 13); // header length
-   stbiw__wptag(o, "IHDR");
-   stbiw__wp32(o, x);
-   stbiw__wp32(o, y);
-   *o++ = 8;
-   *o++ = STBIW_UCHAR(ctype[n]);
-   *o++ = 0;
-   *o++ = 0;
-   *o++ = 0;
-   stbiw__wpcrc(&o,13);
+   stbiw__wpng_header(&o, x, y, n);
 
    stbiw__wp32(o, zlen);
    stbiw__wptag(o, "IDAT");
@@ -1211,6 +1926,145 @@ STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int s
    return out;
 }
 
+#ifndef STBIW_ZLIB_COMPRESS
+#ifndef STBIW_PNG_CHUNK
+#define STBIW_PNG_CHUNK  131072  // bytes of filtered data per deflate task, as in pigz
+#endif
+#define STBIW_PNG_BAND   32      // rows per filter task
+
+typedef struct
+{
+   const unsigned char *pixels;
+   int stride_bytes, x, y, n, force_filter, quality;
+   unsigned char *filt;
+   int filt_len, nchunks;
+   int failed;                 // set by any filter task that ran out of memory
+   unsigned char **chunk;      // stretchy buffers, one per chunk
+   unsigned int *chunk_adler, *chunk_crc;
+} stbiw__png_job;
+
+static void stbiw__png_filter_task(void *data, int index)
+{
+   stbiw__png_job *job = (stbiw__png_job *) data;
+   int j, j1 = (index+1) * STBIW_PNG_BAND;
+   signed char *line_buffer = (signed char *) STBIW_MALLOC(job->x * job->n);
+   if (!line_buffer) { job->failed = 1; return; }
+   if (j1 > job->y) j1 = job->y;
+   for (j = index * STBIW_PNG_BAND; j < j1; ++j)
+      stbiw__png_filter_row(job->pixels, job->stride_bytes, job->x, job->y, j, job->n, job->force_filter, line_buffer, job->filt);
+   STBIW_FREE(line_buffer);
+}
+
+static void stbiw__png_deflate_task(void *data, int index)
+{
+   stbiw__png_job *job = (stbiw__png_job *) data;
+   int start = index * STBIW_PNG_CHUNK;
+   int end = index == job->nchunks-1 ? job->filt_len : start + STBIW_PNG_CHUNK;
+   unsigned char *out = stbiw__zlib_deflate_range(NULL, job->filt, start, end, index == job->nchunks-1, job->quality);
+   job->chunk[index] = out;
+   if (!out) return;
+   job->chunk_adler[index] = stbiw__adler32(1, job->filt + start, end - start);
+   job->chunk_crc[index] = stbiw__crc32(out, stbiw__sbn(out));
+}
+
+static void stbiw__run_tasks(stbi_write_parallel_func *parallel_for, void *context, int count, void (*task)(void *, int), void *data)
+{
+   int i;
+   if (parallel_for) {
+      parallel_for(context, count, task, data);
+      return;
+   }
+   for (i=0; i < count; ++i)
+      task(data, i);
+}
+
+STBIWDEF unsigned char *stbi_write_png_to_mem_parallel(const unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len, stbi_write_parallel_func *parallel_for, void *parallel_context)
+{
+   stbiw__png_job job;
+   unsigned char *out = NULL, *o;
+   unsigned char zhead[6] = { 'I','D','A','T', 0x78, 0x5e };  // DEFLATE 32K window, FLEVEL = 1
+   unsigned int adler = 1, crc;
+   int i, zlen, failed = 0;
+
+   if (stride_bytes == 0)
+      stride_bytes = x * n;
+
+   memset(&job, 0, sizeof(job));
+   job.pixels = pixels;
+   job.stride_bytes = stride_bytes;
+   job.x = x; job.y = y; job.n = n;
+   job.force_filter = stbi_write_force_png_filter >= 5 ? -1 : stbi_write_force_png_filter;
+   job.quality = stbi_write_png_compression_level;
+   job.filt_len = (x*n+1) * y;
+   job.nchunks = (job.filt_len + STBIW_PNG_CHUNK-1) / STBIW_PNG_CHUNK;
+   if (job.nchunks < 1) return stbi_write_png_to_mem(pixels, stride_bytes, x, y, n, out_len);
+
+   job.filt = (unsigned char *) STBIW_MALLOC(job.filt_len);
+   job.chunk = (unsigned char **) STBIW_MALLOC(job.nchunks * sizeof(unsigned char *));
+   if (job.chunk) for (i=0; i < job.nchunks; ++i) job.chunk[i] = NULL;
+   job.chunk_adler = (unsigned int *) STBIW_MALLOC(job.nchunks * sizeof(unsigned int));
+   job.chunk_crc = (unsigned int *) STBIW_MALLOC(job.nchunks * sizeof(unsigned int));
+   if (!job.filt || !job.chunk || !job.chunk_adler || !job.chunk_crc) { failed = 1; goto done; }
+
+   stbiw__run_tasks(parallel_for, parallel_context, (y + STBIW_PNG_BAND-1) / STBIW_PNG_BAND, stbiw__png_filter_task, &job);
+   if (job.failed) { failed = 1; goto done; }
+   stbiw__run_tasks(parallel_for, parallel_context, job.nchunks, stbiw__png_deflate_task, &job);
+
+   // stitch: the IDAT crc runs over tag, zlib header, every chunk and the adler trailer
+   zlen = 2 + 4;
+   crc = stbiw__crc32(zhead, 6);
+   for (i=0; i < job.nchunks; ++i) {
+      int start = i * STBIW_PNG_CHUNK;
+      int len = i == job.nchunks-1 ? job.filt_len - start : STBIW_PNG_CHUNK;
+      if (!job.chunk[i]) { failed = 1; goto done; }
+      zlen += stbiw__sbn(job.chunk[i]);
+      crc = stbiw__crc32_combine(crc, job.chunk_crc[i], stbiw__sbn(job.chunk[i]));
+      adler = i ? stbiw__adler32_combine(adler, job.chunk_adler[i], len) : job.chunk_adler[i];
+   }
+
+   *out_len = 8 + 12+13 + 12+zlen + 12;
+   out = (unsigned char *) STBIW_MALLOC(*out_len);
+   if (!out) { failed = 1; goto done; }
+   o = out;
+   stbiw__wpng_header(&o, x, y, n);
+   stbiw__wp32(o, zlen);
+   STBIW_MEMMOVE(o, zhead, 6); o += 6;
+   for (i=0; i < job.nchunks; ++i) {
+      STBIW_MEMMOVE(o, job.chunk[i], stbiw__sbn(job.chunk[i]));
+      o += stbiw__sbn(job.chunk[i]);
+   }
+   stbiw__wp32(o, adler);
+   crc = stbiw__crc32_combine(crc, stbiw__crc32(o - 4, 4), 4);
+   stbiw__wp32(o, crc);
+
+   stbiw__wp32(o,0);
+   stbiw__wptag(o, "IEND");
+   stbiw__wpcrc(&o,0);
+   STBIW_ASSERT(o == out + *out_len);
+
+done:
+   if (job.chunk)
+      for (i=0; i < job.nchunks; ++i)
+         (void) stbiw__sbfree(job.chunk[i]);
+   STBIW_FREE(job.chunk);
+   STBIW_FREE(job.chunk_adler);
+   STBIW_FREE(job.chunk_crc);
+   STBIW_FREE(job.filt);
+   if (failed) {
+      STBIW_FREE(out);
+      return NULL;
+   }
+   return out;
+}
+#else
+STBIWDEF unsigned char *stbi_write_png_to_mem_parallel(const unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len, stbi_write_parallel_func *parallel_for, void *parallel_context)
+{
+   // a user-supplied zlib can't be split into chunks; write serially
+   (void) parallel_for; (void) parallel_context;
+   return stbi_write_png_to_mem(pixels, stride_bytes, x, y, n, out_len);
+}
+#endif // STBIW_ZLIB_COMPRESS
+
 #ifndef STBI_WRITE_NO_STDIO
 STBIWDEF int stbi_write_png(char const *filename, int x, int y, int comp, const void *data, int stride_bytes)
 {
@@ -1250,15 +2104,17 @@ STBIWDEF int stbi_write_png_to_func(stbi_write_func *func, void *context, int x,
 static const unsigned char stbiw__jpg_ZigZag[] = { 0,1,5,6,14,15,27,28,2,4,7,13,16,26,29,42,3,8,12,17,25,30,41,43,9,11,18,
       24,31,40,44,53,10,19,23,32,39,45,52,54,20,22,33,38,46,51,55,60,21,34,37,47,50,56,59,61,35,36,48,49,57,58,62,63 };
 
-static void stbiw__jpg_writeBits(stbi__write_context *s, int *bitBufP, int *bitCntP, const unsigned short *bs) {
-   int bitBuf = *bitBufP, bitCnt = *bitCntP;
+// bitBuf is unsigned: bits shift out of the top as bytes are written
+static void stbiw__jpg_writeBits(stbi__write_context *s, unsigned int *bitBufP, int *bitCntP, const unsigned short *bs) {
+   unsigned int bitBuf = *bitBufP;
+   int bitCnt = *bitCntP;
    bitCnt += bs[1];
-   bitBuf |= bs[0] << (24 - bitCnt);
+   bitBuf |= (unsigned int) bs[0] << (24 - bitCnt);
    while(bitCnt >= 8) {
       unsigned char c = (bitBuf >> 16) & 255;
-      stbiw__putc(s, c);
+      stbiw__write1(s, c);
       if(c == 255) {
-         stbiw__putc(s, 0);
+         stbiw__write1(s, 0);
       }
       bitBuf <<= 8;
       bitCnt -= 8;
@@ -1267,6 +2123,7 @@ static void stbiw__jpg_writeBits(stbi__write_context *s, int *bitBufP, int *bitC
    *bitCntP = bitCnt;
 }
 
+#ifndef STBIW_SSE2
 static void stbiw__jpg_DCT(float *d0p, float *d1p, float *d2p, float *d3p, float *d4p, float *d5p, float *d6p, float *d7p) {
    float d0 = *d0p, d1 = *d1p, d2 = *d2p, d3 = *d3p, d4 = *d4p, d5 = *d5p, d6 = *d6p, d7 = *d7p;
    float z1, z2, z3, z4, z5, z11, z13;
@@ -1314,6 +2171,7 @@ static void stbiw__jpg_DCT(float *d0p, float *d1p, float *d2p, float *d3p, float
 
    *d0p = d0;  *d2p = d2;  *d4p = d4;  *d6p = d6;
 }
+#endif
 
 static void stbiw__jpg_calcBits(int val, unsigned short bits[2]) {
    int tmp1 = val < 0 ? -val : val;
@@ -1325,11 +2183,98 @@ static void stbiw__jpg_calcBits(int val, unsigned short bits[2]) {
    bits[0] = val & ((1<<bits[1])-1);
 }
 
-static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt, float *CDU, int du_stride, float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
-   const unsigned short EOB[2] = { HTAC[0x00][0], HTAC[0x00][1] };
-   const unsigned short M16zeroes[2] = { HTAC[0xF0][0], HTAC[0xF0][1] };
-   int dataOff, i, j, n, diff, end0pos, x, y;
-   int DU[64];
+#ifdef STBIW_SSE2
+// stbiw__jpg_DCT on four columns at once: d[k] holds row k of four
+// neighbouring columns, and every lane does the scalar code's arithmetic in
+// the same order, so the results are bit-identical to it
+static void stbiw__jpg_DCT4(__m128 *d) {
+   __m128 tmp0 = _mm_add_ps(d[0], d[7]);
+   __m128 tmp7 = _mm_sub_ps(d[0], d[7]);
+   __m128 tmp1 = _mm_add_ps(d[1], d[6]);
+   __m128 tmp6 = _mm_sub_ps(d[1], d[6]);
+   __m128 tmp2 = _mm_add_ps(d[2], d[5]);
+   __m128 tmp5 = _mm_sub_ps(d[2], d[5]);
+   __m128 tmp3 = _mm_add_ps(d[3], d[4]);
+   __m128 tmp4 = _mm_sub_ps(d[3], d[4]);
+   __m128 tmp10, tmp11, tmp12, tmp13, z1, z2, z3, z4, z5, z11, z13;
+
+   // Even part
+   tmp10 = _mm_add_ps(tmp0, tmp3);
+   tmp13 = _mm_sub_ps(tmp0, tmp3);
+   tmp11 = _mm_add_ps(tmp1, tmp2);
+   tmp12 = _mm_sub_ps(tmp1, tmp2);
+
+   d[0] = _mm_add_ps(tmp10, tmp11);
+   d[4] = _mm_sub_ps(tmp10, tmp11);
+
+   z1 = _mm_mul_ps(_mm_add_ps(tmp12, tmp13), _mm_set1_ps(0.707106781f));
+   d[2] = _mm_add_ps(tmp13, z1);
+   d[6] = _mm_sub_ps(tmp13, z1);
+
+   // Odd part
+   tmp10 = _mm_add_ps(tmp4, tmp5);
+   tmp11 = _mm_add_ps(tmp5, tmp6);
+   tmp12 = _mm_add_ps(tmp6, tmp7);
+
+   z5 = _mm_mul_ps(_mm_sub_ps(tmp10, tmp12), _mm_set1_ps(0.382683433f));
+   z2 = _mm_add_ps(_mm_mul_ps(tmp10, _mm_set1_ps(0.541196100f)), z5);
+   z4 = _mm_add_ps(_mm_mul_ps(tmp12, _mm_set1_ps(1.306562965f)), z5);
+   z3 = _mm_mul_ps(tmp11, _mm_set1_ps(0.707106781f));
+
+   z11 = _mm_add_ps(tmp7, z3);
+   z13 = _mm_sub_ps(tmp7, z3);
+
+   d[5] = _mm_add_ps(z13, z2);
+   d[3] = _mm_sub_ps(z13, z2);
+   d[1] = _mm_add_ps(z11, z4);
+   d[7] = _mm_sub_ps(z11, z4);
+}
+
+// lo[k]/hi[k] are columns 0..3 / 4..7 of row k; transposes the 8x8 block
+static void stbiw__jpg_transpose8(__m128 *lo, __m128 *hi) {
+   __m128 t;
+   _MM_TRANSPOSE4_PS(lo[0], lo[1], lo[2], lo[3]);
+   _MM_TRANSPOSE4_PS(hi[4], hi[5], hi[6], hi[7]);
+   _MM_TRANSPOSE4_PS(hi[0], hi[1], hi[2], hi[3]);
+   _MM_TRANSPOSE4_PS(lo[4], lo[5], lo[6], lo[7]);
+   t = hi[0]; hi[0] = lo[4]; lo[4] = t;
+   t = hi[1]; hi[1] = lo[5]; lo[5] = t;
+   t = hi[2]; hi[2] = lo[6]; lo[6] = t;
+   t = hi[3]; hi[3] = lo[7]; lo[7] = t;
+}
+#endif
+
+// forward DCT of the 8x8 block at CDU, then quantize/descale/zigzag into DU
+static void stbiw__jpg_fdct_quant(float *CDU, int du_stride, const float *fdtbl, int DU[64]) {
+#ifdef STBIW_SSE2
+   __m128 lo[8], hi[8];
+   int q[64];
+   int k;
+   for(k = 0; k < 8; ++k) {
+      lo[k] = _mm_loadu_ps(CDU + k*du_stride);
+      hi[k] = _mm_loadu_ps(CDU + k*du_stride + 4);
+   }
+   // rows first, as in the scalar code: transpose, DCT the columns, transpose back
+   stbiw__jpg_transpose8(lo, hi);
+   stbiw__jpg_DCT4(lo);
+   stbiw__jpg_DCT4(hi);
+   stbiw__jpg_transpose8(lo, hi);
+   stbiw__jpg_DCT4(lo);
+   stbiw__jpg_DCT4(hi);
+   for(k = 0; k < 8; ++k) {
+      // round half away from zero: add 0.5 carrying v's sign, then truncate
+      __m128 sign = _mm_set1_ps(-0.0f), half = _mm_set1_ps(0.5f);
+      __m128 a = _mm_mul_ps(lo[k], _mm_loadu_ps(fdtbl + k*8));
+      __m128 b = _mm_mul_ps(hi[k], _mm_loadu_ps(fdtbl + k*8 + 4));
+      a = _mm_add_ps(a, _mm_or_ps(half, _mm_and_ps(a, sign)));
+      b = _mm_add_ps(b, _mm_or_ps(half, _mm_and_ps(b, sign)));
+      _mm_storeu_si128((__m128i *) (q + k*8), _mm_cvttps_epi32(a));
+      _mm_storeu_si128((__m128i *) (q + k*8 + 4), _mm_cvttps_epi32(b));
+   }
+   for(k = 0; k < 64; ++k)
+      DU[stbiw__jpg_ZigZag[k]] = q[k];
+#else
+   int dataOff, i, j, n, x, y;
 
    // DCT rows
    for(dataOff=0, n=du_stride*8; dataOff<n; dataOff+=du_stride) {
@@ -1351,6 +2296,16 @@ static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt
          DU[stbiw__jpg_ZigZag[j]] = (int)(v < 0 ? v - 0.5f : v + 0.5f);
       }
    }
+#endif
+}
+
+static int stbiw__jpg_processDU(stbi__write_context *s, unsigned int *bitBuf, int *bitCnt, float *CDU, int du_stride, float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
+   const unsigned short EOB[2] = { HTAC[0x00][0], HTAC[0x00][1] };
+   const unsigned short M16zeroes[2] = { HTAC[0xF0][0], HTAC[0xF0][1] };
+   int i, diff, end0pos;
+   int DU[64];
+
+   stbiw__jpg_fdct_quant(CDU, du_stride, fdtbl, DU);
 
    // Encode DC
    diff = DU[0] - DC;
@@ -1395,7 +2350,264 @@ static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt
    return DU[0];
 }
 
-static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, int comp, const void* data, int quality) {
+// stbiw__jpg_processDU's symbol walk, tallying Huffman symbols instead of
+// writing them (first pass of the optimized-table mode)
+static int stbiw__jpg_countDU(float *CDU, int du_stride, float *fdtbl, int DC, unsigned int *dcfreq, unsigned int *acfreq) {
+   int i, end0pos;
+   int DU[64];
+   unsigned short bits[2];
+
+   stbiw__jpg_fdct_quant(CDU, du_stride, fdtbl, DU);
+
+   if (DU[0] == DC) {
+      ++dcfreq[0];
+   } else {
+      stbiw__jpg_calcBits(DU[0] - DC, bits);
+      ++dcfreq[bits[1]];
+   }
+   for(end0pos = 63; (end0pos>0)&&(DU[end0pos]==0); --end0pos) {
+   }
+   for(i = 1; i <= end0pos; ++i) {
+      int startpos = i;
+      int nrzeroes;
+      for (; DU[i]==0 && i<=end0pos; ++i) {
+      }
+      nrzeroes = i-startpos;
+      acfreq[0xF0] += nrzeroes >> 4;
+      stbiw__jpg_calcBits(DU[i], bits);
+      ++acfreq[((nrzeroes&15)<<4)+bits[1]];
+   }
+   if(end0pos != 63) {
+      ++acfreq[0x00]; // EOB
+   }
+   return DU[0];
+}
+
+// JPEG Annex K.2: code lengths from symbol counts, limited to 16 bits with
+// one code held back so no code is all 1s. Fills bits[1..16] and val[] in
+// code order (the DHT payload) and returns the number of symbols.
+static int stbiw__jpg_gen_table(const unsigned int count[256], unsigned char bits[17], unsigned char val[256]) {
+   unsigned int freq[257];
+   int codesize[257], others[257], nbits[33];
+   int i, j, n = 0;
+
+   for(i = 0; i < 256; ++i) freq[i] = count[i];
+   freq[256] = 1; // reserved
+   for(i = 0; i < 257; ++i) { codesize[i] = 0; others[i] = -1; }
+
+   for(;;) {
+      // the two least frequent live symbols, larger index first on ties
+      int c1 = -1, c2 = -1;
+      unsigned int v = 0xffffffffu;
+      for(i = 0; i < 257; ++i)
+         if(freq[i] && freq[i] <= v) { v = freq[i]; c1 = i; }
+      v = 0xffffffffu;
+      for(i = 0; i < 257; ++i)
+         if(freq[i] && freq[i] <= v && i != c1) { v = freq[i]; c2 = i; }
+      if(c2 < 0) break;
+
+      freq[c1] += freq[c2];
+      freq[c2] = 0;
+      ++codesize[c1];
+      while(others[c1] >= 0) { c1 = others[c1]; ++codesize[c1]; }
+      others[c1] = c2;
+      ++codesize[c2];
+      while(others[c2] >= 0) { c2 = others[c2]; ++codesize[c2]; }
+   }
+
+   for(i = 0; i < 33; ++i) nbits[i] = 0;
+   for(i = 0; i < 257; ++i)
+      if(codesize[i]) ++nbits[codesize[i] > 32 ? 32 : codesize[i]];
+   for(i = 32; i > 16; --i) {
+      while(nbits[i] > 0) {
+         j = i - 2;
+         while(nbits[j] == 0) --j;
+         nbits[i] -= 2;
+         ++nbits[i-1];
+         nbits[j+1] += 2;
+         --nbits[j];
+      }
+   }
+   while(nbits[i] == 0) --i;
+   --nbits[i]; // drop the reserved symbol's code, the longest one
+
+   for(i = 1; i <= 16; ++i) bits[i] = (unsigned char) nbits[i];
+   for(i = 1; i <= 32; ++i)
+      for(j = 0; j < 256; ++j)
+         if(codesize[j] == i) val[n++] = (unsigned char) j;
+   return n;
+}
+
+// canonical (code, length) per symbol from a DHT bits/val pair
+static void stbiw__jpg_build_codes(const unsigned char bits[17], const unsigned char *val, unsigned short ht[256][2]) {
+   int len, i, k = 0, code = 0;
+   memset(ht, 0, 256 * sizeof(ht[0]));
+   for(len = 1; len <= 16; ++len) {
+      for(i = 0; i < bits[len]; ++i, ++k, ++code) {
+         ht[val[k]][0] = (unsigned short) code;
+         ht[val[k]][1] = (unsigned short) len;
+      }
+      code <<= 1;
+   }
+}
+
+typedef struct
+{
+   const unsigned char *data;
+   int width, height, comp, subsample;
+   float fdtbl_Y[64], fdtbl_UV[64];
+   const unsigned short (*YDC_HT)[2], (*YAC_HT)[2], (*UVDC_HT)[2], (*UVAC_HT)[2];
+} stbiw__jpg_state;
+
+// one data unit: encoded, or when freq is set (YDC, YAC, UVDC, UVAC), counted
+#define stbiw__jpg_DU(CDU, stride, fdtbl, DC, DC_HT, AC_HT, nfreq) \
+      (freq ? stbiw__jpg_countDU(CDU, stride, fdtbl, DC, freq[nfreq], freq[(nfreq)+1]) \
+            : stbiw__jpg_processDU(s, &bitBuf, &bitCnt, CDU, stride, fdtbl, DC, DC_HT, AC_HT))
+
+// encode the MCUs covering image rows [y0,y1) (y0 on an MCU boundary) with
+// DC prediction starting from 0, and pad the last byte. With freq, nothing
+// is written; the Huffman symbols are tallied instead.
+static void stbiw__jpg_encode_rows(stbi__write_context *s, const stbiw__jpg_state *st, int y0, int y1, unsigned int (*freq)[256]) {
+   static const unsigned short fillBits[] = {0x7F, 7};
+   const unsigned short (*YDC_HT)[2] = st->YDC_HT, (*YAC_HT)[2] = st->YAC_HT;
+   const unsigned short (*UVDC_HT)[2] = st->UVDC_HT, (*UVAC_HT)[2] = st->UVAC_HT;
+   float *fdtbl_Y = (float *) st->fdtbl_Y, *fdtbl_UV = (float *) st->fdtbl_UV;
+   int width = st->width, height = st->height, comp = st->comp;
+   int DCY=0, DCU=0, DCV=0;
+   unsigned int bitBuf=0;
+   int bitCnt=0;
+   // comp == 2 is grey+alpha (alpha is ignored)
+   int ofsG = comp > 2 ? 1 : 0, ofsB = comp > 2 ? 2 : 0;
+   const unsigned char *dataR = st->data;
+   const unsigned char *dataG = dataR + ofsG;
+   const unsigned char *dataB = dataR + ofsB;
+   int x, y, pos, row, col;
+   if(st->subsample) {
+      for(y = y0; y < y1; y += 16) {
+         for(x = 0; x < width; x += 16) {
+            float Y[256], U[256], V[256];
+            for(row = y, pos = 0; row < y+16; ++row) {
+               // row >= height => use last input row
+               int clamped_row = (row < height) ? row : height - 1;
+               int base_p = (stbi__flip_vertically_on_write ? (height-1-clamped_row) : clamped_row)*width*comp;
+               for(col = x; col < x+16; ++col, ++pos) {
+                  // if col >= width => use pixel from last input column
+                  int p = base_p + ((col < width) ? col : (width-1))*comp;
+                  float r = dataR[p], g = dataG[p], b = dataB[p];
+                  Y[pos]= +0.29900f*r + 0.58700f*g + 0.11400f*b - 128;
+                  U[pos]= -0.16874f*r - 0.33126f*g + 0.50000f*b;
+                  V[pos]= +0.50000f*r - 0.41869f*g - 0.08131f*b;
+               }
+            }
+            DCY = stbiw__jpg_DU(Y+0,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT, 0);
+            DCY = stbiw__jpg_DU(Y+8,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT, 0);
+            DCY = stbiw__jpg_DU(Y+128, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT, 0);
+            DCY = stbiw__jpg_DU(Y+136, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT, 0);
+
+            // subsample U,V
+            {
+               float subU[64], subV[64];
+               int yy, xx;
+               for(yy = 0, pos = 0; yy < 8; ++yy) {
+                  for(xx = 0; xx < 8; ++xx, ++pos) {
+                     int j = yy*32+xx*2;
+                     subU[pos] = (U[j+0] + U[j+1] + U[j+16] + U[j+17]) * 0.25f;
+                     subV[pos] = (V[j+0] + V[j+1] + V[j+16] + V[j+17]) * 0.25f;
+                  }
+               }
+               DCU = stbiw__jpg_DU(subU, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT, 2);
+               DCV = stbiw__jpg_DU(subV, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT, 2);
+            }
+         }
+      }
+   } else {
+      for(y = y0; y < y1; y += 8) {
+         for(x = 0; x < width; x += 8) {
+            float Y[64], U[64], V[64];
+            for(row = y, pos = 0; row < y+8; ++row) {
+               // row >= height => use last input row
+               int clamped_row = (row < height) ? row : height - 1;
+               int base_p = (stbi__flip_vertically_on_write ? (height-1-clamped_row) : clamped_row)*width*comp;
+               for(col = x; col < x+8; ++col, ++pos) {
+                  // if col >= width => use pixel from last input column
+                  int p = base_p + ((col < width) ? col : (width-1))*comp;
+                  float r = dataR[p], g = dataG[p], b = dataB[p];
+                  Y[pos]= +0.29900f*r + 0.58700f*g + 0.11400f*b - 128;
+                  U[pos]= -0.16874f*r - 0.33126f*g + 0.50000f*b;
+                  V[pos]= +0.50000f*r - 0.41869f*g - 0.08131f*b;
+               }
+            }
+
+            DCY = stbiw__jpg_DU(Y, 8, fdtbl_Y,  DCY, YDC_HT, YAC_HT, 0);
+            DCU = stbiw__jpg_DU(U, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT, 2);
+            DCV = stbiw__jpg_DU(V, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT, 2);
+         }
+      }
+   }
+
+   if (freq) return;
+
+   // Do the bit alignment of the EOI/RSTn marker
+   stbiw__jpg_writeBits(s, &bitBuf, &bitCnt, fillBits);
+   stbiw__write_flush(s);
+}
+
+#ifndef STBIW_JPG_BAND_MCU_ROWS
+#define STBIW_JPG_BAND_MCU_ROWS  4   // MCU rows per restart interval in banded output
+#endif
+
+// growable output for one band; cap < 0 marks an allocation failure
+typedef struct
+{
+   unsigned char *data;
+   int len, cap;
+} stbiw__membuf;
+
+static void stbiw__membuf_write(void *context, void *data, int size)
+{
+   stbiw__membuf *b = (stbiw__membuf *) context;
+   if (b->cap < 0) return;
+   if (b->len + size > b->cap) {
+      int cap = 2*b->cap + size + 4096;
+      unsigned char *p = (unsigned char *) STBIW_REALLOC_SIZED(b->data, b->cap, cap);
+      if (!p) { b->cap = -1; return; }
+      b->data = p;
+      b->cap = cap;
+   }
+   memcpy(b->data + b->len, data, size);
+   b->len += size;
+}
+
+typedef struct
+{
+   const stbiw__jpg_state *st;
+   int band_rows;
+   stbiw__membuf *bands;
+   unsigned int (*freq)[256];  // counting pass: 4 tables per band
+} stbiw__jpg_job;
+
+static void stbiw__jpg_band_task(void *data, int index)
+{
+   stbiw__jpg_job *job = (stbiw__jpg_job *) data;
+   stbi__write_context s;
+   int y0 = index * job->band_rows, y1 = y0 + job->band_rows;
+   memset(&s, 0, sizeof(s));
+   if (!job->freq)
+      stbi__start_write_callbacks(&s, stbiw__membuf_write, &job->bands[index]);
+   stbiw__jpg_encode_rows(&s, job->st, y0, y1 < job->st->height ? y1 : job->st->height, job->freq ? job->freq + 4*index : NULL);
+}
+
+static void stbiw__jpg_run_bands(stbiw__jpg_job *job, int nbands, stbi_write_parallel_func *parallel_for, void *parallel_context)
+{
+   int i;
+   if (parallel_for)
+      parallel_for(parallel_context, nbands, stbiw__jpg_band_task, job);
+   else
+      for (i=0; i < nbands; ++i)
+         stbiw__jpg_band_task(job, i);
+}
+
+static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, int comp, const void* data, int quality, int banded, stbi_write_parallel_func *parallel_for, void *parallel_context) {
    // Constants that don't pollute global namespace
    static const unsigned char std_dc_luminance_nrcodes[] = {0,0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0};
    static const unsigned char std_dc_luminance_values[] = {0,1,2,3,4,5,6,7,8,9,10,11};
@@ -1467,9 +2679,17 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
    static const float aasf[] = { 1.0f * 2.828427125f, 1.387039845f * 2.828427125f, 1.306562965f * 2.828427125f, 1.175875602f * 2.828427125f,
                                  1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f };
 
-   int row, col, i, k, subsample;
-   float fdtbl_Y[64], fdtbl_UV[64];
+   int row, col, i, k, subsample, band_rows, nbands;
+   stbiw__jpg_state st;
+   stbiw__jpg_job job;
    unsigned char YTable[64], UVTable[64];
+   // DHT payloads in Y DC, Y AC, UV DC, UV AC order: the Annex K tables, or
+   // tables built from a counting pass
+   const unsigned char *dht_bits[4] = { std_dc_luminance_nrcodes, std_ac_luminance_nrcodes, std_dc_chrominance_nrcodes, std_ac_chrominance_nrcodes };
+   const unsigned char *dht_val[4] = { std_dc_luminance_values, std_ac_luminance_values, std_dc_chrominance_values, std_ac_chrominance_values };
+   int dht_n[4] = { sizeof(std_dc_luminance_values), sizeof(std_ac_luminance_values), sizeof(std_dc_chrominance_values), sizeof(std_ac_chrominance_values) };
+   unsigned char opt_bits[4][17], opt_val[4][256];
+   unsigned short opt_ht[4][256][2];
 
    if(!data || !width || !height || comp > 4 || comp < 1) {
       return 0;
@@ -1489,112 +2709,92 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
 
    for(row = 0, k = 0; row < 8; ++row) {
       for(col = 0; col < 8; ++col, ++k) {
-         fdtbl_Y[k]  = 1 / (YTable [stbiw__jpg_ZigZag[k]] * aasf[row] * aasf[col]);
-         fdtbl_UV[k] = 1 / (UVTable[stbiw__jpg_ZigZag[k]] * aasf[row] * aasf[col]);
+         st.fdtbl_Y[k]  = 1 / (YTable [stbiw__jpg_ZigZag[k]] * aasf[row] * aasf[col]);
+         st.fdtbl_UV[k] = 1 / (UVTable[stbiw__jpg_ZigZag[k]] * aasf[row] * aasf[col]);
+      }
+   }
+   st.data = (const unsigned char *) data;
+   st.width = width; st.height = height; st.comp = comp; st.subsample = subsample;
+   st.YDC_HT = YDC_HT; st.YAC_HT = YAC_HT; st.UVDC_HT = UVDC_HT; st.UVAC_HT = UVAC_HT;
+
+   // banded output restarts every band, which must fit DRI's 16-bit MCU count
+   band_rows = STBIW_JPG_BAND_MCU_ROWS * (subsample ? 16 : 8);
+   nbands = banded ? (height + band_rows-1) / band_rows : 1;
+   if (nbands > 1 && STBIW_JPG_BAND_MCU_ROWS * ((width + (subsample ? 15 : 7)) / (subsample ? 16 : 8)) > 65535)
+      nbands = 1;
+   job.st = &st;
+   job.band_rows = nbands > 1 ? band_rows : height;
+   job.bands = NULL;
+   job.freq = NULL;
+
+   if (stbi_write_jpg_optimize_huffman) {
+      // first pass: tally symbols per band exactly as the second pass will code them
+      job.freq = (unsigned int (*)[256]) STBIW_MALLOC(nbands * 4 * sizeof(job.freq[0]));
+      if (!job.freq) return 0;
+      memset(job.freq, 0, nbands * 4 * sizeof(job.freq[0]));
+      stbiw__jpg_run_bands(&job, nbands, parallel_for, parallel_context);
+      for (i=4; i < nbands*4; ++i)
+         for (k=0; k < 256; ++k)
+            job.freq[i & 3][k] += job.freq[i][k];
+      for (i=0; i < 4; ++i) {
+         dht_n[i] = stbiw__jpg_gen_table(job.freq[i], opt_bits[i], opt_val[i]);
+         stbiw__jpg_build_codes(opt_bits[i], opt_val[i], opt_ht[i]);
+         dht_bits[i] = opt_bits[i];
+         dht_val[i] = opt_val[i];
       }
+      STBIW_FREE(job.freq);
+      job.freq = NULL;
+      st.YDC_HT = opt_ht[0]; st.YAC_HT = opt_ht[1]; st.UVDC_HT = opt_ht[2]; st.UVAC_HT = opt_ht[3];
    }
 
    // Write Headers
    {
       static const unsigned char head0[] = { 0xFF,0xD8,0xFF,0xE0,0,0x10,'J','F','I','F',0,1,1,0,0,1,0,1,0,0,0xFF,0xDB,0,0x84,0 };
       static const unsigned char head2[] = { 0xFF,0xDA,0,0xC,3,1,0,2,0x11,3,0x11,0,0x3F,0 };
+      static const unsigned char htinfo[4] = { 0x00, 0x10, 0x01, 0x11 }; // HTYDCinfo, HTYACinfo, HTUDCinfo, HTUACinfo
+      int dht_len = 2 + 4*17 + dht_n[0] + dht_n[1] + dht_n[2] + dht_n[3];
       const unsigned char head1[] = { 0xFF,0xC0,0,0x11,8,(unsigned char)(height>>8),STBIW_UCHAR(height),(unsigned char)(width>>8),STBIW_UCHAR(width),
-                                      3,1,(unsigned char)(subsample?0x22:0x11),0,2,0x11,1,3,0x11,1,0xFF,0xC4,0x01,0xA2,0 };
+                                      3,1,(unsigned char)(subsample?0x22:0x11),0,2,0x11,1,3,0x11,1,0xFF,0xC4,(unsigned char)(dht_len>>8),STBIW_UCHAR(dht_len) };
       s->func(s->context, (void*)head0, sizeof(head0));
       s->func(s->context, (void*)YTable, sizeof(YTable));
       stbiw__putc(s, 1);
       s->func(s->context, UVTable, sizeof(UVTable));
       s->func(s->context, (void*)head1, sizeof(head1));
-      s->func(s->context, (void*)(std_dc_luminance_nrcodes+1), sizeof(std_dc_luminance_nrcodes)-1);
-      s->func(s->context, (void*)std_dc_luminance_values, sizeof(std_dc_luminance_values));
-      stbiw__putc(s, 0x10); // HTYACinfo
-      s->func(s->context, (void*)(std_ac_luminance_nrcodes+1), sizeof(std_ac_luminance_nrcodes)-1);
-      s->func(s->context, (void*)std_ac_luminance_values, sizeof(std_ac_luminance_values));
-      stbiw__putc(s, 1); // HTUDCinfo
-      s->func(s->context, (void*)(std_dc_chrominance_nrcodes+1), sizeof(std_dc_chrominance_nrcodes)-1);
-      s->func(s->context, (void*)std_dc_chrominance_values, sizeof(std_dc_chrominance_values));
-      stbiw__putc(s, 0x11); // HTUACinfo
-      s->func(s->context, (void*)(std_ac_chrominance_nrcodes+1), sizeof(std_ac_chrominance_nrcodes)-1);
-      s->func(s->context, (void*)std_ac_chrominance_values, sizeof(std_ac_chrominance_values));
+      for (i=0; i < 4; ++i) {
+         stbiw__putc(s, htinfo[i]);
+         s->func(s->context, (void*)(dht_bits[i]+1), 16);
+         s->func(s->context, (void*)dht_val[i], dht_n[i]);
+      }
+      if (nbands > 1) {
+         int interval = STBIW_JPG_BAND_MCU_ROWS * ((width + (subsample ? 15 : 7)) / (subsample ? 16 : 8));
+         const unsigned char dri[] = { 0xFF,0xDD,0,4,(unsigned char)(interval>>8),STBIW_UCHAR(interval) };
+         s->func(s->context, (void*)dri, sizeof(dri));
+      }
       s->func(s->context, (void*)head2, sizeof(head2));
    }
 
    // Encode 8x8 macroblocks
-   {
-      static const unsigned short fillBits[] = {0x7F, 7};
-      int DCY=0, DCU=0, DCV=0;
-      int bitBuf=0, bitCnt=0;
-      // comp == 2 is grey+alpha (alpha is ignored)
-      int ofsG = comp > 2 ? 1 : 0, ofsB = comp > 2 ? 2 : 0;
-      const unsigned char *dataR = (const unsigned char *)data;
-      const unsigned char *dataG = dataR + ofsG;
-      const unsigned char *dataB = dataR + ofsB;
-      int x, y, pos;
-      if(subsample) {
-         for(y = 0; y < height; y += 16) {
-            for(x = 0; x < width; x += 16) {
-               float Y[256], U[256], V[256];
-               for(row = y, pos = 0; row < y+16; ++row) {
-                  // row >= height => use last input row
-                  int clamped_row = (row < height) ? row : height - 1;
-                  int base_p = (stbi__flip_vertically_on_write ? (height-1-clamped_row) : clamped_row)*width*comp;
-                  for(col = x; col < x+16; ++col, ++pos) {
-                     // if col >= width => use pixel from last input column
-                     int p = base_p + ((col < width) ? col : (width-1))*comp;
-                     float r = dataR[p], g = dataG[p], b = dataB[p];
-                     Y[pos]= +0.29900f*r + 0.58700f*g + 0.11400f*b - 128;
-                     U[pos]= -0.16874f*r - 0.33126f*g + 0.50000f*b;
-                     V[pos]= +0.50000f*r - 0.41869f*g - 0.08131f*b;
-                  }
-               }
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+0,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+8,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+128, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+136, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-
-               // subsample U,V
-               {
-                  float subU[64], subV[64];
-                  int yy, xx;
-                  for(yy = 0, pos = 0; yy < 8; ++yy) {
-                     for(xx = 0; xx < 8; ++xx, ++pos) {
-                        int j = yy*32+xx*2;
-                        subU[pos] = (U[j+0] + U[j+1] + U[j+16] + U[j+17]) * 0.25f;
-                        subV[pos] = (V[j+0] + V[j+1] + V[j+16] + V[j+17]) * 0.25f;
-                     }
-                  }
-                  DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subU, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
-                  DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subV, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
-               }
-            }
-         }
-      } else {
-         for(y = 0; y < height; y += 8) {
-            for(x = 0; x < width; x += 8) {
-               float Y[64], U[64], V[64];
-               for(row = y, pos = 0; row < y+8; ++row) {
-                  // row >= height => use last input row
-                  int clamped_row = (row < height) ? row : height - 1;
-                  int base_p = (stbi__flip_vertically_on_write ? (height-1-clamped_row) : clamped_row)*width*comp;
-                  for(col = x; col < x+8; ++col, ++pos) {
-                     // if col >= width => use pixel from last input column
-                     int p = base_p + ((col < width) ? col : (width-1))*comp;
-                     float r = dataR[p], g = dataG[p], b = dataB[p];
-                     Y[pos]= +0.29900f*r + 0.58700f*g + 0.11400f*b - 128;
-                     U[pos]= -0.16874f*r - 0.33126f*g + 0.50000f*b;
-                     V[pos]= +0.50000f*r - 0.41869f*g - 0.08131f*b;
-                  }
-               }
-
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y, 8, fdtbl_Y,  DCY, YDC_HT, YAC_HT);
-               DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, U, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
-               DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, V, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
-            }
+   if (nbands <= 1) {
+      stbiw__jpg_encode_rows(s, &st, 0, height, NULL);
+   } else {
+      int failed = 0;
+      job.bands = (stbiw__membuf *) STBIW_MALLOC(nbands * sizeof(stbiw__membuf));
+      if (!job.bands) return 0;
+      memset(job.bands, 0, nbands * sizeof(stbiw__membuf));
+      stbiw__jpg_run_bands(&job, nbands, parallel_for, parallel_context);
+      for (i=0; i < nbands; ++i)
+         if (job.bands[i].cap < 0) failed = 1;
+      for (i=0; i < nbands && !failed; ++i) {
+         s->func(s->context, job.bands[i].data, job.bands[i].len);
+         if (i+1 < nbands) {
+            stbiw__putc(s, 0xFF);
+            stbiw__putc(s, (unsigned char) (0xD0 + (i & 7))); // RSTn
          }
       }
-
-      // Do the bit alignment of the EOI marker
-      stbiw__jpg_writeBits(s, &bitBuf, &bitCnt, fillBits);
+      for (i=0; i < nbands; ++i)
+         STBIW_FREE(job.bands[i].data);
+      STBIW_FREE(job.bands);
+      if (failed) return 0;
    }
 
    // EOI
@@ -1608,7 +2808,14 @@ STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x,
 {
    stbi__write_context s = { 0 };
    stbi__start_write_callbacks(&s, func, context);
-   return stbi_write_jpg_core(&s, x, y, comp, (void *) data, quality);
+   return stbi_write_jpg_core(&s, x, y, comp, (void *) data, quality, 0, NULL, NULL);
+}
+
+STBIWDEF int stbi_write_jpg_to_func_parallel(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int quality, stbi_write_parallel_func *parallel_for, void *parallel_context)
+{
+   stbi__write_context s = { 0 };
+   stbi__start_write_callbacks(&s, func, context);
+   return stbi_write_jpg_core(&s, x, y, comp, (void *) data, quality, 1, parallel_for, parallel_context);
 }
 
 
@@ -1617,7 +2824,7 @@ STBIWDEF int stbi_write_jpg(char const *filename, int x, int y, int comp, const
 {
    stbi__write_context s = { 0 };
    if (stbi__start_write_file(&s,filename)) {
-      int r = stbi_write_jpg_core(&s, x, y, comp, data, quality);
+      int r = stbi_write_jpg_core(&s, x, y, comp, data, quality, 0, NULL, NULL);
       stbi__end_write_file(&s);
       return r;
    } else
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Builds and runs every tests/test_*.cpp from the repository root.
+# OPENN_LARGE_TESTS=1 also runs test_large, which writes about 5 GB of
+# images past 2^31 bytes under $TMPDIR (or /tmp); it skips otherwise.
+set -u
+cd "$(dirname "$0")/.." || exit 1
+CXX=${CXX:-g++}
+out=${TMPDIR:-/tmp}/openn-tests
+mkdir -p "$out"
+status=0
+for src in tests/test_*.cpp; do
+    name=$(basename "$src" .cpp)
+    if ! $CXX -O2 -std=c++17 -I. "$src" -o "$out/$name" -pthread; then
+        echo "$name: build FAILED"
+        status=1
+        continue
+    fi
+    "$out/$name" || status=1
+done
+exit $status
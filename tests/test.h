@@ -0,0 +1,27 @@
+#pragma once
+
+// Minimal checks for the standalone test programs in this directory. Each
+// test_*.cpp is its own program, built like check.cpp:
+//   g++ -O2 -std=c++17 -I. tests/test_foo.cpp -o test_foo -pthread
+// and run from the repository root; tests/run_tests.sh builds and runs all.
+
+#include <cstdio>
+#include <cmath>
+
+static int test_failures = 0;
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if (!(cond)) {                                                           \
+            std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++test_failures;                                                     \
+        }                                                                        \
+    } while (0)
+
+#define CHECK_NEAR(a, b, eps) CHECK(std::fabs(static_cast<double>(a) - static_cast<double>(b)) <= (eps))
+
+// Ends main(): prints the verdict, exit status 1 on any failure.
+inline int testResult(const char *name) {
+    std::printf("%s: %s\n", name, test_failures ? "FAILED" : "ok");
+    return test_failures ? 1 : 0;
+}
@@ -0,0 +1,283 @@
+// The comparator's scores: the SIMD row kernels, interleaved and planar, must
+// match a plain per-pixel reference for every channel count, mode, metric and
+// row length; every mode and metric must give the same answer at 8-bit,
+// 16-bit and float depth, for Mats and for files scored through
+// compareBatch; a file decoded once and converted must equal a second decode
+// at the other depth. Batch tasks start heaviest first on every thread.
+
+#include "ImageCompare.h"
+#include "tests/test.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+
+static const ToleranceMode kModes[] = {ToleranceMode::PerChannel, ToleranceMode::PerPixelMax, ToleranceMode::PerPixelSum};
+static const CompareMetric kMetrics[] = {CompareMetric::Similarity, CompareMetric::MeanAbsDiff, CompareMetric::MeanSquaredError};
+
+// b is a with mostly small, sometimes large, per-byte changes. Mat is always
+// allocated with 3 channels, so other counts wrap the caller's buffers.
+static void makePair(int rows, int cols, int cn, unsigned seed, std::vector<unsigned char> &pa,
+                     std::vector<unsigned char> &pb, cv::Mat &a, cv::Mat &b) {
+    std::mt19937 rng(seed);
+    pa.resize(static_cast<size_t>(rows) * cols * cn);
+    pb.resize(pa.size());
+    for (size_t i = 0; i < pa.size(); ++i) {
+        pa[i] = static_cast<unsigned char>(rng());
+        int d = rng() % 4 == 0 ? static_cast<int>(rng() % 256) - 128 : static_cast<int>(rng() % 25) - 12;
+        pb[i] = static_cast<unsigned char>(std::min(255, std::max(0, pa[i] + d)));
+    }
+    a = cv::Mat(rows, cols, cv::CV_8UC3, pa.data(), static_cast<size_t>(cols) * cn);
+    b = cv::Mat(rows, cols, cv::CV_8UC3, pb.data(), static_cast<size_t>(cols) * cn);
+    a.channels = b.channels = cn;
+}
+
+// The definition of each mode and metric, one pixel at a time.
+static uint64_t referenceRow(const uint8_t *a, const uint8_t *b, int cols, int cn, const CompareOptions &opts) {
+    uint64_t sum = 0;
+    auto term = [&](int d) -> uint64_t {
+        if (opts.metric == CompareMetric::Similarity) return d < opts.tolerance;
+        return opts.metric == CompareMetric::MeanAbsDiff ? d : static_cast<uint64_t>(d) * d;
+    };
+    for (int x = 0; x < cols; ++x) {
+        int mx = 0, total = 0;
+        for (int c = 0; c < cn; ++c) {
+            int d = std::abs(a[x * cn + c] - b[x * cn + c]);
+            if (opts.mode == ToleranceMode::PerChannel) sum += term(d);
+            mx = std::max(mx, d);
+            total += d;
+        }
+        if (opts.mode == ToleranceMode::PerPixelMax) sum += term(mx);
+        if (opts.mode == ToleranceMode::PerPixelSum) sum += term(total);
+    }
+    return sum;
+}
+
+static void checkKernels() {
+    std::mt19937 rng(44);
+    // widths around the 16-pixel blocks, with differences up to the full range
+    const int widths[] = {1, 5, 15, 16, 17, 31, 33, 100, 70000};
+    for (int cn = 1; cn <= 4; ++cn)
+        for (int cols : widths) {
+            std::vector<uint8_t> a(static_cast<size_t>(cols) * cn), b(a.size());
+            for (size_t i = 0; i < a.size(); ++i) {
+                a[i] = static_cast<uint8_t>(rng());
+                b[i] = rng() % 3 ? static_cast<uint8_t>(a[i] + rng() % 21 - 10) : static_cast<uint8_t>(rng() % 2 * 255);
+            }
+            std::vector<std::vector<uint8_t>> pa(cn, std::vector<uint8_t>(cols)), pb = pa;
+            const uint8_t *ra[4], *rb[4];
+            for (int c = 0; c < cn; ++c) {
+                for (int x = 0; x < cols; ++x) {
+                    pa[c][x] = a[static_cast<size_t>(x) * cn + c];
+                    pb[c][x] = b[static_cast<size_t>(x) * cn + c];
+                }
+                ra[c] = pa[c].data();
+                rb[c] = pb[c].data();
+            }
+            for (ToleranceMode mode : kModes)
+                for (CompareMetric metric : kMetrics)
+                    for (int tol : {0, 1, 2, 10, 128, 255, 256, 500, 1021}) {
+                        CompareOptions opts;
+                        opts.mode = mode;
+                        opts.metric = metric;
+                        opts.tolerance = tol;
+                        uint64_t ref = referenceRow(a.data(), b.data(), cols, cn, opts);
+                        CHECK(compareRowFn(cn, opts)(a.data(), b.data(), cols, tol) == ref);
+                        CHECK(planarRowFn(cn, opts)(ra, rb, cols, tol) == ref);
+                        if (metric == CompareMetric::MeanSquaredError) break; // tolerance unused
+                    }
+        }
+
+    // every difference at its maximum over rows longer than any accumulator
+    // holds before it must be flushed
+    for (int cn = 1; cn <= 4; ++cn) {
+        const int cols = 600000 / cn;
+        std::vector<uint8_t> a(static_cast<size_t>(cols) * cn, 0), b(a.size(), 255);
+        std::vector<const uint8_t *> ra(cn, a.data()), rb(cn, b.data());
+        for (ToleranceMode mode : kModes)
+            for (CompareMetric metric : {CompareMetric::MeanAbsDiff, CompareMetric::MeanSquaredError}) {
+                CompareOptions opts;
+                opts.mode = mode;
+                opts.metric = metric;
+                uint64_t ref = referenceRow(a.data(), b.data(), cols, cn, opts);
+                CHECK(compareRowFn(cn, opts)(a.data(), b.data(), cols, 10) == ref);
+                CHECK(planarRowFn(cn, opts)(ra.data(), rb.data(), cols, 10) == ref);
+            }
+    }
+
+    // countSimilarRow's SIMD overloads against the generic template
+    for (size_t n : {size_t(1), size_t(7), size_t(64), size_t(1000), size_t(600000)}) {
+        std::vector<uint8_t> a8(n), b8(n);
+        std::vector<uint16_t> a16(n), b16(n);
+        std::vector<float> af(n), bf(n);
+        for (size_t i = 0; i < n; ++i) {
+            a8[i] = static_cast<uint8_t>(rng());
+            b8[i] = static_cast<uint8_t>(a8[i] + rng() % 31 - 15);
+            a16[i] = static_cast<uint16_t>(rng());
+            b16[i] = static_cast<uint16_t>(a16[i] + rng() % 8001 - 4000);
+            af[i] = a8[i] / 255.0f;
+            bf[i] = b8[i] / 255.0f + (i % 97 == 0 ? NAN : 0.0f);
+        }
+        for (int tol : {1, 10, 255}) {
+            CHECK(countSimilarRow(a8.data(), b8.data(), n, static_cast<uint8_t>(tol)) ==
+                  countSimilarRow<uint8_t>(a8.data(), b8.data(), n, static_cast<uint8_t>(tol)));
+            CHECK(countSimilarRow(a16.data(), b16.data(), n, static_cast<uint16_t>(tol * 257)) ==
+                  countSimilarRow<uint16_t>(a16.data(), b16.data(), n, static_cast<uint16_t>(tol * 257)));
+            CHECK(countSimilarRow(af.data(), bf.data(), n, tol / 255.0f) ==
+                  countSimilarRow<float>(af.data(), bf.data(), n, tol / 255.0f));
+        }
+    }
+}
+
+template <typename T>
+static cv::Mat_<T> widen(const cv::Mat &m, double scale) {
+    cv::Mat_<T> out(m.rows, m.cols, m.channels);
+    for (int y = 0; y < m.rows; ++y)
+        for (int x = 0; x < m.cols * m.channels; ++x)
+            out.ptr(y)[x] = static_cast<T>(m.ptr(y)[x] * scale);
+    return out;
+}
+
+static bool near(double a, double b) { return std::abs(a - b) <= 1e-6 * std::max(1.0, std::abs(b)); }
+
+static void checkDepths() {
+    ImageComparator cmp;
+    for (int cn = 1; cn <= 4; ++cn) {
+        std::vector<unsigned char> pa, pb;
+        cv::Mat a, b;
+        makePair(37, 101, cn, 43 + cn, pa, pb, a, b);
+        cv::Mat_<uint16_t> a16 = widen<uint16_t>(a, 257), b16 = widen<uint16_t>(b, 257);
+        cv::Mat_<float> af = widen<float>(a, 1.0 / 255), bf = widen<float>(b, 1.0 / 255);
+        for (ToleranceMode mode : kModes)
+            for (CompareMetric metric : kMetrics)
+                for (int tol : {0, 1, 10, 40, 255, 300}) {
+                    CompareOptions opts;
+                    opts.mode = mode;
+                    opts.metric = metric;
+                    opts.tolerance = tol;
+                    double ref = cmp.compare(a, b, opts);
+                    CHECK(near(cmp.compare(a16, b16, opts), ref));
+                    // float division can land a difference of exactly tol a
+                    // hair either side of it, so whole-step tolerances only
+                    // count for the means
+                    if (metric != CompareMetric::Similarity) CHECK(near(cmp.compare(af, bf, opts), ref));
+                }
+    }
+}
+
+// Writes a 16-bit binary PPM of m's bytes scaled by 257.
+static bool write16(const std::string &path, const cv::Mat &m) {
+    FILE *f = std::fopen(path.c_str(), "wb");
+    if (!f) return false;
+    std::fprintf(f, "P6\n%d %d\n65535\n", m.cols, m.rows);
+    for (size_t i = 0; i < m.total() * 3; ++i) {
+        unsigned v = m.data[i] * 257u;
+        std::fputc(static_cast<int>(v >> 8), f);
+        std::fputc(static_cast<int>(v & 255), f);
+    }
+    return std::fclose(f) == 0;
+}
+
+// compareBatch on deep files scores under the comparator's options.
+static void checkDeepFiles() {
+    std::vector<unsigned char> bytes1, bytes2;
+    cv::Mat a, b;
+    makePair(64, 80, 3, 7, bytes1, bytes2, a, b);
+    const std::string pa = "/tmp/openn_test_compare_a.ppm", pb = "/tmp/openn_test_compare_b.ppm";
+    CHECK(write16(pa, a) && write16(pb, b));
+    std::vector<std::pair<std::string, std::string>> pairs(1, std::make_pair(pa, pb));
+    ImageComparator cmp;
+    for (ToleranceMode mode : kModes) {
+        CompareOptions opts;
+        opts.mode = mode;
+        opts.tolerance = 20;
+        cmp.setCompareOptions(opts);
+        std::vector<double> scores = cmp.compareBatch(pairs);
+        CHECK(scores.size() == 1 && near(scores[0], cmp.compare(a, b, opts)));
+    }
+    std::remove(pa.c_str());
+    std::remove(pb.c_str());
+}
+
+template <typename T>
+static bool sameMat(const cv::Mat_<T> &a, const cv::Mat_<T> &b) {
+    if (a.rows != b.rows || a.cols != b.cols || a.channels != b.channels) return false;
+    for (int y = 0; y < a.rows; ++y)
+        if (std::memcmp(a.ptr(y), b.ptr(y), static_cast<size_t>(a.cols) * a.channels * sizeof(T)) != 0) return false;
+    return true;
+}
+
+static bool sameMat(const cv::Mat &a, const cv::Mat &b) {
+    return a.rows == b.rows && a.cols == b.cols && !a.empty() && cv::countNonZero(cv::absdiff(a, b)) == 0;
+}
+
+static void checkDepthConversions() {
+    std::vector<unsigned char> bytes1, bytes2;
+    cv::Mat a, b;
+    makePair(33, 47, 3, 11, bytes1, bytes2, a, b);
+    const std::string p8 = "/tmp/openn_test_compare.png", p16 = "/tmp/openn_test_compare16.ppm",
+                      phdr = "/tmp/openn_test_compare.hdr";
+    CHECK(cv::imwrite(p8, a) && write16(p16, b));
+    std::vector<float> hdr(a.total() * 3);
+    for (size_t i = 0; i < hdr.size(); ++i) hdr[i] = a.data[i] * a.data[i] / 4096.0f;
+    CHECK(stbi_write_hdr(phdr.c_str(), a.cols, a.rows, 3, hdr.data()));
+
+    CHECK(cv::imreadDepth(p8) == cv::CV_8U && cv::imreadDepth(p16) == cv::CV_16U && cv::imreadDepth(phdr) == cv::CV_32F);
+    CHECK(cv::imreadDepth("/tmp/openn_test_compare_missing.png") == cv::CV_8U);
+
+    cv::Mat m8;
+    cv::Mat_<uint16_t> m16, c16;
+    cv::Mat_<float> mf, cf;
+    // 8-bit file widened
+    CHECK(cv::imread(p8, m16, 3) && cv::imread(p8, mf, 3));
+    cv::convertDepth(cv::imread(p8), c16);
+    cv::convertDepth(cv::imread(p8), cf);
+    CHECK(sameMat(c16, m16) && sameMat(cf, mf));
+    // deep files narrowed
+    CHECK(cv::imread(p16, m16, 3) && cv::imread(phdr, mf, 3));
+    cv::convertDepth(m16, m8);
+    CHECK(sameMat(m8, cv::imread(p16)));
+    cv::convertDepth(mf, m8);
+    CHECK(sameMat(m8, cv::imread(phdr)));
+    // a 16-bit file loaded as float goes through 8 bits
+    CHECK(cv::imread(p16, mf, 3));
+    cv::convertDepth(cv::imread(p16), cf);
+    CHECK(sameMat(cf, mf));
+
+    std::remove(p8.c_str());
+    std::remove(p16.c_str());
+    std::remove(phdr.c_str());
+}
+
+// 6 tasks of 300 ms among 60 of 10 ms on 4 threads: started heaviest first,
+// the two heavy ones left over begin when the first four end and the batch
+// takes about the 0.6 s of a perfect schedule; heavy tasks reached late push
+// it past 0.8 s.
+static void checkLargestFirst() {
+    cv::setNumThreads(4);
+    std::vector<uint64_t> costs;
+    for (int k = 0; k < 66; ++k) costs.push_back(k % 11 == 7 ? 300 : 10);
+    std::vector<double> startedAt(costs.size(), -1.0);
+    auto t0 = std::chrono::steady_clock::now();
+    auto since = [&] { return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count(); };
+    parallelLargestFirst(costs, 1, [&](size_t i) {
+        startedAt[i] = since();
+        std::this_thread::sleep_for(std::chrono::milliseconds(costs[i]));
+    });
+    double elapsed = since();
+    for (size_t i = 0; i < costs.size(); ++i) {
+        CHECK(startedAt[i] >= 0.0);
+        if (costs[i] == 300) CHECK(startedAt[i] < 0.4);
+    }
+    CHECK(elapsed < 0.72);
+    cv::setNumThreads(0);
+}
+
+int main() {
+    checkLargestFirst();
+    checkKernels();
+    checkDepths();
+    checkDeepFiles();
+    checkDepthConversions();
+    return testResult("test_compare");
+}
@@ -0,0 +1,238 @@
+// ImageDecoder against imread: a warmed-up decoder allocates nothing for a run
+// of same-sized images, and a truncated file never shows the pixels of the
+// image decoded before it. Per-call load options hold at every depth while
+// other threads decode and flip stb_image's global settings.
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Every allocation stb_image or the C++ side makes while a check is counting.
+static std::atomic<long> allocations(0);
+
+static void *countedMalloc(size_t size) {
+    ++allocations;
+    return std::malloc(size);
+}
+
+static void *countedRealloc(void *p, size_t size) {
+    ++allocations;
+    return std::realloc(p, size);
+}
+
+#define STBI_MALLOC(sz) countedMalloc(sz)
+#define STBI_REALLOC(p, sz) countedRealloc(p, sz)
+#define STBI_FREE(p) std::free(p)
+
+#include "openn.hpp"
+#include "tests/test.h"
+#include <random>
+#include <thread>
+
+void *operator new(size_t size) {
+    ++allocations;
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+static const std::string dir = "/tmp/openn_test_decoder_";
+
+static cv::Mat noise(int rows, int cols, unsigned seed) {
+    std::mt19937 rng(seed);
+    cv::Mat m(rows, cols, cv::CV_8UC3);
+    for (int y = 0; y < rows; ++y)
+        for (int x = 0; x < cols * 3; ++x) m.ptr(y)[x] = static_cast<unsigned char>((x + 2 * y) / 5 + rng() % 48);
+    return m;
+}
+
+static bool same(const cv::Mat &a, const cv::Mat &b) {
+    return !a.empty() && a.rows == b.rows && a.cols == b.cols && cv::countNonZero(cv::absdiff(a, b)) == 0;
+}
+
+// Writes the first `keep` bytes of src to dst.
+static void truncateCopy(const std::string &src, const std::string &dst, long keep) {
+    std::vector<char> bytes(static_cast<size_t>(keep));
+    FILE *f = std::fopen(src.c_str(), "rb");
+    size_t n = std::fread(bytes.data(), 1, bytes.size(), f);
+    std::fclose(f);
+    f = std::fopen(dst.c_str(), "wb");
+    std::fwrite(bytes.data(), 1, n, f);
+    std::fclose(f);
+}
+
+static long fileSize(const std::string &path) {
+    FILE *f = std::fopen(path.c_str(), "rb");
+    std::fseek(f, 0, SEEK_END);
+    long n = std::ftell(f);
+    std::fclose(f);
+    return n;
+}
+
+// Decodes a run of same-sized files twice through one decoder: the first
+// pass warms the pool, the second must match imread without allocating.
+static void checkSteadyState(const std::vector<std::string> &paths) {
+    cv::ImageDecoder dec;
+    cv::Mat dst;
+    for (const std::string &p : paths) CHECK(dec.read(p, dst));
+    std::vector<cv::Mat> expected;
+    for (const std::string &p : paths) expected.push_back(cv::imread(p));
+
+    long counted = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        allocations = 0;
+        CHECK(dec.read(paths[i], dst));
+        counted += allocations;
+        CHECK(same(dst, expected[i]));
+    }
+    CHECK(counted == 0);
+    if (counted) std::printf("  %ld allocations decoding %s...\n", counted, paths[0].c_str());
+}
+
+// Writes a 16-bit binary PPM of m's bytes scaled by 257.
+static bool write16(const std::string &path, const cv::Mat &m) {
+    FILE *f = std::fopen(path.c_str(), "wb");
+    if (!f) return false;
+    std::fprintf(f, "P6\n%d %d\n65535\n", m.cols, m.rows);
+    for (size_t i = 0; i < m.total() * 3; ++i) {
+        unsigned v = m.data[i] * 257u;
+        std::fputc(static_cast<int>(v >> 8), f);
+        std::fputc(static_cast<int>(v & 255), f);
+    }
+    return std::fclose(f) == 0;
+}
+
+// One 3-channel load of path through the _ex call for depth (0: 8-bit,
+// 1: 16-bit, 2: float), as raw bytes; empty on failure.
+static std::vector<unsigned char> loadEx(const std::string &path, int depth, stbi_load_options &opts) {
+    int w, h, c;
+    void *p = depth == 0   ? static_cast<void *>(stbi_load_ex(path.c_str(), &w, &h, &c, 3, &opts))
+              : depth == 1 ? static_cast<void *>(stbi_load_16_ex(path.c_str(), &w, &h, &c, 3, &opts))
+                           : static_cast<void *>(stbi_loadf_ex(path.c_str(), &w, &h, &c, 3, &opts));
+    if (!p) return std::vector<unsigned char>();
+    const unsigned char *b = static_cast<unsigned char *>(p);
+    std::vector<unsigned char> bytes(b, b + static_cast<size_t>(w) * h * 3 * (depth == 0 ? 1 : depth == 1 ? 2 : 4));
+    stbi_image_free(p);
+    return bytes;
+}
+
+template <typename T>
+static std::vector<unsigned char> imreadBytes(const std::string &path) {
+    cv::Mat_<T> m;
+    if (!cv::imread(path, m, 3) || !m.isContinuous()) return std::vector<unsigned char>();
+    const unsigned char *b = reinterpret_cast<const unsigned char *>(m.data);
+    return std::vector<unsigned char>(b, b + m.total() * 3 * sizeof(T));
+}
+
+static std::vector<unsigned char> flipRows(const std::vector<unsigned char> &bytes, int rows) {
+    size_t row = bytes.size() / rows;
+    std::vector<unsigned char> out(bytes.size());
+    for (int y = 0; y < rows; ++y) std::memcpy(&out[y * row], &bytes[(rows - 1 - y) * row], row);
+    return out;
+}
+
+// Hundreds of loads across threads, mixing files, depths, flips and the
+// Mat_ imread overloads, while another thread keeps toggling the global flip
+// flag: every result must match the serial load with the same options.
+static void checkConcurrentOptions() {
+    const int rows = 37, cols = 53;
+    cv::Mat img = noise(rows, cols, 7);
+    std::vector<float> hdr(img.total() * 3);
+    for (size_t i = 0; i < hdr.size(); ++i) hdr[i] = img.data[i] / 64.0f;
+    std::vector<std::string> files = {dir + "opts.jpg", dir + "opts16.ppm", dir + "opts.hdr"};
+    CHECK(cv::imwrite(files[0], img) && write16(files[1], img));
+    CHECK(stbi_write_hdr(files[2].c_str(), cols, rows, 3, hdr.data()));
+
+    // expected[file][depth][flip]
+    std::vector<unsigned char> expected[3][3][2];
+    for (int f = 0; f < 3; ++f)
+        for (int d = 0; d < 3; ++d) {
+            stbi_load_options opts = {};
+            expected[f][d][0] = loadEx(files[f], d, opts);
+            expected[f][d][1] = flipRows(expected[f][d][0], rows);
+            CHECK(!expected[f][d][0].empty() && opts.failure_reason == nullptr);
+            // planar applies to 8-bit loads only
+            opts.planar = 1;
+            if (d) CHECK(loadEx(files[f], d, opts) == expected[f][d][0]);
+        }
+
+    std::atomic<bool> done(false);
+    std::atomic<int> mismatches(0);
+    std::thread toggler([&] {
+        for (int k = 0; !done; ++k) stbi_set_flip_vertically_on_load(k & 1);
+    });
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 8; ++t)
+        workers.emplace_back([&, t] {
+            for (int i = 0; i < 48; ++i) {
+                int k = t * 48 + i, f = k % 3, d = (k / 3) % 3, flip = (k / 9) % 2;
+                std::vector<unsigned char> got;
+                if ((k / 18) % 2 == 0) {
+                    stbi_load_options opts = {};
+                    opts.flip_vertically = flip;
+                    got = loadEx(files[f], d, opts);
+                } else {
+                    flip = 0;
+                    got = d == 0 ? imreadBytes<uint8_t>(files[f])
+                          : d == 1 ? imreadBytes<uint16_t>(files[f])
+                                   : imreadBytes<float>(files[f]);
+                }
+                if (got != expected[f][d][flip]) ++mismatches;
+            }
+        });
+    for (std::thread &w : workers) w.join();
+    done = true;
+    toggler.join();
+    stbi_set_flip_vertically_on_load(0);
+    CHECK(mismatches == 0);
+
+    // a failed load reports its own reason at every depth
+    for (int d = 0; d < 3; ++d) {
+        stbi_load_options opts = {};
+        CHECK(loadEx(dir + "missing.png", d, opts).empty());
+        CHECK(opts.failure_reason && std::strcmp(opts.failure_reason, "can't fopen") == 0);
+    }
+    for (const std::string &p : files) std::remove(p.c_str());
+}
+
+int main() {
+    std::vector<std::string> jpgs, pngs;
+    for (unsigned k = 0; k < 4; ++k) {
+        cv::Mat img = noise(120, 170, k);
+        jpgs.push_back(dir + std::to_string(k) + ".jpg");
+        pngs.push_back(dir + std::to_string(k) + ".png");
+        cv::imwrite(jpgs.back(), img);
+        cv::imwrite(pngs.back(), img);
+    }
+    checkSteadyState(jpgs);
+    checkSteadyState(pngs);
+
+    // a JPEG cut off mid-scan decodes the same through a warm decoder as on
+    // its own, not over the previous image's planes
+    for (long cut : {fileSize(jpgs[1]) / 3, fileSize(jpgs[1]) * 2 / 3}) {
+        std::string cutPath = dir + "cut.jpg";
+        truncateCopy(jpgs[1], cutPath, cut);
+        cv::ImageDecoder dec;
+        cv::Mat dst;
+        CHECK(dec.read(jpgs[0], dst));
+        cv::Mat fresh = cv::imread(cutPath);
+        if (dec.read(cutPath, dst) || !fresh.empty()) CHECK(same(dst, fresh));
+        std::remove(cutPath.c_str());
+    }
+
+    // a file that fails below stb_image's size limit is an error, not a
+    // retry through imread's streaming path
+    cv::ImageDecoder dec;
+    cv::Mat dst;
+    truncateCopy(pngs[2], dir + "cut.png", fileSize(pngs[2]) / 2);
+    CHECK(!dec.read(dir + "cut.png", dst));
+    std::remove((dir + "cut.png").c_str());
+
+    checkConcurrentOptions();
+
+    for (const std::string &p : jpgs) std::remove(p.c_str());
+    for (const std::string &p : pngs) std::remove(p.c_str());
+    return testResult("test_decoder");
+}
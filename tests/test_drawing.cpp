@@ -0,0 +1,256 @@
+// Drawing against per-pixel references: one-pixel lines pixel for pixel,
+// thick axis-aligned lines and rectangle outlines as exact pixel sets, lines
+// clipped at the image border the same as the visible part of an unclipped
+// one, the vector span fill against its byte loop, and dirtyRect() as the
+// bounding box of what actually changed.
+
+#include "openn.hpp"
+#include "tests/test.h"
+#include <set>
+#include <utility>
+
+typedef std::set<std::pair<int, int>> Pixels;   // (x, y)
+
+static const cv::Scalar kColor(200, 100, 50);
+
+// Pixels of m that differ from black; every one must be exactly kColor.
+static Pixels painted(const cv::Mat &m) {
+    Pixels px;
+    bool exact = true;
+    for (int y = 0; y < m.rows; ++y)
+        for (int x = 0; x < m.cols; ++x) {
+            const unsigned char *p = m.ptr(y) + x * 3;
+            if (p[0] | p[1] | p[2]) {
+                px.insert(std::make_pair(x, y));
+                exact = exact && p[0] == 200 && p[1] == 100 && p[2] == 50;
+            }
+        }
+    CHECK(exact);
+    return px;
+}
+
+static Pixels rectPixels(const cv::Rect &r, int rows, int cols) {
+    Pixels px;
+    cv::Rect c = r & cv::Rect(0, 0, cols, rows);
+    for (int y = c.y; y < c.y + c.height; ++y)
+        for (int x = c.x; x < c.x + c.width; ++x) px.insert(std::make_pair(x, y));
+    return px;
+}
+
+static cv::Rect bounds(const Pixels &px) {
+    cv::Rect r;
+    for (const std::pair<int, int> &p : px) r = r | cv::Rect(p.first, p.second, 1, 1);
+    return r;
+}
+
+static bool sameRect(const cv::Rect &a, const cv::Rect &b) {
+    return (a.empty() && b.empty()) || (a.x == b.x && a.y == b.y && a.width == b.width && a.height == b.height);
+}
+
+// The one-pixel LINE_8 line from p0 to p1 when the major axis length is odd:
+// the minor coordinate is the exact one rounded, never a tie.
+static Pixels line8Ref(cv::Point p0, cv::Point p1) {
+    Pixels px;
+    int dx = p1.x - p0.x, dy = p1.y - p0.y, n = std::max(std::abs(dx), std::abs(dy));
+    for (int k = 0; k <= n; ++k) {
+        double x = p0.x + static_cast<double>(dx) * k / n, y = p0.y + static_cast<double>(dy) * k / n;
+        px.insert(std::make_pair(static_cast<int>(std::floor(x + 0.5)), static_cast<int>(std::floor(y + 0.5))));
+    }
+    return px;
+}
+
+static Pixels drawLine(int rows, int cols, cv::Point p0, cv::Point p1, int thickness, int type) {
+    cv::Mat m(rows, cols, cv::CV_8UC3);
+    cv::line(m, p0, p1, kColor, thickness, type);
+    return painted(m);
+}
+
+static void checkThinLines() {
+    // diagonals in all four directions: LINE_8 is one pixel per step, LINE_4
+    // a staircase through the same pixels plus one side step each
+    for (int sx : {-1, 1})
+        for (int sy : {-1, 1}) {
+            cv::Point p0(20, 20), p1(20 + 13 * sx, 20 + 13 * sy);
+            Pixels diag, stairs;
+            for (int k = 0; k <= 13; ++k) {
+                diag.insert(std::make_pair(20 + k * sx, 20 + k * sy));
+                stairs.insert(std::make_pair(20 + k * sx, 20 + k * sy));
+                if (k < 13) stairs.insert(std::make_pair(20 + k * sx, 20 + (k + 1) * sy));
+            }
+            CHECK(drawLine(41, 41, p0, p1, 1, cv::LINE_8) == diag);
+            CHECK(drawLine(41, 41, p0, p1, 1, cv::LINE_4) == stairs);
+        }
+
+    // other slopes with an odd major axis, both ways round
+    const int ends[][4] = {{3, 4, 28, 11}, {3, 30, 10, 5}, {30, 2, 1, 9}, {15, 15, 16, 40}, {0, 0, 37, 36}};
+    for (const auto &e : ends) {
+        cv::Point p0(e[0], e[1]), p1(e[2], e[3]);
+        Pixels ref = line8Ref(p0, p1);
+        CHECK(drawLine(45, 45, p0, p1, 1, cv::LINE_8) == ref);
+        CHECK(drawLine(45, 45, p1, p0, 1, cv::LINE_8) == ref);
+
+        // LINE_4: |dx| + |dy| + 1 pixels from end to end, each a 4-neighbour
+        // of the one before, none further than half a diagonal from the line
+        cv::Mat m(45, 45, cv::CV_8UC3);
+        cv::line(m, p0, p1, kColor, 1, cv::LINE_4);
+        Pixels px = painted(m);
+        int dx = p1.x - p0.x, dy = p1.y - p0.y;
+        CHECK(static_cast<int>(px.size()) == std::abs(dx) + std::abs(dy) + 1);
+        CHECK(px.count(std::make_pair(p0.x, p0.y)) && px.count(std::make_pair(p1.x, p1.y)));
+        double len = std::sqrt(static_cast<double>(dx * dx + dy * dy));
+        bool near = true, connected = true;
+        for (const std::pair<int, int> &p : px) {
+            near = near && std::fabs((p.first - p0.x) * dy - (p.second - p0.y) * dx) / len <= 0.7072;
+            if (p.first == p0.x && p.second == p0.y) continue;
+            int neighbours = 0;
+            for (const std::pair<int, int> &q : px)
+                neighbours += std::abs(p.first - q.first) + std::abs(p.second - q.second) == 1;
+            connected = connected && neighbours >= 1;
+        }
+        CHECK(near && connected);
+    }
+}
+
+static void checkThickAndRectangles() {
+    // thick axis-aligned lines: thickness / 2 on the near side, the rest on
+    // the far side, caps included
+    for (int t : {1, 2, 3, 4, 5}) {
+        const int lo = t / 2;
+        CHECK(drawLine(40, 40, cv::Point(5, 12), cv::Point(25, 12), t, cv::LINE_8) ==
+              rectPixels(cv::Rect(5 - (t > 1 ? lo : 0), 12 - lo, 21 + (t > 1 ? t - 1 : 0), t), 40, 40));
+        CHECK(drawLine(40, 40, cv::Point(30, 33), cv::Point(30, 4), t, cv::LINE_4) ==
+              rectPixels(cv::Rect(30 - lo, 4 - (t > 1 ? lo : 0), t, 30 + (t > 1 ? t - 1 : 0)), 40, 40));
+    }
+
+    // a thick diagonal covers the thin one
+    Pixels thin = drawLine(40, 40, cv::Point(5, 5), cv::Point(30, 20), 1, cv::LINE_8);
+    Pixels thick = drawLine(40, 40, cv::Point(5, 5), cv::Point(30, 20), 4, cv::LINE_8);
+    bool covers = true;
+    for (const std::pair<int, int> &p : thin) covers = covers && thick.count(p);
+    CHECK(covers && thick.size() > 3 * thin.size());
+
+    // rectangle outlines: the band between the corners grown by thickness/2
+    // outward and the rest inward, whatever the corner order
+    for (int t : {1, 2, 3, 4}) {
+        const int lo = t / 2;
+        cv::Rect outer(8 - lo, 6 - lo, 20 + t, 14 + t), inner(8 - lo + t, 6 - lo + t, 20 - t, 14 - t);
+        Pixels ref;
+        for (const std::pair<int, int> &p : rectPixels(outer, 40, 40))
+            if (!(p.first >= inner.x && p.first < inner.x + inner.width && p.second >= inner.y &&
+                  p.second < inner.y + inner.height))
+                ref.insert(p);
+        for (int order = 0; order < 2; ++order) {
+            cv::Mat m(40, 40, cv::CV_8UC3);
+            if (order)
+                cv::rectangle(m, cv::Point(28, 6), cv::Point(8, 20), kColor, t);
+            else
+                cv::rectangle(m, cv::Rect(8, 6, 21, 15), kColor, t);
+            CHECK(painted(m) == ref);
+        }
+    }
+    cv::Mat filled(40, 40, cv::CV_8UC3);
+    cv::rectangle(filled, cv::Point(30, 35), cv::Point(-5, 10), kColor, cv::FILLED);
+    CHECK(painted(filled) == rectPixels(cv::Rect(0, 10, 31, 26), 40, 40));
+}
+
+static void checkClipping() {
+    // the part of a line inside the image is the same pixels as that part
+    // of the line drawn unclipped on a larger canvas
+    const int pad = 50;
+    const int ends[][4] = {{-20, -20, 30, 30}, {-7, 40, 40, -7}, {10, -30, 10, 60}, {-40, 15, 80, 15}, {25, 25, 70, 70}};
+    for (const auto &e : ends)
+        for (int type : {cv::LINE_8, cv::LINE_4}) {
+            cv::Point p0(e[0], e[1]), p1(e[2], e[3]);
+            Pixels small = drawLine(33, 33, p0, p1, 1, type);
+            Pixels big = drawLine(33 + 2 * pad, 33 + 2 * pad, cv::Point(p0.x + pad, p0.y + pad),
+                                  cv::Point(p1.x + pad, p1.y + pad), 1, type);
+            Pixels visible;
+            for (const std::pair<int, int> &p : big)
+                if (p.first >= pad && p.second >= pad && p.first < pad + 33 && p.second < pad + 33)
+                    visible.insert(std::make_pair(p.first - pad, p.second - pad));
+            if (type == cv::LINE_8) {
+                CHECK(small == visible);
+                continue;
+            }
+            // LINE_4 restarts its staircase at the clipped end point, so the
+            // side step just before it may be left out, never anything else
+            bool subset = true;
+            for (const std::pair<int, int> &p : small) subset = subset && visible.count(p);
+            CHECK(subset && visible.size() - small.size() <= 2);
+        }
+
+    // clipLine's end points land on the border, on the line
+    cv::Point a(-10, -5), b(50, 25);
+    CHECK(cv::clipLine(cv::Size(33, 33), a, b));
+    CHECK(a.x == 0 && a.y == 0 && b.x == 32 && b.y == 16);
+
+    // far outside: nothing drawn, nothing marked, even at extreme coordinates
+    cv::Mat m(33, 33, cv::CV_8UC3);
+    cv::Point c(-100, 5), d(-1, 40);
+    CHECK(!cv::clipLine(cv::Size(33, 33), c, d));
+    cv::line(m, cv::Point(-100, 5), cv::Point(-1, 40), kColor);
+    cv::line(m, cv::Point(40, -2000000000), cv::Point(2000000000, -1), kColor);
+    CHECK(painted(m).empty() && m.dirtyRect().empty());
+    cv::line(m, cv::Point(-2000000000, -2000000000), cv::Point(2000000000, 2000000000), kColor);
+    Pixels diag;
+    for (int k = 0; k < 33; ++k) diag.insert(std::make_pair(k, k));
+    CHECK(painted(m) == diag);
+}
+
+static void checkFillSpan() {
+    const cv::Scalar colors[] = {cv::Scalar(1, 2, 3, 4), cv::Scalar(255, 0, 255, 0)};
+    for (int cn = 1; cn <= 4; ++cn)
+        for (const cv::Scalar &s : colors) {
+            cv::Mat shape(1, 1, cv::CV_8UC3);
+            shape.channels = cn;
+            cv::detail::PixelColor col(shape, s);
+            for (int offset = 0; offset < 3; ++offset)
+                for (int n = 0; n <= 70; ++n) {
+                    std::vector<unsigned char> got(offset + 70 * 4 + 16, 0xa5), ref = got;
+                    cv::detail::fillSpan(got.data() + offset, n, col);
+                    for (int i = 0; i < n * cn; ++i) ref[offset + i] = static_cast<unsigned char>(s.val[i % cn]);
+                    CHECK(got == ref);
+                }
+        }
+}
+
+static void checkDirty() {
+    cv::Mat m(60, 80, cv::CV_8UC3);
+    CHECK(m.dirtyRect().empty());
+    cv::line(m, cv::Point(10, 12), cv::Point(30, 25), kColor);
+    CHECK(sameRect(m.dirtyRect(), cv::Rect(10, 12, 21, 14)));
+    cv::rectangle(m, cv::Point(50, 40), cv::Point(70, 50), kColor, 3);
+    cv::line(m, cv::Point(5, 55), cv::Point(5, 58), kColor, 4);
+    std::vector<cv::Point> tri = {cv::Point(40, 2), cv::Point(48, 9), cv::Point(36, 9)};
+    cv::fillConvexPoly(m, tri, kColor);
+    cv::polylines(m, {cv::Point(60, 5), cv::Point(78, 5), cv::Point(78, 20)}, false, kColor, 2);
+    CHECK(sameRect(m.dirtyRect(), bounds(painted(m))));
+
+    // a thick line partly off the image is clipped to it
+    cv::line(m, cv::Point(75, 30), cv::Point(95, 30), kColor, 5);
+    CHECK(sameRect(m.dirtyRect(), bounds(painted(m))));
+
+    // clearDirty starts over; copies keep the box, views start clean
+    cv::Mat copy = m;
+    m.clearDirty();
+    CHECK(m.dirtyRect().empty());
+    CHECK(sameRect(copy.dirtyRect(), bounds(painted(copy))));
+    cv::Mat fresh(60, 80, cv::CV_8UC3);
+    cv::line(fresh, cv::Point(20, 30), cv::Point(25, 30), kColor);
+    cv::line(m, cv::Point(20, 30), cv::Point(25, 30), kColor);
+    CHECK(sameRect(m.dirtyRect(), cv::Rect(20, 30, 6, 1)));
+    cv::Mat view = m(cv::Rect(10, 10, 20, 20));
+    CHECK(view.dirtyRect().empty());
+    cv::line(view, cv::Point(0, 0), cv::Point(4, 4), kColor);
+    CHECK(sameRect(view.dirtyRect(), cv::Rect(0, 0, 5, 5)));
+    CHECK(sameRect(m.dirtyRect(), cv::Rect(20, 30, 6, 1)));
+}
+
+int main() {
+    checkThinLines();
+    checkThickAndRectangles();
+    checkClipping();
+    checkFillSpan();
+    checkDirty();
+    return testResult("test_drawing");
+}
@@ -0,0 +1,129 @@
+// Encoder output decoded back: PNG must reproduce the source exactly at every
+// compression level and filter, serial and parallel; JPEG must stay close to
+// it and decode identically whether encoded in one pass or in bands; the
+// writer's checksum kernels must match their byte loops.
+
+#define STBIW_SELFTEST
+#include "openn.hpp"
+#include "tests/test.h"
+#include <random>
+
+// Gradient plus noise: compressible, but not trivially.
+static std::vector<unsigned char> pixels(int w, int h, int n, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::vector<unsigned char> p(static_cast<size_t>(w) * h * n);
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w * n; ++x)
+            p[static_cast<size_t>(y) * w * n + x] = static_cast<unsigned char>(x / n + 2 * y + (rng() % 8 == 0 ? rng() % 64 : 0));
+    return p;
+}
+
+// Decodes a PNG from memory and compares it with w x h x n src of row stride
+// `stride`.
+static bool decodesTo(const unsigned char *png, int len, const unsigned char *src, int w, int h, int n, int stride) {
+    int dw, dh, dn;
+    unsigned char *img = stbi_load_from_memory(png, len, &dw, &dh, &dn, n);
+    bool ok = img && dw == w && dh == h && dn == n;
+    for (int y = 0; ok && y < h; ++y)
+        ok = std::memcmp(img + static_cast<size_t>(y) * w * n, src + static_cast<size_t>(y) * stride, static_cast<size_t>(w) * n) == 0;
+    stbi_image_free(img);
+    return ok;
+}
+
+static void checkPng() {
+    const int sizes[][2] = {{1, 1}, {7, 3}, {64, 64}, {333, 257}};
+    for (const auto &sz : sizes)
+        for (int n = 1; n <= 4; ++n) {
+            const int w = sz[0], h = sz[1];
+            std::vector<unsigned char> src = pixels(w, h, n, w * 31 + n);
+            for (int level = 0; level <= 9; level += 4)
+                for (int filter = -1; filter <= 4; ++filter) {
+                    stbi_write_png_compression_level = level;
+                    stbi_write_force_png_filter = filter;
+                    int len = 0;
+                    unsigned char *png = stbi_write_png_to_mem(src.data(), w * n, w, h, n, &len);
+                    CHECK(png && decodesTo(png, len, src.data(), w, h, n, w * n));
+                    STBIW_FREE(png);
+                    png = stbi_write_png_to_mem_parallel(src.data(), w * n, w, h, n, &len, cv::detail::stbiwParallelFor, nullptr);
+                    CHECK(png && decodesTo(png, len, src.data(), w, h, n, w * n));
+                    STBIW_FREE(png);
+                }
+        }
+    stbi_write_png_compression_level = 8;
+    stbi_write_force_png_filter = -1;
+
+    // a strided ROI through imwrite, with the pool spread over four threads
+    cv::Mat big(300, 400, cv::CV_8UC3);
+    std::vector<unsigned char> src = pixels(400, 300, 3, 9);
+    std::memcpy(big.data, src.data(), src.size());
+    cv::Mat roi = big(cv::Rect(13, 21, 301, 250));
+    const std::string path = "/tmp/openn_test_encoders.png";
+    CHECK(cv::imwrite(path, roi));
+    cv::Mat back = cv::imread(path);
+    CHECK(back.rows == 250 && back.cols == 301 && cv::countNonZero(cv::absdiff(back, roi)) == 0);
+    std::remove(path.c_str());
+}
+
+static void appendBytes(void *context, void *data, int size) {
+    auto *out = static_cast<std::vector<unsigned char> *>(context);
+    out->insert(out->end(), static_cast<unsigned char *>(data), static_cast<unsigned char *>(data) + size);
+}
+
+static std::vector<unsigned char> decodeJpeg(const std::vector<unsigned char> &jpg, int w, int h, int n) {
+    int dw, dh, dn;
+    unsigned char *img = stbi_load_from_memory(jpg.data(), static_cast<int>(jpg.size()), &dw, &dh, &dn, n);
+    std::vector<unsigned char> out;
+    if (img && dw == w && dh == h)
+        out.assign(img, img + static_cast<size_t>(w) * h * n);
+    stbi_image_free(img);
+    return out;
+}
+
+static void checkJpeg() {
+    const int w = 517, h = 389;
+    for (int n = 1; n <= 4; ++n) {
+        // smooth content so quality 95 stays within a few levels; JPEG keeps
+        // no alpha, so only the colour channels are compared
+        std::mt19937 rng(n);
+        std::vector<unsigned char> src(static_cast<size_t>(w) * h * n);
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w * n; ++x)
+                src[static_cast<size_t>(y) * w * n + x] = static_cast<unsigned char>(128 + 100 * std::sin(x * 0.05 + y * 0.03) + rng() % 5);
+        const int colour = n >= 3 ? 3 : 1;
+
+        std::vector<unsigned char> serial, banded;
+        CHECK(stbi_write_jpg_to_func(appendBytes, &serial, w, h, n, src.data(), 95));
+        CHECK(stbi_write_jpg_to_func_parallel(appendBytes, &banded, w, h, n, src.data(), 95, cv::detail::stbiwParallelFor, nullptr));
+        std::vector<unsigned char> a = decodeJpeg(serial, w, h, n), b = decodeJpeg(banded, w, h, n);
+        CHECK(!a.empty() && a == b);
+        if (a.empty())
+            continue;
+
+        double sum = 0;
+        int worst = 0;
+        for (size_t i = 0; i < src.size(); i += n)
+            for (int c = 0; c < colour; ++c) {
+                int d = std::abs(a[i + c] - src[i + c]);
+                sum += d;
+                worst = std::max(worst, d);
+            }
+        CHECK(sum / (src.size() / n * colour) < 2.0);
+        CHECK(worst <= 12);
+
+        // optimized tables only change the entropy coding
+        std::vector<unsigned char> optimized;
+        stbi_write_jpg_optimize_huffman = 1;
+        CHECK(stbi_write_jpg_to_func(appendBytes, &optimized, w, h, n, src.data(), 95));
+        stbi_write_jpg_optimize_huffman = 0;
+        CHECK(optimized.size() < serial.size());
+        CHECK(decodeJpeg(optimized, w, h, n) == a);
+    }
+}
+
+int main() {
+    CHECK(stbi_write_checksum_selftest() != 0);
+    cv::setNumThreads(4);
+    checkPng();
+    checkJpeg();
+    return testResult("test_encoders");
+}
@@ -0,0 +1,59 @@
+// computeSimilarityHierarchical against the exact computeSimilarity score.
+
+#include "ImageCompare.h"
+#include "tests/test.h"
+#include <random>
+
+// Smooth gradient with noise, plus a perturbed copy whose changes are confined
+// to a few blocks, so most tiles are decidable from the pyramid.
+static void makePair(cv::Mat &a, cv::Mat &b, int rows, int cols, unsigned seed) {
+    std::mt19937 rng(seed);
+    a = cv::Mat(rows, cols, cv::CV_8UC3);
+    for (int y = 0; y < rows; ++y)
+        for (int x = 0; x < cols * 3; ++x)
+            a.ptr(y)[x] = static_cast<unsigned char>((x / 3 + y) / 4 + rng() % 4);
+    b = a.clone();
+    for (int k = 0; k < 6; ++k) {
+        int y0 = rng() % rows, x0 = rng() % cols, amp = 3 + rng() % 40;
+        for (int y = y0; y < std::min(rows, y0 + 40); ++y)
+            for (int x = x0 * 3; x < std::min(cols, x0 + 50) * 3; ++x)
+                b.ptr(y)[x] = static_cast<unsigned char>(std::min(255, b.ptr(y)[x] + static_cast<int>(rng() % amp)));
+    }
+}
+
+int main() {
+    ImageComparator cmp;
+    for (unsigned seed = 1; seed <= 4; ++seed) {
+        cv::Mat a, b;
+        makePair(a, b, 301, 437, seed);
+        CompareOptions perChannel;
+        double exact = cmp.compare(a, b, perChannel);
+
+        // margins that never decide on means give the exact score
+        HierarchicalOptions strict;
+        strict.same_margin = -1.0;
+        strict.diff_margin = 256.0;
+        HierarchicalResult r = cmp.computeSimilarityHierarchical(a, b, strict);
+        CHECK(r.similarity == exact);
+        CHECK(r.error_bound == 0.0);
+
+        // default margins stay within the reported bound
+        r = cmp.computeSimilarityHierarchical(a, b);
+        CHECK(std::fabs(r.similarity - exact) <= r.error_bound + 1e-12);
+        CHECK(r.touched_fraction < 1.0);
+        // building both pyramids reads every pixel once
+        CHECK_NEAR(r.read_fraction, 1.0 + r.touched_fraction, 1e-12);
+
+        // with pyramids built up front only the leaf reads count
+        std::vector<StatsLevel> p1 = buildStatsPyramid(a, 4), p2 = buildStatsPyramid(b, 4);
+        HierarchicalResult pre = cmp.computeSimilarityHierarchical(a, b, p1, p2);
+        CHECK(pre.similarity == r.similarity);
+        CHECK(pre.read_fraction == pre.touched_fraction);
+
+        // identical images are settled from the pyramid, no pixel compared
+        HierarchicalResult same = cmp.computeSimilarityHierarchical(a, a);
+        CHECK(same.similarity == 1.0);
+        CHECK(same.touched_fraction == 0.0);
+    }
+    return testResult("test_hierarchical");
+}
@@ -0,0 +1,141 @@
+// stb_image's JPEG kernels against each other: the AVX2 IDCT, upsampler and
+// colour conversion must give the sse2 results bit for bit, for every row
+// length, and write nothing past the row; interleaved and planar colour
+// conversion must agree for every YCbCr triple, so imreadPlanar's planes are
+// exactly imread's channels.
+
+#include "openn.hpp"
+#include "tests/test.h"
+#include <random>
+
+#ifdef STBI_AVX2
+static void checkIdct(std::mt19937 &rng) {
+    for (int round = 0; round < 2000; ++round) {
+        short a[64], b[64], a2[64], b2[64];
+        // mostly small coefficients, like dequantized real data, plus a few extremes
+        for (int k = 0; k < 64; ++k) {
+            a[k] = static_cast<short>(round % 7 == 0 ? static_cast<int>(rng() % 4096) - 2048 : static_cast<int>(rng() % 256) - 128);
+            b[k] = static_cast<short>(k < 8 ? static_cast<int>(rng() % 1024) - 512 : 0);
+        }
+        std::memcpy(a2, a, sizeof a);
+        std::memcpy(b2, b, sizeof b);
+        stbi_uc out0[8 * 8], out1[8 * 8], ref0[8 * 8], ref1[8 * 8];
+        stbi__idct_2blocks_avx2(out0, out1, 8, a, b);
+        stbi__idct_simd(ref0, 8, a2);
+        stbi__idct_simd(ref1, 8, b2);
+        CHECK(std::memcmp(out0, ref0, sizeof ref0) == 0 && std::memcmp(out1, ref1, sizeof ref1) == 0);
+    }
+}
+
+static void checkUpsample(std::mt19937 &rng) {
+    for (int w = 1; w < 100; ++w) {
+        std::vector<stbi_uc> near(w), far(w), out(2 * w + 64, 0xAB), ref(2 * w + 64, 0xAB);
+        for (int i = 0; i < w; ++i) {
+            near[i] = static_cast<stbi_uc>(rng());
+            far[i] = static_cast<stbi_uc>(rng());
+        }
+        stbi__resample_row_hv_2_avx2(out.data(), near.data(), far.data(), w, 2);
+        stbi__resample_row_hv_2_simd(ref.data(), near.data(), far.data(), w, 2);
+        CHECK(out == ref);
+    }
+}
+
+static void checkColour(std::mt19937 &rng) {
+    for (int count = 1; count < 200; ++count) {
+        std::vector<stbi_uc> y(count), cb(count), cr(count);
+        for (int i = 0; i < count; ++i) {
+            y[i] = static_cast<stbi_uc>(rng());
+            cb[i] = static_cast<stbi_uc>(rng());
+            cr[i] = static_cast<stbi_uc>(rng());
+        }
+        for (int step = 3; step <= 4; ++step) {
+            const size_t bytes = static_cast<size_t>(count) * step;
+            std::vector<stbi_uc> out(bytes + 64, 0xAB), ref(bytes + 64, 0xAB);
+            stbi__YCbCr_to_RGB_avx2(out.data(), y.data(), cb.data(), cr.data(), count, step);
+            // the AVX2 loop takes whole groups of 16 and hands the rest on
+            const int vec = count / 16 * 16;
+            std::vector<stbi_uc> rgbx(static_cast<size_t>(vec) * 4);
+            stbi__YCbCr_to_RGB_simd(rgbx.data(), y.data(), cb.data(), cr.data(), vec, 4);
+            for (int i = 0; i < vec; ++i)
+                std::memcpy(&ref[static_cast<size_t>(i) * step], &rgbx[static_cast<size_t>(i) * 4], step);
+            stbi__YCbCr_to_RGB_simd(ref.data() + static_cast<size_t>(vec) * step, y.data() + vec, cb.data() + vec, cr.data() + vec, count - vec, step);
+            std::fill(ref.begin() + bytes, ref.end(), 0xAB);
+            CHECK(out == ref);
+        }
+    }
+}
+#endif
+
+// every (y, cb, cr): one row per cr value, through the scalar kernels and the
+// ones stbi__setup_jpeg picks for this machine
+static void checkColourExhaustive() {
+    std::unique_ptr<stbi__jpeg> j(new stbi__jpeg());
+    stbi__setup_jpeg(j.get());
+    const int n = 65536;
+    std::vector<stbi_uc> y(n), cb(n), cr(n), ref(3 * n), rgb(3 * n), rgbx(4 * n), r(n), g(n), b(n);
+    for (int i = 0; i < n; ++i) {
+        y[i] = static_cast<stbi_uc>(i);
+        cb[i] = static_cast<stbi_uc>(i >> 8);
+    }
+    bool same = true;
+    for (int v = 0; v < 256 && same; ++v) {
+        std::fill(cr.begin(), cr.end(), static_cast<stbi_uc>(v));
+        stbi__YCbCr_to_RGB_row(ref.data(), y.data(), cb.data(), cr.data(), n, 3);
+
+        j->YCbCr_to_RGB_kernel(rgb.data(), y.data(), cb.data(), cr.data(), n, 3);
+        same = same && rgb == ref;
+        j->YCbCr_to_RGB_kernel(rgbx.data(), y.data(), cb.data(), cr.data(), n, 4);
+        for (int i = 0; i < n && same; ++i)
+            same = std::memcmp(&rgbx[i * 4], &ref[i * 3], 3) == 0 && rgbx[i * 4 + 3] == 255;
+        stbi__YCbCr_to_planar_row(r.data(), g.data(), b.data(), y.data(), cb.data(), cr.data(), n);
+        for (int i = 0; i < n && same; ++i)
+            same = r[i] == ref[i * 3] && g[i] == ref[i * 3 + 1] && b[i] == ref[i * 3 + 2];
+        j->YCbCr_to_planar_kernel(r.data(), g.data(), b.data(), y.data(), cb.data(), cr.data(), n);
+        for (int i = 0; i < n && same; ++i)
+            same = r[i] == ref[i * 3] && g[i] == ref[i * 3 + 1] && b[i] == ref[i * 3 + 2];
+    }
+    CHECK(same);
+}
+
+// imreadPlanar against imread + split, and merge back, on a subsampled
+// JPEG with a width that leaves vector tails
+static void checkPlanarDecode() {
+    std::mt19937 rng(45);
+    cv::Mat src(203, 517, cv::CV_8UC3);
+    for (size_t i = 0; i < src.total() * 3; ++i)
+        src.data[i] = static_cast<unsigned char>(rng());
+    const std::string path = "/tmp/openn_test_jpeg_kernels.jpg";
+    CHECK(cv::imwrite(path, src));
+
+    cv::Mat interleaved = cv::imread(path);
+    std::vector<cv::Mat_<uint8_t>> planes, channels;
+    CHECK(cv::imreadPlanar(path, planes));
+    std::remove(path.c_str());
+    if (interleaved.empty() || planes.size() != 3)
+        return;
+    cv::split(interleaved, channels);
+    bool same = true;
+    for (int k = 0; k < 3; ++k)
+        for (int row = 0; row < interleaved.rows; ++row)
+            same = same && std::memcmp(planes[k].ptr(row), channels[k].ptr(row), interleaved.cols) == 0;
+    CHECK(same);
+
+    cv::Mat merged;
+    cv::merge(planes, merged);
+    CHECK(merged.rows == interleaved.rows && merged.cols == interleaved.cols);
+    CHECK(std::memcmp(merged.data, interleaved.data, interleaved.total() * 3) == 0);
+}
+
+int main() {
+#ifdef STBI_AVX2
+    if (stbi__avx2_available()) {
+        std::mt19937 rng(37);
+        checkIdct(rng);
+        checkUpsample(rng);
+        checkColour(rng);
+    }
+#endif
+    checkColourExhaustive();
+    checkPlanarDecode();
+    return testResult("test_jpeg_kernels");
+}
@@ -0,0 +1,106 @@
+// Images past 2^31 bytes, end to end: a 26000x28000 PPM loads through imread
+// (mapped) and its PGM twin through the ImageReader fallback for images
+// stb_image refuses, both score against a copy with one changed block
+// through compare()'s parallel row sum and the streaming compare with
+// exact counts, and ROIs above the 2^31-byte offset read and copy the right
+// pixels. The files take about 5 GB, so this only runs with
+// OPENN_LARGE_TESTS=1 in the environment; otherwise it reports a skip.
+
+#include "ImageCompare.h"
+#include "tests/test.h"
+#include <cstdlib>
+
+static const int kRows = 28000, kCols = 26000;
+
+// The changed block, entirely past byte 2^31 of the 3-channel image.
+static const cv::Rect kBlock(20000, 27600, 300, 200);
+
+static unsigned char pattern(int x, int y) { return static_cast<unsigned char>(x * 7 + y * 3 + (x ^ y)); }
+
+static unsigned char changed(int x, int y) {
+    bool inside = x >= kBlock.x && x < kBlock.x + kBlock.width && y >= kBlock.y && y < kBlock.y + kBlock.height;
+    return inside ? pattern(x, y) ^ 0x80 : pattern(x, y);
+}
+
+// Writes the image as gray P6 (every channel the same) or P5.
+static bool writeImage(const std::string &path, bool gray, unsigned char (*value)(int, int)) {
+    FILE *f = std::fopen(path.c_str(), "wb");
+    if (!f) return false;
+    std::fprintf(f, "%s\n%d %d\n255\n", gray ? "P5" : "P6", kCols, kRows);
+    const int cn = gray ? 1 : 3;
+    std::vector<unsigned char> row(static_cast<size_t>(kCols) * cn);
+    bool ok = true;
+    for (int y = 0; y < kRows && ok; ++y) {
+        for (int x = 0; x < kCols; ++x)
+            for (int c = 0; c < cn; ++c) row[static_cast<size_t>(x) * cn + c] = value(x, y);
+        ok = std::fwrite(row.data(), 1, row.size(), f) == row.size();
+    }
+    return std::fclose(f) == 0 && ok;
+}
+
+// Whether every pixel of m, at (x0, y0) in the full image, is value's.
+static bool holds(const cv::Mat &m, int x0, int y0, unsigned char (*value)(int, int)) {
+    for (int y = 0; y < m.rows; ++y) {
+        const unsigned char *p = m.ptr(y);
+        for (int x = 0; x < m.cols; ++x, p += 3) {
+            unsigned char v = value(x0 + x, y0 + y);
+            if (p[0] != v || p[1] != v || p[2] != v) return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    const char *enabled = std::getenv("OPENN_LARGE_TESTS");
+    if (!enabled || std::strcmp(enabled, "1") != 0) {
+        std::printf("test_large: skipped (set OPENN_LARGE_TESTS=1 to run)\n");
+        return 0;
+    }
+    const char *tmp = std::getenv("TMPDIR");
+    const std::string dir = std::string(tmp ? tmp : "/tmp") + "/openn_test_large_";
+    const std::string ppm = dir + "a.ppm", pgm = dir + "a.pgm", other = dir + "b.ppm";
+    CHECK(writeImage(ppm, false, pattern) && writeImage(pgm, true, pattern) && writeImage(other, false, changed));
+    CHECK(cv::detail::exceedsDecodeLimit(ppm) && cv::detail::exceedsDecodeLimit(pgm));
+
+    cv::setNumThreads(4);
+    ImageComparator cmp;
+    const uint64_t terms = static_cast<uint64_t>(kRows) * kCols * 3;
+    const double expected = static_cast<double>(terms - static_cast<uint64_t>(kBlock.area()) * 3) / terms;
+    const size_t blockOffset = kBlock.y * static_cast<size_t>(kCols) * 3 + static_cast<size_t>(kBlock.x) * 3;
+    CHECK(blockOffset > (size_t(1) << 31));
+    {
+        // stb_image refuses the PGM at 3 channels, so imread streams it in
+        cv::Mat gray = cv::imread(pgm);
+        CHECK(gray.rows == kRows && gray.cols == kCols && gray.channels == 3);
+        CHECK(!gray.empty() && holds(gray, 0, 0, pattern));
+
+        // an ROI past 2^31 bytes: the right address, the right pixels, and
+        // copyTo in both directions
+        cv::Mat roi = gray(kBlock);
+        CHECK(static_cast<size_t>(roi.data - gray.data) == blockOffset);
+        cv::Mat out(kBlock.height, kBlock.width, cv::CV_8UC3);
+        roi.copyTo(out);
+        CHECK(holds(out, kBlock.x, kBlock.y, pattern));
+        for (int y = 0; y < out.rows; ++y)
+            for (int x = 0; x < out.cols * 3; ++x) out.ptr(y)[x] ^= 0x80;
+        out.copyTo(roi);
+        CHECK(holds(gray(cv::Rect(kBlock.x - 1, kBlock.y - 1, kBlock.width + 2, kBlock.height + 2)), kBlock.x - 1,
+                    kBlock.y - 1, changed));
+
+        cv::Mat b = cv::imread(other);
+        CHECK(cmp.compare(gray, b) == 1.0);
+    }
+
+    cv::Mat a = cv::imread(ppm), b = cv::imread(other);
+    CHECK(a.rows == kRows && a.cols == kCols && holds(a, 0, 0, pattern));
+    CHECK(b.rows == kRows && b.cols == kCols);
+    CHECK(cmp.compare(a, b) == expected);
+    CHECK(cmp.computeSimilarityStreaming(ppm, other) == expected);
+    CHECK(cmp.computeSimilarityStreaming(pgm, other, 1000) == expected);
+
+    a = cv::Mat();
+    b = cv::Mat();
+    for (const std::string &p : {ppm, pgm, other}) std::remove(p.c_str());
+    cv::setNumThreads(0);
+    return testResult("test_large");
+}
@@ -0,0 +1,120 @@
+// parallel_for_ on the work-stealing pool: every index runs exactly once in
+// pieces of at least the grain, idle threads steal from a busy one, a thread
+// waiting on its loop (nested or not) runs pieces instead of blocking and
+// never brings in more threads than the pool has, exceptions reach the caller,
+// and callers from outside the pool can run loops side by side.
+
+#include "openn.hpp"
+#include "tests/test.h"
+#include <chrono>
+#include <set>
+#include <stdexcept>
+
+// Runs parallel_for_ over [0, n) and checks every index is visited once, in
+// pieces no shorter than grain unless the loop ran whole.
+static void checkCoverage(int n, int grain) {
+    std::vector<std::atomic<int>> hits(n);
+    for (std::atomic<int> &h : hits) h = 0;
+    std::atomic<int> shortPieces(0), pieces(0);
+    cv::parallel_for_(cv::Range(0, n), [&](const cv::Range &r) {
+        ++pieces;
+        if (r.size() < grain) ++shortPieces;
+        for (int i = r.start; i < r.end; ++i) ++hits[i];
+    }, grain);
+    bool once = true;
+    for (std::atomic<int> &h : hits) once = once && h == 1;
+    CHECK(once);
+    CHECK(shortPieces == 0 || pieces == 1);
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main() {
+    for (int threads : {1, 2, 4, 7}) {
+        cv::setNumThreads(threads);
+        CHECK(cv::getNumThreads() == threads);
+        for (int n : {1, 2, 3, 17, 1000, 100003})
+            for (int grain : {1, 5, 64}) checkCoverage(n, grain);
+    }
+
+    cv::setNumThreads(4);
+
+    // sleeping pieces leave the CPU free, so the time shows how many threads
+    // shared them: 16 x 20 ms takes 0.32 s on one thread, 0.08 s on four
+    std::set<std::thread::id> ids;
+    std::mutex m;
+    auto t0 = std::chrono::steady_clock::now();
+    cv::parallel_for_(cv::Range(0, 16), [&](const cv::Range &r) {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            ids.insert(std::this_thread::get_id());
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20 * r.size()));
+    });
+    CHECK(secondsSince(t0) < 0.2);
+    CHECK(ids.size() > 1 && ids.size() <= 4);
+    CHECK(ids.count(std::this_thread::get_id()) == 1);
+
+    // nested loops split onto the waiting thread's deque: all indices run
+    // once, on no more threads than the pool has
+    ids.clear();
+    std::vector<std::atomic<int>> hits(64 * 64);
+    for (std::atomic<int> &h : hits) h = 0;
+    cv::parallel_for_(cv::Range(0, 64), [&](const cv::Range &outer) {
+        for (int i = outer.start; i < outer.end; ++i)
+            cv::parallel_for_(cv::Range(0, 64), [&](const cv::Range &inner) {
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    ids.insert(std::this_thread::get_id());
+                }
+                for (int j = inner.start; j < inner.end; ++j) ++hits[i * 64 + j];
+            });
+    });
+    bool once = true;
+    for (std::atomic<int> &h : hits) once = once && h == 1;
+    CHECK(once);
+    CHECK(ids.size() <= 4);
+
+    // a throwing piece: the first exception reaches the caller once no piece
+    // is still running, and the pool keeps working
+    std::atomic<int> running(0);
+    bool caught = false;
+    try {
+        cv::parallel_for_(cv::Range(0, 100), [&](const cv::Range &r) {
+            ++running;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            --running;
+            if (r.start <= 50 && 50 < r.end) throw std::runtime_error("piece 50");
+        });
+    } catch (const std::runtime_error &e) {
+        caught = std::string(e.what()) == "piece 50";
+    }
+    CHECK(caught);
+    CHECK(running == 0);
+    checkCoverage(1000, 1);
+
+    // loops from more outside threads than the pool has spare deques, each
+    // with nested work, run side by side
+    std::vector<std::thread> callers;
+    std::atomic<int> wrong(0);
+    for (int t = 0; t < 24; ++t)
+        callers.emplace_back([&] {
+            std::atomic<long> sum(0);
+            cv::parallel_for_(cv::Range(0, 40), [&](const cv::Range &outer) {
+                for (int i = outer.start; i < outer.end; ++i)
+                    cv::parallel_for_(cv::Range(0, 100), [&](const cv::Range &inner) {
+                        long s = 0;
+                        for (int j = inner.start; j < inner.end; ++j) s += j;
+                        sum += s;
+                    });
+            });
+            if (sum != 40L * 4950) ++wrong;
+        });
+    for (std::thread &th : callers) th.join();
+    CHECK(wrong == 0);
+
+    cv::setNumThreads(0);
+    return testResult("test_parallel");
+}
@@ -0,0 +1,82 @@
+// FFTPlan against a direct DFT, and phaseCorrelate on known shifts.
+
+#include "openn.hpp"
+#include "tests/test.h"
+#include <random>
+
+typedef std::complex<double> cplx;
+
+// The batched [n][batch] transform of one plan against the O(n^2) sum, and
+// inverse(forward(x)) == n * x.
+static void checkPlan(int n, size_t batch) {
+    std::mt19937 rng(n);
+    std::uniform_real_distribution<double> u(-1.0, 1.0);
+    std::vector<cplx> x(n * batch), data, work(n * batch);
+    for (cplx &v : x) v = cplx(u(rng), u(rng));
+    data = x;
+    cv::detail::FFTPlan plan(n);
+    plan.forward(data.data(), work.data(), batch);
+    double err = 0.0;
+    for (size_t b = 0; b < batch; ++b)
+        for (int k = 0; k < n; ++k) {
+            cplx acc = 0.0;
+            for (int t = 0; t < n; ++t) acc += x[t * batch + b] * std::polar(1.0, -2.0 * cv::detail::kPi * k * t / n);
+            err = std::max(err, std::abs(acc - data[k * batch + b]));
+        }
+    CHECK(err < 1e-9 * n);
+    plan.inverse(data.data(), work.data(), batch);
+    err = 0.0;
+    for (size_t i = 0; i < x.size(); ++i) err = std::max(err, std::abs(data[i] / static_cast<double>(n) - x[i]));
+    CHECK(err < 1e-12 * n);
+}
+
+// Smooth random texture, so the correlation peak is unambiguous.
+static cv::Mat texture(int rows, int cols, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::vector<double> noise(static_cast<size_t>(rows) * cols);
+    for (double &v : noise) v = rng() % 256;
+    cv::Mat m(rows, cols, cv::CV_8UC3);
+    for (int y = 0; y < rows; ++y)
+        for (int x = 0; x < cols; ++x) {
+            double s = 0.0;
+            for (int dy = -1; dy <= 1; ++dy)
+                for (int dx = -1; dx <= 1; ++dx)
+                    s += noise[static_cast<size_t>((y + dy + rows) % rows) * cols + (x + dx + cols) % cols];
+            for (int c = 0; c < 3; ++c) m.ptr(y)[3 * x + c] = static_cast<unsigned char>(s / 9);
+        }
+    return m;
+}
+
+int main() {
+    for (int n : {1, 2, 3, 4, 5, 7, 8, 12, 30, 49, 60, 64, 97, 120})
+        for (size_t batch : {1, 3})
+            checkPlan(n, batch);
+
+    CHECK(cv::getOptimalDFTSize(1) == 1);
+    CHECK(cv::getOptimalDFTSize(7) == 8);
+    CHECK(cv::getOptimalDFTSize(97) == 100);
+    CHECK(cv::getOptimalDFTSize(121) == 125);
+
+    // img2 is img1 moved by (dx, dy): img2(x + dx, y + dy) == img1(x, y)
+    const int R = 150, C = 211;
+    cv::Mat big = texture(R + 40, C + 40, 5);
+    const int shifts[][2] = {{0, 0}, {7, -3}, {-12, 9}, {15, 15}, {-1, 0}};
+    for (const auto &s : shifts) {
+        int dx = s[0], dy = s[1];
+        cv::Mat a = big(cv::Rect(20, 20, C, R)).clone();
+        cv::Mat b = big(cv::Rect(20 - dx, 20 - dy, C, R)).clone();
+        double response = 0.0;
+        cv::Point d = cv::phaseCorrelate(a, b, &response);
+        CHECK(d.x == dx && d.y == dy);
+        CHECK(response > 0.1);
+    }
+
+    // more sizes than the plan cache holds still give the same answers
+    for (int k = 0; k < 12; ++k) {
+        cv::Mat a = big(cv::Rect(20, 20, 64 + k, 64)).clone();
+        cv::Mat b = big(cv::Rect(17, 22, 64 + k, 64)).clone();
+        cv::Point d = cv::phaseCorrelate(a, b);
+        CHECK(d.x == 3 && d.y == -2);
+    }
+    return testResult("test_phase_correlate");
+}
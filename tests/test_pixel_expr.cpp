@@ -0,0 +1,127 @@
+// Lazy pixel expressions against eager evaluation: every fused chain must
+// equal the same operations materialized one Mat at a time, and both must
+// equal the per-element definitions, SIMD body and scalar tail alike.
+
+#include "openn.hpp"
+#include "tests/test.h"
+#include <functional>
+#include <random>
+
+static cv::Mat randomMat(int rows, int cols, std::mt19937 &rng) {
+    cv::Mat m(rows, cols, cv::CV_8UC3);
+    for (size_t i = 0; i < m.total() * 3; ++i) m.data[i] = static_cast<unsigned char>(rng());
+    return m;
+}
+
+// m with every element replaced by f(element of a, element of b).
+static cv::Mat eager(const cv::Mat &a, const cv::Mat &b, const std::function<int(int, int)> &f) {
+    cv::Mat out(a.rows, a.cols, cv::CV_8UC3);
+    for (int y = 0; y < a.rows; ++y)
+        for (int i = 0; i < a.cols * 3; ++i) out.ptr(y)[i] = static_cast<unsigned char>(f(a.ptr(y)[i], b.ptr(y)[i]));
+    return out;
+}
+
+static bool same(const cv::Mat &a, const cv::Mat &b) {
+    if (a.rows != b.rows || a.cols != b.cols) return false;
+    for (int y = 0; y < a.rows; ++y)
+        if (std::memcmp(a.ptr(y), b.ptr(y), static_cast<size_t>(a.cols) * 3) != 0) return false;
+    return true;
+}
+
+// OpenCV's definitions of the threshold types.
+static int thresholdRef(int x, double thresh, double maxval, int type) {
+    const int t = static_cast<int>(std::floor(thresh));
+    const int mv = static_cast<int>(std::min(std::max(std::lround(maxval), 0L), 255L));
+    switch (type) {
+    case cv::THRESH_BINARY: return x > t ? mv : 0;
+    case cv::THRESH_BINARY_INV: return x > t ? 0 : mv;
+    case cv::THRESH_TRUNC: return x > t ? std::min(std::max(t, 0), 255) : x;
+    case cv::THRESH_TOZERO: return x > t ? x : 0;
+    default: return x > t ? 0 : x;
+    }
+}
+
+static int countRef(const cv::Mat &m) {
+    int n = 0;
+    for (int y = 0; y < m.rows; ++y)
+        for (int i = 0; i < m.cols * 3; ++i) n += m.ptr(y)[i] != 0;
+    return n;
+}
+
+static void checkShape(int rows, int cols, std::mt19937 &rng) {
+    // views into larger images, so rows are not contiguous
+    cv::Mat big1 = randomMat(rows + 3, cols + 5, rng), big2 = big1;
+    for (size_t i = 0; i < big2.total() * 3; ++i)
+        if (rng() % 3 == 0) big2.data[i] = static_cast<unsigned char>(big2.data[i] + rng() % 41 - 20);
+    cv::Mat a = big1(cv::Rect(2, 1, cols, rows)), b = big2(cv::Rect(2, 1, cols, rows));
+
+    cv::Mat diff = eager(a, b, [](int x, int y) { return std::abs(x - y); });
+    cv::Mat lazyDiff = cv::absdiff(a, b);
+    CHECK(same(lazyDiff, diff));
+
+    for (int type = cv::THRESH_BINARY; type <= cv::THRESH_TOZERO_INV; ++type)
+        for (double t : {-3.0, 0.0, 9.5, 10.0, 200.0, 254.0, 255.0}) {
+            cv::Mat step = eager(diff, diff, [&](int x, int) { return thresholdRef(x, t, 200.4, type); });
+            cv::Mat fused = cv::threshold(cv::absdiff(a, b), t, 200.4, type);
+            CHECK(same(fused, step));
+            CHECK(cv::countNonZero(cv::threshold(cv::absdiff(a, b), t, 200.4, type)) == countRef(step));
+        }
+
+    for (double alpha : {0.0, 0.3, 0.5, 1.0, 1.7}) {
+        const double beta = 1.0 - alpha * 0.5, gamma = alpha * 10 - 5;
+        cv::Mat step = eager(a, b, [&](int x, int y) {
+            float v = static_cast<float>(x) * static_cast<float>(alpha) + static_cast<float>(y) * static_cast<float>(beta) +
+                      static_cast<float>(gamma);
+            return static_cast<int>(std::nearbyint(std::min(std::max(v, 0.0f), 255.0f)));
+        });
+        CHECK(same(cv::Mat(cv::addWeighted(a, alpha, b, beta, gamma)), step));
+
+        // a three-node chain, fused, against its materialized steps
+        cv::Mat diffOfBlend = cv::absdiff(step, a);
+        cv::Mat fusedChain = cv::absdiff(cv::addWeighted(a, alpha, b, beta, gamma), a);
+        CHECK(same(fusedChain, diffOfBlend));
+        cv::Scalar lazyMean = cv::mean(cv::absdiff(cv::addWeighted(a, alpha, b, beta, gamma), a));
+        for (int c = 0; c < 3; ++c) {
+            uint64_t sum = 0;
+            for (int y = 0; y < rows; ++y)
+                for (int x = 0; x < cols; ++x) sum += diffOfBlend.ptr(y)[x * 3 + c];
+            CHECK_NEAR(lazyMean.val[c], static_cast<double>(sum) / (static_cast<double>(rows) * cols), 1e-9);
+        }
+    }
+
+    // the viewer's blends in 8.8 fixed point, from their definitions
+    for (double alpha : {-0.5, 0.0, 0.25, 0.5, 0.999, 1.0, 2.0}) {
+        const long w = std::min(std::max(std::lround(alpha * 256.0), 0L), 256L);
+        cv::Mat step = eager(a, b, [&](int x, int y) { return static_cast<int>((x * w + y * (256 - w) + 128) >> 8); });
+        CHECK(same(cv::Mat(cv::crossfade(a, b, alpha)), step));
+    }
+    for (double gain : {0.0, 1.0, 3.3, 16.0, 255.0, 300.0})
+        for (double base : {0.0, 0.25, 1.0}) {
+            const long g = std::min(std::max(std::lround(gain * 256.0), 0L), 65535L), w = std::lround(base * 256.0);
+            cv::Mat step = eager(a, b, [&](int x, int y) {
+                return static_cast<int>(std::min(255L, ((x * w + 128) >> 8) + ((std::abs(x - y) * g) >> 8)));
+            });
+            CHECK(same(cv::Mat(cv::amplifiedDiff(a, b, gain, base)), step));
+            CHECK(cv::countNonZero(cv::amplifiedDiff(a, b, gain, base)) == countRef(step));
+        }
+
+    // saturated input keeps the mean's 16-bit lane sums at their limit
+    cv::Scalar full = cv::mean(cv::threshold(a, -1.0, 255.0, cv::THRESH_BINARY));
+    CHECK(full.val[0] == 255.0 && full.val[1] == 255.0 && full.val[2] == 255.0);
+
+    // the OpenCV-style out-parameter forms evaluate in place into an
+    // existing Mat of the right size
+    cv::Mat dst(rows, cols, cv::CV_8UC3);
+    unsigned char *before = dst.data;
+    cv::absdiff(a, b, dst);
+    CHECK(dst.data == before && same(dst, diff));
+}
+
+int main() {
+    std::mt19937 rng(46);
+    // tails around the 16-byte blocks, and rows past the 255-block
+    // countNonZero and 256-block mean accumulators
+    const int shapes[][2] = {{1, 1}, {3, 5}, {7, 16}, {9, 21}, {31, 100}, {4, 1500}, {2, 4500}};
+    for (const auto &s : shapes) checkShape(s[0], s[1], rng);
+    return testResult("test_pixel_expr");
+}
@@ -0,0 +1,65 @@
+// resize: the SSE2 horizontal pass against its scalar definition, resize of
+// flat images, and size normalization refusing mismatched aspect ratios.
+
+#include "ImageCompare.h"
+#include "tests/test.h"
+#include <random>
+
+// resizeRowH's definition, one tap at a time.
+static void referenceRowH(const unsigned char *src, int16_t *dst, const cv::detail::ResizeAxis &ax, int dcols, int cn) {
+    const int shift = cv::detail::resizeCoefBits - 7;
+    for (int x = 0; x < dcols; ++x)
+        for (int c = 0; c < cn; ++c) {
+            int acc = 1 << (shift - 1);
+            for (int k = 0; k < ax.taps; ++k)
+                acc += src[ax.idx[x * ax.taps + k] * cn + c] * ax.wt[x * ax.taps + k];
+            dst[x * cn + c] = static_cast<int16_t>(acc >> shift);
+        }
+}
+
+static cv::Mat flat(int rows, int cols, unsigned char v) {
+    cv::Mat m(rows, cols, cv::CV_8UC3);
+    std::memset(m.data, v, m.total() * 3);
+    return m;
+}
+
+int main() {
+    std::mt19937 rng(28);
+    for (int it = 0; it < 2000; ++it) {
+        int cn = 1 + rng() % 4, scols = 1 + rng() % 150, dcols = 1 + rng() % 150;
+        bool area = rng() & 1;
+        std::vector<unsigned char> src(static_cast<size_t>(scols) * cn);
+        for (unsigned char &v : src) v = static_cast<unsigned char>(rng());
+        cv::detail::ResizeAxis ax = cv::detail::resizeTable(scols, dcols, area);
+        std::vector<int16_t> got(static_cast<size_t>(dcols) * cn), want(got.size());
+        cv::detail::resizeRowH(src.data(), scols, got.data(), ax, dcols, cn);
+        referenceRowH(src.data(), want.data(), ax, dcols, cn);
+        CHECK(got == want);
+    }
+
+    // a flat image stays flat at any size, with either filter
+    for (int interp : {cv::INTER_LINEAR, cv::INTER_AREA}) {
+        cv::Mat out;
+        cv::resize(flat(97, 131, 200), out, cv::Size(40, 29), interp);
+        CHECK(out.cols == 40 && out.rows == 29);
+        CHECK(cv::countNonZero(cv::absdiff(out, flat(29, 40, 200))) == 0);
+        cv::resize(flat(31, 17, 77), out, cv::Size(90, 64), interp);
+        CHECK(cv::countNonZero(cv::absdiff(out, flat(64, 90, 77))) == 0);
+    }
+
+    // normalization shrinks the larger image when the aspects agree and
+    // refuses when they don't
+    const std::string dir = "/tmp/openn_test_resize_";
+    CHECK(cv::imwrite(dir + "a.png", flat(300, 400, 90)));
+    CHECK(cv::imwrite(dir + "b.png", flat(150, 200, 90)));
+    CHECK(cv::imwrite(dir + "c.png", flat(150, 300, 90)));
+    ImageComparator cmp;
+    cmp.setNormalizeSize(true);
+    std::vector<double> s = cmp.compareBatch({{dir + "a.png", dir + "b.png"}, {dir + "a.png", dir + "c.png"}});
+    CHECK(s[0] == 1.0);
+    CHECK(s[1] == -1.0);
+    cmp.setNormalizeSize(false);
+    CHECK(cmp.compareBatch({{dir + "a.png", dir + "b.png"}})[0] == -1.0);
+    for (const char *f : {"a.png", "b.png", "c.png"}) std::remove((dir + f).c_str());
+    return testResult("test_resize");
+}
@@ -0,0 +1,139 @@
+// ImageReader strips against whole decodes, streamed scores against
+// computeSimilarity, PNM header bounds, and imread's mapped PPMs against
+// stb_image's decode.
+
+#include "ImageCompare.h"
+#include "tests/test.h"
+#include <random>
+
+static const std::string dir = "/tmp/openn_test_streaming_";
+
+static cv::Mat noise(int rows, int cols, unsigned seed) {
+    std::mt19937 rng(seed);
+    cv::Mat m(rows, cols, cv::CV_8UC3);
+    for (int y = 0; y < rows; ++y)
+        for (int x = 0; x < cols * 3; ++x) m.ptr(y)[x] = static_cast<unsigned char>((x + y) / 3 + rng() % 32);
+    return m;
+}
+
+static void writeFile(const std::string &path, const std::string &header, const cv::Mat &img) {
+    FILE *f = std::fopen(path.c_str(), "wb");
+    std::fwrite(header.data(), 1, header.size(), f);
+    for (int y = 0; y < img.rows; ++y) std::fwrite(img.ptr(y), 1, static_cast<size_t>(img.cols) * 3, f);
+    std::fclose(f);
+}
+
+// Reads path through an ImageReader in strips of `strip` rows.
+static cv::Mat readStrips(const std::string &path, int strip) {
+    cv::ImageReader r;
+    if (!r.open(path)) return cv::Mat();
+    cv::Mat out(r.rows, r.cols, cv::CV_8UC3), buf(strip, r.cols, cv::CV_8UC3);
+    int y = 0, n;
+    while ((n = r.read(buf)) > 0) {
+        for (int k = 0; k < n; ++k) std::memcpy(out.ptr(y + k), buf.ptr(k), static_cast<size_t>(r.cols) * 3);
+        y += n;
+    }
+    return y == r.rows ? out : cv::Mat();
+}
+
+static bool same(const cv::Mat &a, const cv::Mat &b) {
+    return !a.empty() && a.rows == b.rows && a.cols == b.cols && cv::countNonZero(cv::absdiff(a, b)) == 0;
+}
+
+// stb_image's own decode of path, for comparison with a mapped PPM.
+static cv::Mat stbiMat(const std::string &path) {
+    stbi_load_options opts = {};
+    int w, h, c;
+    unsigned char *img = stbi_load_ex(path.c_str(), &w, &h, &c, 3, &opts);
+    if (!img) return cv::Mat();
+    cv::Mat m(h, w, cv::CV_8UC3);
+    std::memcpy(m.data, img, static_cast<size_t>(w) * h * 3);
+    stbi_image_free(img);
+    return m;
+}
+
+// Whether imread of path gives what stb_image decodes, an empty Mat included.
+static bool imreadMatchesStbi(const std::string &path) {
+    cv::Mat ref = stbiMat(path), got = cv::imread(path);
+    return ref.empty() ? got.empty() : same(got, ref);
+}
+
+static void checkMappedPpm(const cv::Mat &img) {
+    const std::string p = dir + "map.ppm";
+    // headers stb_image accepts map to the same pixels
+    for (const char *header : {"P6\n157 203\n255\n", "P6\n# one\n#two\n157 203\n255\n", "P6 157\t203\r255\n",
+                               "P6\n157\n# between\n  203 255 "}) {
+        writeFile(p, header, img);
+        cv::Mat mapped = cv::detail::mapPpm(p);
+        CHECK(!mapped.empty() && same(mapped, stbiMat(p)));
+        CHECK(same(cv::imread(p), img));
+    }
+
+    // anything else is left to stb_image: a token not ended by whitespace,
+    // a payload shorter than the header says, 16-bit samples, other formats
+    writeFile(p, "P6\n157 203\n255x", img);
+    CHECK(cv::detail::mapPpm(p).empty());
+    CHECK(imreadMatchesStbi(p));
+    writeFile(p, "P6\n157 204\n255\n", img);
+    CHECK(cv::detail::mapPpm(p).empty());
+    CHECK(imreadMatchesStbi(p));
+    FILE *f = std::fopen(p.c_str(), "wb");
+    std::fprintf(f, "P6\n%d %d\n65535\n", img.cols, img.rows);
+    for (size_t i = 0; i < img.total() * 3; ++i) {
+        std::fputc(img.data[i], f);
+        std::fputc(0, f);
+    }
+    std::fclose(f);
+    CHECK(cv::detail::mapPpm(p).empty());
+    CHECK(!cv::imread(p).empty() && imreadMatchesStbi(p));
+    CHECK(cv::detail::mapPpm(dir + "a.png").empty());
+    CHECK(cv::detail::mapPpm(dir + "a.jpg").empty());
+    std::remove(p.c_str());
+}
+
+int main() {
+    cv::Mat a = noise(203, 157, 1), b = noise(203, 157, 2);
+    writeFile(dir + "a.ppm", "P6\n# comment\n157 203\n255\n", a);
+    writeFile(dir + "b.ppm", "P6 157 203 255\n", b);
+    CHECK(cv::imwrite(dir + "a.jpg", a));
+    CHECK(cv::imwrite(dir + "b.jpg", b));
+    CHECK(cv::imwrite(dir + "a.png", a));
+
+    for (int strip : {1, 7, 64, 500}) {
+        CHECK(same(readStrips(dir + "a.ppm", strip), a));
+        CHECK(same(readStrips(dir + "a.jpg", strip), cv::imread(dir + "a.jpg")));
+        CHECK(same(readStrips(dir + "a.png", strip), a));
+    }
+    checkMappedPpm(a);
+
+    cv::ImageReader r;
+    CHECK(r.open(dir + "a.jpg") && r.streaming());
+    CHECK(r.open(dir + "a.ppm") && r.streaming());
+    CHECK(r.open(dir + "a.png") && !r.streaming());
+
+    ImageComparator cmp;
+    for (const char *ext : {".ppm", ".jpg"}) {
+        std::string p1 = dir + "a" + ext, p2 = dir + "b" + ext;
+        double whole = cmp.compare(cv::imread(p1), cv::imread(p2));
+        for (int strip : {3, 64})
+            CHECK(cmp.computeSimilarityStreaming(p1, p2, strip) == whole);
+    }
+
+    // header values past stb_image's dimension limit are rejected, not wrapped
+    writeFile(dir + "huge.ppm", "P6\n99999999999999999999 2\n255\n", a);
+    CHECK(!r.open(dir + "huge.ppm"));
+    writeFile(dir + "wrap.ppm", "P6\n4294967297 1\n255\n", a);
+    CHECK(!r.open(dir + "wrap.ppm"));
+
+    // imread streams only images whose header exceeds stb_image's buffer
+    // limit; a truncated one still fails cleanly
+    writeFile(dir + "big.ppm", "P6\n40000 20000\n255\n", a);
+    CHECK(cv::detail::exceedsDecodeLimit(dir + "big.ppm"));
+    CHECK(!cv::detail::exceedsDecodeLimit(dir + "a.ppm"));
+    CHECK(!cv::detail::exceedsDecodeLimit(dir + "missing.ppm"));
+    CHECK(cv::imread(dir + "big.ppm").empty());
+
+    for (const char *f : {"a.ppm", "b.ppm", "a.jpg", "b.jpg", "a.png", "huge.ppm", "wrap.ppm", "big.ppm"})
+        std::remove((dir + f).c_str());
+    return testResult("test_streaming");
+}